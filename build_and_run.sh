@@ -28,7 +28,6 @@ echo "✅ Build complete!"
 echo ""
 echo "Available executables:"
 echo "  - aiori           : Original DNS load balancer"
-echo "  - pdns-backend    : PowerDNS pipe backend"
 echo "  - aiori-dnsdist   : DNS load balancer with dnsdist algorithms"
 echo ""
 
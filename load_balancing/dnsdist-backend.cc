@@ -24,7 +24,9 @@
 #include <sys/socket.h>
 #include <net/if.h>
 
-#include <boost/format.hpp>
+#include <array>
+#include <charconv>
+#include <boost/uuid/uuid_io.hpp>
 
 #include "config.h"
 #include "dnsdist.hh"
@@ -190,24 +192,79 @@ void DownstreamState::stop()
   }
 }
 
+/* appends the hashes of the points firstWeight..lastWeight of a server, each point being "<id>-<weight>".
+   Only the weight part is rewritten in a fixed buffer, instead of formatting a new string per point */
+static void computeHashPoints(const boost::uuids::uuid& serverID, int firstWeight, int lastWeight, uint32_t hashPerturbation, std::vector<unsigned int>& out)
+{
+  std::array<char, 64> buffer{};
+  const auto idStr = boost::uuids::to_string(serverID);
+  const size_t prefixLen = std::min(idStr.size(), buffer.size() - 16);
+  std::copy_n(idStr.begin(), prefixLen, buffer.begin());
+  buffer.at(prefixLen) = '-';
+  char* const suffix = buffer.data() + prefixLen + 1;
+  for (int weight = firstWeight; weight <= lastWeight; ++weight) {
+    const auto result = std::to_chars(suffix, buffer.data() + buffer.size(), weight);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast): sorry, it's the burtle API
+    out.push_back(burtleCI(reinterpret_cast<const unsigned char*>(buffer.data()), result.ptr - buffer.data(), hashPerturbation));
+  }
+}
+
 void DownstreamState::hash()
 {
   const auto hashPerturbation = dnsdist::configuration::getImmutableConfiguration().d_hashPerturbation;
   // LOGGING REMOVED
   // vinfolog("Computing hashes for id=%s and weight=%d, hash_perturbation=%d", *d_config.id, d_config.d_weight, hashPerturbation);
-  auto weight = d_config.d_weight;
-  auto idStr = boost::str(boost::format("%s") % *d_config.id);
+  /* like upstream, the whole recomputation holds the write lock, so that concurrent
+     hash() and updateHashes() calls are serialized and the last one wins with the
+     weight it read */
   auto lockedHashes = hashes.write_lock();
-  lockedHashes->clear();
-  lockedHashes->reserve(weight);
-  while (weight > 0) {
-    std::string uuid = boost::str(boost::format("%s-%d") % idStr % weight);
-    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast): sorry, it's the burtle API
-    unsigned int wshash = burtleCI(reinterpret_cast<const unsigned char*>(uuid.c_str()), uuid.size(), hashPerturbation);
-    lockedHashes->push_back(wshash);
-    --weight;
+  const auto weight = d_config.d_weight;
+  std::vector<unsigned int> points;
+  points.reserve(weight);
+  computeHashPoints(*d_config.id, 1, weight, hashPerturbation, points);
+  std::sort(points.begin(), points.end());
+  lockedHashes->swap(points);
+  d_hashedWeight = weight;
+  hashesComputed = true;
+}
+
+void DownstreamState::updateHashes()
+{
+  const auto hashPerturbation = dnsdist::configuration::getImmutableConfiguration().d_hashPerturbation;
+  /* the old weight, the merge and the swap all under one write lock, a concurrent
+     call sees either none or all of this update */
+  auto lockedHashes = hashes.write_lock();
+  const auto newWeight = d_config.d_weight;
+  const auto oldWeight = d_hashedWeight.load();
+  if (newWeight == oldWeight) {
+    return;
+  }
+
+  std::vector<unsigned int> updated;
+  if (oldWeight <= 0) {
+    updated.reserve(newWeight);
+    computeHashPoints(*d_config.id, 1, newWeight, hashPerturbation, updated);
+    std::sort(updated.begin(), updated.end());
   }
-  std::sort(lockedHashes->begin(), lockedHashes->end());
+  else {
+    /* the points of weights 1..min(old, new) are the same, only compute the others */
+    std::vector<unsigned int> delta;
+    delta.reserve(std::abs(newWeight - oldWeight));
+    computeHashPoints(*d_config.id, std::min(oldWeight, newWeight) + 1, std::max(oldWeight, newWeight), hashPerturbation, delta);
+    std::sort(delta.begin(), delta.end());
+
+    if (newWeight > oldWeight) {
+      updated.reserve(lockedHashes->size() + delta.size());
+      std::merge(lockedHashes->begin(), lockedHashes->end(), delta.begin(), delta.end(), std::back_inserter(updated));
+    }
+    else {
+      /* multiset difference, so that colliding hashes of other points are kept */
+      updated.reserve(lockedHashes->size());
+      std::set_difference(lockedHashes->begin(), lockedHashes->end(), delta.begin(), delta.end(), std::back_inserter(updated));
+    }
+  }
+  lockedHashes->swap(updated);
+  d_hashedWeight = newWeight;
   hashesComputed = true;
 }
 
@@ -231,7 +288,7 @@ void DownstreamState::setWeight(int newWeight)
   d_config.d_weight = newWeight;
 
   if (hashesComputed) {
-    hash();
+    updateHashes();
   }
 }
 
@@ -27,6 +27,7 @@
  // #include "dnsdist-lua-ffi.hh"
  // #include "dolog.hh"
  #include "dns_random.hh"
+ #include <cmath>
  
  static constexpr size_t s_staticArrayCutOff = 16;
  template <typename T> using DynamicIndexArray = std::vector<std::pair<T, size_t>>;
@@ -81,6 +82,69 @@
    return getLeastOutstanding(servers);
  }
  
+ /* power of two choices: sample two distinct servers and keep the better one according to isBetter,
+    falling back to a full scan when neither of them is up */
+ template <class Compare>
+ static std::optional<ServerPolicy::SelectedServerPosition> getPowerOfTwoChoices(const ServerPolicy::NumberedServerVector& servers, const Compare& isBetter)
+ {
+   const auto count = servers.size();
+   if (count == 0) {
+     return std::nullopt;
+   }
+   if (count == 1) {
+     if (servers[0].second->isUp()) {
+       return servers[0].first;
+     }
+     return std::nullopt;
+   }
+ 
+   const auto random = dns_random_uint32();
+   const size_t firstIdx = random % count;
+   /* offset in [1, count - 1] so that the two choices are always distinct */
+   const size_t secondIdx = (firstIdx + 1 + (random / count) % (count - 1)) % count;
+   const auto& first = servers[firstIdx];
+   const auto& second = servers[secondIdx];
+ 
+   const bool firstUp = first.second->isUp();
+   const bool secondUp = second.second->isUp();
+   if (firstUp && secondUp) {
+     return isBetter(*second.second, *first.second) ? second.first : first.first;
+   }
+   if (firstUp) {
+     return first.first;
+   }
+   if (secondUp) {
+     return second.first;
+   }
+   return getLeastOutstanding(servers);
+ }
+ 
+ // two random servers, the one with fewer outstanding queries wins, then the fastest
+ std::optional<ServerPolicy::SelectedServerPosition> p2c(const ServerPolicy::NumberedServerVector& servers, [[maybe_unused]] const DNSQuestion* dnsQuestion)
+ {
+   return getPowerOfTwoChoices(servers, [](const DownstreamState& lhs, const DownstreamState& rhs) {
+     auto lhsOutstanding = lhs.outstanding.load();
+     auto rhsOutstanding = rhs.outstanding.load();
+     if (lhsOutstanding != rhsOutstanding) {
+       return lhsOutstanding < rhsOutstanding;
+     }
+     return lhs.getRelevantLatencyUsec() < rhs.getRelevantLatencyUsec();
+   });
+ }
+ 
+ // two random servers, the lowest expected wait wins: smoothed latency times the queue we would join,
+ // the cost function of peak EWMA load balancing
+ std::optional<ServerPolicy::SelectedServerPosition> ewmaLatency(const ServerPolicy::NumberedServerVector& servers, [[maybe_unused]] const DNSQuestion* dnsQuestion)
+ {
+   return getPowerOfTwoChoices(servers, [](const DownstreamState& lhs, const DownstreamState& rhs) {
+     /* +1 so that an idle server, or one without a measurement yet, still compares on the other factor */
+     auto cost = [](const DownstreamState& server) {
+       return (server.getRelevantLatencyUsec() + 1.0) * (static_cast<double>(server.outstanding.load()) + 1.0);
+     };
+     return cost(lhs) < cost(rhs);
+   });
+ }
+ 
  std::optional<ServerPolicy::SelectedServerPosition> firstAvailable(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dnsQuestion)
  {
    for (const auto& server : servers) {
@@ -233,6 +297,266 @@
    return std::nullopt;
  }
  
+ namespace dnsdist::lbpolicies
+ {
+ /* in-order walk of the implicit tree rooted at node, filling it from sorted[idx...],
+    returns the next unused input index */
+ template <class T>
+ static size_t eytzinger(const std::vector<T>& sorted, std::vector<T>& out, size_t idx, size_t node)
+ {
+   if (node < out.size()) {
+     idx = eytzinger(sorted, out, idx, 2 * node);
+     out[node] = sorted[idx++];
+     idx = eytzinger(sorted, out, idx, 2 * node + 1);
+   }
+   return idx;
+ }
+ 
+ ConsistentHashRing::ConsistentHashRing(const ServerPolicy::NumberedServerVector& servers)
+ {
+   std::vector<std::pair<unsigned int, ServerPolicy::SelectedServerPosition>> points;
+   for (const auto& serverPair : servers) {
+     if (!serverPair.second->hashesComputed) {
+       serverPair.second->hash();
+     }
+     auto hashes = serverPair.second->hashes.read_lock();
+     for (const auto hash : *hashes) {
+       points.emplace_back(hash, serverPair.first);
+     }
+     if (serverPair.second->isUp()) {
+       d_totalWeight += serverPair.second->d_config.d_weight;
+     }
+   }
+   /* on equal hashes the first server in the vector wins, like in chashedFromHash() */
+   std::sort(points.begin(), points.end());
+ 
+   std::vector<unsigned int> sortedHashes;
+   std::vector<uint32_t> sortedRanks;
+   sortedHashes.reserve(points.size());
+   sortedRanks.reserve(points.size());
+   d_ring.reserve(points.size());
+   for (const auto& point : points) {
+     sortedHashes.push_back(point.first);
+     sortedRanks.push_back(static_cast<uint32_t>(sortedRanks.size()));
+     d_ring.push_back(point.second);
+   }
+ 
+   d_hashes.resize(points.size() + 1);
+   d_positions.resize(points.size() + 1);
+   d_ranks.resize(points.size() + 1);
+   eytzinger(sortedHashes, d_hashes, 0, 1);
+   eytzinger(d_ring, d_positions, 0, 1);
+   eytzinger(sortedRanks, d_ranks, 0, 1);
+ }
+ 
+ size_t ConsistentHashRing::findNode(size_t qhash) const
+ {
+   const size_t count = size();
+   /* branchless lower_bound: descend to a leaf, then climb back to the last
+      node where we went left, which is the first hash >= qhash */
+   size_t node = 1;
+   while (node <= count) {
+     __builtin_prefetch(&d_hashes[std::min(16 * node, count)]);
+     node = 2 * node + static_cast<size_t>(d_hashes[node] < qhash);
+   }
+   return node >> __builtin_ffsll(static_cast<long long>(~node));
+ }
+ 
+ std::optional<ServerPolicy::SelectedServerPosition> ConsistentHashRing::lookup(size_t qhash) const
+ {
+   const size_t count = size();
+   if (count == 0) {
+     return std::nullopt;
+   }
+ 
+   size_t node = findNode(qhash);
+   if (node == 0) {
+     /* past the last point, wrap around to the lowest one, which is the leftmost node */
+     node = 1;
+     while (2 * node <= count) {
+       node *= 2;
+     }
+   }
+   return d_positions[node];
+ }
+ }
+ 
+ std::optional<ServerPolicy::SelectedServerPosition> chashedFromRing(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::ConsistentHashRing& ring, size_t qhash)
+ {
+   const auto consistentHashBalancingFactor = dnsdist::configuration::getImmutableConfiguration().d_consistentHashBalancingFactor;
+   if (consistentHashBalancingFactor > 0) {
+     return chashedBoundedFromRing(servers, ring, qhash, consistentHashBalancingFactor);
+   }
+ 
+   auto position = ring.lookup(qhash);
+   if (!position || *position == 0 || *position > servers.size() || !servers[*position - 1].second->isUp()) {
+     /* the ring is stale, take the slow path */
+     return chashedFromHash(servers, qhash);
+   }
+   return position;
+ }
+ 
+ std::optional<ServerPolicy::SelectedServerPosition> chashedBoundedFromRing(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::ConsistentHashRing& ring, size_t qhash, double balancingFactor)
+ {
+   const size_t totalWeight = ring.totalWeight();
+   if (totalWeight == 0) {
+     return std::nullopt;
+   }
+   /* we start with one, representing the query we are currently handling */
+   double currentLoad = 1;
+   for (const auto& pair : servers) {
+     if (pair.second->isUp()) {
+       currentLoad += pair.second->outstanding;
+     }
+   }
+   const double targetLoad = (currentLoad / static_cast<double>(totalWeight)) * balancingFactor;
+ 
+   auto position = ring.lookupBounded(qhash, [&servers, targetLoad](ServerPolicy::SelectedServerPosition pos) {
+     if (pos == 0 || pos > servers.size()) {
+       return false;
+     }
+     const auto& server = servers[pos - 1].second;
+     return server->isUp() && static_cast<double>(server->outstanding.load()) < std::ceil(targetLoad * server->d_config.d_weight);
+   });
+   if (!position) {
+     /* the ring is stale or every server is full, take the slow path */
+     return chashedFromHash(servers, qhash);
+   }
+   return position;
+ }
+ 
+ std::optional<ServerPolicy::SelectedServerPosition> maglevFromTable(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::MaglevTable& table, size_t qhash)
+ {
+   auto position = table.lookup(qhash);
+   if (!position || *position == 0 || *position > servers.size() || !servers[*position - 1].second->isUp()) {
+     /* the table is stale, take the slow path */
+     return chashedFromHash(servers, qhash);
+   }
+   return position;
+ }
+ 
+ namespace dnsdist::lbpolicies
+ {
+ MaglevTable::MaglevTable(const ServerPolicy::NumberedServerVector& servers, size_t tableSize)
+ {
+   struct Candidate
+   {
+     ServerPolicy::SelectedServerPosition d_position;
+     size_t d_next;
+     size_t d_skip;
+     double d_share;
+     double d_credit{0};
+   };
+ 
+   if (tableSize < 2) {
+     return;
+   }
+ 
+   const auto hashPerturbation = dnsdist::configuration::getImmutableConfiguration().d_hashPerturbation;
+   std::vector<Candidate> candidates;
+   int maxWeight = 0;
+   for (const auto& serverPair : servers) {
+     const auto& server = serverPair.second;
+     if (!server->isUp() || server->d_config.d_weight <= 0) {
+       continue;
+     }
+     /* the permutation only depends on the server ID, so it survives membership changes */
+     const auto& serverID = server->getID();
+     const auto offset = burtle(serverID.begin(), serverID.size(), hashPerturbation);
+     const auto skip = burtle(serverID.begin(), serverID.size(), hashPerturbation ^ 0x9e3779b9U);
+     candidates.push_back({serverPair.first, offset % tableSize, (skip % (tableSize - 1)) + 1, static_cast<double>(server->d_config.d_weight)});
+     maxWeight = std::max(maxWeight, server->d_config.d_weight);
+   }
+   if (candidates.empty()) {
+     return;
+   }
+   for (auto& candidate : candidates) {
+     candidate.d_share /= maxWeight;
+   }
+ 
+   /* 0 is never a valid position, so it marks the free slots */
+   d_entries.assign(tableSize, 0);
+   size_t filled = 0;
+   while (true) {
+     for (auto& candidate : candidates) {
+       /* the heaviest server claims a slot every turn, the others in proportion */
+       candidate.d_credit += candidate.d_share;
+       while (candidate.d_credit >= 1.0) {
+         candidate.d_credit -= 1.0;
+         while (d_entries[candidate.d_next] != 0) {
+           candidate.d_next = (candidate.d_next + candidate.d_skip) % tableSize;
+         }
+         d_entries[candidate.d_next] = candidate.d_position;
+         if (++filled == tableSize) {
+           return;
+         }
+       }
+     }
+   }
+ }
+ 
+ WeightedAliasTable::WeightedAliasTable(const ServerPolicy::NumberedServerVector& servers)
+ {
+   std::vector<std::pair<double, ServerPolicy::SelectedServerPosition>> weights;
+   double totalWeight = 0;
+   for (const auto& server : servers) {
+     if (server.second->isUp() && server.second->d_config.d_weight > 0) {
+       weights.emplace_back(server.second->d_config.d_weight, server.first);
+       totalWeight += server.second->d_config.d_weight;
+     }
+   }
+   if (weights.empty()) {
+     return;
+   }
+ 
+   /* scale so that the average column holds exactly 1.0 */
+   const auto count = weights.size();
+   std::vector<double> scaled(count);
+   std::vector<size_t> small;
+   std::vector<size_t> large;
+   for (size_t idx = 0; idx < count; idx++) {
+     scaled[idx] = weights[idx].first * static_cast<double>(count) / totalWeight;
+     (scaled[idx] < 1.0 ? small : large).push_back(idx);
+   }
+ 
+   constexpr double s_fixedPointOne = 4294967296.0;
+   d_columns.resize(count);
+   while (!small.empty() && !large.empty()) {
+     auto less = small.back();
+     small.pop_back();
+     auto more = large.back();
+     large.pop_back();
+ 
+     d_columns[less] = {static_cast<uint32_t>(scaled[less] * s_fixedPointOne), weights[less].second, weights[more].second};
+     scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+     (scaled[more] < 1.0 ? small : large).push_back(more);
+   }
+   /* whatever is left is full, up to rounding errors */
+   for (auto idx : large) {
+     d_columns[idx] = {std::numeric_limits<uint32_t>::max(), weights[idx].second, weights[idx].second};
+   }
+   for (auto idx : small) {
+     d_columns[idx] = {std::numeric_limits<uint32_t>::max(), weights[idx].second, weights[idx].second};
+   }
+ }
+ }
+ 
+ std::optional<ServerPolicy::SelectedServerPosition> wrandomFromAlias(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::WeightedAliasTable& table)
+ {
+   if (dnsdist::configuration::getImmutableConfiguration().d_weightedBalancingFactor > 0 || table.empty()) {
+     return valrandom(dns_random_uint32(), servers);
+   }
+   return table.lookup(dns_random_uint32());
+ }
+ 
+ std::optional<ServerPolicy::SelectedServerPosition> whashedFromAlias(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::WeightedAliasTable& table, size_t hash)
+ {
+   if (dnsdist::configuration::getImmutableConfiguration().d_weightedBalancingFactor > 0 || table.empty()) {
+     return valrandom(hash, servers);
+   }
+   return table.lookup(static_cast<uint32_t>(hash));
+ }
+ 
  std::optional<ServerPolicy::SelectedServerPosition> chashed(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dnsQuestion)
  {
    const auto hashPerturbation = dnsdist::configuration::getImmutableConfiguration().d_hashPerturbation;
@@ -289,7 +613,8 @@
    unsigned int curNumber = 1;
  
    for (const auto& svr : servers) {
-     if (svr.second->isUp() && (!dnsQuestion->ids.qTag || dnsQuestion->ids.qTag->count(svr.second->getNameWithAddr()) == 0)) {
+     /* without a DNSQuestion (selection from a bare hash) there are no tags to exclude */
+     if (svr.second->isUp() && (dnsQuestion == nullptr || !dnsQuestion->ids.qTag || dnsQuestion->ids.qTag->count(svr.second->getNameWithAddr()) == 0)) {
        // the servers in a pool are already sorted in ascending order by its 'order', see ``ServerPool::addServer()``
        if (svr.second->d_config.order > curOrder) {
          break;
@@ -507,7 +832,9 @@
      std::make_shared<ServerPolicy>("whashed", whashed, false),
      std::make_shared<ServerPolicy>("chashed", chashed, false),
      std::make_shared<ServerPolicy>("orderedWrandUntag", orderedWrandUntag, false),
-     std::make_shared<ServerPolicy>("leastOutstanding", leastOutstanding, false)};
+     std::make_shared<ServerPolicy>("leastOutstanding", leastOutstanding, false),
+     std::make_shared<ServerPolicy>("p2c", p2c, false),
+     std::make_shared<ServerPolicy>("ewmaLatency", ewmaLatency, false)};
    return s_policies;
  }
  }
\ No newline at end of file
@@ -21,8 +21,10 @@
  */
  #pragma once
 
+ #include <cstdint>
  #include <memory>
  #include <optional>
+ #include <vector>
  
  struct dnsdist_ffi_servers_list_t;
  struct dnsdist_ffi_server_t;
@@ -149,10 +151,199 @@
  std::optional<ServerPolicy::SelectedServerPosition> chashedFromHash(const ServerPolicy::NumberedServerVector& servers, size_t hash);
  std::optional<ServerPolicy::SelectedServerPosition> roundrobin(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dnsQuestion);
  std::optional<ServerPolicy::SelectedServerPosition> orderedWrandUntag(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dnsQuestion);
+ std::optional<ServerPolicy::SelectedServerPosition> p2c(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dnsQuestion);
+ std::optional<ServerPolicy::SelectedServerPosition> ewmaLatency(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dnsQuestion);
  
  #include <unordered_map>
  
  namespace dnsdist::lbpolicies
  {
  const std::vector<std::shared_ptr<ServerPolicy>>& getBuiltInPolicies();
- }
\ No newline at end of file
+ 
+ /* All the hashes of a set of servers merged into one ring, so that chashed
+    becomes a single search instead of a lock and a lower_bound per server.
+    The ring is immutable once built: rebuild it whenever the set of servers,
+    their weights or their up state change. Hashes are stored in Eytzinger
+    (BFS) order, which keeps the top of the search tree in a few cache lines. */
+ class ConsistentHashRing
+ {
+ public:
+   ConsistentHashRing() = default;
+   /* computes the hashes of the servers that do not have them yet */
+   explicit ConsistentHashRing(const ServerPolicy::NumberedServerVector& servers);
+ 
+   /* position of the server owning the first point at or after qhash,
+      wrapping around to the lowest point */
+   std::optional<ServerPolicy::SelectedServerPosition> lookup(size_t qhash) const;
+ 
+   /* same starting point as lookup(), then keeps walking clockwise past the
+      positions accept() refuses: a key only moves when its server is full, and
+      then to the next server on the ring, never to a random one.
+      Returns std::nullopt when every server is refused. */
+   template <class Accept>
+   std::optional<ServerPolicy::SelectedServerPosition> lookupBounded(size_t qhash, const Accept& accept) const
+   {
+     const size_t count = size();
+     if (count == 0) {
+       return std::nullopt;
+     }
+ 
+     const size_t start = findRank(qhash);
+     ServerPolicy::SelectedServerPosition refused = 0;
+     for (size_t step = 0; step < count; ++step) {
+       const auto position = d_ring[(start + step) % count];
+       /* consecutive points often belong to the same server, only ask once */
+       if (position == refused) {
+         continue;
+       }
+       if (accept(position)) {
+         return position;
+       }
+       refused = position;
+     }
+     return std::nullopt;
+   }
+ 
+   size_t size() const
+   {
+     return d_hashes.size() - 1;
+   }
+ 
+   bool empty() const
+   {
+     return size() == 0;
+   }
+ 
+   /* weight of the up servers the ring was built from, for chashedBoundedFromRing() */
+   size_t totalWeight() const
+   {
+     return d_totalWeight;
+   }
+ 
+ private:
+   /* 1-based, index 0 is unused */
+   std::vector<unsigned int> d_hashes{0};
+   std::vector<ServerPolicy::SelectedServerPosition> d_positions{0};
+   /* rank in ring order of each node, 1-based like d_hashes */
+   std::vector<uint32_t> d_ranks{0};
+   /* positions in ring order, for the clockwise walk of lookupBounded() */
+   std::vector<ServerPolicy::SelectedServerPosition> d_ring;
+   size_t d_totalWeight{0};
+ 
+   /* Eytzinger node of the first point >= qhash, 0 when past the last point */
+   size_t findNode(size_t qhash) const;
+   /* rank in ring order of the first point >= qhash, wrapping around to 0 */
+   size_t findRank(size_t qhash) const
+   {
+     const size_t node = findNode(qhash);
+     return node == 0 ? 0 : d_ranks[node];
+   }
+ };
+ }
+ 
+ namespace dnsdist::lbpolicies
+ {
+ /* Vose alias table over the weights of a set of servers: picking a server with
+    probability weight / totalWeight is one table read and a compare, whatever the
+    number of servers. Immutable once built, rebuild it when weights or the up
+    state of the servers change. */
+ class WeightedAliasTable
+ {
+ public:
+   WeightedAliasTable() = default;
+   /* only servers that are up take part */
+   explicit WeightedAliasTable(const ServerPolicy::NumberedServerVector& servers);
+ 
+   /* val is a uniformly distributed 32-bit value (random number or hash) */
+   std::optional<ServerPolicy::SelectedServerPosition> lookup(uint32_t val) const
+   {
+     if (d_columns.empty()) {
+       return std::nullopt;
+     }
+     /* the high half picks the column, the low half is the coin flip */
+     const uint64_t scaled = static_cast<uint64_t>(val) * d_columns.size();
+     const auto& column = d_columns[scaled >> 32];
+     return static_cast<uint32_t>(scaled) < column.d_threshold ? column.d_position : column.d_alias;
+   }
+ 
+   bool empty() const
+   {
+     return d_columns.empty();
+   }
+ 
+ private:
+   struct Column
+   {
+     uint32_t d_threshold;
+     ServerPolicy::SelectedServerPosition d_position;
+     ServerPolicy::SelectedServerPosition d_alias;
+   };
+   std::vector<Column> d_columns;
+ };
+ }
+ 
+ namespace dnsdist::lbpolicies
+ {
+ /* Maglev lookup table (Eisenbud et al., NSDI 2016): every server walks its own
+    permutation of the slots and claims the next free one, in turns proportional
+    to its weight, until the table is full. Lookup is a single read, and when a
+    server goes away only its own slots and a few others change owner.
+    Building costs O(size * log(servers)), so do it off the hot path. */
+ class MaglevTable
+ {
+ public:
+   /* must be prime so that every skip value yields a full permutation */
+   static constexpr size_t s_defaultSize = 65537;
+ 
+   MaglevTable() = default;
+   /* only servers that are up take part */
+   explicit MaglevTable(const ServerPolicy::NumberedServerVector& servers, size_t tableSize = s_defaultSize);
+   /* a table built earlier for the same servers in the same order, by a previous process for example */
+   explicit MaglevTable(std::vector<ServerPolicy::SelectedServerPosition> entries) :
+     d_entries(std::move(entries))
+   {
+   }
+ 
+   std::optional<ServerPolicy::SelectedServerPosition> lookup(size_t qhash) const
+   {
+     if (d_entries.empty()) {
+       return std::nullopt;
+     }
+     return d_entries[qhash % d_entries.size()];
+   }
+ 
+   bool empty() const
+   {
+     return d_entries.empty();
+   }
+ 
+   const std::vector<ServerPolicy::SelectedServerPosition>& entries() const
+   {
+     return d_entries;
+   }
+ 
+ private:
+   std::vector<ServerPolicy::SelectedServerPosition> d_entries;
+ };
+ }
+ 
+ /* wrandom/whashed through the alias table, fall back to valrandom() when the
+    weighted balancing factor is in use since the load bound changes per query */
+ std::optional<ServerPolicy::SelectedServerPosition> wrandomFromAlias(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::WeightedAliasTable& table);
+ std::optional<ServerPolicy::SelectedServerPosition> whashedFromAlias(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::WeightedAliasTable& table, size_t hash);
+ 
+ /* same result as chashedFromHash() when the ring was built from servers, falls
+    back to it when the consistent hash balancing factor is in use */
+ std::optional<ServerPolicy::SelectedServerPosition> chashedFromRing(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::ConsistentHashRing& ring, size_t hash);
+ 
+ /* Maglev lookup, falls back to chashedFromHash() when the table is stale */
+ std::optional<ServerPolicy::SelectedServerPosition> maglevFromTable(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::MaglevTable& table, size_t hash);
+ 
+ /* consistent hashing with bounded loads (Mirrokni, Thorup and Zadimoghaddam): a server
+    takes a query only while its outstanding queries stay under
+    ceil(balancingFactor * (total outstanding + 1) * weight / total weight), otherwise the
+    query goes to the next server clockwise on the ring. balancingFactor must be > 1 for
+    a server to always be under capacity, 1.25 is a good starting point.
+    The total weight comes with the ring, but the total outstanding is still summed over
+    every server on every query: n atomic loads of counters the forwarders keep writing. */
+ std::optional<ServerPolicy::SelectedServerPosition> chashedBoundedFromRing(const ServerPolicy::NumberedServerVector& servers, const dnsdist::lbpolicies::ConsistentHashRing& ring, size_t hash, double balancingFactor);
\ No newline at end of file
@@ -723,6 +723,9 @@
    unsigned int d_nextCheck{0};
    uint16_t currentCheckFailures{0};
    std::atomic<bool> hashesComputed{false};
+   /* weight the current hashes were computed for, so that a weight change only adds or removes the difference.
+      Only written with the hashes write lock held */
+   std::atomic<int> d_hashedWeight{0};
    std::atomic<bool> connected{false};
    std::atomic<bool> upStatus{false};
  
@@ -837,6 +840,8 @@
    bool reconnect(bool initialAttempt = false);
    void waitUntilConnected();
    void hash();
+   // only compute the points added or removed since the last hash()
+   void updateHashes();
    void setId(const boost::uuids::uuid& newId);
    void setWeight(int newWeight);
    void stop();
@@ -0,0 +1,279 @@
+/**
+ * Microbenchmarks of the dnsdist load balancing policies.
+ *
+ * Every policy runs on synthetic pools of 2 to 1024 backends with varied
+ * weights and outstanding counts. Besides the time per selection, each run
+ * reports:
+ *   allocs/sel  heap allocations per selection, counted by the operator new below
+ *   skew        largest share of selections any backend got, divided by the share
+ *               it should get (its weight for the weighted policies, 1/n otherwise).
+ *               1.0 is a perfect spread, firstAvailable is n by design and
+ *               leastOutstanding sticks to one backend as nothing completes.
+ *
+ * BM_setWeight times the incremental hash update of a weight change and fails
+ * if its points differ from those of a full hash() for the same weight.
+ *
+ * Built when Google Benchmark is installed, run ./build/bench-policies, for
+ * example with --benchmark_filter=chashed to compare a single policy.
+ */
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../../load_balancing/dnsdist-lbpolicies.hh"
+#include "../../load_balancing/dnsdist.hh"
+
+static std::atomic<uint64_t> g_allocations{0};
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+constexpr size_t HASH_COUNT = 4096;              // power of two, cycled through by the hashed policies
+constexpr size_t SKEW_SAMPLES = 100000;
+
+// Share each backend should get: the same, by weight, or by weight within the lowest order
+enum class Expected { Uniform, Weighted, WeightedLowestOrder };
+
+/**
+ * A pool of up backends numbered 1..n like ServerPool hands them to the policies.
+ * Weights are 1..100 and a few queries are outstanding on every backend, both
+ * drawn from a fixed seed so runs are comparable.
+ */
+struct Pool {
+    ServerPolicy::NumberedServerVector servers;
+    std::vector<uint32_t> hashes;
+    uint64_t total_weight{0};
+
+    explicit Pool(size_t count) {
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> weight(1, 100);
+        std::uniform_int_distribution<int> outstanding(0, 16);
+
+        servers.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            const std::string ip = "10." + std::to_string((i >> 16) & 0xFF) + "." + std::to_string((i >> 8) & 0xFF) +
+                                   "." + std::to_string(i & 0xFF);
+            DownstreamState::Config config(ComboAddress(ip, 53));
+            config.d_weight = weight(rng);
+            config.d_availability = DownstreamState::Availability::Up;
+            // Two tiers for orderedWrandUntag, which only picks from the lowest order
+            config.order = i < (count + 1) / 2 ? 1 : 2;
+            auto state = std::make_shared<DownstreamState>(std::move(config), nullptr, false);
+            state->outstanding = static_cast<uint64_t>(outstanding(rng));
+            total_weight += static_cast<uint64_t>(state->d_config.d_weight);
+            servers.emplace_back(static_cast<ServerPolicy::SelectedServerPosition>(i + 1), std::move(state));
+        }
+
+        hashes.resize(HASH_COUNT);
+        for (auto& hash : hashes) {
+            hash = static_cast<uint32_t>(rng());
+        }
+    }
+};
+
+/**
+ * Largest observed share over expected share, out of SKEW_SAMPLES selections
+ */
+template <typename Select>
+double measureSkew(const Pool& pool, const Select& select, Expected expected) {
+    std::vector<uint64_t> picks(pool.servers.size() + 1, 0);
+    uint64_t lowest_order_weight = 0;
+    for (const auto& server : pool.servers) {
+        if (server.second->d_config.order == 1) {
+            lowest_order_weight += static_cast<uint64_t>(server.second->d_config.d_weight);
+        }
+    }
+
+    std::mt19937 rng(7);
+    for (size_t i = 0; i < SKEW_SAMPLES; ++i) {
+        auto selected = select(static_cast<uint32_t>(rng()));
+        if (selected && *selected <= pool.servers.size()) {
+            ++picks[*selected];
+        }
+    }
+
+    double skew = 0.0;
+    for (const auto& server : pool.servers) {
+        const double share = static_cast<double>(picks[server.first]) / SKEW_SAMPLES;
+        const double weight = static_cast<double>(server.second->d_config.d_weight);
+        double fair = 1.0 / static_cast<double>(pool.servers.size());
+        if (expected == Expected::Weighted) {
+            fair = weight / static_cast<double>(pool.total_weight);
+        } else if (expected == Expected::WeightedLowestOrder) {
+            if (server.second->d_config.order != 1) {
+                continue;
+            }
+            fair = weight / static_cast<double>(lowest_order_weight);
+        }
+        skew = std::max(skew, share / fair);
+    }
+    return skew;
+}
+
+/**
+ * select maps a query hash to a position, inlined so only the policy itself is timed
+ */
+template <typename Select>
+void runSelections(benchmark::State& state, const Pool& pool, const Select& select, Expected expected) {
+    // The first call may build lazy state, chashed hashes every backend
+    benchmark::DoNotOptimize(select(pool.hashes[0]));
+
+    size_t next = 0;
+    const uint64_t allocations_before = g_allocations.load(std::memory_order_relaxed);
+    for (auto _ : state) {
+        auto selected = select(pool.hashes[next++ & (HASH_COUNT - 1)]);
+        benchmark::DoNotOptimize(selected);
+    }
+    const uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - allocations_before;
+
+    state.counters["allocs/sel"] = benchmark::Counter(static_cast<double>(allocations) /
+                                                      static_cast<double>(std::max<int64_t>(1, state.iterations())));
+    state.counters["skew"] = measureSkew(pool, select, expected);
+    state.counters["selections/s"] = benchmark::Counter(static_cast<double>(state.iterations()),
+                                                        benchmark::Counter::kIsRate);
+}
+
+/**
+ * Policies that take a DNSQuestion get nullptr, like DnsdistLoadBalancer passes them
+ */
+template <std::optional<ServerPolicy::SelectedServerPosition> (*Policy)(const ServerPolicy::NumberedServerVector&,
+                                                                        const DNSQuestion*)>
+void benchQuestionPolicy(benchmark::State& state, Expected expected) {
+    const Pool pool(static_cast<size_t>(state.range(0)));
+    runSelections(state, pool, [&pool](uint32_t) { return Policy(pool.servers, nullptr); }, expected);
+}
+
+template <std::optional<ServerPolicy::SelectedServerPosition> (*Policy)(const ServerPolicy::NumberedServerVector&,
+                                                                        size_t)>
+void benchHashPolicy(benchmark::State& state, Expected expected) {
+    const Pool pool(static_cast<size_t>(state.range(0)));
+    runSelections(state, pool, [&pool](uint32_t hash) { return Policy(pool.servers, hash); }, expected);
+}
+
+void BM_roundrobin(benchmark::State& state) {
+    benchQuestionPolicy<roundrobin>(state, Expected::Uniform);
+}
+
+void BM_leastOutstanding(benchmark::State& state) {
+    benchQuestionPolicy<leastOutstanding>(state, Expected::Uniform);
+}
+
+void BM_wrandom(benchmark::State& state) {
+    benchQuestionPolicy<wrandom>(state, Expected::Weighted);
+}
+
+void BM_firstAvailable(benchmark::State& state) {
+    benchQuestionPolicy<firstAvailable>(state, Expected::Uniform);
+}
+
+void BM_orderedWrandUntag(benchmark::State& state) {
+    benchQuestionPolicy<orderedWrandUntag>(state, Expected::WeightedLowestOrder);
+}
+
+// whashed and chashed hash the qname of their DNSQuestion, benchmark their hash entry points
+void BM_whashed(benchmark::State& state) {
+    benchHashPolicy<whashedFromHash>(state, Expected::Weighted);
+}
+
+void BM_chashed(benchmark::State& state) {
+    benchHashPolicy<chashedFromHash>(state, Expected::Weighted);
+}
+
+// Precomputed variants DnsdistLoadBalancer uses, the tables are built outside the timed loop
+void BM_wrandomFromAlias(benchmark::State& state) {
+    const Pool pool(static_cast<size_t>(state.range(0)));
+    const dnsdist::lbpolicies::WeightedAliasTable table(pool.servers);
+    runSelections(state, pool, [&](uint32_t) { return wrandomFromAlias(pool.servers, table); }, Expected::Weighted);
+}
+
+void BM_whashedFromAlias(benchmark::State& state) {
+    const Pool pool(static_cast<size_t>(state.range(0)));
+    const dnsdist::lbpolicies::WeightedAliasTable table(pool.servers);
+    runSelections(state, pool, [&](uint32_t hash) { return whashedFromAlias(pool.servers, table, hash); },
+                  Expected::Weighted);
+}
+
+void BM_chashedFromRing(benchmark::State& state) {
+    const Pool pool(static_cast<size_t>(state.range(0)));
+    const dnsdist::lbpolicies::ConsistentHashRing ring(pool.servers);
+    runSelections(state, pool, [&](uint32_t hash) { return chashedFromRing(pool.servers, ring, hash); },
+                  Expected::Weighted);
+}
+
+void BM_maglevFromTable(benchmark::State& state) {
+    const Pool pool(static_cast<size_t>(state.range(0)));
+    const dnsdist::lbpolicies::MaglevTable table(pool.servers);
+    runSelections(state, pool, [&](uint32_t hash) { return maglevFromTable(pool.servers, table, hash); },
+                  Expected::Weighted);
+}
+
+// Weight changes between 1 and range(0), each followed by the same check against a full rehash
+void BM_setWeight(benchmark::State& state) {
+    const int max_weight = static_cast<int>(state.range(0));
+    DownstreamState::Config config(ComboAddress("10.0.0.1", 53));
+    config.d_weight = max_weight;
+    auto server = std::make_shared<DownstreamState>(std::move(config), nullptr, false);
+    server->hash();
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> weight(1, max_weight);
+    for (auto _ : state) {
+        server->setWeight(weight(rng));
+    }
+
+    // Same id, so the points of a full hash() must be exactly the incremental ones
+    DownstreamState::Config reference_config(ComboAddress("10.0.0.1", 53));
+    reference_config.d_weight = server->d_config.d_weight;
+    reference_config.id = server->getID();
+    DownstreamState reference(std::move(reference_config), nullptr, false);
+    reference.hash();
+    if (*server->hashes.read_lock() != *reference.hashes.read_lock()) {
+        state.SkipWithError("incremental hash points differ from a full hash()");
+    }
+}
+
+void poolSizes(benchmark::internal::Benchmark* bench) {
+    for (int64_t count = 2; count <= 1024; count *= 2) {
+        bench->Arg(count);
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_roundrobin)->Apply(poolSizes);
+BENCHMARK(BM_leastOutstanding)->Apply(poolSizes);
+BENCHMARK(BM_wrandom)->Apply(poolSizes);
+BENCHMARK(BM_whashed)->Apply(poolSizes);
+BENCHMARK(BM_chashed)->Apply(poolSizes);
+BENCHMARK(BM_firstAvailable)->Apply(poolSizes);
+BENCHMARK(BM_orderedWrandUntag)->Apply(poolSizes);
+BENCHMARK(BM_wrandomFromAlias)->Apply(poolSizes);
+BENCHMARK(BM_whashedFromAlias)->Apply(poolSizes);
+BENCHMARK(BM_chashedFromRing)->Apply(poolSizes);
+BENCHMARK(BM_maglevFromTable)->Apply(poolSizes);
+BENCHMARK(BM_setWeight)->Arg(10)->Arg(100)->Arg(1000);
+
+BENCHMARK_MAIN();
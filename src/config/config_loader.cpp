@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <nlohmann/json.hpp>
@@ -7,6 +9,15 @@
 
 using json = nlohmann::json;
 
+// Relative paths in the config are taken from the directory of the config file
+static std::string resolvePath(const std::string& path, const std::string& config_path) {
+    const size_t slash = config_path.rfind('/');
+    if (!path.empty() && path[0] != '/' && slash != std::string::npos) {
+        return config_path.substr(0, slash + 1) + path;
+    }
+    return path;
+}
+
 std::vector<ServerPool> ConfigLoader::loadBackends(const std::string& config_path) {
     std::vector<ServerPool> pools;
     
@@ -25,11 +36,37 @@ std::vector<ServerPool> ConfigLoader::loadBackends(const std::string& config_pat
             pool.health_endpoint = pool_config["health_endpoint"];
             pool.geo_region = pool_config["geo_region"];
             pool.check_interval_sec = pool_config["check_interval_sec"];
+            pool.policy = pool_config.value("policy", std::string());
             
-            // Load servers
+            // Load servers, either "ip" or {"ip": ..., "port": ..., "weight": ...}
             for (const auto& server_config : pool_config["servers"]) {
-                std::string server_ip = server_config["ip"];
-                pool.servers.push_back(server_ip);
+                ServerConfig server;
+                int port = server.port;
+                if (server_config.is_string()) {
+                    server.ip = server_config.get<std::string>();
+                } else {
+                    server.ip = server_config["ip"];
+                    port = server_config.value("port", port);
+                    server.weight = server_config.value("weight", server.weight);
+                    server.order = server_config.value("order", server.order);
+                    server.tcp_only = server_config.value("tcp_only", server.tcp_only);
+                    server.qps_limit = server_config.value("qps_limit", server.qps_limit);
+                }
+                if (port < 1 || port > 65535) {
+                    std::cerr << "⚠️  Server " << server.ip << " in pool " << pool.name << " has port " << port
+                              << ", using 53" << std::endl;
+                    port = 53;
+                }
+                server.port = static_cast<uint16_t>(port);
+                if (server.weight < 1) {
+                    std::cerr << "⚠️  Server " << server.ip << " in pool " << pool.name << " has weight "
+                              << server.weight << ", using 1" << std::endl;
+                    server.weight = 1;
+                }
+                if (server.qps_limit < 0) {
+                    server.qps_limit = 0;
+                }
+                pool.servers.push_back(server);
             }
             
             pools.push_back(pool);
@@ -43,4 +80,218 @@ std::vector<ServerPool> ConfigLoader::loadBackends(const std::string& config_pat
     }
     
     return pools;
-}
\ No newline at end of file
+}
+
+GlobalSettings ConfigLoader::loadGlobalSettings(const std::string& config_path) {
+    GlobalSettings settings;
+    
+    try {
+        std::ifstream config_file(config_path);
+        if (!config_file.is_open()) {
+            return settings;
+        }
+        
+        json config = json::parse(config_file);
+        if (!config.contains("global_settings")) {
+            return settings;
+        }
+        
+        const auto& global = config["global_settings"];
+        settings.health_check_timeout_ms = global.value("health_check_timeout_ms", settings.health_check_timeout_ms);
+        settings.max_failures_before_unhealthy = global.value("max_failures_before_unhealthy", settings.max_failures_before_unhealthy);
+        settings.min_successes_before_healthy = global.value("min_successes_before_healthy", settings.min_successes_before_healthy);
+        settings.health_check_method = global.value("health_check_method", settings.health_check_method);
+        settings.log_level = global.value("log_level", settings.log_level);
+        settings.log_rate_limit = global.value("log_rate_limit", settings.log_rate_limit);
+        if (global.contains("state_file")) {
+            settings.state_file = resolvePath(global["state_file"].get<std::string>(), config_path);
+        }
+        settings.state_save_interval_sec = global.value("state_save_interval_sec", settings.state_save_interval_sec);
+        settings.state_max_age_sec = global.value("state_max_age_sec", settings.state_max_age_sec);
+        
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading global settings from " << config_path << ": " << e.what() << std::endl;
+    }
+    
+    return settings;
+}
+
+RoutingConfig ConfigLoader::loadRouting(const std::string& config_path) {
+    RoutingConfig routing;
+    
+    try {
+        std::ifstream config_file(config_path);
+        if (!config_file.is_open()) {
+            return routing;
+        }
+        
+        json config = json::parse(config_file);
+        if (!config.contains("routing")) {
+            return routing;
+        }
+        
+        const auto& section = config["routing"];
+        routing.default_pool = section.value("default_pool", routing.default_pool);
+        routing.use_ecs = section.value("use_ecs", routing.use_ecs);
+        if (section.contains("client_subnets_file")) {
+            routing.client_subnets = loadCIDRFile(section["client_subnets_file"].get<std::string>(), config_path);
+        }
+        if (section.contains("qname_suffixes")) {
+            for (const auto& [suffix, target] : section["qname_suffixes"].items()) {
+                routing.qname_suffixes.emplace_back(suffix, target.get<std::string>());
+            }
+        }
+        if (section.contains("client_subnets")) {
+            for (const auto& [subnet, target] : section["client_subnets"].items()) {
+                routing.client_subnets.emplace_back(subnet, target.get<std::string>());
+            }
+        }
+        
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading routing from " << config_path << ": " << e.what() << std::endl;
+        return RoutingConfig();
+    }
+    
+    return routing;
+}
+
+AccessControlConfig ConfigLoader::loadAccessControl(const std::string& config_path) {
+    AccessControlConfig acl;
+    
+    try {
+        std::ifstream config_file(config_path);
+        if (!config_file.is_open()) {
+            return acl;
+        }
+        
+        json config = json::parse(config_file);
+        if (!config.contains("acl")) {
+            return acl;
+        }
+        
+        const auto& section = config["acl"];
+        acl.default_allow = section.value("default", std::string("allow")) != "deny";
+        if (section.contains("file")) {
+            acl.rules = loadCIDRFile(section["file"].get<std::string>(), config_path);
+        }
+        if (section.contains("rules")) {
+            for (const auto& [subnet, action] : section["rules"].items()) {
+                acl.rules.emplace_back(subnet, action.get<std::string>());
+            }
+        }
+        
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading acl from " << config_path << ": " << e.what() << std::endl;
+        return AccessControlConfig();
+    }
+    
+    return acl;
+}
+
+RateLimitConfig ConfigLoader::loadRateLimit(const std::string& config_path) {
+    RateLimitConfig limit;
+    
+    try {
+        std::ifstream config_file(config_path);
+        if (!config_file.is_open()) {
+            return limit;
+        }
+        
+        json config = json::parse(config_file);
+        if (!config.contains("rate_limit")) {
+            return limit;
+        }
+        
+        const auto& section = config["rate_limit"];
+        limit.client_qps = section.value("client_qps", limit.client_qps);
+        limit.client_burst = section.value("client_burst", limit.client_burst);
+        limit.ipv4_prefix = static_cast<uint8_t>(std::clamp(section.value("ipv4_prefix", 32), 0, 32));
+        limit.ipv6_prefix = static_cast<uint8_t>(std::clamp(section.value("ipv6_prefix", 64), 0, 128));
+        limit.max_clients = section.value("max_clients", limit.max_clients);
+        
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading rate_limit from " << config_path << ": " << e.what() << std::endl;
+        return RateLimitConfig();
+    }
+    
+    return limit;
+}
+
+std::vector<LuaPolicyConfig> ConfigLoader::loadLuaPolicies(const std::string& config_path) {
+    std::vector<LuaPolicyConfig> policies;
+    
+    try {
+        std::ifstream config_file(config_path);
+        if (!config_file.is_open()) {
+            return policies;
+        }
+        
+        json config = json::parse(config_file);
+        if (!config.contains("lua_policies")) {
+            return policies;
+        }
+        
+        for (const auto& [name, policy] : config["lua_policies"].items()) {
+            if (policy.contains("code")) {
+                policies.push_back({name, policy["code"].get<std::string>()});
+                continue;
+            }
+            if (!policy.contains("file")) {
+                std::cerr << "Ignoring Lua policy " << name << ": neither code nor file" << std::endl;
+                continue;
+            }
+            
+            const std::string full_path = resolvePath(policy["file"].get<std::string>(), config_path);
+            std::ifstream file(full_path);
+            if (!file.is_open()) {
+                std::cerr << "❌ Cannot open Lua policy file: " << full_path << std::endl;
+                continue;
+            }
+            std::ostringstream code;
+            code << file.rdbuf();
+            policies.push_back({name, code.str()});
+        }
+        
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading lua_policies from " << config_path << ": " << e.what() << std::endl;
+        return {};
+    }
+    
+    return policies;
+}
+
+std::vector<std::pair<std::string, std::string>> ConfigLoader::loadCIDRFile(const std::string& path,
+                                                                            const std::string& config_path) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    
+    const std::string full_path = resolvePath(path, config_path);
+    std::ifstream file(full_path);
+    if (!file.is_open()) {
+        std::cerr << "❌ Cannot open CIDR file: " << full_path << std::endl;
+        return entries;
+    }
+    
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        
+        std::istringstream fields(line);
+        std::string subnet;
+        std::string target;
+        if (!(fields >> subnet)) {
+            continue;
+        }
+        if (!(fields >> target)) {
+            std::cerr << "Ignoring line " << line_number << " of " << full_path << ": no target for " << subnet << std::endl;
+            continue;
+        }
+        entries.emplace_back(subnet, target);
+    }
+    
+    return entries;
+}
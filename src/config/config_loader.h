@@ -1,25 +1,113 @@
 #ifndef CONFIG_LOADER_H
 #define CONFIG_LOADER_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 
 #ifndef CONFIG_LOADER_SERVER_POOL
 #define CONFIG_LOADER_SERVER_POOL
 
+/**
+ * One entry of a pool's "servers", handed to DownstreamState::Config as is.
+ * A plain string in the config is an IP with the defaults below.
+ */
+struct ServerConfig {
+    std::string ip;
+    uint16_t port = 53;
+    int weight = 1;          // share of the traffic for the weighted and hashed policies
+    int order = 1;           // lower is preferred by firstAvailable and orderedWrandUntag
+    bool tcp_only = false;   // forwarded over TCP even when the query came over UDP
+    int qps_limit = 0;       // queries per second, 0 for no limit, the policy skips it when over
+
+    // "ip:port", what backends are told apart by
+    std::string key() const { return ip + ':' + std::to_string(port); }
+};
+
 struct ServerPool {
     std::string name;
-    std::vector<std::string> servers;
+    std::vector<ServerConfig> servers;
     std::string health_endpoint;
     std::string geo_region;
     int check_interval_sec;
+    std::string policy;      // load balancing policy of the pool, empty for the global one
 };
 
 #endif // CONFIG_LOADER_SERVER_POOL
 
+/**
+ * "global_settings" section of the config, defaults apply to missing keys
+ */
+struct GlobalSettings {
+    int health_check_timeout_ms = 2000;
+    int max_failures_before_unhealthy = 3;   // fall: consecutive failures to go down
+    int min_successes_before_healthy = 1;    // rise: consecutive successes to come back up
+    std::string health_check_method = "http_endpoint";   // or "dns"
+    std::string log_level = "info";          // error, warning, info or debug
+    size_t log_rate_limit = 1000;            // messages per second and thread, 0 for no limit
+    std::string state_file;                  // warm start state, relative to the config file, empty for none
+    int state_save_interval_sec = 30;        // how often the state file is rewritten, 0 only on shutdown
+    int state_max_age_sec = 3600;            // older state files are ignored at startup
+};
+
+/**
+ * "routing" section of the config: which pool answers a query. Targets are
+ * pool names or geo_region values, a region stands for its first pool.
+ */
+struct RoutingConfig {
+    std::vector<std::pair<std::string, std::string>> qname_suffixes;   // suffix, target
+    std::vector<std::pair<std::string, std::string>> client_subnets;   // CIDR, target, client_subnets_file first
+    std::string default_pool;                // empty sends unmatched queries to every pool
+    bool use_ecs = true;                     // route on the EDNS Client Subnet when present
+};
+
+/**
+ * "acl" section of the config: which clients are answered at all. Targets of
+ * the rules are "allow" or "deny", the longest matching rule wins.
+ */
+struct AccessControlConfig {
+    std::vector<std::pair<std::string, std::string>> rules;   // CIDR, "allow" or "deny", file first
+    bool default_allow = true;               // for clients that match no rule
+};
+
+/**
+ * "rate_limit" section of the config: queries per second a single client, or
+ * a whole subnet of clients, gets answered at most
+ */
+struct RateLimitConfig {
+    uint32_t client_qps = 0;                 // 0 for no limit
+    uint32_t client_burst = 0;               // 0 for client_qps
+    uint8_t ipv4_prefix = 32;                // clients in the same /ipv4_prefix share a limit
+    uint8_t ipv6_prefix = 64;
+    size_t max_clients = 65536;              // clients tracked at the same time
+};
+
+/**
+ * One entry of the "lua_policies" section: a policy pools can name like a
+ * built-in one, with its code inline ("code") or in a file ("file")
+ */
+struct LuaPolicyConfig {
+    std::string name;
+    std::string code;
+};
+
 class ConfigLoader {
 public:
     static std::vector<ServerPool> loadBackends(const std::string& config_path);
+    static GlobalSettings loadGlobalSettings(const std::string& config_path);
+    static RoutingConfig loadRouting(const std::string& config_path);
+    static AccessControlConfig loadAccessControl(const std::string& config_path);
+    static RateLimitConfig loadRateLimit(const std::string& config_path);
+    static std::vector<LuaPolicyConfig> loadLuaPolicies(const std::string& config_path);
+
+    /**
+     * "CIDR target" per line, # starts a comment. A relative path is taken
+     * from the directory of the config file.
+     */
+    static std::vector<std::pair<std::string, std::string>> loadCIDRFile(const std::string& path,
+                                                                         const std::string& config_path);
 };
 
 #endif // CONFIG_LOADER_H
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <string>
 #include <atomic>
 #include <random>
+#include <algorithm>
 #include <curl/curl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -13,6 +14,11 @@
 #include <unistd.h>
 #include "health_checker.h"
 #include "config_loader.h"
+#include "warm_state.h"
+#include "../logging/logger.h"
+
+// Weight of the newest RTT sample in HealthStatus::response_time_ms
+static constexpr double LATENCY_EWMA_ALPHA = 0.3;
 
 // Private method implementations
 bool HealthChecker::isSimulatedDownServer(const std::string& endpoint) {
@@ -25,7 +31,7 @@ bool HealthChecker::isSimulatedDownServer(const std::string& endpoint) {
     
     for (const auto& down_ip : down_servers) {
         if (endpoint.find(down_ip) != std::string::npos) {
-            std::cout << "SIMULATED DOWN SERVER: " << endpoint << std::endl;
+            LOG_DEBUG("Simulated down server: %s", endpoint.c_str());
             return true;
         }
     }
@@ -37,204 +43,470 @@ bool HealthChecker::shouldSimulateRandomFailure() {
     return dis(gen_) <= 10; // 10% chance of random failure
 }
 
-bool HealthChecker::checkHttpHealth(const std::string& endpoint) {
-    // Check if this is a simulated down server
-    if (isSimulatedDownServer(endpoint)) {
-        return false; // Always down
+/**
+ * Point a pool's health endpoint at one of its servers by swapping in the
+ * server as host, e.g. "192.168.1.10:8080/health" -> "192.168.1.11:8080/health"
+ */
+static std::string endpointForServer(const std::string& endpoint, const std::string& server_ip) {
+    size_t host_start = endpoint.find("://");
+    host_start = (host_start == std::string::npos) ? 0 : host_start + 3;
+    size_t host_end = endpoint.find_first_of(":/", host_start);
+    if (host_end == std::string::npos) {
+        host_end = endpoint.size();
     }
+    return endpoint.substr(0, host_start) + server_ip + endpoint.substr(host_end);
+}
+
+void HealthChecker::addBackendProbe(size_t backend_index, const ServerPool& pool, const ServerConfig& server) {
+    const std::string& server_ip = server.ip;
+    auto interval = std::chrono::seconds(pool.check_interval_sec > 0 ? pool.check_interval_sec : 10);
     
-    // Simulate occasional random failures
-    if (shouldSimulateRandomFailure()) {
-        std::cout << "RANDOM FAILURE SIMULATION for: " << endpoint << std::endl;
-        return false;
+    try {
+        size_t probe_id;
+        // Try HTTP health endpoint first, fallback to a DNS probe
+        if (settings_.health_check_method != "dns" && !pool.health_endpoint.empty()) {
+            probe_id = prober_.addHttpProbe(endpointForServer(pool.health_endpoint, server_ip), interval);
+        } else {
+            probe_id = prober_.addDnsProbe(server_ip, server.port, interval);
+        }
+        probe_backend_.push_back(backend_index);
+        backend_probe_[backend_index] = probe_id;
+    } catch (const std::exception& e) {
+        LOG_ERROR("Cannot probe %s in pool %s: %s", server_ip.c_str(), pool.name.c_str(), e.what());
     }
-    
-    CURL* curl = curl_easy_init();
-    if (!curl) return false;
-    
-    curl_easy_setopt(curl, CURLOPT_URL, endpoint.c_str());
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 2L);
-    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
-    
-    CURLcode res = curl_easy_perform(curl);
-    long http_code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-    
-    curl_easy_cleanup(curl);
-    
-    return (res == CURLE_OK && http_code == 200);
 }
 
-bool HealthChecker::checkDnsHealth(const std::string& server_ip) {
+void HealthChecker::applyProbeResult(const ProbeResult& result, long timestamp) {
+    const size_t backend_idx = probe_backend_[result.probe_id];
+    const auto& pool = pools_[backend_pool_[backend_idx]];
+    const std::string& server_ip = backend_server_[backend_idx].ip;
+    
+    bool is_healthy = result.success;
+    std::string error_msg = result.error;
+    
     // Check if this is a simulated down server
     if (isSimulatedDownServer(server_ip)) {
-        return false; // Always down
+        is_healthy = false; // Always down
+        error_msg = "Simulated down server";
     }
-    
     // Simulate occasional random failures
-    if (shouldSimulateRandomFailure()) {
-        std::cout << "RANDOM DNS FAILURE SIMULATION for: " << server_ip << std::endl;
-        return false;
+    else if (is_healthy && shouldSimulateRandomFailure()) {
+        LOG_DEBUG("Random failure simulation for: %s", prober_.target(result.probe_id).c_str());
+        is_healthy = false;
+        error_msg = "Simulated random failure";
     }
     
-    int sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0) return false;
-    
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(53);
-    inet_pton(AF_INET, server_ip.c_str(), &server_addr.sin_addr);
-    
-    struct timeval timeout;
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    
-    bool reachable = (connect(sock, (struct sockaddr*)&server_addr, 
-                            sizeof(server_addr)) == 0);
+    // Update health status with rise/fall counting
+    auto& status = backend_health_[backend_idx];
+    const bool first_check = (status.last_check_timestamp == 0);
+    const bool was_healthy = status.is_healthy;
+    if (is_healthy) {
+        status.consecutive_failures = 0;
+        status.consecutive_successes++;
+        status.last_error = "OK";
+        // Smooth the measured RTT, the first sample seeds the average
+        if (status.response_time_ms <= 0.0) {
+            status.response_time_ms = result.response_time_ms;
+        } else {
+            status.response_time_ms = LATENCY_EWMA_ALPHA * result.response_time_ms
+                                    + (1.0 - LATENCY_EWMA_ALPHA) * status.response_time_ms;
+        }
+        
+        // The very first check decides right away, later a down backend has to
+        // pass min_successes_before_healthy checks in a row
+        if (first_check || status.consecutive_successes >= settings_.min_successes_before_healthy) {
+            status.is_healthy = true;
+        }
+    } else {
+        status.consecutive_successes = 0;
+        status.consecutive_failures++;
+        status.last_error = error_msg;
+        
+        // Mark unhealthy only after max_failures_before_unhealthy consecutive failures
+        if (first_check || status.consecutive_failures >= settings_.max_failures_before_unhealthy) {
+            status.is_healthy = false;
+            status.response_time_ms = 0.0;
+        }
+    }
+    status.last_check_timestamp = timestamp;
     
-    close(sock);
-    return reachable;
+    // State changes are worth a line, the outcome of every single check is debug output
+    const LogLevel level = (first_check || was_healthy != status.is_healthy) ? LogLevel::Info : LogLevel::Debug;
+    if (status.is_healthy) {
+        LOG_AT(level, "Pool: %s - Server: %s - HEALTHY - Failures: %d - RTT: %.1fms", pool.name.c_str(),
+               server_ip.c_str(), status.consecutive_failures, status.response_time_ms);
+    } else {
+        LOG_AT(level, "Pool: %s - Server: %s - UNHEALTHY - Failures: %d - Error: %s", pool.name.c_str(),
+               server_ip.c_str(), status.consecutive_failures, status.last_error.c_str());
+    }
 }
 
 void HealthChecker::healthCheckLoop() {
-    int check_cycle = 0;
+    std::vector<ProbeResult> results;
     
     while (running_) {
-        check_cycle++;
+        applyPendingReloads();
+
+        // Probes run concurrently, each pool on its own interval
+        results.clear();
+        prober_.poll(std::chrono::milliseconds(500), results);
+        if (results.empty()) {
+            continue;
+        }
+        
         auto now = std::chrono::system_clock::now();
         auto now_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(now);
-        auto value = now_ms.time_since_epoch();
-        long timestamp = value.count();
+        long timestamp = now_ms.time_since_epoch().count();
         
-        std::cout << "\n=== Health Check Cycle #" << check_cycle << " ===" << std::endl;
+        for (const auto& result : results) {
+            applyProbeResult(result, timestamp);
+        }
+        publishSnapshot();
+    }
+    // Do not leave a reload() waiting
+    applyPendingReloads();
+}
+
+void HealthChecker::applyPools(const std::vector<ServerPool>& pools) {
+    std::lock_guard<std::mutex> lock(layout_mutex_);
+    
+    // Backends are identified by pool, IP and port
+    std::unordered_map<std::string, size_t> existing;
+    for (size_t i = 0; i < backend_server_.size(); ++i) {
+        existing[pools_[backend_pool_[i]].name + '/' + backend_server_[i].key()] = i;
+    }
+    std::vector<bool> configured(backend_server_.size(), false);
+    std::vector<bool> pool_configured(pools_.size(), false);
+    
+    for (const auto& pool : pools) {
+        auto pool_it = pool_index_.find(pool.name);
+        bool probes_changed = false;
+        if (pool_it == pool_index_.end()) {
+            pool_it = pool_index_.emplace(pool.name, pools_.size()).first;
+            pools_.push_back(pool);
+            pool_backends_.emplace_back();
+            pool_configured.push_back(false);
+        } else {
+            const auto& previous = pools_[pool_it->second];
+            probes_changed = previous.health_endpoint != pool.health_endpoint ||
+                             previous.check_interval_sec != pool.check_interval_sec;
+            pools_[pool_it->second] = pool;
+        }
+        const size_t pool_idx = pool_it->second;
+        pool_configured[pool_idx] = true;
         
-        for (const auto& pool : pools_) {
-            bool is_healthy = false;
-            std::string error_msg = "OK";
-            
-            // Try HTTP health endpoint first
-            if (!pool.health_endpoint.empty()) {
-                is_healthy = checkHttpHealth(pool.health_endpoint);
-                if (!is_healthy) error_msg = "HTTP health check failed";
-            } 
-            // Fallback to DNS connectivity check
-            else if (!pool.servers.empty()) {
-                is_healthy = checkDnsHealth(pool.servers[0]);
-                if (!is_healthy) error_msg = "DNS connectivity check failed";
-            }
-            
-            // Update health status with failure counting
-            auto& status = pool_health_[pool.name];
-            if (is_healthy) {
-                status.consecutive_failures = 0;
-                status.is_healthy = true;
-                status.last_error = "OK";
+        auto& members = pool_backends_[pool_idx];
+        members.clear();
+        for (const auto& server : pool.servers) {
+            size_t backend_index;
+            auto it = existing.find(pool.name + '/' + server.key());
+            if (it != existing.end()) {
+                backend_index = it->second;
+                // Weight and the like only matter to the load balancer
+                backend_server_[backend_index] = server;
             } else {
-                status.consecutive_failures++;
-                status.last_error = error_msg;
-                
-                // Mark unhealthy only after 3 consecutive failures
-                if (status.consecutive_failures >= 3) {
-                    status.is_healthy = false;
-                }
+                backend_index = backend_server_.size();
+                existing.emplace(pool.name + '/' + server.key(), backend_index);
+                backend_health_.push_back({false, 0, 0, 0.0, "Initializing"});
+                backend_pool_.push_back(pool_idx);
+                backend_server_.push_back(server);
+                backend_probe_.push_back(NO_PROBE);
+                configured.push_back(false);
             }
-            status.last_check_timestamp = timestamp;
-            
-            // Color-coded output for easy reading
-            std::string health_color = status.is_healthy ? "\033[32m" : "\033[31m";
-            std::string health_text = status.is_healthy ? "HEALTHY" : "UNHEALTHY";
-            
-            std::cout << health_color 
-                      << "Pool: " << pool.name 
-                      << " - " << health_text
-                      << " - Failures: " << status.consecutive_failures;
+            members.push_back(backend_index);
+            // Listed twice in the pool, the first entry already set it up
+            if (configured[backend_index]) {
+                continue;
+            }
+            configured[backend_index] = true;
             
-            if (!status.is_healthy) {
-                std::cout << " - Error: " << status.last_error;
+            if (backend_probe_[backend_index] == NO_PROBE) {
+                // New, or back after being removed: nothing is known about it yet
+                backend_health_[backend_index] = {false, 0, 0, 0.0, "Initializing"};
+                addBackendProbe(backend_index, pool, server);
+            } else if (probes_changed) {
+                // Same backend, the status carries over to the new probe
+                prober_.removeProbe(backend_probe_[backend_index]);
+                backend_probe_[backend_index] = NO_PROBE;
+                addBackendProbe(backend_index, pool, server);
             }
-            std::cout << "\033[0m" << std::endl;
         }
-        
-        std::cout << "=== End Cycle #" << check_cycle << " ===" << std::endl;
-        
-        // Sleep until next check cycle
-        std::this_thread::sleep_for(std::chrono::seconds(10));
+    }
+    
+    for (size_t i = 0; i < pools_.size(); ++i) {
+        if (!pool_configured[i]) {
+            pools_[i].servers.clear();
+            pool_backends_[i].clear();
+        }
+    }
+    for (size_t i = 0; i < backend_server_.size(); ++i) {
+        if (configured[i] || backend_probe_[i] == NO_PROBE) {
+            continue;
+        }
+        prober_.removeProbe(backend_probe_[i]);
+        backend_probe_[i] = NO_PROBE;
+        backend_health_[i] = {false, 0, 0, 0.0, "Removed"};
+        LOG_INFO("Pool: %s - Server: %s - removed from configuration", pools_[backend_pool_[i]].name.c_str(),
+                 backend_server_[i].ip.c_str());
     }
 }
 
-// Public method implementations
-HealthChecker::HealthChecker(const std::vector<ServerPool>& pools) : pools_(pools), gen_(rd_()) {
-    // Initialize all pools as unhealthy until first check
-    for (const auto& pool : pools_) {
-        pool_health_[pool.name] = {false, 0, 0, 0.0, "Initializing"};
+void HealthChecker::applyPendingReloads() {
+    std::vector<PendingReload> pending;
+    {
+        std::lock_guard<std::mutex> lock(reload_mutex_);
+        pending.swap(pending_reloads_);
+    }
+    for (auto& reload : pending) {
+        applyPools(reload.pools);
+        publishSnapshot();
+        reload.done.set_value();
+    }
+}
+
+void HealthChecker::publishSnapshot() {
+    auto snapshot = std::make_shared<HealthSnapshot>();
+    snapshot->generation = generation_.load(std::memory_order_relaxed) + 1;
+    snapshot->status = backend_health_;
+    snapshot->healthy.reserve(backend_health_.size());
+    snapshot->response_time_ms.reserve(backend_health_.size());
+    snapshot->pool_healthy.assign(pools_.size(), false);
+    for (size_t i = 0; i < backend_health_.size(); ++i) {
+        const auto& status = backend_health_[i];
+        snapshot->healthy.push_back(status.is_healthy);
+        snapshot->response_time_ms.push_back(status.response_time_ms);
+        if (status.is_healthy) {
+            snapshot->pool_healthy[backend_pool_[i]] = true;
+        }
     }
     
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    // Store the snapshot before the generation, so that a reader seeing the
+    // new generation always loads a snapshot at least that recent
+    std::shared_ptr<const HealthSnapshot> published(std::move(snapshot));
+    std::atomic_store(&snapshot_, published);
+    generation_.fetch_add(1, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    for (const auto& listener : listeners_) {
+        listener.second(*published);
+    }
+}
+
+size_t HealthChecker::addSnapshotListener(SnapshotListener listener) {
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    const size_t listener_id = next_listener_id_++;
+    listeners_.emplace_back(listener_id, std::move(listener));
+    return listener_id;
+}
+
+void HealthChecker::removeSnapshotListener(size_t listener_id) {
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    listeners_.erase(std::remove_if(listeners_.begin(), listeners_.end(),
+                                    [listener_id](const auto& listener) { return listener.first == listener_id; }),
+                     listeners_.end());
+}
+
+// Public method implementations
+HealthChecker::HealthChecker(const std::vector<ServerPool>& pools, const GlobalSettings& settings)
+    : settings_(settings), gen_(rd_()),
+      prober_(std::chrono::milliseconds(settings.health_check_timeout_ms)) {
+    // All backends start unhealthy until their first check
+    applyPools(pools);
+    publishSnapshot();
 }
 
 HealthChecker::~HealthChecker() {
     stop();
-    curl_global_cleanup();
 }
 
 void HealthChecker::start() {
+    LOG_INFO("Health checker started monitoring %zu servers in %zu pools", backend_health_.size(), pools_.size());
     running_ = true;
     health_check_thread_ = std::thread(&HealthChecker::healthCheckLoop, this);
-    std::cout << "Health checker started monitoring " << pools_.size() << " pools" << std::endl;
+}
+
+void HealthChecker::reload(const std::vector<ServerPool>& pools) {
+    if (!running_) {
+        applyPools(pools);
+        publishSnapshot();
+        return;
+    }
+    
+    // The prober and the working state belong to the health check thread
+    std::future<void> applied;
+    {
+        std::lock_guard<std::mutex> lock(reload_mutex_);
+        pending_reloads_.push_back({pools, std::promise<void>()});
+        applied = pending_reloads_.back().done.get_future();
+    }
+    prober_.wakeup();
+    applied.wait();
 }
 
 void HealthChecker::stop() {
     running_ = false;
+    prober_.wakeup();
     if (health_check_thread_.joinable()) {
         health_check_thread_.join();
     }
 }
 
 bool HealthChecker::isPoolHealthy(const std::string& pool_name) {
-    auto it = pool_health_.find(pool_name);
-    if (it != pool_health_.end()) {
-        return it->second.is_healthy;
+    std::lock_guard<std::mutex> lock(layout_mutex_);
+    auto it = pool_index_.find(pool_name);
+    if (it != pool_index_.end()) {
+        return getSnapshot()->isPoolHealthy(it->second);
     }
     return false;
 }
 
+int HealthChecker::getPoolIndex(const std::string& pool_name) const {
+    std::lock_guard<std::mutex> lock(layout_mutex_);
+    auto it = pool_index_.find(pool_name);
+    return it != pool_index_.end() ? static_cast<int>(it->second) : -1;
+}
+
+int HealthChecker::getBackendIndex(const std::string& pool_name, size_t server_index) const {
+    std::lock_guard<std::mutex> lock(layout_mutex_);
+    auto it = pool_index_.find(pool_name);
+    if (it == pool_index_.end() || server_index >= pool_backends_[it->second].size()) {
+        return -1;
+    }
+    return static_cast<int>(pool_backends_[it->second][server_index]);
+}
+
 std::vector<std::string> HealthChecker::getHealthyPools() {
+    auto snapshot = getSnapshot();
+    std::lock_guard<std::mutex> lock(layout_mutex_);
     std::vector<std::string> healthy_pools;
-    for (const auto& [pool_name, status] : pool_health_) {
-        if (status.is_healthy) {
-            healthy_pools.push_back(pool_name);
+    for (size_t i = 0; i < pools_.size(); ++i) {
+        if (snapshot->isPoolHealthy(i)) {
+            healthy_pools.push_back(pools_[i].name);
         }
     }
     return healthy_pools;
 }
 
 HealthStatus HealthChecker::getPoolStatus(const std::string& pool_name) {
-    auto it = pool_health_.find(pool_name);
-    if (it != pool_health_.end()) {
-        return it->second;
+    auto snapshot = getSnapshot();
+    std::lock_guard<std::mutex> lock(layout_mutex_);
+    auto it = pool_index_.find(pool_name);
+    if (it == pool_index_.end()) {
+        return {false, 0, 0, 0.0, "Unknown pool"};
+    }
+    
+    // Healthy if any member is, counters and RTT from the best member
+    HealthStatus aggregate{false, 0, 0, 0.0, "No servers"};
+    size_t healthy_members = 0;
+    for (size_t backend_idx : pool_backends_[it->second]) {
+        // A backend added by a reload still in progress is not in this snapshot yet
+        if (backend_idx >= snapshot->status.size()) {
+            continue;
+        }
+        const auto& status = snapshot->status[backend_idx];
+        aggregate.last_check_timestamp = std::max(aggregate.last_check_timestamp, status.last_check_timestamp);
+        if (status.is_healthy) {
+            healthy_members++;
+            if (!aggregate.is_healthy || status.response_time_ms < aggregate.response_time_ms) {
+                aggregate.response_time_ms = status.response_time_ms;
+            }
+            aggregate.is_healthy = true;
+            aggregate.last_error = "OK";
+        } else if (!aggregate.is_healthy) {
+            aggregate.consecutive_failures = std::max(aggregate.consecutive_failures, status.consecutive_failures);
+            aggregate.last_error = status.last_error;
+        }
     }
-    return {false, 0, 0, 0.0, "Unknown pool"};
+    if (aggregate.is_healthy) {
+        aggregate.consecutive_failures = 0;
+    }
+    return aggregate;
 }
 
 void HealthChecker::printHealthSummary() {
     std::cout << "\n SYSTEM HEALTH SUMMARY" << std::endl;
     std::cout << "========================" << std::endl;
     
+    auto snapshot = getSnapshot();
+    std::lock_guard<std::mutex> lock(layout_mutex_);
     int healthy_count = 0;
-    for (const auto& [pool_name, status] : pool_health_) {
-        std::string indicator = status.is_healthy ? "✅" : "❌";
-        std::cout << indicator << " " << pool_name 
-                  << " - Failures: " << status.consecutive_failures;
-        if (!status.is_healthy) {
-            std::cout << " - " << status.last_error;
-        }
-        std::cout << std::endl;
+    int pool_count = 0;
+    for (size_t pool_idx = 0; pool_idx < pools_.size(); ++pool_idx) {
+        const auto& pool = pools_[pool_idx];
+        // Removed by a reload
+        if (pool.servers.empty()) {
+            continue;
+        }
+        pool_count++;
+        const bool pool_healthy = snapshot->isPoolHealthy(pool_idx);
+        std::cout << (pool_healthy ? "✅" : "❌") << " " << pool.name << std::endl;
         
-        if (status.is_healthy) healthy_count++;
+        for (size_t i = 0; i < pool.servers.size(); ++i) {
+            const size_t backend_idx = pool_backends_[pool_idx][i];
+            if (backend_idx >= snapshot->status.size()) {
+                continue;
+            }
+            const auto& status = snapshot->status[backend_idx];
+            std::string indicator = status.is_healthy ? "✅" : "❌";
+            std::cout << "   " << indicator << " " << pool.servers[i].ip
+                      << " - Failures: " << status.consecutive_failures;
+            if (status.is_healthy) {
+                std::cout << " - RTT: " << status.response_time_ms << "ms";
+            } else {
+                std::cout << " - " << status.last_error;
+            }
+            std::cout << std::endl;
+        }
+        
+        if (pool_healthy) healthy_count++;
     }
     
     std::cout << "========================" << std::endl;
-    std::cout << "Healthy: " << healthy_count << "/" << pool_health_.size() 
+    std::cout << "Healthy: " << healthy_count << "/" << pool_count 
               << " pools" << std::endl;
-}
\ No newline at end of file
+}
+size_t HealthChecker::restoreState(const WarmState& state) {
+    std::unordered_map<std::string, const WarmState::Backend*> saved;
+    for (const auto& backend : state.backends) {
+        saved.emplace(backend.key, &backend);
+    }
+
+    size_t restored = 0;
+    {
+        std::lock_guard<std::mutex> lock(layout_mutex_);
+        for (size_t pool_idx = 0; pool_idx < pools_.size(); ++pool_idx) {
+            for (size_t backend_idx : pool_backends_[pool_idx]) {
+                auto it = saved.find(pools_[pool_idx].name + '/' + backend_server_[backend_idx].key());
+                auto& status = backend_health_[backend_idx];
+                // Checked already, what it found is more recent than the file. Or listed twice.
+                if (it == saved.end() || status.last_check_timestamp != 0 || status.last_error == "Restored") {
+                    continue;
+                }
+                // last_check_timestamp stays 0: the first probe counts as the first check
+                status = {it->second->healthy, 0, 0, it->second->healthy ? it->second->response_time_ms : 0.0,
+                          "Restored"};
+                restored++;
+            }
+        }
+    }
+    if (restored > 0) {
+        publishSnapshot();
+    }
+    LOG_INFO("Restored the health of %zu of %zu backends", restored, backend_health_.size());
+    return restored;
+}
+
+void HealthChecker::exportState(WarmState& state) const {
+    auto snapshot = getSnapshot();
+    std::lock_guard<std::mutex> lock(layout_mutex_);
+    for (size_t pool_idx = 0; pool_idx < pools_.size(); ++pool_idx) {
+        for (size_t backend_idx : pool_backends_[pool_idx]) {
+            if (backend_idx >= snapshot->status.size()) {
+                continue;
+            }
+            const auto& status = snapshot->status[backend_idx];
+            state.backends.push_back({pools_[pool_idx].name + '/' + backend_server_[backend_idx].key(),
+                                      status.is_healthy, status.response_time_ms});
+        }
+    }
+}
@@ -5,9 +5,14 @@
 #include <vector>
 #include <unordered_map>
 #include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <random>
 #include "config_loader.h"
+#include "health_prober.h"
 
 #ifndef HEALTH_CHECKER_STATUS
 #define HEALTH_CHECKER_STATUS
@@ -16,37 +21,135 @@ struct HealthStatus {
     bool is_healthy;
     int consecutive_failures;
     long last_check_timestamp;
-    double response_time_ms;
+    double response_time_ms;   // EWMA of the probe round-trip time
     std::string last_error;
+    int consecutive_successes = 0;
 };
 
 #endif // HEALTH_CHECKER_STATUS
 
+class WarmState;
+
+/**
+ * Immutable health state of every backend, indexed by backend position: the
+ * servers of all pools flattened in configuration order (see getBackendIndex()),
+ * with backends added by a reload appended and removed ones left in place.
+ * A new snapshot is published whenever probes complete and never modified
+ * afterwards, so readers need no locking.
+ */
+struct HealthSnapshot {
+    uint64_t generation{0};
+    std::vector<bool> healthy;              // one bit per backend
+    std::vector<double> response_time_ms;   // per backend, 0 when unknown
+    std::vector<HealthStatus> status;       // full status, for reporting
+    std::vector<bool> pool_healthy;         // pool has at least one healthy member
+
+    bool isHealthy(size_t backend_index) const {
+        return backend_index < healthy.size() && healthy[backend_index];
+    }
+    bool isPoolHealthy(size_t pool_index) const {
+        return pool_index < pool_healthy.size() && pool_healthy[pool_index];
+    }
+};
+
 class HealthChecker {
+public:
+    // Called on the health check thread after each new snapshot is published
+    using SnapshotListener = std::function<void(const HealthSnapshot&)>;
+
 private:
-    std::unordered_map<std::string, HealthStatus> pool_health_;
-    std::vector<ServerPool> pools_;
+    static constexpr size_t NO_PROBE = static_cast<size_t>(-1);
+
+    /**
+     * A new configuration waiting for the health check thread, reload() blocks on done
+     */
+    struct PendingReload {
+        std::vector<ServerPool> pools;
+        std::promise<void> done;
+    };
+
+    // Working state, only touched by the health check thread
+    std::vector<HealthStatus> backend_health_;
+    GlobalSettings settings_;
+    // Backend layout. Only changed on the health check thread, under layout_mutex_,
+    // which other threads take to read it. Backend and pool indices are stable:
+    // a removed backend keeps its index, unhealthy, and gets it back if re-added
+    // with the same IP and port.
+    mutable std::mutex layout_mutex_;
+    std::vector<ServerPool> pools_;                     // every pool seen, removed ones have no servers
+    std::unordered_map<std::string, size_t> pool_index_;
+    std::vector<std::vector<size_t>> pool_backends_;    // backend index of each server of a pool
+    std::vector<size_t> backend_pool_;                  // backend index -> pool index
+    std::vector<ServerConfig> backend_server_;          // backend index -> server
     std::atomic<bool> running_{false};
+    // Published with std::atomic_store(), generation_ is bumped after each publication
+    std::shared_ptr<const HealthSnapshot> snapshot_;
+    std::atomic<uint64_t> generation_{0};
+    // Held while listeners run, so removeSnapshotListener() waits for a call in progress
+    std::mutex listeners_mutex_;
+    std::vector<std::pair<size_t, SnapshotListener>> listeners_;
+    size_t next_listener_id_{0};
+    std::mutex reload_mutex_;
+    std::vector<PendingReload> pending_reloads_;
     std::thread health_check_thread_;
     std::random_device rd_;
     std::mt19937 gen_;
+    // One probe per configured backend, driven by the health check thread
+    HealthProber prober_;
+    std::vector<size_t> probe_backend_;   // probe id -> backend index
+    std::vector<size_t> backend_probe_;   // backend index -> probe id, NO_PROBE once removed
     
     bool isSimulatedDownServer(const std::string& endpoint);
     bool shouldSimulateRandomFailure();
-    bool checkHttpHealth(const std::string& endpoint);
-    bool checkDnsHealth(const std::string& server_ip);
+    void addBackendProbe(size_t backend_index, const ServerPool& pool, const ServerConfig& server);
+    void applyProbeResult(const ProbeResult& result, long timestamp);
+    void applyPools(const std::vector<ServerPool>& pools);
+    void applyPendingReloads();
     void healthCheckLoop();
+    void publishSnapshot();
 
 public:
-    HealthChecker(const std::vector<ServerPool>& pools);
+    HealthChecker(const std::vector<ServerPool>& pools, const GlobalSettings& settings = GlobalSettings());
     ~HealthChecker();
     
     void start();
     void stop();
+    /**
+     * Switch to a new set of pools. Backends kept from the current set keep their
+     * index and health state, removed ones turn unhealthy and stop being probed,
+     * new ones start out unhealthy until their first check. Runs on the health
+     * check thread and returns once the resulting snapshot is published. Must not
+     * be called concurrently with stop().
+     */
+    void reload(const std::vector<ServerPool>& pools);
+    // A pool is healthy while at least one of its servers is
     bool isPoolHealthy(const std::string& pool_name);
+    // Position of the pool in HealthSnapshot::pool_healthy, -1 if unknown
+    int getPoolIndex(const std::string& pool_name) const;
+    // Position of the server_index-th server of the pool in snapshots, -1 if unknown
+    int getBackendIndex(const std::string& pool_name, size_t server_index) const;
+    // Latest published snapshot, never null
+    std::shared_ptr<const HealthSnapshot> getSnapshot() const { return std::atomic_load(&snapshot_); }
+    // Generation of the latest snapshot, lets callers cache derived state and
+    // only call getSnapshot() when it changes
+    uint64_t getGeneration() const { return generation_.load(std::memory_order_acquire); }
+    // Lets callers rebuild derived state off their own hot path, returns an id for removal.
+    // Listeners must not add or remove listeners themselves.
+    size_t addSnapshotListener(SnapshotListener listener);
+    void removeSnapshotListener(size_t listener_id);
     std::vector<std::string> getHealthyPools();
+    // Aggregated over the members of the pool
     HealthStatus getPoolStatus(const std::string& pool_name);
     void printHealthSummary();
+    /**
+     * Take the health a previous process saved, before start(). Backends found
+     * in state start out with its health and RTT instead of unhealthy, and their
+     * first check decides again right away. Publishes a snapshot if any matched,
+     * returns how many did.
+     */
+    size_t restoreState(const WarmState& state);
+    // Health of every configured backend as of the latest snapshot, appended to state.backends
+    void exportState(WarmState& state) const;
 };
 
 #endif // HEALTH_CHECKER_H
\ No newline at end of file
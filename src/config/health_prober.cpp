@@ -0,0 +1,371 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "health_prober.h"
+
+using Clock = TimerWheel::Clock;
+
+static constexpr size_t DNS_HEADER_SIZE = 12;
+
+/**
+ * Encode a single-question query for qname/qtype IN, with a zero ID
+ */
+static std::vector<uint8_t> buildDnsQuery(const std::string& qname, uint16_t qtype) {
+    std::vector<uint8_t> query(DNS_HEADER_SIZE, 0);
+    query[5] = 1;   // qdcount
+
+    size_t start = 0;
+    while (start < qname.size()) {
+        size_t end = qname.find('.', start);
+        if (end == std::string::npos) {
+            end = qname.size();
+        }
+        const size_t label_length = end - start;
+        if (label_length > 63) {
+            throw std::runtime_error("Invalid DNS probe name: " + qname);
+        }
+        if (label_length > 0) {
+            query.push_back(static_cast<uint8_t>(label_length));
+            query.insert(query.end(), qname.begin() + start, qname.begin() + end);
+        }
+        start = end + 1;
+    }
+    query.push_back(0);
+
+    query.push_back(static_cast<uint8_t>(qtype >> 8));
+    query.push_back(static_cast<uint8_t>(qtype & 0xFF));
+    query.push_back(0);
+    query.push_back(1);   // IN
+    return query;
+}
+
+TimerWheel::TimerWheel(size_t slots, std::chrono::milliseconds tick)
+    : slots_(slots), tick_(tick), start_(Clock::now()) {
+}
+
+void TimerWheel::schedule(size_t id, Clock::time_point when) {
+    uint64_t tick = 0;
+    if (when > start_) {
+        // Round up, a timer never fires early
+        tick = static_cast<uint64_t>((when - start_ + tick_ - std::chrono::nanoseconds(1)) / tick_);
+    }
+    tick = std::max(tick, current_tick_);
+    slots_[tick % slots_.size()].push_back({id, tick});
+}
+
+void TimerWheel::advance(Clock::time_point now, std::vector<size_t>& due) {
+    if (now < start_) {
+        return;
+    }
+    const uint64_t now_tick = static_cast<uint64_t>((now - start_) / tick_);
+
+    // Visit each slot at most once per call, even after a long stall
+    const uint64_t last = std::min(now_tick, current_tick_ + slots_.size() - 1);
+    for (; current_tick_ <= last; ++current_tick_) {
+        auto& slot = slots_[current_tick_ % slots_.size()];
+        auto kept = slot.begin();
+        for (auto& entry : slot) {
+            if (entry.tick <= now_tick) {
+                due.push_back(entry.id);
+            } else {
+                *kept++ = entry;
+            }
+        }
+        slot.erase(kept, slot.end());
+    }
+    current_tick_ = std::max(current_tick_, now_tick);
+}
+
+HealthProber::HealthProber(std::chrono::milliseconds timeout)
+    : multi_((curl_global_init(CURL_GLOBAL_DEFAULT), curl_multi_init())), timeout_(timeout),
+      wheel_(WHEEL_SLOTS, WHEEL_TICK) {
+
+    if (!multi_) {
+        throw std::runtime_error("curl_multi_init() failed");
+    }
+    std::random_device rd;
+    next_query_id_ = static_cast<uint16_t>(rd());
+}
+
+HealthProber::~HealthProber() {
+    for (auto& probe : probes_) {
+        if (probe.easy) {
+            if (probe.in_flight) {
+                curl_multi_remove_handle(multi_, probe.easy);
+            }
+            curl_easy_cleanup(probe.easy);
+        }
+        if (probe.fd >= 0) {
+            close(probe.fd);
+        }
+    }
+    curl_multi_cleanup(multi_);
+    // curl_global_init() calls are reference counted
+    curl_global_cleanup();
+}
+
+size_t HealthProber::addHttpProbe(const std::string& url, std::chrono::milliseconds interval) {
+    Probe probe;
+    probe.kind = ProbeKind::Http;
+    probe.target = url;
+    probe.interval = interval;
+
+    probe.easy = curl_easy_init();
+    if (!probe.easy) {
+        throw std::runtime_error("curl_easy_init() failed");
+    }
+    const size_t probe_id = probes_.size();
+    curl_easy_setopt(probe.easy, CURLOPT_URL, probe.target.c_str());
+    curl_easy_setopt(probe.easy, CURLOPT_TIMEOUT_MS, static_cast<long>(timeout_.count()));
+    curl_easy_setopt(probe.easy, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(probe.easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(probe.easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(probe.easy, CURLOPT_PRIVATE, reinterpret_cast<void*>(probe_id));
+
+    probes_.push_back(std::move(probe));
+    wheel_.schedule(probe_id, Clock::now());
+    return probe_id;
+}
+
+size_t HealthProber::addDnsProbe(const std::string& server_ip, uint16_t port, std::chrono::milliseconds interval,
+                                 const std::string& qname, uint16_t qtype) {
+    Probe probe;
+    probe.kind = ProbeKind::Dns;
+    probe.target = server_ip;
+    probe.interval = interval;
+    probe.query = buildDnsQuery(qname, qtype);
+    probe.address.sin_family = AF_INET;
+    probe.address.sin_port = htons(port);
+    if (inet_pton(AF_INET, server_ip.c_str(), &probe.address.sin_addr) != 1) {
+        throw std::runtime_error("Invalid DNS probe address: " + server_ip);
+    }
+
+    const size_t probe_id = probes_.size();
+    probes_.push_back(std::move(probe));
+    wheel_.schedule(probe_id, Clock::now());
+    return probe_id;
+}
+
+void HealthProber::removeProbe(size_t probe_id) {
+    Probe& probe = probes_[probe_id];
+    if (probe.removed) {
+        return;
+    }
+    if (probe.in_flight && probe.kind == ProbeKind::Dns) {
+        dns_in_flight_.erase(std::remove(dns_in_flight_.begin(), dns_in_flight_.end(), probe_id),
+                             dns_in_flight_.end());
+    }
+    if (probe.easy) {
+        if (probe.in_flight) {
+            curl_multi_remove_handle(multi_, probe.easy);
+        }
+        curl_easy_cleanup(probe.easy);
+        probe.easy = nullptr;
+    }
+    if (probe.fd >= 0) {
+        close(probe.fd);
+        probe.fd = -1;
+    }
+    probe.in_flight = false;
+    // Still on the timer wheel, startProbe() drops it when it comes up
+    probe.removed = true;
+}
+
+void HealthProber::wakeup() {
+    curl_multi_wakeup(multi_);
+}
+
+void HealthProber::poll(std::chrono::milliseconds max_wait, std::vector<ProbeResult>& results) {
+    auto now = Clock::now();
+    due_.clear();
+    wheel_.advance(now, due_);
+    for (size_t probe_id : due_) {
+        startProbe(probe_id, now, results);
+    }
+
+    // Sleep until something happens, the next wheel tick or the first DNS deadline
+    auto wake_at = std::min(now + max_wait, wheel_.nextTick());
+    wait_fds_.clear();
+    for (size_t probe_id : dns_in_flight_) {
+        const auto& probe = probes_[probe_id];
+        wait_fds_.push_back({probe.fd, CURL_WAIT_POLLIN, 0});
+        wake_at = std::min(wake_at, probe.deadline);
+    }
+    auto wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(wake_at - now).count();
+    curl_multi_poll(multi_, wait_fds_.data(), static_cast<unsigned int>(wait_fds_.size()),
+                    static_cast<int>(std::max<long long>(0, wait_ms)), nullptr);
+
+    int running = 0;
+    curl_multi_perform(multi_, &running);
+
+    now = Clock::now();
+    collectHttpResults(now, results);
+    collectDnsResults(now, results);
+}
+
+void HealthProber::startProbe(size_t probe_id, Clock::time_point now, std::vector<ProbeResult>& results) {
+    Probe& probe = probes_[probe_id];
+    if (probe.in_flight || probe.removed) {
+        return;
+    }
+    probe.started = now;
+    probe.deadline = now + timeout_;
+
+    if (probe.kind == ProbeKind::Http) {
+        // Re-adding a finished easy handle restarts the transfer, the multi
+        // handle's connection cache lets it reuse the previous connection
+        if (curl_multi_add_handle(multi_, probe.easy) != CURLM_OK) {
+            finishProbe(probe_id, now, false, "curl_multi_add_handle failed", results);
+            return;
+        }
+        probe.in_flight = true;
+        return;
+    }
+
+    if (!sendDnsQuery(probe)) {
+        finishProbe(probe_id, now, false, std::string("DNS probe send failed: ") + strerror(errno), results);
+        return;
+    }
+    probe.in_flight = true;
+    dns_in_flight_.push_back(probe_id);
+}
+
+bool HealthProber::sendDnsQuery(Probe& probe) {
+    if (probe.fd < 0) {
+        probe.fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (probe.fd < 0) {
+            return false;
+        }
+        // A connected socket only receives from the backend, and gets ICMP errors back
+        if (connect(probe.fd, reinterpret_cast<const sockaddr*>(&probe.address), sizeof(probe.address)) != 0) {
+            close(probe.fd);
+            probe.fd = -1;
+            return false;
+        }
+    }
+
+    // Drop late answers to a previous probe
+    uint8_t discard[512];
+    while (recv(probe.fd, discard, sizeof(discard), 0) >= 0) {
+    }
+
+    probe.query_id = next_query_id_++;
+    probe.query[0] = static_cast<uint8_t>(probe.query_id >> 8);
+    probe.query[1] = static_cast<uint8_t>(probe.query_id & 0xFF);
+    return send(probe.fd, probe.query.data(), probe.query.size(), 0) == static_cast<ssize_t>(probe.query.size());
+}
+
+bool HealthProber::validateDnsResponse(const Probe& probe, const uint8_t* response, size_t length,
+                                       std::string& error) const {
+    // Stray or spoofed packets are ignored rather than failing the probe
+    if (length < probe.query.size()) {
+        return false;
+    }
+    const uint16_t id = static_cast<uint16_t>((response[0] << 8) | response[1]);
+    if (id != probe.query_id || !(response[2] & 0x80)) {
+        return false;
+    }
+    const uint16_t qdcount = static_cast<uint16_t>((response[4] << 8) | response[5]);
+    if (qdcount != 1) {
+        return false;
+    }
+    // The question must be ours, names compare case-insensitively (0x20 randomisation)
+    for (size_t i = DNS_HEADER_SIZE; i < probe.query.size(); ++i) {
+        if (std::tolower(response[i]) != std::tolower(probe.query[i])) {
+            return false;
+        }
+    }
+
+    const uint8_t rcode = response[3] & 0x0F;
+    if (rcode != 0 && rcode != 3) {
+        // SERVFAIL, REFUSED... the backend is up but cannot serve
+        error = "DNS probe failed: rcode " + std::to_string(rcode);
+    }
+    return true;
+}
+
+void HealthProber::collectHttpResults(Clock::time_point now, std::vector<ProbeResult>& results) {
+    int remaining = 0;
+    while (CURLMsg* msg = curl_multi_info_read(multi_, &remaining)) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        CURL* easy = msg->easy_handle;
+        CURLcode res = msg->data.result;
+
+        void* priv = nullptr;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, &priv);
+        long http_code = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+        curl_off_t total_usec = 0;
+        curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME_T, &total_usec);
+        curl_multi_remove_handle(multi_, easy);
+
+        const size_t probe_id = reinterpret_cast<size_t>(priv);
+        if (res != CURLE_OK) {
+            finishProbe(probe_id, now, false, std::string("HTTP health check failed: ") + curl_easy_strerror(res), results);
+        } else if (http_code != 200) {
+            finishProbe(probe_id, now, false, "HTTP health check failed: status " + std::to_string(http_code), results);
+        } else {
+            finishProbe(probe_id, now, true, "OK", results, static_cast<double>(total_usec) / 1000.0);
+        }
+    }
+}
+
+void HealthProber::collectDnsResults(Clock::time_point now, std::vector<ProbeResult>& results) {
+    for (size_t i = 0; i < dns_in_flight_.size();) {
+        const size_t probe_id = dns_in_flight_[i];
+        Probe& probe = probes_[probe_id];
+
+        bool done = false;
+        bool success = false;
+        double rtt_ms = 0.0;
+        std::string error;
+        uint8_t response[512];
+        for (;;) {
+            ssize_t got = recv(probe.fd, response, sizeof(response), 0);
+            if (got < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    done = true;
+                    error = std::string("DNS probe failed: ") + strerror(errno);
+                }
+                break;
+            }
+            if (validateDnsResponse(probe, response, static_cast<size_t>(got), error)) {
+                rtt_ms = std::chrono::duration<double, std::milli>(Clock::now() - probe.started).count();
+                done = true;
+                success = error.empty();
+                break;
+            }
+        }
+        if (!done && now >= probe.deadline) {
+            done = true;
+            error = "DNS probe timed out";
+        }
+
+        if (done) {
+            dns_in_flight_[i] = dns_in_flight_.back();
+            dns_in_flight_.pop_back();
+            finishProbe(probe_id, now, success, success ? "OK" : error, results, rtt_ms);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void HealthProber::finishProbe(size_t probe_id, Clock::time_point now, bool success,
+                               std::string error, std::vector<ProbeResult>& results, double rtt_ms) {
+    Probe& probe = probes_[probe_id];
+    probe.in_flight = false;
+
+    results.push_back({probe_id, success, success ? rtt_ms : 0.0, std::move(error)});
+
+    // Keep the cadence of the probe, without bunching up after a slow one
+    wheel_.schedule(probe_id, std::max(now, probe.started + probe.interval));
+}
@@ -0,0 +1,143 @@
+#ifndef HEALTH_PROBER_H
+#define HEALTH_PROBER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <curl/curl.h>
+#include <netinet/in.h>
+
+/**
+ * Hashed timer wheel: timers are dropped into the slot of the tick they expire
+ * in, so scheduling is O(1) and each tick only looks at one slot. Timers further
+ * away than one revolution stay in their slot until their round comes up.
+ */
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    TimerWheel(size_t slots, std::chrono::milliseconds tick);
+
+    void schedule(size_t id, Clock::time_point when);
+
+    /**
+     * Append the ids of all timers that expired up to now to due
+     */
+    void advance(Clock::time_point now, std::vector<size_t>& due);
+
+    Clock::time_point nextTick() const { return start_ + tick_ * current_tick_; }
+
+private:
+    struct Entry {
+        size_t id;
+        uint64_t tick;
+    };
+
+    std::vector<std::vector<Entry>> slots_;
+    std::chrono::milliseconds tick_;
+    Clock::time_point start_;
+    uint64_t current_tick_{0};
+};
+
+/**
+ * Outcome of one probe. response_time_ms is the measured round-trip time of a
+ * successful probe (query sent to matching response received for DNS, total
+ * transfer time for HTTP).
+ */
+struct ProbeResult {
+    size_t probe_id;
+    bool success;
+    double response_time_ms;
+    std::string error;
+};
+
+/**
+ * Event-driven health prober. HTTP probes run concurrently on one curl multi
+ * handle, DNS probes on non-blocking UDP sockets polled alongside curl's own
+ * descriptors, and every probe is re-armed on a timer wheel according to its
+ * own interval. Easy handles and sockets are created once and reused, so HTTP
+ * probes keep their connections alive between checks.
+ *
+ * Not thread-safe: addHttpProbe(), addDnsProbe(), removeProbe() and poll() must
+ * be called from the same thread. wakeup() may be called from anywhere.
+ */
+class HealthProber {
+public:
+    static constexpr uint16_t QTYPE_A = 1;
+    static constexpr uint16_t QTYPE_SOA = 6;
+
+    explicit HealthProber(std::chrono::milliseconds timeout);
+    ~HealthProber();
+
+    HealthProber(const HealthProber&) = delete;
+    HealthProber& operator=(const HealthProber&) = delete;
+
+    /**
+     * Register a probe, returns its id. The first run is scheduled immediately.
+     */
+    size_t addHttpProbe(const std::string& url, std::chrono::milliseconds interval);
+    // DNS probes send a real qname/qtype query and only count a matching NOERROR
+    // or NXDOMAIN response as healthy
+    size_t addDnsProbe(const std::string& server_ip, uint16_t port, std::chrono::milliseconds interval,
+                       const std::string& qname = ".", uint16_t qtype = QTYPE_SOA);
+
+    /**
+     * Stop a probe for good, an in-flight check is abandoned without a result.
+     * Ids are not reused.
+     */
+    void removeProbe(size_t probe_id);
+
+    const std::string& target(size_t probe_id) const { return probes_[probe_id].target; }
+
+    /**
+     * Start probes that are due, wait up to max_wait for activity and append
+     * the results of finished probes
+     */
+    void poll(std::chrono::milliseconds max_wait, std::vector<ProbeResult>& results);
+
+    /**
+     * Interrupt a poll() in progress
+     */
+    void wakeup();
+
+private:
+    enum class ProbeKind { Http, Dns };
+
+    struct Probe {
+        ProbeKind kind;
+        std::string target;
+        std::chrono::milliseconds interval;
+        CURL* easy{nullptr};
+        int fd{-1};
+        sockaddr_in address{};
+        std::vector<uint8_t> query;      // wire format, the ID is patched in per probe
+        bool in_flight{false};
+        bool removed{false};
+        uint16_t query_id{0};
+        TimerWheel::Clock::time_point started;
+        TimerWheel::Clock::time_point deadline;
+    };
+
+    static constexpr size_t WHEEL_SLOTS = 512;
+    static constexpr std::chrono::milliseconds WHEEL_TICK{100};
+
+    CURLM* multi_;
+    std::chrono::milliseconds timeout_;
+    TimerWheel wheel_;
+    std::vector<Probe> probes_;
+    std::vector<size_t> due_;
+    std::vector<size_t> dns_in_flight_;
+    std::vector<curl_waitfd> wait_fds_;
+    uint16_t next_query_id_;
+
+    void startProbe(size_t probe_id, TimerWheel::Clock::time_point now, std::vector<ProbeResult>& results);
+    bool sendDnsQuery(Probe& probe);
+    bool validateDnsResponse(const Probe& probe, const uint8_t* response, size_t length, std::string& error) const;
+    void collectHttpResults(TimerWheel::Clock::time_point now, std::vector<ProbeResult>& results);
+    void collectDnsResults(TimerWheel::Clock::time_point now, std::vector<ProbeResult>& results);
+    void finishProbe(size_t probe_id, TimerWheel::Clock::time_point now, bool success,
+                     std::string error, std::vector<ProbeResult>& results, double rtt_ms = 0.0);
+};
+
+#endif // HEALTH_PROBER_H
@@ -0,0 +1,327 @@
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "warm_state.h"
+#include "../logging/logger.h"
+
+static constexpr char MAGIC[8] = {'D', 'N', 'S', 'L', 'B', 'W', 'S', '\0'};
+
+// On-disk layout. Offsets and record sizes are stored so that load() checks
+// them instead of trusting the file, every record starts 8-byte aligned.
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    int64_t written_at_ms;
+    uint64_t file_size;
+    uint32_t backend_count;
+    uint32_t backend_record_size;
+    uint32_t server_count;
+    uint32_t server_record_size;
+    uint32_t table_count;
+    uint32_t table_record_size;
+    uint64_t backends_offset;
+    uint64_t servers_offset;
+    uint64_t tables_offset;
+};
+
+struct BackendRecord {
+    char key[WarmState::KEY_SIZE];
+    double response_time_ms;
+    uint8_t healthy;
+    uint8_t padding[23];
+};
+
+struct ServerRecord {
+    char key[WarmState::KEY_SIZE];
+    uint8_t id[16];
+    int32_t weight;
+    uint8_t padding[12];
+};
+
+// Followed by server_count server indices and entry_count entries, all uint32_t,
+// padded to the next record
+struct TableRecord {
+    char pool[WarmState::KEY_SIZE];
+    uint32_t all_pools;
+    uint32_t server_count;
+    uint32_t entry_count;
+    uint32_t padding;
+};
+
+static_assert(std::is_trivially_copyable<FileHeader>::value && sizeof(FileHeader) % 8 == 0, "FileHeader layout");
+static_assert(sizeof(BackendRecord) == 128, "BackendRecord layout");
+static_assert(sizeof(ServerRecord) == 128, "ServerRecord layout");
+static_assert(sizeof(TableRecord) % 8 == 0, "TableRecord layout");
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static uint64_t tableRecordSize(uint64_t server_count, uint64_t entry_count) {
+    const uint64_t arrays = (server_count + entry_count) * sizeof(uint32_t);
+    return sizeof(TableRecord) + ((arrays + 7) & ~uint64_t{7});
+}
+
+static bool fitsKey(const std::string& key) {
+    return !key.empty() && key.size() < WarmState::KEY_SIZE;
+}
+
+static bool hasKey(const char (&key)[WarmState::KEY_SIZE]) {
+    return memchr(key, '\0', WarmState::KEY_SIZE) != nullptr;
+}
+
+// count records of record_size at offset, within size bytes
+static bool fits(uint64_t offset, uint64_t count, uint64_t record_size, uint64_t size) {
+    return offset % 8 == 0 && offset <= size && count <= (size - offset) / record_size;
+}
+
+bool WarmState::save(const std::string& path) {
+    written_at_ms = nowMs();
+
+    // Keys that do not fit a record are left out, and the tables that use them
+    std::vector<size_t> saved_backends;
+    for (size_t i = 0; i < backends.size(); ++i) {
+        if (fitsKey(backends[i].key)) {
+            saved_backends.push_back(i);
+        } else {
+            LOG_WARNING("Warm state: key %s is too long, not saved", backends[i].key.c_str());
+        }
+    }
+    std::vector<int64_t> server_record(servers.size(), -1);
+    std::vector<size_t> saved_servers;
+    for (size_t i = 0; i < servers.size(); ++i) {
+        if (fitsKey(servers[i].key)) {
+            server_record[i] = static_cast<int64_t>(saved_servers.size());
+            saved_servers.push_back(i);
+        }
+    }
+    std::vector<size_t> saved_tables;
+    uint64_t tables_size = 0;
+    for (size_t i = 0; i < maglev_tables.size(); ++i) {
+        const MaglevTable& table = maglev_tables[i];
+        bool complete = table.pool.size() < KEY_SIZE;
+        for (uint32_t server : table.servers) {
+            complete = complete && server < servers.size() && server_record[server] >= 0;
+        }
+        if (complete) {
+            saved_tables.push_back(i);
+            tables_size += tableRecordSize(table.servers.size(), table.entries.size());
+        }
+    }
+
+    FileHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.header_size = sizeof(FileHeader);
+    header.written_at_ms = written_at_ms;
+    header.backend_count = static_cast<uint32_t>(saved_backends.size());
+    header.backend_record_size = sizeof(BackendRecord);
+    header.server_count = static_cast<uint32_t>(saved_servers.size());
+    header.server_record_size = sizeof(ServerRecord);
+    header.table_count = static_cast<uint32_t>(saved_tables.size());
+    header.table_record_size = sizeof(TableRecord);
+    header.backends_offset = sizeof(FileHeader);
+    header.servers_offset = header.backends_offset + saved_backends.size() * sizeof(BackendRecord);
+    header.tables_offset = header.servers_offset + saved_servers.size() * sizeof(ServerRecord);
+    header.file_size = header.tables_offset + tables_size;
+
+    // Next to the target, rename() only replaces it atomically within one file system
+    std::string temp_path = path + ".XXXXXX";
+    const int fd = mkstemp(&temp_path[0]);
+    if (fd < 0) {
+        LOG_ERROR("Cannot create %s: %s", temp_path.c_str(), strerror(errno));
+        return false;
+    }
+    auto fail = [&](const char* what) {
+        LOG_ERROR("Cannot write warm state to %s: %s %s", path.c_str(), what, strerror(errno));
+        close(fd);
+        unlink(temp_path.c_str());
+        return false;
+    };
+    if (ftruncate(fd, static_cast<off_t>(header.file_size)) != 0) {
+        return fail("ftruncate");
+    }
+    void* mapping = mmap(nullptr, header.file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return fail("mmap");
+    }
+
+    // ftruncate() zero-filled the file, padding and key tails stay zero
+    auto* data = static_cast<uint8_t*>(mapping);
+    memcpy(data, &header, sizeof(header));
+    auto* backend_records = reinterpret_cast<BackendRecord*>(data + header.backends_offset);
+    for (size_t i = 0; i < saved_backends.size(); ++i) {
+        const Backend& backend = backends[saved_backends[i]];
+        BackendRecord& record = backend_records[i];
+        memcpy(record.key, backend.key.data(), backend.key.size());
+        record.response_time_ms = backend.response_time_ms;
+        record.healthy = backend.healthy ? 1 : 0;
+    }
+    auto* server_records = reinterpret_cast<ServerRecord*>(data + header.servers_offset);
+    for (size_t i = 0; i < saved_servers.size(); ++i) {
+        const Server& server = servers[saved_servers[i]];
+        ServerRecord& record = server_records[i];
+        memcpy(record.key, server.key.data(), server.key.size());
+        memcpy(record.id, server.id.data, sizeof(record.id));
+        record.weight = server.weight;
+    }
+    uint64_t offset = header.tables_offset;
+    for (size_t index : saved_tables) {
+        const MaglevTable& table = maglev_tables[index];
+        auto* record = reinterpret_cast<TableRecord*>(data + offset);
+        memcpy(record->pool, table.pool.data(), table.pool.size());
+        record->all_pools = table.all_pools ? 1 : 0;
+        record->server_count = static_cast<uint32_t>(table.servers.size());
+        record->entry_count = static_cast<uint32_t>(table.entries.size());
+        auto* values = reinterpret_cast<uint32_t*>(record + 1);
+        for (uint32_t server : table.servers) {
+            *values++ = static_cast<uint32_t>(server_record[server]);
+        }
+        memcpy(values, table.entries.data(), table.entries.size() * sizeof(uint32_t));
+        offset += tableRecordSize(table.servers.size(), table.entries.size());
+    }
+
+    const bool synced = msync(mapping, header.file_size, MS_SYNC) == 0;
+    munmap(mapping, header.file_size);
+    if (!synced) {
+        return fail("msync");
+    }
+    // The size too, before the rename makes the file visible
+    if (fsync(fd) != 0) {
+        return fail("fsync");
+    }
+    close(fd);
+    if (rename(temp_path.c_str(), path.c_str()) != 0) {
+        LOG_ERROR("Cannot rename %s to %s: %s", temp_path.c_str(), path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+    LOG_DEBUG("Warm state saved to %s: %zu backends, %zu servers, %zu Maglev tables", path.c_str(),
+              saved_backends.size(), saved_servers.size(), saved_tables.size());
+    return true;
+}
+
+/**
+ * Read a mapped state file into state, false as soon as something does not add up
+ */
+static bool parseState(const uint8_t* data, uint64_t size, WarmState& state) {
+    if (size < sizeof(FileHeader)) {
+        return false;
+    }
+    FileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != WarmState::VERSION ||
+        header.header_size != sizeof(FileHeader) || header.file_size != size ||
+        header.backend_record_size != sizeof(BackendRecord) || header.server_record_size != sizeof(ServerRecord) ||
+        header.table_record_size != sizeof(TableRecord) ||
+        !fits(header.backends_offset, header.backend_count, sizeof(BackendRecord), size) ||
+        !fits(header.servers_offset, header.server_count, sizeof(ServerRecord), size)) {
+        return false;
+    }
+    state.written_at_ms = header.written_at_ms;
+
+    const auto* backend_records = reinterpret_cast<const BackendRecord*>(data + header.backends_offset);
+    state.backends.reserve(header.backend_count);
+    for (uint32_t i = 0; i < header.backend_count; ++i) {
+        const BackendRecord& record = backend_records[i];
+        if (!hasKey(record.key)) {
+            return false;
+        }
+        state.backends.push_back({record.key, record.healthy != 0, record.response_time_ms});
+    }
+
+    const auto* server_records = reinterpret_cast<const ServerRecord*>(data + header.servers_offset);
+    state.servers.reserve(header.server_count);
+    for (uint32_t i = 0; i < header.server_count; ++i) {
+        const ServerRecord& record = server_records[i];
+        if (!hasKey(record.key)) {
+            return false;
+        }
+        WarmState::Server server;
+        server.key = record.key;
+        memcpy(server.id.data, record.id, sizeof(record.id));
+        server.weight = record.weight;
+        state.servers.push_back(std::move(server));
+    }
+
+    uint64_t offset = header.tables_offset;
+    state.maglev_tables.reserve(header.table_count);
+    for (uint32_t i = 0; i < header.table_count; ++i) {
+        if (!fits(offset, 1, sizeof(TableRecord), size)) {
+            return false;
+        }
+        const auto* record = reinterpret_cast<const TableRecord*>(data + offset);
+        const uint64_t record_size = tableRecordSize(record->server_count, record->entry_count);
+        if (!hasKey(record->pool) || record_size > size - offset) {
+            return false;
+        }
+        WarmState::MaglevTable table;
+        table.pool = record->pool;
+        table.all_pools = record->all_pools != 0;
+        const auto* values = reinterpret_cast<const uint32_t*>(record + 1);
+        table.servers.assign(values, values + record->server_count);
+        table.entries.assign(values + record->server_count, values + record->server_count + record->entry_count);
+        for (uint32_t server : table.servers) {
+            if (server >= state.servers.size()) {
+                return false;
+            }
+        }
+        for (uint32_t entry : table.entries) {
+            if (entry == 0 || entry > table.servers.size()) {
+                return false;
+            }
+        }
+        state.maglev_tables.push_back(std::move(table));
+        offset += record_size;
+    }
+    return offset == size;
+}
+
+bool WarmState::load(const std::string& path) {
+    *this = WarmState();
+
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            LOG_INFO("No warm state in %s, starting cold", path.c_str());
+        } else {
+            LOG_WARNING("Cannot open warm state %s: %s", path.c_str(), strerror(errno));
+        }
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+        close(fd);
+        LOG_WARNING("Ignoring warm state %s: too short", path.c_str());
+        return false;
+    }
+    const uint64_t size = static_cast<uint64_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping outlives the descriptor
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        LOG_WARNING("Cannot map warm state %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    const bool valid = parseState(static_cast<const uint8_t*>(mapping), size, *this);
+    munmap(mapping, size);
+    if (!valid) {
+        *this = WarmState();
+        LOG_WARNING("Ignoring warm state %s: corrupt, or not a version %u state file", path.c_str(), VERSION);
+        return false;
+    }
+    return true;
+}
+
+int64_t WarmState::ageMs() const {
+    return nowMs() - written_at_ms;
+}
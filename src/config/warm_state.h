@@ -0,0 +1,82 @@
+#ifndef WARM_STATE_H
+#define WARM_STATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/uuid/uuid.hpp>
+
+/**
+ * What a restarted process needs to serve right away instead of waiting for
+ * its first round of health checks: the health and probe RTT of every
+ * backend, the identity the hashed policies derive their rings and Maglev
+ * permutations from, and the Maglev tables themselves.
+ *
+ * The file is a fixed header followed by fixed-size, naturally aligned
+ * records, so that load() can map it and read it in place. It is written to
+ * a temporary file renamed over the old one, a reader never sees half of
+ * it. The layout is that of the host, the file is not meant to move between
+ * machines: VERSION changes with it, and a file of another version, or of
+ * the wrong size, is ignored as a whole.
+ */
+class WarmState {
+public:
+    static constexpr uint32_t VERSION = 1;
+    // Longest pool/ip:port key stored plus its terminating NUL, longer ones are skipped
+    static constexpr size_t KEY_SIZE = 96;
+
+    /**
+     * Health of one backend, keyed like HealthChecker keys them
+     */
+    struct Backend {
+        std::string key;                     // pool/ip:port
+        bool healthy{false};
+        double response_time_ms{0.0};        // EWMA of the probe RTT
+    };
+
+    /**
+     * Identity of one backend of the load balancer. The consistent hash ring
+     * and the Maglev permutation follow from id and weight.
+     */
+    struct Server {
+        std::string key;                     // pool/ip:port
+        boost::uuids::uuid id{};
+        int weight{1};
+    };
+
+    /**
+     * The Maglev table of one pool view, or of the view of all pools
+     */
+    struct MaglevTable {
+        std::string pool;                    // empty with all_pools
+        bool all_pools{false};
+        std::vector<uint32_t> servers;       // index in servers of each position, 1-based positions
+        std::vector<uint32_t> entries;       // position of the table slots
+    };
+
+    int64_t written_at_ms{0};                // set by save(), milliseconds since the epoch
+    std::vector<Backend> backends;
+    std::vector<Server> servers;
+    std::vector<MaglevTable> maglev_tables;
+
+    /**
+     * Write the state to path, replacing the previous file at once. Returns
+     * false if it could not be written, the previous file is left alone then.
+     */
+    bool save(const std::string& path);
+
+    /**
+     * Replace this state with the one in path. Returns false, leaving this
+     * state empty, when there is no file or it is not a valid one.
+     */
+    bool load(const std::string& path);
+
+    /**
+     * Milliseconds since the state was saved
+     */
+    int64_t ageMs() const;
+};
+
+#endif // WARM_STATE_H
@@ -0,0 +1,957 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <arpa/inet.h>
+#include "dnsdist_load_balancer.h"
+#include "../config/warm_state.h"
+#include "../logging/logger.h"
+
+static std::atomic<uint64_t> s_next_instance_id{1};
+
+// The policies setPolicy() knows without registerPolicy()
+struct BuiltInPolicy {
+    const char* name;
+    PolicyKind kind;
+    ViewPolicy view_policy;
+};
+
+static constexpr BuiltInPolicy BUILT_IN_POLICIES[] = {
+    {"roundrobin", PolicyKind::RoundRobin, ViewPolicy::None},
+    {"leastOutstanding", PolicyKind::LeastOutstanding, ViewPolicy::None},
+    {"wrandom", PolicyKind::WeightedRandom, ViewPolicy::WeightedAlias},
+    {"whashed", PolicyKind::WeightedHashed, ViewPolicy::HashedAlias},
+    {"chashed", PolicyKind::ConsistentHashed, ViewPolicy::ConsistentRing},
+    {"chashedBounded", PolicyKind::BoundedConsistentHashed, ViewPolicy::BoundedRing},
+    {"maglev", PolicyKind::Maglev, ViewPolicy::Maglev},
+    {"p2c", PolicyKind::PowerOfTwoChoices, ViewPolicy::None},
+    {"ewmaLatency", PolicyKind::EwmaLatency, ViewPolicy::None},
+    {"firstAvailable", PolicyKind::FirstAvailable, ViewPolicy::None},
+};
+
+// Policies added by registerPolicy(), shared by all instances
+static std::mutex s_custom_policies_mutex;
+static std::map<std::string, CustomPolicyFunction> s_custom_policies;
+
+static const BuiltInPolicy* findBuiltInPolicy(const std::string& name) {
+    for (const auto& policy : BUILT_IN_POLICIES) {
+        if (name == policy.name) {
+            return &policy;
+        }
+    }
+    return nullptr;
+}
+
+DnsdistLoadBalancer::DnsdistLoadBalancer(const std::vector<ServerPool>& pools, HealthChecker* health_checker,
+                                         uint32_t answer_ttl, size_t backend_capacity)
+    : health_checker_(health_checker), answer_ttl_(answer_ttl), default_policy_(makePolicy("roundrobin")),
+      instance_id_(s_next_instance_id.fetch_add(1)) {
+
+    if (!health_checker_) {
+        throw std::runtime_error("HealthChecker cannot be null");
+    }
+
+    // Initialize server pools and create DownstreamState objects
+    initializeBackends(pools, backend_capacity);
+
+    // Set default policy to round-robin
+    setPolicy("roundrobin");
+
+    LOG_INFO("DnsdistLoadBalancer initialized with %zu backend servers, room for %zu", backendCount(),
+             slot_capacity_);
+}
+
+DnsdistLoadBalancer::~DnsdistLoadBalancer() {
+    // Waits for a rebuild in progress on the health check thread
+    health_checker_->removeSnapshotListener(listener_id_);
+}
+
+int DnsdistLoadBalancer::routeQuery(const dnswire::QueryView& query, const sockaddr* client,
+                                    socklen_t client_length) {
+    const HealthyView& view = healthyView();
+    return view.router ? view.router->route(query, client, client_length) : ALL_POOLS;
+}
+
+bool DnsdistLoadBalancer::isAllowed(const sockaddr* client, socklen_t client_length) {
+    const HealthyView& view = healthyView();
+    if (!view.acl) {
+        return true;
+    }
+    const uint32_t rule = client && client_length > 0 ? view.acl->lookup(ComboAddress(client, client_length))
+                                                      : PrefixTable::NOT_FOUND;
+    const bool allowed = rule == PrefixTable::NOT_FOUND ? view.acl_default_allow : rule != 0;
+    if (!allowed) {
+        acl_dropped_.increment(0);
+    }
+    return allowed;
+}
+
+bool DnsdistLoadBalancer::admitClient(const sockaddr* client, socklen_t client_length) {
+    const HealthyView& view = healthyView();
+    if (!view.client_limiter || view.client_limiter->tryAcquire(client, client_length, TokenBucket::nowNs())) {
+        return true;
+    }
+    rate_limited_.increment(0);
+    return false;
+}
+
+const std::string& DnsdistLoadBalancer::getServerForQuery(uint32_t qname_hash, int pool) {
+    BackendSlot* slot = selectBackend(qname_hash, pool);
+    return slot ? slot->ip : empty_ip_;
+}
+
+const dnswire::AnswerTemplate* DnsdistLoadBalancer::getAnswerForQuery(uint32_t qname_hash, int* backend_index,
+                                                                      int pool) {
+    BackendSlot* slot = selectBackend(qname_hash, pool);
+    if (!slot || slot->answer.size == 0) {
+        return nullptr;
+    }
+    if (backend_index) {
+        *backend_index = static_cast<int>(slot - slots_.get());
+    }
+    return &slot->answer;
+}
+
+int DnsdistLoadBalancer::selectBackendIndex(uint32_t qname_hash, int pool) {
+    BackendSlot* slot = selectBackend(qname_hash, pool);
+    return slot ? static_cast<int>(slot - slots_.get()) : -1;
+}
+
+bool DnsdistLoadBalancer::reload(const std::vector<ServerPool>& pools) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    const bool complete = updateBackends(pools);
+    // Membership changed even if health did not, queries move over with the next view
+    publishHealthyView(*health_checker_->getSnapshot());
+
+    size_t active = 0;
+    const size_t slot_count = slot_count_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < slot_count; ++i) {
+        if (!slots_[i].retired.load(std::memory_order_relaxed)) {
+            active++;
+        }
+    }
+    LOG_INFO("Configuration reloaded: %zu backends in %zu slots", active, slot_count);
+    return complete;
+}
+
+size_t DnsdistLoadBalancer::addBackendListener(BackendListener listener) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    const size_t listener_id = next_backend_listener_id_++;
+    backend_listeners_.emplace_back(listener_id, std::move(listener));
+    return listener_id;
+}
+
+void DnsdistLoadBalancer::removeBackendListener(size_t listener_id) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    backend_listeners_.erase(std::remove_if(backend_listeners_.begin(), backend_listeners_.end(),
+                                            [listener_id](const auto& listener) { return listener.first == listener_id; }),
+                             backend_listeners_.end());
+}
+
+std::shared_ptr<const DnsdistLoadBalancer::Policy> DnsdistLoadBalancer::makePolicy(const std::string& policy_name) {
+    auto policy = std::make_shared<Policy>();
+    policy->name = policy_name;
+    if (const BuiltInPolicy* built_in = findBuiltInPolicy(policy_name)) {
+        policy->kind = built_in->kind;
+        policy->view_policy = built_in->view_policy;
+        return policy;
+    }
+    {
+        std::lock_guard<std::mutex> lock(s_custom_policies_mutex);
+        auto it = s_custom_policies.find(policy_name);
+        if (it != s_custom_policies.end()) {
+            policy->kind = PolicyKind::Custom;
+            policy->custom = it->second;
+            return policy;
+        }
+    }
+    LOG_WARNING("Unknown policy '%s', using roundrobin", policy_name.c_str());
+    policy->name = "roundrobin";
+    return policy;
+}
+
+void DnsdistLoadBalancer::setPolicy(const std::string& policy_name) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    std::shared_ptr<const Policy> policy = makePolicy(policy_name);
+    default_policy_ = policy;
+    // Policies live in the view, queries switch over with the next one
+    publishHealthyView(*health_checker_->getSnapshot());
+
+    LOG_INFO("Load balancing policy set to: %s", policy->name.c_str());
+}
+
+bool DnsdistLoadBalancer::setPoolPolicy(const std::string& pool_name, const std::string& policy_name) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    auto it = std::find(pool_names_.begin(), pool_names_.end(), pool_name);
+    if (it == pool_names_.end()) {
+        LOG_WARNING("Cannot set the policy of unknown pool %s", pool_name.c_str());
+        return false;
+    }
+    std::shared_ptr<const Policy> policy = policy_name.empty() ? nullptr : makePolicy(policy_name);
+    pool_policies_[static_cast<size_t>(it - pool_names_.begin())] = policy;
+    publishHealthyView(*health_checker_->getSnapshot());
+
+    LOG_INFO("Load balancing policy of pool %s set to: %s", pool_name.c_str(),
+             policy ? policy->name.c_str() : default_policy_->name.c_str());
+    return true;
+}
+
+bool DnsdistLoadBalancer::registerPolicy(const std::string& name, CustomPolicyFunction select) {
+    if (findBuiltInPolicy(name) || !select) {
+        LOG_WARNING("Cannot register policy '%s'", name.c_str());
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(s_custom_policies_mutex);
+    s_custom_policies[name] = std::move(select);
+    LOG_INFO("Registered load balancing policy: %s", name.c_str());
+    return true;
+}
+
+std::string DnsdistLoadBalancer::getPoolPolicy(const std::string& pool_name) const {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    auto it = std::find(pool_names_.begin(), pool_names_.end(), pool_name);
+    if (it != pool_names_.end()) {
+        const auto& policy = pool_policies_[static_cast<size_t>(it - pool_names_.begin())];
+        if (policy) {
+            return policy->name;
+        }
+    }
+    return default_policy_->name;
+}
+
+void DnsdistLoadBalancer::setRouting(const RoutingConfig& routing) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    PoolRouter::Rules rules;
+    rules.use_ecs = routing.use_ecs;
+
+    for (const auto& suffix : routing.qname_suffixes) {
+        const int pool = findPool(suffix.second);
+        if (pool == PoolRouter::NO_POOL) {
+            LOG_WARNING("Routing: no pool or region named %s for suffix %s", suffix.second.c_str(),
+                        suffix.first.c_str());
+            continue;
+        }
+        try {
+            rules.suffixes.emplace_back(DNSName(suffix.first), pool);
+        } catch (const std::exception& e) {
+            LOG_WARNING("Routing: skipping suffix %s: %s", suffix.first.c_str(), e.what());
+        }
+    }
+
+    for (const auto& subnet : routing.client_subnets) {
+        const int pool = findPool(subnet.second);
+        if (pool == PoolRouter::NO_POOL) {
+            LOG_WARNING("Routing: no pool or region named %s for subnet %s", subnet.second.c_str(),
+                        subnet.first.c_str());
+            continue;
+        }
+        try {
+            rules.subnets.emplace_back(Netmask(subnet.first), pool);
+        } catch (const PDNSException& e) {
+            LOG_WARNING("Routing: skipping subnet %s: %s", subnet.first.c_str(), e.reason.c_str());
+        }
+    }
+
+    if (!routing.default_pool.empty()) {
+        rules.default_pool = findPool(routing.default_pool);
+        if (rules.default_pool == PoolRouter::NO_POOL) {
+            LOG_WARNING("Routing: no pool or region named %s for the default pool, using every pool",
+                        routing.default_pool.c_str());
+        }
+    }
+
+    // Without any rule every query goes to every pool, skip the per-pool views altogether
+    if (rules.suffixes.empty() && rules.subnets.empty() && rules.default_pool == PoolRouter::NO_POOL) {
+        router_.reset();
+    } else {
+        router_ = std::make_shared<const PoolRouter>(rules);
+    }
+    publishHealthyView(*health_checker_->getSnapshot());
+
+    LOG_INFO("Routing: %zu qname suffixes, %zu client subnets, default pool %s%s",
+             router_ ? router_->suffixCount() : 0, router_ ? router_->subnetCount() : 0,
+             rules.default_pool == PoolRouter::NO_POOL ? "(all)" : pool_names_[rules.default_pool].c_str(),
+             routing.use_ecs ? ", ECS" : "");
+}
+
+void DnsdistLoadBalancer::setAccessControl(const AccessControlConfig& acl) {
+    std::vector<std::pair<Netmask, uint32_t>> rules;
+    rules.reserve(acl.rules.size());
+    for (const auto& rule : acl.rules) {
+        if (rule.second != "allow" && rule.second != "deny") {
+            LOG_WARNING("ACL: skipping %s, action must be allow or deny, not %s", rule.first.c_str(),
+                        rule.second.c_str());
+            continue;
+        }
+        try {
+            rules.emplace_back(Netmask(rule.first), rule.second == "allow" ? 1 : 0);
+        } catch (const PDNSException& e) {
+            LOG_WARNING("ACL: skipping %s: %s", rule.first.c_str(), e.reason.c_str());
+        }
+    }
+    // Built outside the lock, a large ACL file takes a while
+    auto table = rules.empty() && acl.default_allow ? nullptr : std::make_shared<const PrefixTable>(rules);
+
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    acl_ = std::move(table);
+    acl_default_allow_ = acl.default_allow;
+    publishHealthyView(*health_checker_->getSnapshot());
+
+    LOG_INFO("ACL: %zu rules, %zu bytes, default %s", acl_ ? acl_->size() : 0, acl_ ? acl_->memoryUsage() : 0,
+             acl_default_allow_ ? "allow" : "deny");
+}
+
+void DnsdistLoadBalancer::setRateLimit(const RateLimitConfig& limit) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    if (limit.client_qps == 0) {
+        client_limiter_.reset();
+    } else if (!client_limiter_ || client_limiter_->capacity() < limit.max_clients ||
+               client_limiter_->ipv4Bits() != limit.ipv4_prefix || client_limiter_->ipv6Bits() != limit.ipv6_prefix) {
+        client_limiter_ = std::make_shared<ClientRateLimiter>(limit.max_clients, limit.ipv4_prefix, limit.ipv6_prefix);
+    }
+    // In place for a table that is kept, clients keep their buckets
+    if (client_limiter_) {
+        client_limiter_->configure(limit.client_qps, limit.client_burst);
+    }
+    publishHealthyView(*health_checker_->getSnapshot());
+
+    if (client_limiter_) {
+        LOG_INFO("Client rate limit: %u qps, burst %u, per /%u IPv4 and /%u IPv6 subnet, %zu clients",
+                 limit.client_qps, limit.client_burst > 0 ? limit.client_burst : limit.client_qps,
+                 static_cast<unsigned>(limit.ipv4_prefix), static_cast<unsigned>(limit.ipv6_prefix),
+                 client_limiter_->capacity());
+    }
+}
+
+int DnsdistLoadBalancer::findPool(const std::string& target) const {
+    auto it = std::find(pool_names_.begin(), pool_names_.end(), target);
+    if (it != pool_names_.end()) {
+        return static_cast<int>(it - pool_names_.begin());
+    }
+    it = std::find(pool_regions_.begin(), pool_regions_.end(), target);
+    if (it != pool_regions_.end()) {
+        return static_cast<int>(it - pool_regions_.begin());
+    }
+    return PoolRouter::NO_POOL;
+}
+
+void DnsdistLoadBalancer::printStats() const {
+    std::cout << "\n📊 Load Balancer Statistics:" << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(view_mutex_);
+        std::cout << "   Policy: " << default_policy_->name << std::endl;
+        for (size_t i = 0; i < pool_policies_.size(); ++i) {
+            if (pool_policies_[i]) {
+                std::cout << "   Policy of " << pool_names_[i] << ": " << pool_policies_[i]->name << std::endl;
+            }
+        }
+    }
+    const size_t slot_count = backendCount();
+    std::cout << "   Total Backends: " << slot_count << std::endl;
+
+    size_t healthy_count = 0;
+    for (size_t i = 0; i < slot_count; ++i) {
+        if (slots_[i].healthy.load(std::memory_order_relaxed)) {
+            healthy_count++;
+        }
+    }
+    std::cout << "   Healthy Backends: " << healthy_count << std::endl;
+
+    // Print per-backend stats
+    std::vector<uint64_t> queries = query_counters_->loadAll();
+    for (size_t i = 0; i < slot_count; ++i) {
+        const BackendSlot& slot = slots_[i];
+        bool is_healthy = slot.healthy.load(std::memory_order_relaxed);
+
+        std::cout << "   Backend " << i << ": " << slot.ip
+                  << (slot.retired.load(std::memory_order_relaxed) ? " (removed)" : is_healthy ? " ✓" : " ✗")
+                  << " (" << queries[i] << " queries)" << std::endl;
+    }
+}
+
+void DnsdistLoadBalancer::writeMetrics(std::string& out) const {
+    char line[256];
+    const size_t slot_count = backendCount();
+    const std::vector<uint64_t> queries = query_counters_->loadAll();
+
+    {
+        std::lock_guard<std::mutex> lock(view_mutex_);
+        snprintf(line, sizeof(line), "# TYPE dnslb_policy_info gauge\ndnslb_policy_info{policy=\"%s\"} 1\n",
+                 default_policy_->name.c_str());
+        out += line;
+        for (size_t i = 0; i < pool_policies_.size(); ++i) {
+            if (pool_policies_[i]) {
+                snprintf(line, sizeof(line), "dnslb_policy_info{pool=\"%s\",policy=\"%s\"} 1\n",
+                         pool_names_[i].c_str(), pool_policies_[i]->name.c_str());
+                out += line;
+            }
+        }
+    }
+
+    out += "# TYPE dnslb_backend_queries_total counter\n";
+    for (size_t i = 0; i < slot_count; ++i) {
+        if (slots_[i].retired.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "dnslb_backend_queries_total{backend=\"%s\"} %llu\n", slots_[i].ip.c_str(),
+                 static_cast<unsigned long long>(queries[i]));
+        out += line;
+    }
+
+    out += "# TYPE dnslb_backend_outstanding gauge\n";
+    for (size_t i = 0; i < slot_count; ++i) {
+        if (slots_[i].retired.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "dnslb_backend_outstanding{backend=\"%s\"} %llu\n", slots_[i].ip.c_str(),
+                 static_cast<unsigned long long>(slots_[i].state->outstanding.load()));
+        out += line;
+    }
+
+    out += "# TYPE dnslb_backend_healthy gauge\n";
+    for (size_t i = 0; i < slot_count; ++i) {
+        if (slots_[i].retired.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "dnslb_backend_healthy{backend=\"%s\"} %d\n", slots_[i].ip.c_str(),
+                 slots_[i].healthy.load(std::memory_order_relaxed) ? 1 : 0);
+        out += line;
+    }
+
+    out += "# TYPE dnslb_backend_latency_seconds histogram\n";
+    for (size_t i = 0; i < slot_count; ++i) {
+        if (slots_[i].retired.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        backend_latency_[i].writePrometheus(out, "dnslb_backend_latency_seconds",
+                                            "backend=\"" + slots_[i].ip + "\"", 1e-6);
+    }
+
+    snprintf(line, sizeof(line), "# TYPE dnslb_acl_dropped_total counter\ndnslb_acl_dropped_total %llu\n",
+             static_cast<unsigned long long>(acl_dropped_.load(0)));
+    out += line;
+    const std::vector<uint64_t> limited = rate_limited_.loadAll();
+    snprintf(line, sizeof(line),
+             "# TYPE dnslb_rate_limited_total counter\n"
+             "dnslb_rate_limited_total{limit=\"client\"} %llu\n"
+             "dnslb_rate_limited_total{limit=\"backend\"} %llu\n",
+             static_cast<unsigned long long>(limited[0]), static_cast<unsigned long long>(limited[1]));
+    out += line;
+
+    out += "# TYPE dnslb_policy_selection_seconds histogram\n";
+    selection_time_.writePrometheus(out, "dnslb_policy_selection_seconds", "", 1e-9);
+}
+
+void DnsdistLoadBalancer::initializeBackends(const std::vector<ServerPool>& pools, size_t backend_capacity) {
+    size_t configured = 0;
+    for (const auto& pool : pools) {
+        configured += pool.servers.size();
+    }
+
+    // Slots are allocated once and never move, the hot path indexes into them directly
+    slot_capacity_ = std::max(backend_capacity, configured);
+    slots_ = std::make_unique<BackendSlot[]>(slot_capacity_);
+    query_counters_ = std::make_unique<PerThreadCounters>(slot_capacity_);
+    backend_latency_ = std::make_unique<LatencyHistogram[]>(slot_capacity_);
+
+    // Register before building the first view, so that no snapshot falls in between
+    listener_id_ = health_checker_->addSnapshotListener(
+        [this](const HealthSnapshot& snapshot) { refreshHealthyView(snapshot); });
+
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    updateBackends(pools);
+    publishHealthyView(*health_checker_->getSnapshot());
+}
+
+bool DnsdistLoadBalancer::updateBackends(const std::vector<ServerPool>& pools) {
+    size_t slot_count = slot_count_.load(std::memory_order_relaxed);
+    // Backends are identified by pool, IP and port. Retired slots stay in here, a
+    // server that comes back gets its old slot back.
+    std::unordered_multimap<std::string, size_t> existing;
+    for (size_t i = 0; i < slot_count; ++i) {
+        existing.emplace(pool_names_[slots_[i].pool_index] + '/' + slots_[i].address.toStringWithPort(), i);
+    }
+    std::unordered_set<std::string> seen;
+    std::vector<bool> configured(slot_capacity_, false);
+    const size_t first_new = slot_count;
+    bool complete = true;
+    bool weights_changed = false;
+
+    for (const auto& pool : pools) {
+        auto pool_it = std::find(pool_names_.begin(), pool_names_.end(), pool.name);
+        const size_t pool_index = static_cast<size_t>(pool_it - pool_names_.begin());
+        if (pool_it == pool_names_.end()) {
+            pool_names_.push_back(pool.name);
+            pool_policies_.emplace_back();
+            pool_regions_.emplace_back();
+        }
+        pool_regions_[pool_index] = pool.geo_region;
+        pool_policies_[pool_index] = pool.policy.empty() ? nullptr : makePolicy(pool.policy);
+
+        for (size_t i = 0; i < pool.servers.size(); ++i) {
+            const auto& server = pool.servers[i];
+            const int health_index = health_checker_->getBackendIndex(pool.name, i);
+
+            ComboAddress address;
+            try {
+                address = ComboAddress(server.ip, server.port);
+            } catch (const PDNSException& e) {
+                LOG_WARNING("Skipping backend %s: %s", server.ip.c_str(), e.reason.c_str());
+                continue;
+            }
+            const std::string key = pool.name + '/' + address.toStringWithPort();
+            if (!seen.insert(key).second) {
+                LOG_WARNING("Skipping duplicate backend %s in pool %s", server.key().c_str(), pool.name.c_str());
+                continue;
+            }
+
+            // Kept backends keep their DownstreamState, and with it their id, hashes and counters.
+            // The weight changes in place like dnsdist's setWeight(), which only adds or removes
+            // the hash points of the difference, and the next view rebuilds what depends on it.
+            // Order and TCP only are read by queries still running on the current view, a
+            // change of those takes another slot. The qps limit is ours and changes in place.
+            auto range = existing.equal_range(key);
+            auto it = std::find_if(range.first, range.second, [this, &server](const auto& entry) {
+                const DownstreamState::Config& config = slots_[entry.second].state->d_config;
+                return config.order == server.order && config.d_tcpOnly == server.tcp_only;
+            });
+            if (it == range.second) {
+                // A slot retired by an earlier reload is in no view a query can still be
+                // running on, so its settings can be rewritten. Not its address: forwarder
+                // sockets, TCP endpoints and traffic ring names stay with the slot, only a
+                // slot of the same backend is reused, keeping its id and with it its hashes.
+                it = std::find_if(range.first, range.second, [this](const auto& entry) {
+                    return slots_[entry.second].retired.load(std::memory_order_relaxed);
+                });
+                if (it != range.second) {
+                    DownstreamState::Config& config = slots_[it->second].state->d_config;
+                    config.order = server.order;
+                    config.d_tcpOnly = server.tcp_only;
+                }
+            }
+            if (it != range.second) {
+                BackendSlot& slot = slots_[it->second];
+                configured[it->second] = true;
+                slot.health_index = health_index;
+                slot.qps.configure(static_cast<uint32_t>(server.qps_limit), static_cast<uint32_t>(server.qps_limit));
+                if (slot.state->d_config.d_weight != server.weight) {
+                    LOG_INFO("Changed weight of backend %s (pool: %s) from %d to %d", slot.ip.c_str(),
+                             pool.name.c_str(), slot.state->d_config.d_weight, server.weight);
+                    slot.state->setWeight(server.weight);
+                    weights_changed = true;
+                }
+                if (slot.retired.load(std::memory_order_relaxed)) {
+                    slot.retired.store(false, std::memory_order_relaxed);
+                    LOG_INFO("Restored backend: %s (pool: %s)", slot.ip.c_str(), pool.name.c_str());
+                }
+                continue;
+            }
+
+            if (slot_count == slot_capacity_) {
+                LOG_ERROR("No free backend slot for %s (pool: %s), capacity is %zu", server.ip.c_str(),
+                          pool.name.c_str(), slot_capacity_);
+                complete = false;
+                continue;
+            }
+
+            BackendSlot& slot = slots_[slot_count];
+            slot.address = address;
+            slot.ip = server.ip;
+            slot.pool_index = pool_index;
+            slot.health_index = health_index;
+
+            // Note: This is a simplified version. In production dnsdist,
+            // DownstreamState is much more complex with connection pools, etc.
+            DownstreamState::Config config(slot.address);
+            config.d_weight = server.weight;
+            config.order = server.order;
+            config.d_tcpOnly = server.tcp_only;
+            // Not config.d_qpsLimit: dnsdist's QPSLimiter is not thread-safe, slot.qps enforces it
+            slot.state = std::make_shared<DownstreamState>(std::move(config), nullptr, false);
+            slot.qps.configure(static_cast<uint32_t>(server.qps_limit), static_cast<uint32_t>(server.qps_limit));
+
+            // Render the A answer once instead of converting the IP per query
+            if (slot.address.sin4.sin_family == AF_INET) {
+                slot.answer = dnswire::AnswerTemplate::forA(slot.address.sin4.sin_addr.s_addr, answer_ttl_);
+            } else {
+                LOG_WARNING("Backend %s is not an IPv4 address, queries routed to it will get SERVFAIL",
+                            slot.ip.c_str());
+            }
+
+            existing.emplace(key, slot_count);
+            configured[slot_count] = true;
+            // Filled in before it is counted, readers of backendCount() see a complete slot
+            slot_count_.store(++slot_count, std::memory_order_release);
+
+            LOG_INFO("Added backend: %s (pool: %s, weight: %d, order: %d, qps limit: %d%s)", server.key().c_str(),
+                     pool_names_[slot.pool_index].c_str(), server.weight, server.order, server.qps_limit,
+                     server.tcp_only ? ", TCP only" : "");
+        }
+    }
+
+    for (size_t i = 0; i < slot_count; ++i) {
+        BackendSlot& slot = slots_[i];
+        if (configured[i] || slot.retired.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        // Out of every view from now on, in-flight queries still hold its state
+        slot.health_index = -1;
+        slot.retired.store(true, std::memory_order_relaxed);
+        LOG_INFO("Removed backend: %s (pool: %s)", slot.ip.c_str(), pool_names_[slot.pool_index].c_str());
+    }
+
+    if (weights_changed) {
+        weights_generation_++;
+    }
+
+    for (size_t i = first_new; i < slot_count; ++i) {
+        for (const auto& listener : backend_listeners_) {
+            listener.second(i);
+        }
+    }
+    return complete;
+}
+
+const DnsdistLoadBalancer::HealthyView& DnsdistLoadBalancer::healthyView() {
+    struct CachedView {
+        uint64_t owner{0};
+        std::shared_ptr<const HealthyView> view;
+    };
+    static thread_local CachedView t_cached;
+
+    const uint64_t generation = view_generation_.load(std::memory_order_acquire);
+    if (t_cached.owner == instance_id_ && t_cached.view->generation >= generation) {
+        return *t_cached.view;
+    }
+
+    t_cached.owner = instance_id_;
+    t_cached.view = std::atomic_load(&healthy_view_);
+    return *t_cached.view;
+}
+
+void DnsdistLoadBalancer::refreshHealthyView(const HealthSnapshot& snapshot) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    if (healthy_view_ && healthy_view_->snapshot_generation >= snapshot.generation) {
+        return;
+    }
+    publishHealthyView(snapshot);
+}
+
+void DnsdistLoadBalancer::publishHealthyView(const HealthSnapshot& snapshot) {
+    // Publish the view before its generation, like HealthChecker does with snapshots
+    std::shared_ptr<const HealthyView> view = buildHealthyView(snapshot);
+    std::atomic_store(&healthy_view_, view);
+    view_generation_.store(view->generation, std::memory_order_release);
+}
+
+std::shared_ptr<const DnsdistLoadBalancer::HealthyView> DnsdistLoadBalancer::buildHealthyView(const HealthSnapshot& snapshot) {
+    auto view = std::make_shared<HealthyView>();
+    // Own counter rather than the snapshot's, a reload publishes a view for the same snapshot
+    view->generation = healthy_view_ ? healthy_view_->generation + 1 : 1;
+    view->snapshot_generation = snapshot.generation;
+    view->weights_generation = weights_generation_;
+    view->router = router_;
+    view->acl = acl_;
+    view->acl_default_allow = acl_default_allow_;
+    view->client_limiter = client_limiter_;
+    const size_t slot_count = slot_count_.load(std::memory_order_relaxed);
+    view->all.servers.reserve(slot_count);
+    view->all.slot_index.reserve(slot_count);
+    if (router_) {
+        view->pools.resize(pool_names_.size());
+    }
+
+    for (size_t i = 0; i < slot_count; ++i) {
+        BackendSlot& slot = slots_[i];
+        // Each backend has its own health, a dead server no longer hides its pool
+        bool healthy = slot.health_index >= 0 && snapshot.isHealthy(static_cast<size_t>(slot.health_index));
+        slot.healthy.store(healthy, std::memory_order_relaxed);
+        // Keep isUp() in sync so policies that re-check it see the same state
+        slot.state->setUpStatus(healthy);
+        if (healthy) {
+            // Probe RTT, used by the latency-aware policies
+            slot.state->latencyUsec = snapshot.response_time_ms[slot.health_index] * 1000.0;
+        }
+
+        if (healthy) {
+            view->all.servers.emplace_back(static_cast<unsigned int>(view->all.servers.size() + 1), slot.state);
+            view->all.slot_index.push_back(static_cast<uint32_t>(i));
+            if (router_) {
+                PoolView& pool = view->pools[slot.pool_index];
+                pool.servers.emplace_back(static_cast<unsigned int>(pool.servers.size() + 1), slot.state);
+                pool.slot_index.push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
+
+    // A Maglev table is only good for the weights it was built with
+    const HealthyView* previous =
+        healthy_view_ && healthy_view_->weights_generation == weights_generation_ ? healthy_view_.get() : nullptr;
+    view->all.policy = default_policy_;
+    preparePoolView(view->all, previous ? &previous->all : nullptr, &warm_all_);
+    for (size_t i = 0; i < view->pools.size(); ++i) {
+        view->pools[i].policy = pool_policies_[i] ? pool_policies_[i] : default_policy_;
+        preparePoolView(view->pools[i], previous && i < previous->pools.size() ? &previous->pools[i] : nullptr,
+                        i < warm_pools_.size() ? &warm_pools_[i] : nullptr);
+    }
+
+    return view;
+}
+
+void DnsdistLoadBalancer::preparePoolView(PoolView& pool, const PoolView* previous, const PoolView* warm) {
+    switch (pool.policy->view_policy) {
+    case ViewPolicy::ConsistentRing:
+    case ViewPolicy::BoundedRing:
+        // One merged ring for all healthy servers instead of a scan per query
+        pool.ring = dnsdist::lbpolicies::ConsistentHashRing(pool.servers);
+        break;
+    case ViewPolicy::WeightedAlias:
+    case ViewPolicy::HashedAlias:
+        // Constant-time weighted selection, weights and up states only change with the view
+        pool.alias = dnsdist::lbpolicies::WeightedAliasTable(pool.servers);
+        break;
+    case ViewPolicy::Maglev:
+        // The Maglev table is the expensive part, only rebuild it when membership or weights change
+        if (warm && warm->maglev && warm->slot_index == pool.slot_index) {
+            // Saved by the previous process for the same servers, with the same ids and weights.
+            // Ahead of previous, whose table restoreState() replaces as it was built from random ids.
+            pool.maglev = warm->maglev;
+        } else if (previous && previous->maglev && previous->slot_index == pool.slot_index) {
+            pool.maglev = previous->maglev;
+        } else {
+            pool.maglev = std::make_shared<const dnsdist::lbpolicies::MaglevTable>(pool.servers);
+        }
+        break;
+    case ViewPolicy::None:
+        break;
+    }
+}
+
+std::string DnsdistLoadBalancer::slotKey(size_t slot_index) const {
+    const BackendSlot& slot = slots_[slot_index];
+    return pool_names_[slot.pool_index] + '/' + slot.address.toStringWithPort();
+}
+
+size_t DnsdistLoadBalancer::restoreState(const WarmState& state) {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    const size_t slot_count = slot_count_.load(std::memory_order_relaxed);
+    std::unordered_map<std::string, size_t> slot_of_key;
+    for (size_t i = 0; i < slot_count; ++i) {
+        if (!slots_[i].retired.load(std::memory_order_relaxed)) {
+            slot_of_key.emplace(slotKey(i), i);
+        }
+    }
+
+    // The ring points and the Maglev permutation of a backend follow from its id,
+    // random for every new DownstreamState. A changed weight moves them anyway.
+    std::vector<int64_t> restored_slot(state.servers.size(), -1);
+    size_t restored = 0;
+    for (size_t i = 0; i < state.servers.size(); ++i) {
+        const WarmState::Server& server = state.servers[i];
+        auto it = slot_of_key.find(server.key);
+        if (it == slot_of_key.end() || slots_[it->second].state->d_config.d_weight != server.weight) {
+            continue;
+        }
+        slots_[it->second].state->setId(server.id);
+        restored_slot[i] = static_cast<int64_t>(it->second);
+        restored++;
+    }
+
+    // A table is only good for the servers it was built from, in the same order
+    warm_all_ = PoolView();
+    warm_pools_.assign(pool_names_.size(), PoolView());
+    size_t tables = 0;
+    for (const auto& table : state.maglev_tables) {
+        PoolView* warm = nullptr;
+        if (table.all_pools) {
+            warm = &warm_all_;
+        } else {
+            auto pool_it = std::find(pool_names_.begin(), pool_names_.end(), table.pool);
+            if (pool_it != pool_names_.end()) {
+                warm = &warm_pools_[static_cast<size_t>(pool_it - pool_names_.begin())];
+            }
+        }
+        if (!warm) {
+            continue;
+        }
+        std::vector<uint32_t> slot_index;
+        for (uint32_t server : table.servers) {
+            if (server >= restored_slot.size() || restored_slot[server] < 0) {
+                break;
+            }
+            slot_index.push_back(static_cast<uint32_t>(restored_slot[server]));
+        }
+        if (slot_index.size() != table.servers.size()) {
+            continue;
+        }
+        warm->slot_index = std::move(slot_index);
+        warm->maglev = std::make_shared<const dnsdist::lbpolicies::MaglevTable>(
+            std::vector<ServerPolicy::SelectedServerPosition>(table.entries.begin(), table.entries.end()));
+        tables++;
+    }
+
+    // Rings and tables of the current view were built from the random ids
+    publishHealthyView(*health_checker_->getSnapshot());
+
+    // A view that took a saved table holds that very table, its entries are the saved ones.
+    // Later views reuse it from this one while the servers do not change.
+    size_t in_use = 0;
+    auto usesWarm = [](const PoolView& pool, const PoolView& warm) {
+        return warm.maglev && pool.maglev == warm.maglev;
+    };
+    in_use += usesWarm(healthy_view_->all, warm_all_) ? 1 : 0;
+    for (size_t i = 0; i < healthy_view_->pools.size() && i < warm_pools_.size(); ++i) {
+        in_use += usesWarm(healthy_view_->pools[i], warm_pools_[i]) ? 1 : 0;
+    }
+    warm_all_ = PoolView();
+    warm_pools_.clear();
+
+    LOG_INFO("Restored %zu of %zu backend ids and %zu of %zu Maglev tables", restored, state.servers.size(),
+             in_use, tables);
+    if (in_use < tables) {
+        LOG_WARNING("%zu saved Maglev tables did not fit the current views and were rebuilt", tables - in_use);
+    }
+    return restored;
+}
+
+void DnsdistLoadBalancer::exportState(WarmState& state) const {
+    std::lock_guard<std::mutex> lock(view_mutex_);
+    const size_t slot_count = slot_count_.load(std::memory_order_relaxed);
+    std::vector<int64_t> server_of_slot(slot_count, -1);
+    for (size_t i = 0; i < slot_count; ++i) {
+        const BackendSlot& slot = slots_[i];
+        if (slot.retired.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        server_of_slot[i] = static_cast<int64_t>(state.servers.size());
+        state.servers.push_back({slotKey(i), slot.state->getID(), slot.state->d_config.d_weight});
+    }
+
+    auto exportTable = [&](const PoolView& pool, const std::string& pool_name, bool all_pools) {
+        if (!pool.maglev || pool.maglev->empty()) {
+            return;
+        }
+        WarmState::MaglevTable table;
+        table.pool = pool_name;
+        table.all_pools = all_pools;
+        for (uint32_t slot_index : pool.slot_index) {
+            if (slot_index >= slot_count || server_of_slot[slot_index] < 0) {
+                return;
+            }
+            table.servers.push_back(static_cast<uint32_t>(server_of_slot[slot_index]));
+        }
+        table.entries.assign(pool.maglev->entries().begin(), pool.maglev->entries().end());
+        state.maglev_tables.push_back(std::move(table));
+    };
+    if (healthy_view_) {
+        exportTable(healthy_view_->all, std::string(), true);
+        for (size_t i = 0; i < healthy_view_->pools.size() && i < pool_names_.size(); ++i) {
+            exportTable(healthy_view_->pools[i], pool_names_[i], false);
+        }
+    }
+}
+
+DnsdistLoadBalancer::BackendSlot* DnsdistLoadBalancer::selectBackend(uint32_t qname_hash, int pool) {
+    const HealthyView& view = healthyView();
+    // A routed pool without healthy backends spills over to all of them
+    const PoolView& pool_view = pool >= 0 && static_cast<size_t>(pool) < view.pools.size() &&
+                                        !view.pools[pool].servers.empty()
+                                    ? view.pools[pool]
+                                    : view.all;
+    if (pool_view.servers.empty()) {
+        LOG_WARNING("No healthy backends available");
+        return nullptr;
+    }
+
+    // The only branch on the policy, each case is a selection loop of its own
+    switch (pool_view.policy->kind) {
+    case PolicyKind::RoundRobin:
+        return selectWith<RoundRobinPolicy>(pool_view, qname_hash);
+    case PolicyKind::LeastOutstanding:
+        return selectWith<LeastOutstandingPolicy>(pool_view, qname_hash);
+    case PolicyKind::WeightedRandom:
+        return selectWith<WeightedRandomPolicy>(pool_view, qname_hash);
+    case PolicyKind::WeightedHashed:
+        return selectWith<WeightedHashedPolicy>(pool_view, qname_hash);
+    case PolicyKind::ConsistentHashed:
+        return selectWith<ConsistentHashedPolicy>(pool_view, qname_hash);
+    case PolicyKind::BoundedConsistentHashed:
+        return selectWith<BoundedConsistentHashedPolicy>(pool_view, qname_hash);
+    case PolicyKind::Maglev:
+        return selectWith<MaglevPolicy>(pool_view, qname_hash);
+    case PolicyKind::PowerOfTwoChoices:
+        return selectWith<PowerOfTwoChoicesPolicy>(pool_view, qname_hash);
+    case PolicyKind::EwmaLatency:
+        return selectWith<EwmaLatencyPolicy>(pool_view, qname_hash);
+    case PolicyKind::FirstAvailable:
+        return selectWith<FirstAvailablePolicy>(pool_view, qname_hash);
+    case PolicyKind::Custom:
+        return selectWith<CustomPolicy>(pool_view, qname_hash);
+    }
+    return selectWith<RoundRobinPolicy>(pool_view, qname_hash);
+}
+
+// Shared by every selectWith() instance, so the sample rate holds across policies
+static thread_local uint32_t t_selections = 0;
+
+template <class Selector>
+DnsdistLoadBalancer::BackendSlot* DnsdistLoadBalancer::selectWith(const PoolView& pool_view, uint32_t qname_hash) {
+    try {
+        // Reading the clock twice per query would cost more than some policies, time a sample
+        std::optional<ServerPolicy::SelectedServerPosition> selected_pos;
+        if (++t_selections % SELECTION_SAMPLE_RATE == 0) {
+            const auto started = std::chrono::steady_clock::now();
+            selected_pos = Selector::select(pool_view, qname_hash);
+            selection_time_.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - started).count()));
+        } else {
+            selected_pos = Selector::select(pool_view, qname_hash);
+        }
+
+        if (selected_pos.has_value()) {
+            BackendSlot* slot = admitBackend(pool_view, *selected_pos - 1);
+            if (slot) {
+                LOG_DEBUG("Policy '%s' selected: %s (backend %zu)", pool_view.policy->name.c_str(),
+                          slot->ip.c_str(), static_cast<size_t>(slot - slots_.get()));
+            }
+            return slot;
+        }
+    } catch (const std::exception& e) {
+        LOG_ERROR("Error applying load balancing policy: %s", e.what());
+    }
+
+    // Fallback to first available server if policy fails
+    BackendSlot* fallback = admitBackend(pool_view, 0);
+    if (fallback) {
+        LOG_WARNING("Fallback to first available: %s", fallback->ip.c_str());
+    }
+    return fallback;
+}
+
+DnsdistLoadBalancer::BackendSlot* DnsdistLoadBalancer::admitBackend(const PoolView& pool_view, size_t position) {
+    // Like weightedBalancingFactor, a backend over its limit passes the query on to the
+    // next one in the view, so that hashed policies still move as few queries as possible
+    const size_t count = pool_view.slot_index.size();
+    int64_t now_ns = 0;
+    for (size_t step = 0; step < count; ++step) {
+        const uint32_t slot_index = pool_view.slot_index[(position + step) % count];
+        BackendSlot& slot = slots_[slot_index];
+        if (slot.qps.limited()) {
+            if (now_ns == 0) {
+                now_ns = TokenBucket::nowNs();
+            }
+            if (!slot.qps.tryAcquire(now_ns)) {
+                continue;
+            }
+        }
+        query_counters_->increment(slot_index);
+        return &slot;
+    }
+    rate_limited_.increment(1);
+    LOG_DEBUG("Every backend of policy '%s' is over its qps limit", pool_view.policy->name.c_str());
+    return nullptr;
+}
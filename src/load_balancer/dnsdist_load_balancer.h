@@ -0,0 +1,408 @@
+#ifndef DNSDIST_LOAD_BALANCER_H
+#define DNSDIST_LOAD_BALANCER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Load balancing includes from dnsdist
+#include "../../load_balancing/dnsdist-lbpolicies.hh"
+#include "../../load_balancing/dnsdist-backend.hh"
+#include "../../load_balancing/dnsdist.hh"
+
+// Configuration includes
+#include "../config/config_loader.h"
+#include "../config/health_checker.h"
+
+#include "../metrics/latency_histogram.h"
+#include "../server/dns_wire.h"
+#include "per_thread_counters.h"
+#include "pool_router.h"
+#include "prefix_table.h"
+#include "rate_limiter.h"
+#include "selection_policies.h"
+
+class WarmState;
+
+/**
+ * Wrapper class to integrate dnsdist backend servers with our health checker
+ *
+ * Every backend lives in a fixed slot of a contiguous array, so selecting a
+ * server touches the healthy view, the policy and one slot, without any map
+ * lookups or string hashing. The healthy view is rebuilt on the health check
+ * thread whenever the HealthChecker publishes a new snapshot, query threads
+ * only pick up the finished view.
+ *
+ * reload() applies a new configuration the same way: backends kept from the
+ * previous one stay in their slot with their DownstreamState, a changed weight
+ * is applied in place so that only the hash points of the difference move,
+ * new ones take free slots and removed ones are retired, never freed, so
+ * queries already in flight on an older view or in a forwarder can still
+ * finish on them. A retired slot is taken again by the same pool, IP and
+ * port, so slots only run out with that many distinct backends.
+ *
+ * With routing rules set, routeQuery() picks the pool of a query first and the
+ * policy then only runs over the healthy backends of that pool, with the
+ * pool's own policy if it has one. A query whose pool has no healthy backend,
+ * or that no rule routes, goes to every healthy backend like without rules.
+ */
+class DnsdistLoadBalancer {
+public:
+    static constexpr uint32_t DEFAULT_ANSWER_TTL = 300; // TTL 5min
+    // One policy run in this many is timed for the selection time histogram
+    static constexpr uint32_t SELECTION_SAMPLE_RATE = 64;
+    // Slots reserved for backends added by reload(), if the initial configuration has fewer
+    static constexpr size_t DEFAULT_BACKEND_CAPACITY = 256;
+    // Pool argument of the selection methods for a query that is not routed
+    static constexpr int ALL_POOLS = PoolRouter::NO_POOL;
+
+    /**
+     * Called by reload() for each slot it fills with a new backend, before any
+     * query can be routed to it. Runs on the reloading thread, which holds the
+     * view lock: listeners must not call reload() or add or remove listeners.
+     */
+    using BackendListener = std::function<void(size_t backend_index)>;
+
+    DnsdistLoadBalancer(const std::vector<ServerPool>& pools, HealthChecker* health_checker,
+                        uint32_t answer_ttl = DEFAULT_ANSWER_TTL,
+                        size_t backend_capacity = DEFAULT_BACKEND_CAPACITY);
+    ~DnsdistLoadBalancer();
+
+    DnsdistLoadBalancer(const DnsdistLoadBalancer&) = delete;
+    DnsdistLoadBalancer& operator=(const DnsdistLoadBalancer&) = delete;
+
+    /**
+     * Pool a query should be answered from according to the routing rules, or
+     * ALL_POOLS. client is the source address of the query.
+     */
+    int routeQuery(const dnswire::QueryView& query, const sockaddr* client, socklen_t client_length);
+
+    /**
+     * Get the next server IP for a DNS query using the configured load balancing policy.
+     * qname_hash feeds the hashed policies (whashed, chashed), see dnswire::hashQname().
+     * pool comes from routeQuery(). Returns an empty string when no backend is available.
+     */
+    const std::string& getServerForQuery(uint32_t qname_hash, int pool = ALL_POOLS);
+
+    /**
+     * Select a backend and return its pre-rendered A answer, or nullptr when no
+     * backend is available. The template already carries the IP and TTL, so the
+     * caller only has to echo the question in front of it. The index of the
+     * selected backend is stored in backend_index if given.
+     */
+    const dnswire::AnswerTemplate* getAnswerForQuery(uint32_t qname_hash, int* backend_index = nullptr,
+                                                     int pool = ALL_POOLS);
+
+    /**
+     * Change the load balancing policy, used by every pool without a policy of its own
+     * Supported: roundrobin, leastOutstanding, wrandom, whashed, chashed, chashedBounded,
+     * maglev, firstAvailable, p2c, ewmaLatency, and the names given to registerPolicy()
+     */
+    void setPolicy(const std::string& policy_name);
+
+    /**
+     * Make a policy implemented outside the load balancer available to setPolicy(),
+     * setPoolPolicy() and the pools' "policy" in the config, in every load balancer
+     * of the process. It is called through a std::function on every query, unlike
+     * the built-in ones. Register it before it is used, before the load balancer
+     * is created for the pools' policies: a name that is not known yet falls back
+     * to roundrobin. Returns false if name is taken by a built-in policy.
+     */
+    static bool registerPolicy(const std::string& name, CustomPolicyFunction select);
+
+    /**
+     * Policy for the queries routed to one pool, like dnsdist's setPoolPolicy().
+     * An empty policy_name goes back to the global policy. Returns false for an
+     * unknown pool. A pool's "policy" in the config is applied by reload().
+     */
+    bool setPoolPolicy(const std::string& pool_name, const std::string& policy_name);
+
+    /**
+     * Name of the policy queries routed to pool_name get
+     */
+    std::string getPoolPolicy(const std::string& pool_name) const;
+
+    /**
+     * Replace the routing rules. Targets are resolved to pools by name, then by
+     * geo_region, so call it again after a reload() that changes pools.
+     */
+    void setRouting(const RoutingConfig& routing);
+
+    /**
+     * Replace the access control rules, checked by isAllowed()
+     */
+    void setAccessControl(const AccessControlConfig& acl);
+
+    /**
+     * Whether a query from client should be answered at all, by the longest
+     * matching ACL rule. Denied queries are counted, see writeMetrics().
+     */
+    bool isAllowed(const sockaddr* client, socklen_t client_length);
+
+    /**
+     * Replace the per-client limit checked by admitClient(). Buckets are kept
+     * unless the table size or the prefix lengths change.
+     */
+    void setRateLimit(const RateLimitConfig& limit);
+
+    /**
+     * Charge a query to the token bucket of client, false if the client is
+     * over its limit. Refused queries are counted, see writeMetrics().
+     */
+    bool admitClient(const sockaddr* client, socklen_t client_length);
+
+    /**
+     * Switch to a new configuration without dropping queries. Call after
+     * HealthChecker::reload() with the same pools, so that new backends already
+     * have a health index. Backends are matched by pool, IP and port. Returns false,
+     * keeping the backends that fit, when there are more than backendCapacity().
+     */
+    bool reload(const std::vector<ServerPool>& pools);
+
+    /**
+     * Take the backend identities and Maglev tables a previous process saved.
+     * Backends found in state with the same weight get their saved id back, so
+     * the hashed policies send queries where they went before the restart, and
+     * the view it publishes takes a saved Maglev table in place of the one it
+     * has if its healthy servers are those the table was built for. The saved
+     * tables are dropped then. Call once the pools, policies and routing are
+     * set, before queries come in.
+     * Returns how many backends got their id back.
+     */
+    size_t restoreState(const WarmState& state);
+
+    /**
+     * Identity of every backend and the Maglev tables of the current view, appended to state
+     */
+    void exportState(WarmState& state) const;
+
+    /**
+     * Print statistics about backend server usage
+     */
+    void printStats() const;
+
+    /**
+     * Select a backend for a query that is forwarded instead of answered here.
+     * Returns its index, below backendCount(), or -1 when no backend is available
+     * or all of them are over their qps_limit.
+     */
+    int selectBackendIndex(uint32_t qname_hash, int pool = ALL_POOLS);
+
+    // Slots in use, retired ones included. Indices below it stay valid for the lifetime of the balancer.
+    size_t backendCount() const { return slot_count_.load(std::memory_order_acquire); }
+    size_t backendCapacity() const { return slot_capacity_; }
+    const ComboAddress& backendAddress(size_t backend_index) const { return slots_[backend_index].address; }
+    // Forwarders account their in-flight queries in its outstanding counter
+    DownstreamState& backendState(size_t backend_index) const { return *slots_[backend_index].state; }
+
+    /**
+     * Changes whenever the set of healthy backends may have changed, so anything
+     * derived from a routing decision can be tagged with it and dropped when it moves
+     */
+    uint64_t viewGeneration() const { return view_generation_.load(std::memory_order_acquire); }
+
+    /**
+     * Whether queries that are not routed have a backend to go to right now
+     */
+    bool hasHealthyBackend() { return !healthyView().all.servers.empty(); }
+
+    // Returns an id for removeBackendListener()
+    size_t addBackendListener(BackendListener listener);
+    void removeBackendListener(size_t listener_id);
+
+    /**
+     * Queries sent to each slot so far, merged from the per-thread counters
+     */
+    std::vector<uint64_t> getBackendQueryCounts() const { return query_counters_->loadAll(); }
+
+    /**
+     * Round-trip time of a query answered by a backend, in microseconds. Safe from any thread.
+     */
+    void recordBackendLatency(size_t backend_index, uint64_t usec) { backend_latency_[backend_index].record(usec); }
+
+    /**
+     * Append per-backend queries, outstanding queries, health and latency plus the
+     * policy selection time, in the Prometheus text format
+     */
+    void writeMetrics(std::string& out) const;
+
+private:
+    /**
+     * Everything the hot path needs about one backend, padded to its own cache
+     * line(s). Only read per query, the query counters live in query_counters_.
+     */
+    struct alignas(64) BackendSlot {
+        std::shared_ptr<DownstreamState> state;
+        ComboAddress address;
+        dnswire::AnswerTemplate answer;      // pre-rendered A answer, size 0 if not IPv4
+        std::atomic<bool> healthy{false};
+        std::atomic<bool> retired{false};    // removed from the configuration by reload()
+        TokenBucket qps;                     // qps_limit, reconfigured in place by reload()
+        size_t pool_index{0};
+        int health_index{-1};                // position in HealthSnapshot, -1 once retired
+        std::string ip;
+    };
+
+    /**
+     * A load balancing policy by name, as setPolicy() resolves it
+     */
+    struct Policy {
+        std::string name;
+        PolicyKind kind{PolicyKind::RoundRobin};
+        ViewPolicy view_policy{ViewPolicy::None};
+        CustomPolicyFunction custom;         // only for PolicyKind::Custom
+    };
+
+    /**
+     * Healthy backends of one pool, or of all of them, in the form the dnsdist
+     * policies expect. Positions are numbered 1..n like ServerPool does,
+     * slot_index maps a position back to its slot. Only the precomputed state
+     * the policy needs is built.
+     */
+    struct PoolView {
+        ServerPolicy::NumberedServerVector servers;
+        std::vector<uint32_t> slot_index;
+        std::shared_ptr<const Policy> policy;
+        dnsdist::lbpolicies::ConsistentHashRing ring;   // for chashed and chashedBounded
+        dnsdist::lbpolicies::WeightedAliasTable alias;  // for wrandom and whashed
+        // for maglev, shared with the previous view while the healthy set is unchanged
+        std::shared_ptr<const dnsdist::lbpolicies::MaglevTable> maglev;
+    };
+
+    /**
+     * Immutable routing state and healthy backends, rebuilt together with the
+     * set of servers it describes and published as a whole
+     */
+    struct HealthyView {
+        uint64_t generation{0};
+        uint64_t snapshot_generation{0};     // of the HealthSnapshot it was built from
+        uint64_t weights_generation{0};      // of the backend weights it was built with
+        PoolView all;                        // every healthy backend, for unrouted queries
+        std::vector<PoolView> pools;         // indexed like pool_names_, empty without routing
+        std::shared_ptr<const PoolRouter> router;
+        std::shared_ptr<const PrefixTable> acl;   // 1 allows, 0 denies, null lets everyone in
+        bool acl_default_allow{true};
+        std::shared_ptr<ClientRateLimiter> client_limiter;   // null without a client limit
+    };
+
+    HealthChecker* health_checker_;
+    std::vector<std::string> pool_names_;
+    std::unique_ptr<BackendSlot[]> slots_;
+    // Only grows, under view_mutex_, published after the new slot is filled in
+    std::atomic<size_t> slot_count_{0};
+    size_t slot_capacity_{0};
+    // One counter per slot, per thread
+    std::unique_ptr<PerThreadCounters> query_counters_;
+    std::unique_ptr<LatencyHistogram[]> backend_latency_;
+    LatencyHistogram selection_time_;               // nanoseconds, sampled
+    PerThreadCounters acl_dropped_{1};
+    PerThreadCounters rate_limited_{2};             // by client, by backend
+
+    const std::string empty_ip_;
+    uint32_t answer_ttl_;
+
+    // Current healthy view, built under view_mutex_, published with std::atomic_store()
+    // and cached per thread. view_generation_ is the generation of the published view.
+    // view_mutex_ also serializes reload() and guards pool_names_, the policies,
+    // the routing, access control and rate limit rules and the backend listeners.
+    mutable std::mutex view_mutex_;
+    std::shared_ptr<const Policy> default_policy_;
+    std::vector<std::shared_ptr<const Policy>> pool_policies_;   // like pool_names_, null for the default
+    std::vector<std::string> pool_regions_;                      // geo_region of each pool
+    std::shared_ptr<const PoolRouter> router_;
+    std::shared_ptr<const PrefixTable> acl_;
+    bool acl_default_allow_{true};
+    std::shared_ptr<ClientRateLimiter> client_limiter_;
+    std::shared_ptr<const HealthyView> healthy_view_;
+    // Bumped by reload() whenever it changes the weight of a kept backend
+    uint64_t weights_generation_{0};
+    // Maglev tables from restoreState(), only slot_index and maglev are set. Empty
+    // again once restoreState() has published the view they are for.
+    PoolView warm_all_;
+    std::vector<PoolView> warm_pools_;                           // like pool_names_
+    std::atomic<uint64_t> view_generation_{0};
+    const uint64_t instance_id_;
+    size_t listener_id_{0};
+    std::vector<std::pair<size_t, BackendListener>> backend_listeners_;
+    size_t next_backend_listener_id_{0};
+
+    /**
+     * Initialize backend servers from configuration
+     */
+    void initializeBackends(const std::vector<ServerPool>& pools, size_t backend_capacity);
+
+    /**
+     * Match pools against the slots, fill and retire slots accordingly.
+     * Called with view_mutex_ held, returns false if some backend found no free slot.
+     */
+    bool updateBackends(const std::vector<ServerPool>& pools);
+
+    /**
+     * Build and publish a view, called with view_mutex_ held
+     */
+    void publishHealthyView(const HealthSnapshot& snapshot);
+
+    /**
+     * Latest published healthy view. The common case is a generation compare
+     * against the calling thread's cached view, never a rebuild.
+     */
+    const HealthyView& healthyView();
+
+    /**
+     * Build and publish a view for snapshot unless a newer one is already out,
+     * runs on the health check thread
+     */
+    void refreshHealthyView(const HealthSnapshot& snapshot);
+
+    /**
+     * Build a new view from a health snapshot, called with view_mutex_ held
+     */
+    std::shared_ptr<const HealthyView> buildHealthyView(const HealthSnapshot& snapshot);
+
+    /**
+     * Precompute what the policy of pool needs, reusing the Maglev table of warm,
+     * or else of previous, if it has the same servers. previous is null when weights changed.
+     */
+    static void preparePoolView(PoolView& pool, const PoolView* previous, const PoolView* warm);
+
+    /**
+     * pool/ip:port of a slot, as the warm state keys it. Called with view_mutex_ held.
+     */
+    std::string slotKey(size_t slot_index) const;
+
+    /**
+     * Resolve a policy name, built-in or registered. Unknown ones fall back to roundrobin.
+     */
+    static std::shared_ptr<const Policy> makePolicy(const std::string& policy_name);
+
+    /**
+     * Pool index for a routing target, by name then by geo_region, or PoolRouter::NO_POOL.
+     * Called with view_mutex_ held.
+     */
+    int findPool(const std::string& target) const;
+
+    /**
+     * Run the policy of pool over its healthy backends, over all of them if it
+     * has none, nullptr if no backend is available at all
+     */
+    BackendSlot* selectBackend(uint32_t qname_hash, int pool);
+
+    /**
+     * The selection loop of selectBackend() for one policy, pool_view is not empty
+     */
+    template <class Selector>
+    BackendSlot* selectWith(const PoolView& pool_view, uint32_t qname_hash);
+
+    /**
+     * The backend at position of pool_view, or the next one that is not over its
+     * qps limit, with its query counted. nullptr when all of them are over.
+     */
+    BackendSlot* admitBackend(const PoolView& pool_view, size_t position);
+};
+
+#endif // DNSDIST_LOAD_BALANCER_H
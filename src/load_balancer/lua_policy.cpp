@@ -0,0 +1,218 @@
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+#include <lua.hpp>
+#include "lua_policy.h"
+#include "../../load_balancing/dnsdist.hh"
+#include "../logging/logger.h"
+
+// The opaque types of the FFI interface. A dnsdist_ffi_server_t is the DownstreamState
+// itself, so handing a server to Lua costs nothing per query.
+struct dnsdist_ffi_servers_list_t {
+    const ServerPolicy::NumberedServerVector* servers;
+};
+
+struct dnsdist_ffi_dnsquestion_t {
+    uint32_t qname_hash;
+};
+
+static const DownstreamState* downstreamOf(const dnsdist_ffi_server_t* server) {
+    return reinterpret_cast<const DownstreamState*>(server);
+}
+
+// Looked up by LuaJIT in the executable's symbol table, which is why it is linked with ENABLE_EXPORTS
+extern "C" {
+
+size_t dnsdist_ffi_servers_list_get_count(const dnsdist_ffi_servers_list_t* list) {
+    return list->servers->size();
+}
+
+// Sets out to NULL for an index past the end, the getters below take that as "no server"
+void dnsdist_ffi_servers_list_get_server(const dnsdist_ffi_servers_list_t* list, size_t index,
+                                         const dnsdist_ffi_server_t** out) {
+    *out = index < list->servers->size()
+               ? reinterpret_cast<const dnsdist_ffi_server_t*>((*list->servers)[index].second.get())
+               : nullptr;
+}
+
+uint64_t dnsdist_ffi_server_get_outstanding(const dnsdist_ffi_server_t* server) {
+    return server ? downstreamOf(server)->outstanding.load() : 0;
+}
+
+bool dnsdist_ffi_server_is_up(const dnsdist_ffi_server_t* server) {
+    return server && downstreamOf(server)->isUp();
+}
+
+const char* dnsdist_ffi_server_get_name(const dnsdist_ffi_server_t* server) {
+    return server ? downstreamOf(server)->getName().c_str() : "";
+}
+
+const char* dnsdist_ffi_server_get_name_with_addr(const dnsdist_ffi_server_t* server) {
+    return server ? downstreamOf(server)->getNameWithAddr().c_str() : "";
+}
+
+int dnsdist_ffi_server_get_weight(const dnsdist_ffi_server_t* server) {
+    return server ? downstreamOf(server)->d_config.d_weight : 0;
+}
+
+int dnsdist_ffi_server_get_order(const dnsdist_ffi_server_t* server) {
+    return server ? downstreamOf(server)->d_config.order : 0;
+}
+
+double dnsdist_ffi_server_get_latency(const dnsdist_ffi_server_t* server) {
+    return server ? downstreamOf(server)->getRelevantLatencyUsec() : 0.0;
+}
+
+// init is ignored: the hash is the one the built-in hashed policies get, computed by the front-end
+size_t dnsdist_ffi_dnsquestion_get_qname_hash(const dnsdist_ffi_dnsquestion_t* dq, size_t /* init */) {
+    return dq->qname_hash;
+}
+
+} // extern "C"
+
+// Run in every new Lua state, so that policies can use ffi.C right away
+static const char* const FFI_PRELUDE = R"(
+ffi = require("ffi")
+ffi.cdef[[
+typedef struct dnsdist_ffi_servers_list_t dnsdist_ffi_servers_list_t;
+typedef struct dnsdist_ffi_server_t dnsdist_ffi_server_t;
+typedef struct dnsdist_ffi_dnsquestion_t dnsdist_ffi_dnsquestion_t;
+size_t dnsdist_ffi_servers_list_get_count(const dnsdist_ffi_servers_list_t* list);
+void dnsdist_ffi_servers_list_get_server(const dnsdist_ffi_servers_list_t* list, size_t idx, const dnsdist_ffi_server_t** out);
+uint64_t dnsdist_ffi_server_get_outstanding(const dnsdist_ffi_server_t* server);
+bool dnsdist_ffi_server_is_up(const dnsdist_ffi_server_t* server);
+const char* dnsdist_ffi_server_get_name(const dnsdist_ffi_server_t* server);
+const char* dnsdist_ffi_server_get_name_with_addr(const dnsdist_ffi_server_t* server);
+int dnsdist_ffi_server_get_weight(const dnsdist_ffi_server_t* server);
+int dnsdist_ffi_server_get_order(const dnsdist_ffi_server_t* server);
+double dnsdist_ffi_server_get_latency(const dnsdist_ffi_server_t* server);
+size_t dnsdist_ffi_dnsquestion_get_qname_hash(const dnsdist_ffi_dnsquestion_t* dq, size_t init);
+]]
+)";
+
+static std::atomic<size_t> s_next_policy_id{0};
+
+static const char* errorOf(lua_State* lua) {
+    const char* message = lua_tostring(lua, -1);
+    return message ? message : "unknown error";
+}
+
+static lua_State* newState() {
+    lua_State* lua = luaL_newstate();
+    if (!lua) {
+        throw std::runtime_error("Cannot create a Lua state");
+    }
+    luaL_openlibs(lua);
+    if (luaL_dostring(lua, FFI_PRELUDE) != 0) {
+        const std::string error = errorOf(lua);
+        lua_close(lua);
+        throw std::runtime_error("Cannot set up the Lua FFI interface: " + error);
+    }
+    return lua;
+}
+
+static int appendBytecode(lua_State*, const void* data, size_t size, void* bytecode) {
+    static_cast<std::string*>(bytecode)->append(static_cast<const char*>(data), size);
+    return 0;
+}
+
+namespace {
+// The Lua state of one thread, with the function of every policy it has run so far
+struct ThreadState {
+    lua_State* lua{nullptr};
+    std::vector<int> functions;       // registry reference by policy id, LUA_NOREF until loaded
+
+    ~ThreadState() {
+        if (lua) {
+            lua_close(lua);
+        }
+    }
+};
+}
+
+static thread_local ThreadState t_state;
+
+LuaFfiPolicy::LuaFfiPolicy(const std::string& name, const std::string& code)
+    : name_(name), id_(s_next_policy_id.fetch_add(1)) {
+    std::unique_ptr<lua_State, decltype(&lua_close)> lua(newState(), lua_close);
+    const std::string chunk_name = "=" + name;
+    if (luaL_loadbuffer(lua.get(), code.data(), code.size(), chunk_name.c_str()) != 0) {
+        throw std::runtime_error("Cannot compile Lua policy " + name + ": " + errorOf(lua.get()));
+    }
+    if (lua_dump(lua.get(), appendBytecode, &bytecode_) != 0) {
+        throw std::runtime_error("Cannot compile Lua policy " + name + " to bytecode");
+    }
+    // Run the chunk once here, so that one that returns no function fails at startup
+    if (lua_pcall(lua.get(), 0, 1, 0) != 0) {
+        throw std::runtime_error("Cannot load Lua policy " + name + ": " + errorOf(lua.get()));
+    }
+    if (!lua_isfunction(lua.get(), -1)) {
+        throw std::runtime_error("Lua policy " + name + " does not return a function");
+    }
+}
+
+std::optional<ServerPolicy::SelectedServerPosition> LuaFfiPolicy::select(
+    const ServerPolicy::NumberedServerVector& servers, uint32_t qname_hash) const {
+
+    if (!t_state.lua) {
+        try {
+            t_state.lua = newState();
+        } catch (const std::exception& e) {
+            LOG_ERROR("%s", e.what());
+            return std::nullopt;
+        }
+    }
+    lua_State* lua = t_state.lua;
+
+    if (t_state.functions.size() <= id_) {
+        t_state.functions.resize(id_ + 1, LUA_NOREF);
+    }
+    int& function = t_state.functions[id_];
+    if (function == LUA_NOREF) {
+        // The bytecode, not the source: parsing happened once, in the constructor
+        const std::string chunk_name = "=" + name_;
+        if (luaL_loadbuffer(lua, bytecode_.data(), bytecode_.size(), chunk_name.c_str()) != 0 ||
+            lua_pcall(lua, 0, 1, 0) != 0) {
+            LOG_ERROR("Cannot load Lua policy %s on this thread: %s", name_.c_str(), errorOf(lua));
+            lua_settop(lua, 0);
+            function = LUA_REFNIL;
+            return std::nullopt;
+        }
+        if (!lua_isfunction(lua, -1)) {
+            LOG_ERROR("Lua policy %s does not return a function on this thread", name_.c_str());
+            lua_settop(lua, 0);
+            function = LUA_REFNIL;
+            return std::nullopt;
+        }
+        function = luaL_ref(lua, LUA_REGISTRYINDEX);
+    }
+    if (function == LUA_REFNIL) {
+        return std::nullopt;
+    }
+
+    dnsdist_ffi_servers_list_t list{&servers};
+    dnsdist_ffi_dnsquestion_t dq{qname_hash};
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, function);
+    lua_pushlightuserdata(lua, &list);
+    lua_pushlightuserdata(lua, &dq);
+    if (lua_pcall(lua, 2, 1, 0) != 0) {
+        LOG_WARNING("Lua policy %s failed: %s", name_.c_str(), errorOf(lua));
+        lua_pop(lua, 1);
+        return std::nullopt;
+    }
+    const bool is_number = lua_isnumber(lua, -1) != 0;
+    const lua_Number index = lua_tonumber(lua, -1);
+    lua_pop(lua, 1);
+
+    // 0-based like in dnsdist, anything out of range means no server
+    if (!is_number || index < 0 || index >= static_cast<lua_Number>(servers.size())) {
+        return std::nullopt;
+    }
+    return static_cast<ServerPolicy::SelectedServerPosition>(index) + 1;
+}
+
+CustomPolicyFunction LuaFfiPolicy::makeFunction(std::shared_ptr<const LuaFfiPolicy> policy) {
+    return [policy](const ServerPolicy::NumberedServerVector& servers, uint32_t qname_hash) {
+        return policy->select(servers, qname_hash);
+    };
+}
@@ -0,0 +1,59 @@
+#ifndef LUA_POLICY_H
+#define LUA_POLICY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "selection_policies.h"
+
+/**
+ * A load balancing policy written in Lua and run by LuaJIT, with the FFI
+ * interface of dnsdist's setServerPolicyLuaFFIPerThread(): the code is a
+ * chunk that returns function(servers_list, dq), which returns the 0-based
+ * index of the server to use. The chunk can call the dnsdist_ffi_servers_list_*,
+ * dnsdist_ffi_server_* and dnsdist_ffi_dnsquestion_get_qname_hash functions
+ * through ffi.C, they are declared for it:
+ *
+ *     return function(servers_list, dq)
+ *         local count = tonumber(ffi.C.dnsdist_ffi_servers_list_get_count(servers_list))
+ *         return tonumber(ffi.C.dnsdist_ffi_dnsquestion_get_qname_hash(dq, 0)) % count
+ *     end
+ *
+ * The code is compiled to bytecode once, by the constructor. Every thread
+ * that selects with the policy gets a Lua state of its own on first use and
+ * loads the bytecode into it once, so queries never share a state or take a
+ * lock. An index out of range, or an error in the code, selects no server.
+ */
+class LuaFfiPolicy {
+public:
+    /**
+     * Throws std::runtime_error if code does not compile or does not return a function
+     */
+    LuaFfiPolicy(const std::string& name, const std::string& code);
+
+    LuaFfiPolicy(const LuaFfiPolicy&) = delete;
+    LuaFfiPolicy& operator=(const LuaFfiPolicy&) = delete;
+
+    /**
+     * 1-based position in servers, like the built-in policies
+     */
+    std::optional<ServerPolicy::SelectedServerPosition> select(const ServerPolicy::NumberedServerVector& servers,
+                                                               uint32_t qname_hash) const;
+
+    const std::string& name() const { return name_; }
+
+    /**
+     * The policy as DnsdistLoadBalancer::registerPolicy() takes it, keeping it alive
+     */
+    static CustomPolicyFunction makeFunction(std::shared_ptr<const LuaFfiPolicy> policy);
+
+private:
+    std::string name_;
+    std::string bytecode_;
+    size_t id_;                 // of the policy's function in the per-thread Lua states
+};
+
+#endif // LUA_POLICY_H
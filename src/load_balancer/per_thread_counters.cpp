@@ -0,0 +1,50 @@
+#include "per_thread_counters.h"
+
+static std::atomic<uint64_t> s_next_instance_id{1};
+
+thread_local std::vector<PerThreadCounters::LocalEntry> PerThreadCounters::t_blocks;
+
+PerThreadCounters::Block::Block(size_t count)
+    : lines(new Line[(count + PER_LINE - 1) / PER_LINE]) {
+    static_assert(sizeof(Line) == CPU_LEVEL1_DCACHE_LINESIZE, "counter line must fill a cache line");
+    for (size_t i = 0; i < (count + PER_LINE - 1) / PER_LINE; ++i) {
+        for (auto& value : lines[i].values) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+PerThreadCounters::PerThreadCounters(size_t count)
+    : count_(count), instance_id_(s_next_instance_id.fetch_add(1)) {
+}
+
+PerThreadCounters::Block& PerThreadCounters::registerThread() {
+    auto block = std::make_unique<Block>(count_);
+    Block* raw = block.get();
+    {
+        std::lock_guard<std::mutex> lock(blocks_mutex_);
+        blocks_.push_back(std::move(block));
+    }
+    t_blocks.push_back({instance_id_, raw});
+    return *raw;
+}
+
+uint64_t PerThreadCounters::load(size_t idx) const {
+    std::lock_guard<std::mutex> lock(blocks_mutex_);
+    uint64_t total = 0;
+    for (const auto& block : blocks_) {
+        total += block->at(idx).load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+std::vector<uint64_t> PerThreadCounters::loadAll() const {
+    std::vector<uint64_t> totals(count_, 0);
+    std::lock_guard<std::mutex> lock(blocks_mutex_);
+    for (const auto& block : blocks_) {
+        for (size_t i = 0; i < count_; ++i) {
+            totals[i] += block->at(i).load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
@@ -0,0 +1,90 @@
+#ifndef PER_THREAD_COUNTERS_H
+#define PER_THREAD_COUNTERS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../../load_balancing/stat_t.hh"
+
+/**
+ * A fixed set of uint64_t counters, sharded per thread.
+ *
+ * Each thread that increments gets its own block of counters, allocated on its
+ * own cache lines, and is the only writer of that block: an increment is a
+ * plain load and store, without a locked instruction or any cache line moving
+ * between cores. Readers merge the blocks lazily with load() / loadAll(), which
+ * is cheap next to the increments as long as it only happens for stats.
+ *
+ * Blocks are kept when their thread exits so no counts are lost. Each thread
+ * remembers its blocks by instance id, ids are never reused.
+ */
+class PerThreadCounters {
+public:
+    explicit PerThreadCounters(size_t count);
+
+    PerThreadCounters(const PerThreadCounters&) = delete;
+    PerThreadCounters& operator=(const PerThreadCounters&) = delete;
+
+    void increment(size_t idx, uint64_t value = 1) {
+        std::atomic<uint64_t>& counter = localBlock().at(idx);
+        // Single writer, relaxed load + store is enough and avoids a lock prefix
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    /**
+     * Sum of counter idx over all threads
+     */
+    uint64_t load(size_t idx) const;
+
+    /**
+     * Sums of all counters, one pass over the blocks
+     */
+    std::vector<uint64_t> loadAll() const;
+
+    size_t size() const { return count_; }
+
+private:
+    static constexpr size_t PER_LINE = CPU_LEVEL1_DCACHE_LINESIZE / sizeof(std::atomic<uint64_t>);
+
+    struct alignas(CPU_LEVEL1_DCACHE_LINESIZE) Line {
+        std::atomic<uint64_t> values[PER_LINE];
+    };
+
+    // Whole cache lines, so the next allocation never shares our last line
+    struct Block {
+        explicit Block(size_t count);
+        std::atomic<uint64_t>& at(size_t idx) { return lines[idx / PER_LINE].values[idx % PER_LINE]; }
+        const std::atomic<uint64_t>& at(size_t idx) const { return lines[idx / PER_LINE].values[idx % PER_LINE]; }
+        std::unique_ptr<Line[]> lines;
+    };
+
+    Block& localBlock() {
+        // Almost always a hit on the first entry, threads rarely use more than a
+        // couple of counter sets
+        for (const auto& entry : t_blocks) {
+            if (entry.owner == instance_id_) {
+                return *entry.block;
+            }
+        }
+        return registerThread();
+    }
+
+    Block& registerThread();
+
+    struct LocalEntry {
+        uint64_t owner;
+        Block* block;
+    };
+    static thread_local std::vector<LocalEntry> t_blocks;
+
+    const size_t count_;
+    const uint64_t instance_id_;
+    mutable std::mutex blocks_mutex_;
+    std::vector<std::unique_ptr<Block>> blocks_;
+};
+
+#endif // PER_THREAD_COUNTERS_H
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <map>
+#include <string_view>
+#include "pool_router.h"
+
+PoolRouter::PoolRouter(const Rules& rules)
+    : default_pool_(rules.default_pool), use_ecs_(rules.use_ecs) {
+    buildTrie(rules.suffixes);
+    std::vector<std::pair<Netmask, uint32_t>> subnets;
+    subnets.reserve(rules.subnets.size());
+    for (const auto& subnet : rules.subnets) {
+        subnets.emplace_back(subnet.first, static_cast<uint32_t>(subnet.second));
+    }
+    subnets_ = PrefixTable(subnets);
+}
+
+void PoolRouter::buildTrie(const std::vector<std::pair<DNSName, int>>& suffixes) {
+    // Built as a tree of maps first, the maps hand out the children already sorted
+    struct BuildNode {
+        std::map<std::string, BuildNode> children;
+        int pool{NO_POOL};
+    };
+    BuildNode root;
+
+    for (const auto& suffix : suffixes) {
+        const std::string wire = suffix.first.toDNSStringLC();
+        std::vector<std::string> labels;
+        for (size_t pos = 0; pos < wire.size() && wire[pos] != 0; pos += 1 + static_cast<uint8_t>(wire[pos])) {
+            labels.emplace_back(wire, pos + 1, static_cast<uint8_t>(wire[pos]));
+        }
+
+        // From the root down: com, example, www
+        BuildNode* node = &root;
+        for (auto label = labels.rbegin(); label != labels.rend(); ++label) {
+            node = &node->children[*label];
+        }
+        if (node->pool == NO_POOL) {
+            suffix_count_++;
+        }
+        node->pool = suffix.second;
+    }
+
+    // Breadth first, so that the children of every node end up next to each other
+    nodes_.emplace_back();
+    nodes_[0].pool = root.pool;
+    std::deque<std::pair<const BuildNode*, size_t>> pending{{&root, 0}};
+    while (!pending.empty()) {
+        const BuildNode* build = pending.front().first;
+        const size_t index = pending.front().second;
+        pending.pop_front();
+
+        nodes_[index].first_child = static_cast<uint32_t>(nodes_.size());
+        nodes_[index].child_count = static_cast<uint32_t>(build->children.size());
+        for (const auto& child : build->children) {
+            Node node;
+            node.label_offset = static_cast<uint32_t>(labels_.size());
+            node.label_length = static_cast<uint8_t>(child.first.size());
+            node.pool = child.second.pool;
+            labels_ += child.first;
+            pending.emplace_back(&child.second, nodes_.size());
+            nodes_.push_back(node);
+        }
+    }
+}
+
+int PoolRouter::route(const dnswire::QueryView& query, const sockaddr* client, socklen_t client_length) const {
+    int pool = routeQname(query);
+    if (pool != NO_POOL || subnets_.empty()) {
+        return pool != NO_POOL ? pool : default_pool_;
+    }
+
+    ComboAddress source;
+    uint8_t source_prefix = 0;
+    if (use_ecs_ && dnswire::getClientSubnet(query, source, source_prefix)) {
+        // Never more bits than the client disclosed, a /16 does not match a /24 rule
+        pool = routeAddress(source, source_prefix);
+    } else if (client && client_length > 0) {
+        pool = routeAddress(ComboAddress(client, client_length));
+    }
+    return pool != NO_POOL ? pool : default_pool_;
+}
+
+int PoolRouter::routeQname(const dnswire::QueryView& query) const {
+    int best = nodes_[0].pool;
+    if (nodes_[0].child_count == 0) {
+        return best;
+    }
+
+    // Label offsets, so that the qname can be walked from its last label
+    std::array<uint8_t, 128> starts;
+    size_t label_count = 0;
+    for (size_t pos = 0; pos < query.qname_length && query.qname[pos] != 0; pos += 1 + query.qname[pos]) {
+        starts[label_count++] = static_cast<uint8_t>(pos);
+    }
+
+    const std::string_view labels(labels_);
+    size_t node = 0;
+    char lowered[63];
+    while (label_count > 0 && nodes_[node].child_count > 0) {
+        const uint8_t* label = query.qname + starts[--label_count];
+        const uint8_t length = label[0];
+        for (uint8_t i = 0; i < length; ++i) {
+            lowered[i] = static_cast<char>(dns_tolower(label[1 + i]));
+        }
+        const std::string_view wanted(lowered, length);
+
+        const auto first = nodes_.begin() + nodes_[node].first_child;
+        const auto last = first + nodes_[node].child_count;
+        const auto child = std::lower_bound(first, last, wanted, [&labels](const Node& candidate, std::string_view value) {
+            return labels.substr(candidate.label_offset, candidate.label_length) < value;
+        });
+        if (child == last || labels.substr(child->label_offset, child->label_length) != wanted) {
+            break;
+        }
+        node = static_cast<size_t>(child - nodes_.begin());
+        if (nodes_[node].pool != NO_POOL) {
+            best = nodes_[node].pool;
+        }
+    }
+    return best;
+}
+
+int PoolRouter::routeAddress(const ComboAddress& address, int max_bits) const {
+    if (subnets_.empty()) {
+        return NO_POOL;
+    }
+    const uint32_t match = subnets_.lookup(address, max_bits);
+    return match != PrefixTable::NOT_FOUND ? static_cast<int>(match) : NO_POOL;
+}
@@ -0,0 +1,81 @@
+#ifndef POOL_ROUTER_H
+#define POOL_ROUTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../../load_balancing/dnsname.hh"
+#include "../../load_balancing/iputils.hh"
+#include "../server/dns_wire.h"
+#include "prefix_table.h"
+
+/**
+ * Maps a query to the pool that should answer it, before any policy runs.
+ *
+ * The qname is tried first against a suffix trie, the longest configured
+ * suffix wins. Otherwise the client is looked up by longest prefix in a
+ * subnet table: the EDNS Client Subnet address when the query carries one
+ * and use_ecs is set, the source address of the query otherwise. Queries
+ * that match no rule go to the default pool.
+ *
+ * The trie is flattened into one array with the children of a node next to
+ * each other, sorted by label, so a lookup is a binary search per label of the
+ * qname, straight on the wire format, without building a DNSName. The subnet
+ * table is a PrefixTable.
+ *
+ * Immutable once built, lookups are safe from any thread.
+ */
+class PoolRouter {
+public:
+    static constexpr int NO_POOL = -1;
+
+    struct Rules {
+        std::vector<std::pair<DNSName, int>> suffixes;
+        std::vector<std::pair<Netmask, int>> subnets;
+        int default_pool{NO_POOL};
+        bool use_ecs{true};
+    };
+
+    explicit PoolRouter(const Rules& rules);
+
+    /**
+     * Pool index for query from client, NO_POOL if no rule matches and there is no default pool
+     */
+    int route(const dnswire::QueryView& query, const sockaddr* client, socklen_t client_length) const;
+
+    /**
+     * Pool of the longest matching qname suffix, NO_POOL if none matches
+     */
+    int routeQname(const dnswire::QueryView& query) const;
+
+    /**
+     * Pool of the longest matching subnet using at most max_bits of address, NO_POOL if none matches
+     */
+    int routeAddress(const ComboAddress& address, int max_bits = 128) const;
+
+    size_t suffixCount() const { return suffix_count_; }
+    size_t subnetCount() const { return subnets_.size(); }
+
+private:
+    struct Node {
+        uint32_t label_offset{0};       // into labels_, lower case
+        uint32_t first_child{0};        // children are nodes_[first_child, first_child + child_count)
+        uint32_t child_count{0};
+        uint8_t label_length{0};
+        int pool{NO_POOL};              // NO_POOL unless a suffix ends here
+    };
+
+    std::vector<Node> nodes_;           // nodes_[0] is the root
+    std::string labels_;
+    size_t suffix_count_{0};
+    PrefixTable subnets_;
+    int default_pool_;
+    bool use_ecs_;
+
+    void buildTrie(const std::vector<std::pair<DNSName, int>>& suffixes);
+};
+
+#endif // POOL_ROUTER_H
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include "prefix_table.h"
+
+// STRIDE bits of a left-aligned 128-bit key starting at offset, zero past the end
+static inline unsigned chunkAt(uint64_t hi, uint64_t lo, unsigned offset) {
+    if (offset + 6 <= 64) {
+        return static_cast<unsigned>(hi >> (58 - offset)) & 63;
+    }
+    if (offset < 64) {
+        return static_cast<unsigned>((hi << (offset - 58)) | (lo >> (122 - offset))) & 63;
+    }
+    if (offset + 6 <= 128) {
+        return static_cast<unsigned>(lo >> (122 - offset)) & 63;
+    }
+    return offset < 128 ? static_cast<unsigned>(lo << (offset - 122)) & 63 : 0;
+}
+
+// Left-aligned key of an address, IPv4 in the top 32 bits. Returns false for IPv6.
+static inline bool keyOf(const ComboAddress& address, uint64_t& hi, uint64_t& lo) {
+    if (address.sin4.sin_family == AF_INET) {
+        hi = static_cast<uint64_t>(ntohl(address.sin4.sin_addr.s_addr)) << 32;
+        lo = 0;
+        return true;
+    }
+    const uint8_t* bytes = address.sin6.sin6_addr.s6_addr;
+    hi = 0;
+    lo = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        hi = (hi << 8) | bytes[i];
+        lo = (lo << 8) | bytes[8 + i];
+    }
+    return false;
+}
+
+// Positions up to and including chunk, a shift of 64 would be undefined
+static inline uint64_t upTo(unsigned chunk) {
+    return chunk == 63 ? ~0ULL : (2ULL << chunk) - 1;
+}
+
+PrefixTable::PrefixTable(const std::vector<std::pair<Netmask, uint32_t>>& prefixes) {
+    std::vector<BuildPrefix> v4;
+    std::vector<BuildPrefix> v6;
+    for (const auto& prefix : prefixes) {
+        BuildPrefix build{};
+        build.length = prefix.first.getBits();
+        build.value = prefix.second;
+        (keyOf(prefix.first.getMaskedNetwork(), build.hi, build.lo) ? v4 : v6).push_back(build);
+    }
+    root4_ = buildTree(v4);
+    root6_ = buildTree(v6);
+}
+
+uint32_t PrefixTable::buildTree(std::vector<BuildPrefix>& prefixes) {
+    if (prefixes.empty()) {
+        return NO_ENTRY;
+    }
+
+    // By address, then shorter first: the prefixes under one child end up next to each other
+    std::stable_sort(prefixes.begin(), prefixes.end(), [](const BuildPrefix& a, const BuildPrefix& b) {
+        if (a.hi != b.hi) {
+            return a.hi < b.hi;
+        }
+        if (a.lo != b.lo) {
+            return a.lo < b.lo;
+        }
+        return a.length < b.length;
+    });
+    // Stable, so the last of a run of duplicates is the one listed last
+    std::vector<BuildPrefix> unique;
+    unique.reserve(prefixes.size());
+    for (size_t i = 0; i < prefixes.size(); ++i) {
+        const BuildPrefix& prefix = prefixes[i];
+        if (i + 1 < prefixes.size() && prefixes[i + 1].hi == prefix.hi && prefixes[i + 1].lo == prefix.lo &&
+            prefixes[i + 1].length == prefix.length) {
+            continue;
+        }
+        unique.push_back(prefix);
+        unique.back().entry = static_cast<uint32_t>(entries_.size());
+        entries_.push_back({prefix.value, NO_ENTRY, prefix.length});
+    }
+
+    const uint32_t root = static_cast<uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+    buildNode(root, 0, unique.data(), unique.data() + unique.size(), NO_ENTRY);
+    return root;
+}
+
+void PrefixTable::buildNode(uint32_t index, unsigned depth, const BuildPrefix* begin, const BuildPrefix* end,
+                            uint32_t inherited) {
+    std::array<uint32_t, 64> leaf;
+    leaf.fill(inherited);
+
+    // Prefixes ending within this stride cover a range of leaves, shorter ones are overridden
+    std::vector<const BuildPrefix*> ending;
+    for (const BuildPrefix* prefix = begin; prefix != end; ++prefix) {
+        if (prefix->length <= depth + STRIDE) {
+            ending.push_back(prefix);
+        }
+    }
+    std::stable_sort(ending.begin(), ending.end(), [](const BuildPrefix* a, const BuildPrefix* b) {
+        return a->length < b->length;
+    });
+    for (const BuildPrefix* prefix : ending) {
+        const unsigned first = chunkAt(prefix->hi, prefix->lo, depth);
+        const unsigned span = 1U << (depth + STRIDE - prefix->length);
+        // Whatever covers the range so far contains the whole prefix
+        entries_[prefix->entry].parent = leaf[first];
+        std::fill(leaf.begin() + first, leaf.begin() + first + span, prefix->entry);
+    }
+
+    // Longer prefixes continue in a child per value of these bits, they are contiguous per value
+    std::vector<std::pair<const BuildPrefix*, const BuildPrefix*>> child_ranges;
+    uint64_t children = 0;
+    for (const BuildPrefix* prefix = begin; prefix != end;) {
+        if (prefix->length <= depth + STRIDE) {
+            ++prefix;
+            continue;
+        }
+        // A prefix ending here sorts before the longer ones of its value, never among them
+        const unsigned chunk = chunkAt(prefix->hi, prefix->lo, depth);
+        const BuildPrefix* last = prefix;
+        while (last != end && last->length > depth + STRIDE && chunkAt(last->hi, last->lo, depth) == chunk) {
+            ++last;
+        }
+        children |= 1ULL << chunk;
+        child_ranges.emplace_back(prefix, last);
+        prefix = last;
+    }
+
+    Node node;
+    node.children = children;
+    node.leaf_base = static_cast<uint32_t>(leaves_.size());
+    bool first_leaf = true;
+    for (unsigned chunk = 0; chunk < 64; ++chunk) {
+        if (children & (1ULL << chunk)) {
+            continue;
+        }
+        if (first_leaf || leaves_.back() != leaf[chunk]) {
+            node.leaves |= 1ULL << chunk;
+            leaves_.push_back(leaf[chunk]);
+            first_leaf = false;
+        }
+    }
+    node.child_base = static_cast<uint32_t>(nodes_.size());
+    nodes_.resize(nodes_.size() + child_ranges.size());
+    nodes_[index] = node;
+
+    for (size_t i = 0; i < child_ranges.size(); ++i) {
+        const BuildPrefix* child_begin = child_ranges[i].first;
+        const unsigned chunk = chunkAt(child_begin->hi, child_begin->lo, depth);
+        buildNode(node.child_base + static_cast<uint32_t>(i), depth + STRIDE, child_begin, child_ranges[i].second,
+                  leaf[chunk]);
+    }
+}
+
+uint32_t PrefixTable::lookup(const ComboAddress& address, int max_bits) const {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+    bool ipv4 = keyOf(address, hi, lo);
+    if (!ipv4 && address.isMappedIPv4()) {
+        // ::ffff:a.b.c.d, the IPv4 address is in the low 32 bits
+        hi = lo << 32;
+        lo = 0;
+        ipv4 = true;
+        max_bits -= 96;
+    }
+    const uint32_t root = ipv4 ? root4_ : root6_;
+    if (root == NO_ENTRY) {
+        return NOT_FOUND;
+    }
+
+    const Node* node = &nodes_[root];
+    unsigned offset = 0;
+    unsigned chunk = chunkAt(hi, lo, 0);
+    while (node->children & (1ULL << chunk)) {
+        node = &nodes_[node->child_base + __builtin_popcountll(node->children & upTo(chunk)) - 1];
+        offset += STRIDE;
+        chunk = chunkAt(hi, lo, offset);
+    }
+    uint32_t entry = leaves_[node->leaf_base + __builtin_popcountll(node->leaves & upTo(chunk)) - 1];
+
+    while (entry != NO_ENTRY && entries_[entry].length > max_bits) {
+        entry = entries_[entry].parent;
+    }
+    return entry == NO_ENTRY ? NOT_FOUND : entries_[entry].value;
+}
+
+size_t PrefixTable::memoryUsage() const {
+    return nodes_.capacity() * sizeof(Node) + leaves_.capacity() * sizeof(uint32_t) +
+           entries_.capacity() * sizeof(Entry);
+}
@@ -0,0 +1,92 @@
+#ifndef PREFIX_TABLE_H
+#define PREFIX_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "../../load_balancing/iputils.hh"
+
+/**
+ * Immutable longest-prefix-match table from IPv4 and IPv6 prefixes to a
+ * uint32_t value, after poptrie (Asai and Ohara, SIGCOMM 2015).
+ *
+ * Every node consumes 6 bits of the address. A node holds two 64-bit bitmaps
+ * over the 64 values of those bits: one marks the values that continue into a
+ * child node, the other marks where a run of identical leaves starts. Children
+ * and leaves of a node are stored contiguously, so the next position is a base
+ * index plus a popcount, and a lookup touches one 24-byte node per 6 bits of
+ * prefix plus one leaf: at most 6 nodes for IPv4 and 22 for IPv6.
+ *
+ * Built once, then shared read-only by all threads without any locking.
+ * IPv4-mapped IPv6 addresses are looked up as IPv4.
+ */
+class PrefixTable {
+public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    /**
+     * An empty table, every lookup returns NOT_FOUND
+     */
+    PrefixTable() = default;
+
+    /**
+     * For a prefix listed more than once, the last value wins
+     */
+    explicit PrefixTable(const std::vector<std::pair<Netmask, uint32_t>>& prefixes);
+
+    /**
+     * Value of the longest prefix containing address that is no longer than
+     * max_bits, or NOT_FOUND. max_bits keeps an EDNS Client Subnet lookup from
+     * matching prefixes longer than what the client disclosed.
+     */
+    uint32_t lookup(const ComboAddress& address, int max_bits = 128) const;
+
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    /**
+     * Bytes held by the nodes, leaves and entries
+     */
+    size_t memoryUsage() const;
+
+private:
+    static constexpr uint32_t NO_ENTRY = UINT32_MAX;
+    static constexpr unsigned STRIDE = 6;
+
+    struct Node {
+        uint64_t children{0};   // bit i: value i continues in a child node
+        uint64_t leaves{0};     // bit i: a new leaf starts at value i
+        uint32_t leaf_base{0};
+        uint32_t child_base{0};
+    };
+
+    // One per distinct prefix, what the leaves point at
+    struct Entry {
+        uint32_t value;
+        uint32_t parent;        // longest shorter prefix containing this one, or NO_ENTRY
+        uint8_t length;
+    };
+
+    // Prefix while building: address bits left-aligned in hi and lo
+    struct BuildPrefix {
+        uint64_t hi;
+        uint64_t lo;
+        uint8_t length;
+        uint32_t value;
+        uint32_t entry;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> leaves_;          // entry indices
+    std::vector<Entry> entries_;
+    uint32_t root4_{NO_ENTRY};
+    uint32_t root6_{NO_ENTRY};
+
+    uint32_t buildTree(std::vector<BuildPrefix>& prefixes);
+    void buildNode(uint32_t index, unsigned depth, const BuildPrefix* begin, const BuildPrefix* end,
+                   uint32_t inherited);
+};
+
+#endif // PREFIX_TABLE_H
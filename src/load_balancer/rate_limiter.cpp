@@ -0,0 +1,86 @@
+#include <cstring>
+#include <netinet/in.h>
+#include "rate_limiter.h"
+
+// splitmix64 finalizer, spreads subnets that differ in a few bits over all sets
+static inline uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+// First bits of a big-endian 64-bit word, bits may be 0 or 64
+static inline uint64_t keepBits(uint64_t value, unsigned bits) {
+    return bits == 0 ? 0 : bits >= 64 ? value : value & ~(~0ULL >> bits);
+}
+
+ClientRateLimiter::ClientRateLimiter(size_t capacity, uint8_t ipv4_bits, uint8_t ipv6_bits)
+    : ipv4_bits_(std::min<uint8_t>(ipv4_bits, 32)), ipv6_bits_(std::min<uint8_t>(ipv6_bits, 128)) {
+    // A power of two sets, at least one
+    size_t sets = 1;
+    while (sets * WAYS < capacity) {
+        sets <<= 1;
+    }
+    set_mask_ = sets - 1;
+    sets_ = std::make_unique<Set[]>(sets);
+    for (size_t i = 0; i < sets; ++i) {
+        for (size_t way = 0; way < WAYS; ++way) {
+            sets_[i].keys[way].store(0, std::memory_order_relaxed);
+            sets_[i].full_at[way].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+uint64_t ClientRateLimiter::keyOf(const sockaddr* client, socklen_t client_length) const {
+    if (client->sa_family == AF_INET && client_length >= static_cast<socklen_t>(sizeof(sockaddr_in))) {
+        const uint32_t address = ntohl(reinterpret_cast<const sockaddr_in*>(client)->sin_addr.s_addr);
+        return mix(keepBits(static_cast<uint64_t>(address) << 32, ipv4_bits_) | 4);
+    }
+    if (client->sa_family == AF_INET6 && client_length >= static_cast<socklen_t>(sizeof(sockaddr_in6))) {
+        const uint8_t* bytes = reinterpret_cast<const sockaddr_in6*>(client)->sin6_addr.s6_addr;
+        uint64_t hi = 0;
+        uint64_t lo = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            hi = (hi << 8) | bytes[i];
+            lo = (lo << 8) | bytes[8 + i];
+        }
+        hi = keepBits(hi, ipv6_bits_);
+        lo = keepBits(lo, ipv6_bits_ > 64 ? ipv6_bits_ - 64U : 0U);
+        return mix(mix(hi) ^ lo ^ 6);
+    }
+    return 0;
+}
+
+bool ClientRateLimiter::tryAcquire(const sockaddr* client, socklen_t client_length, int64_t now_ns) {
+    const int64_t interval = limit_.intervalNs();
+    if (interval == 0 || !client) {
+        return true;
+    }
+    const uint64_t key = keyOf(client, client_length);
+    if (key == 0) {
+        return true;
+    }
+    const int64_t tolerance = limit_.toleranceNs();
+
+    Set& set = sets_[key & set_mask_];
+    size_t victim = 0;
+    int64_t oldest = INT64_MAX;
+    for (size_t way = 0; way < WAYS; ++way) {
+        if (set.keys[way].load(std::memory_order_relaxed) == key) {
+            return TokenBucket::acquire(set.full_at[way], now_ns, interval, tolerance);
+        }
+        const int64_t full_at = set.full_at[way].load(std::memory_order_relaxed);
+        if (full_at < oldest) {
+            oldest = full_at;
+            victim = way;
+        }
+    }
+
+    // New client: evict the least recently charged bucket, its first query is always let through
+    set.full_at[victim].store(now_ns + interval, std::memory_order_relaxed);
+    set.keys[victim].store(key, std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,126 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/socket.h>
+
+/**
+ * Lock-free token bucket, in its GCRA form: instead of a token count and a
+ * refill time it keeps the single time at which the bucket would be full
+ * again, so a query is one load and one compare-exchange on one word.
+ *
+ * Thread-safe, unlike dnsdist's QPSLimiter. A rate of 0 lets everything
+ * through without reading the clock.
+ */
+class TokenBucket {
+public:
+    static int64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * rate queries per second with bursts of up to burst queries, burst 0 means rate.
+     * Can be called while other threads acquire.
+     */
+    void configure(uint32_t rate, uint32_t burst) {
+        const int64_t interval = rate > 0 ? std::max<int64_t>(1, 1000000000LL / rate) : 0;
+        tolerance_ns_.store(interval * (std::max(burst > 0 ? burst : rate, 1U) - 1), std::memory_order_relaxed);
+        interval_ns_.store(interval, std::memory_order_relaxed);
+    }
+
+    bool limited() const { return interval_ns_.load(std::memory_order_relaxed) != 0; }
+    int64_t intervalNs() const { return interval_ns_.load(std::memory_order_relaxed); }
+    int64_t toleranceNs() const { return tolerance_ns_.load(std::memory_order_relaxed); }
+
+    /**
+     * Take one token at now_ns, false if the bucket is empty
+     */
+    bool tryAcquire(int64_t now_ns) {
+        const int64_t interval = interval_ns_.load(std::memory_order_relaxed);
+        if (interval == 0) {
+            return true;
+        }
+        return acquire(full_at_, now_ns, interval, tolerance_ns_.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * The GCRA step on a bare timestamp, for buckets stored elsewhere
+     */
+    static bool acquire(std::atomic<int64_t>& full_at, int64_t now_ns, int64_t interval, int64_t tolerance) {
+        int64_t previous = full_at.load(std::memory_order_relaxed);
+        for (;;) {
+            const int64_t start = std::max(previous, now_ns);
+            if (start - now_ns > tolerance) {
+                return false;
+            }
+            if (full_at.compare_exchange_weak(previous, start + interval, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+private:
+    std::atomic<int64_t> full_at_{0};          // the bucket holds burst tokens again from then on
+    std::atomic<int64_t> interval_ns_{0};      // per token, 0 for no limit
+    std::atomic<int64_t> tolerance_ns_{0};     // (burst - 1) tokens ahead of time
+};
+
+/**
+ * Token buckets per client address or subnet, all with the same rate.
+ *
+ * The buckets live in a fixed set-associative table: a client hashes to one
+ * cache line holding WAYS buckets, and an unknown client takes the way whose
+ * bucket was charged least recently. A bucket that has not been used for
+ * burst / rate seconds is full again and losing it loses nothing, so the
+ * table only needs to be large enough for the clients that are active at the
+ * same time. Memory is fixed at 16 bytes per client.
+ *
+ * No locks: two threads adding different clients to the same set at once can
+ * have one overwrite the other, the loser just starts with a full bucket.
+ */
+class ClientRateLimiter {
+public:
+    /**
+     * Room for about capacity clients. IPv4 clients are grouped in /ipv4_bits
+     * subnets and IPv6 ones in /ipv6_bits, one bucket per subnet.
+     */
+    ClientRateLimiter(size_t capacity, uint8_t ipv4_bits, uint8_t ipv6_bits);
+
+    ClientRateLimiter(const ClientRateLimiter&) = delete;
+    ClientRateLimiter& operator=(const ClientRateLimiter&) = delete;
+
+    void configure(uint32_t rate, uint32_t burst) { limit_.configure(rate, burst); }
+
+    /**
+     * Charge one query to the bucket of client, false if it is over the limit
+     */
+    bool tryAcquire(const sockaddr* client, socklen_t client_length, int64_t now_ns);
+
+    size_t capacity() const { return (set_mask_ + 1) * WAYS; }
+    uint8_t ipv4Bits() const { return ipv4_bits_; }
+    uint8_t ipv6Bits() const { return ipv6_bits_; }
+
+private:
+    static constexpr size_t WAYS = 4;
+
+    struct alignas(64) Set {
+        std::atomic<uint64_t> keys[WAYS];      // 0 for a free way
+        std::atomic<int64_t> full_at[WAYS];
+    };
+
+    TokenBucket limit_;                        // never acquired, holds the rate and burst
+    std::unique_ptr<Set[]> sets_;
+    size_t set_mask_;
+    uint8_t ipv4_bits_;
+    uint8_t ipv6_bits_;
+
+    uint64_t keyOf(const sockaddr* client, socklen_t client_length) const;
+};
+
+#endif // RATE_LIMITER_H
@@ -0,0 +1,148 @@
+#ifndef SELECTION_POLICIES_H
+#define SELECTION_POLICIES_H
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../../load_balancing/dnsdist-lbpolicies.hh"
+
+/**
+ * The built-in load balancing policies, each one a separate type so that the
+ * selection loop is compiled once per policy, with the policy's lookup inlined
+ * or called directly. Which one a pool uses is still chosen at runtime, by one
+ * switch on PolicyKind per query instead of a std::function call. Custom is
+ * the one case that goes through a std::function, for policies plugged in at
+ * runtime.
+ */
+enum class PolicyKind {
+    RoundRobin,
+    LeastOutstanding,
+    WeightedRandom,
+    WeightedHashed,
+    ConsistentHashed,
+    BoundedConsistentHashed,
+    Maglev,
+    PowerOfTwoChoices,
+    EwmaLatency,
+    FirstAvailable,
+    Custom
+};
+
+/**
+ * Which precomputed structure of a pool view serves a policy
+ */
+enum class ViewPolicy { None, ConsistentRing, BoundedRing, Maglev, WeightedAlias, HashedAlias };
+
+/**
+ * A policy plugged in at runtime: picks a 1-based position in servers, or
+ * nothing. Gets the qname hash where dnsdist's policies get the DNSQuestion.
+ */
+using CustomPolicyFunction = std::function<std::optional<ServerPolicy::SelectedServerPosition>(
+    const ServerPolicy::NumberedServerVector& servers, uint32_t qname_hash)>;
+
+/**
+ * CRTP base of the selection policies. Derived::pick() runs the algorithm
+ * over a pool view, select() checks that the position it returns exists.
+ *
+ * A view is anything with the members the policy reads: servers, and ring,
+ * alias, maglev or policy->custom for the policies built on them.
+ */
+template <class Derived>
+struct SelectionPolicy {
+    using Position = ServerPolicy::SelectedServerPosition;
+
+    template <class View>
+    static std::optional<Position> select(const View& pool, uint32_t qname_hash) {
+        const std::optional<Position> position = Derived::pick(pool, qname_hash);
+        // Positions are 1-based, as in ServerPolicy::getSelectedBackend()
+        if (position && *position >= 1 && *position <= pool.servers.size()) {
+            return position;
+        }
+        return std::nullopt;
+    }
+};
+
+struct RoundRobinPolicy : SelectionPolicy<RoundRobinPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t) {
+        return roundrobin(pool.servers, nullptr);
+    }
+};
+
+struct LeastOutstandingPolicy : SelectionPolicy<LeastOutstandingPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t) {
+        return leastOutstanding(pool.servers, nullptr);
+    }
+};
+
+struct WeightedRandomPolicy : SelectionPolicy<WeightedRandomPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t) {
+        return wrandomFromAlias(pool.servers, pool.alias);
+    }
+};
+
+struct WeightedHashedPolicy : SelectionPolicy<WeightedHashedPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t qname_hash) {
+        return whashedFromAlias(pool.servers, pool.alias, qname_hash);
+    }
+};
+
+struct ConsistentHashedPolicy : SelectionPolicy<ConsistentHashedPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t qname_hash) {
+        return chashedFromRing(pool.servers, pool.ring, qname_hash);
+    }
+};
+
+struct BoundedConsistentHashedPolicy : SelectionPolicy<BoundedConsistentHashedPolicy> {
+    // Capacity of each backend, as a multiple of its fair share
+    static constexpr double LOAD_FACTOR = 1.25;
+
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t qname_hash) {
+        return chashedBoundedFromRing(pool.servers, pool.ring, qname_hash, LOAD_FACTOR);
+    }
+};
+
+struct MaglevPolicy : SelectionPolicy<MaglevPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t qname_hash) {
+        return maglevFromTable(pool.servers, *pool.maglev, qname_hash);
+    }
+};
+
+struct PowerOfTwoChoicesPolicy : SelectionPolicy<PowerOfTwoChoicesPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t) {
+        return p2c(pool.servers, nullptr);
+    }
+};
+
+struct EwmaLatencyPolicy : SelectionPolicy<EwmaLatencyPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t) {
+        return ewmaLatency(pool.servers, nullptr);
+    }
+};
+
+struct FirstAvailablePolicy : SelectionPolicy<FirstAvailablePolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t) {
+        return firstAvailable(pool.servers, nullptr);
+    }
+};
+
+struct CustomPolicy : SelectionPolicy<CustomPolicy> {
+    template <class View>
+    static std::optional<Position> pick(const View& pool, uint32_t qname_hash) {
+        return pool.policy->custom(pool.servers, qname_hash);
+    }
+};
+
+#endif // SELECTION_POLICIES_H
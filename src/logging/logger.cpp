@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <ctime>
+#include "logger.h"
+
+static_assert((Logger::RING_SIZE & (Logger::RING_SIZE - 1)) == 0, "The ring size has to be a power of two");
+
+/**
+ * Entries of one producer thread. head is only written by that thread, tail
+ * only by the drain thread; they live on separate cache lines.
+ */
+struct Logger::Ring {
+    std::array<Entry, RING_SIZE> entries;
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+    uint32_t thread_id{0};
+
+    // Rate limiting, only touched by the producer
+    int64_t window_second{0};
+    size_t window_count{0};
+    uint64_t suppressed{0};
+};
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static const char* levelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Error:
+        return "error";
+    case LogLevel::Warning:
+        return "warning";
+    case LogLevel::Info:
+        return "info";
+    case LogLevel::Debug:
+        return "debug";
+    }
+    return "info";
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::~Logger() {
+    stop();
+}
+
+bool Logger::parseLevel(const std::string& name, LogLevel& level) {
+    for (LogLevel candidate : {LogLevel::Error, LogLevel::Warning, LogLevel::Info, LogLevel::Debug}) {
+        if (name == levelName(candidate)) {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Logger::start() {
+    if (running_.exchange(true)) {
+        return;
+    }
+    drain_thread_ = std::thread(&Logger::drainLoop, this);
+}
+
+void Logger::stop() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    if (drain_thread_.joinable()) {
+        drain_thread_.join();
+    }
+    // Whatever came in while the drain thread was winding down
+    drainOnce();
+}
+
+Logger::Ring& Logger::localRing() {
+    thread_local Ring* ring = nullptr;
+    if (!ring) {
+        // Rings are never freed, the drain thread may still be reading one after its thread exits
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(std::make_unique<Ring>());
+        ring = rings_.back().get();
+        ring->thread_id = static_cast<uint32_t>(rings_.size());
+    }
+    return *ring;
+}
+
+bool Logger::push(Ring& ring, int64_t timestamp_us, LogLevel level, const char* format, va_list args) {
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= RING_SIZE) {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Entry& entry = ring.entries[head & (RING_SIZE - 1)];
+    const int length = vsnprintf(entry.text, sizeof(entry.text), format, args);
+    entry.length = static_cast<uint16_t>(length < 0 ? 0 : std::min<size_t>(length, sizeof(entry.text) - 1));
+    entry.timestamp_us = timestamp_us;
+    entry.level = level;
+    ring.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool Logger::pushFormatted(Ring& ring, int64_t timestamp_us, LogLevel level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    const bool pushed = push(ring, timestamp_us, level, format, args);
+    va_end(args);
+    return pushed;
+}
+
+void Logger::log(LogLevel level, const char* format, ...) {
+    const int64_t timestamp_us = nowUs();
+    va_list args;
+    va_start(args, format);
+
+    if (!running_.load(std::memory_order_acquire)) {
+        Entry entry;
+        const int length = vsnprintf(entry.text, sizeof(entry.text), format, args);
+        va_end(args);
+        entry.length = static_cast<uint16_t>(length < 0 ? 0 : std::min<size_t>(length, sizeof(entry.text) - 1));
+        entry.timestamp_us = timestamp_us;
+        entry.level = level;
+        std::string line;
+        writeLine(line, entry, 0);
+        fwrite(line.data(), 1, line.size(), stdout);
+        fflush(stdout);
+        return;
+    }
+
+    Ring& ring = localRing();
+    const size_t rate_limit = rate_limit_.load(std::memory_order_relaxed);
+    if (rate_limit > 0) {
+        const int64_t second = timestamp_us / 1000000;
+        if (second != ring.window_second) {
+            if (ring.suppressed > 0) {
+                pushFormatted(ring, timestamp_us, LogLevel::Warning,
+                              "%llu messages suppressed by the rate limit",
+                              static_cast<unsigned long long>(ring.suppressed));
+            }
+            ring.window_second = second;
+            ring.window_count = 0;
+            ring.suppressed = 0;
+        }
+        if (ring.window_count >= rate_limit) {
+            ++ring.suppressed;
+            ring.dropped.fetch_add(1, std::memory_order_relaxed);
+            va_end(args);
+            return;
+        }
+        ++ring.window_count;
+    }
+
+    push(ring, timestamp_us, level, format, args);
+    va_end(args);
+}
+
+uint64_t Logger::dropped() const {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    uint64_t total = 0;
+    for (const auto& ring : rings_) {
+        total += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Logger::writeLine(std::string& out, const Entry& entry, uint32_t thread_id) {
+    // ts=2026-01-01T00:00:00.000Z level=info thread=1 msg="..."
+    const time_t seconds = static_cast<time_t>(entry.timestamp_us / 1000000);
+    tm utc{};
+    gmtime_r(&seconds, &utc);
+    char prefix[96];
+    const int prefix_length = snprintf(prefix, sizeof(prefix),
+        "ts=%04d-%02d-%02dT%02d:%02d:%02d.%03dZ level=%s thread=%u msg=\"",
+        utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+        static_cast<int>((entry.timestamp_us / 1000) % 1000), levelName(entry.level), thread_id);
+    out.append(prefix, static_cast<size_t>(prefix_length));
+
+    for (size_t i = 0; i < entry.length; ++i) {
+        const char c = entry.text[i];
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+        } else if (c == '\n') {
+            out.append("\\n");
+            continue;
+        }
+        out.push_back(c);
+    }
+    out.append("\"\n");
+}
+
+bool Logger::drainOnce() {
+    std::string out;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        for (auto& ring : rings_) {
+            const uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            const uint64_t head = ring->head.load(std::memory_order_acquire);
+            for (uint64_t i = tail; i < head; ++i) {
+                writeLine(out, ring->entries[i & (RING_SIZE - 1)], ring->thread_id);
+            }
+            ring->tail.store(head, std::memory_order_release);
+        }
+    }
+    if (out.empty()) {
+        return false;
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    fflush(stdout);
+    return true;
+}
+
+void Logger::drainLoop() {
+    while (running_.load(std::memory_order_acquire)) {
+        if (!drainOnce()) {
+            std::this_thread::sleep_for(DRAIN_INTERVAL);
+        }
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class LogLevel : uint8_t { Error = 0, Warning = 1, Info = 2, Debug = 3 };
+
+/**
+ * Asynchronous logger for the hot path.
+ *
+ * Every thread that logs gets its own single-producer ring of fixed-size
+ * entries: logging formats the message straight into the next free entry and
+ * publishes it with one release store, without locks, allocations or
+ * syscalls. A background thread drains all rings and writes the lines to
+ * stdout in batches. When a ring is full the message is dropped and counted,
+ * the query path never waits for the terminal.
+ *
+ * Messages above the configured level are skipped before any formatting
+ * (use the LOG_* macros), and each thread may log at most rate_limit messages
+ * per second. What goes over the limit is counted and reported once the next
+ * second starts.
+ *
+ * Before start() and after stop() messages are written synchronously, so
+ * startup and shutdown output is never lost.
+ */
+class Logger {
+public:
+    static constexpr size_t RING_SIZE = 1024;        // entries per thread, power of two
+    static constexpr size_t MESSAGE_SIZE = 256;
+    static constexpr size_t DEFAULT_RATE_LIMIT = 1000;
+    static constexpr std::chrono::milliseconds DRAIN_INTERVAL{20};
+
+    static Logger& instance();
+
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    /**
+     * Start the drain thread
+     */
+    void start();
+    /**
+     * Write out what is queued and stop the drain thread
+     */
+    void stop();
+
+    void setLevel(LogLevel level) { level_.store(level, std::memory_order_relaxed); }
+    LogLevel level() const { return level_.load(std::memory_order_relaxed); }
+    bool enabled(LogLevel level) const { return level <= level_.load(std::memory_order_relaxed); }
+
+    /**
+     * Messages per second and thread, 0 for no limit
+     */
+    void setRateLimit(size_t messages_per_second) { rate_limit_.store(messages_per_second, std::memory_order_relaxed); }
+
+    void log(LogLevel level, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+    /**
+     * Messages lost to full rings or the rate limit
+     */
+    uint64_t dropped() const;
+
+    /**
+     * "error", "warning", "info" or "debug", returns false for anything else
+     */
+    static bool parseLevel(const std::string& name, LogLevel& level);
+
+private:
+    struct Entry {
+        int64_t timestamp_us{0};     // system clock
+        LogLevel level{LogLevel::Info};
+        uint16_t length{0};
+        char text[MESSAGE_SIZE];
+    };
+
+    struct Ring;
+
+    Logger() = default;
+
+    Ring& localRing();
+    static bool push(Ring& ring, int64_t timestamp_us, LogLevel level, const char* format, va_list args);
+    static bool pushFormatted(Ring& ring, int64_t timestamp_us, LogLevel level, const char* format, ...)
+        __attribute__((format(printf, 4, 5)));
+    bool drainOnce();
+    void drainLoop();
+    static void writeLine(std::string& out, const Entry& entry, uint32_t thread_id);
+
+    std::atomic<LogLevel> level_{LogLevel::Info};
+    std::atomic<size_t> rate_limit_{DEFAULT_RATE_LIMIT};
+    std::atomic<bool> running_{false};
+    std::thread drain_thread_;
+    mutable std::mutex rings_mutex_;     // guards rings_ (registration and draining)
+    std::vector<std::unique_ptr<Ring>> rings_;
+};
+
+#define LOG_AT(lvl, ...)                                                       \
+    do {                                                                       \
+        Logger& log_instance_ = Logger::instance();                            \
+        if (log_instance_.enabled(lvl)) {                                      \
+            log_instance_.log(lvl, __VA_ARGS__);                               \
+        }                                                                      \
+    } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LogLevel::Error, __VA_ARGS__)
+#define LOG_WARNING(...) LOG_AT(LogLevel::Warning, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::Info, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LogLevel::Debug, __VA_ARGS__)
+
+#endif // LOGGER_H
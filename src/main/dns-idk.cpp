@@ -1,13 +1,18 @@
 #include <boost/asio.hpp>
 #include <ldns/ldns.h>
 #include <iostream>
+#include <cstring>
 #include <thread>
 #include <vector>
 #include <signal.h>
 #include <unistd.h>
 #include "../config/config_loader.h"
 #include "../config/health_checker.h"
-#include "../config/load_balancer.h"
+#include "../load_balancer/dnsdist_load_balancer.h"
+#include "../logging/logger.h"
+#include "../server/packet_buffer_pool.h"
+#include "../server/udp_batch.h"
+#include "../server/dns_wire.h"
 using namespace std;
 
 using boost::asio::ip::udp;
@@ -17,7 +22,8 @@ const char* ZONE_NAME = "example.com."; // Our zone
 
 class DnsServer {
 public:
-    DnsServer(boost::asio::io_context& io_context, LoadBalancer* load_balancer)
+    // batch_size > 1 drains the socket with recvmmsg() and answers with sendmmsg()
+    DnsServer(boost::asio::io_context& io_context, DnsdistLoadBalancer* load_balancer, size_t batch_size = 1)
         : socket_(io_context, udp::endpoint(udp::v4(), DNS_PORT)),
           load_balancer_(load_balancer) {
         zone_dname_ = ldns_dname_new_frm_str(ZONE_NAME);
@@ -27,8 +33,13 @@ public:
         if (!load_balancer_) {
             throw std::runtime_error("LoadBalancer is null");
         }
-        start_receive();
-        
+        if (batch_size > 1) {
+            batch_ = std::make_unique<UdpBatch>(batch_size, PacketBufferPool::BUFFER_SIZE);
+            socket_.non_blocking(true);
+            start_batch_receive();
+        } else {
+            start_receive();
+        }
     }
     ~DnsServer() {
         if (zone_dname_) {
@@ -40,25 +51,74 @@ public:
 private:
     udp::socket socket_;
     udp::endpoint remote_endpoint_;
-    std::array<uint8_t, 512> recv_buffer_;
+    PacketBuffer recv_buffer_ = PacketBufferPool::acquire();
+    PacketBuffer send_buffer_ = PacketBufferPool::acquire();
+    std::unique_ptr<UdpBatch> batch_;
     ldns_rdf* zone_dname_;
-    LoadBalancer* load_balancer_;
+    DnsdistLoadBalancer* load_balancer_;
     
     void start_receive() {
         socket_.async_receive_from(
-            boost::asio::buffer(recv_buffer_), remote_endpoint_,
+            boost::asio::buffer(recv_buffer_.data(), recv_buffer_.size()), remote_endpoint_,
             [this](boost::system::error_code ec, std::size_t bytes_recvd) {
                 if (!ec && bytes_recvd > 0) {
-                    handle_request(bytes_recvd);
+                    size_t resp_len = handle_request(recv_buffer_.data(), bytes_recvd,
+                                                     send_buffer_.data(), send_buffer_.size());
+                    if (resp_len > 0) {
+                        boost::system::error_code send_ec;
+                        socket_.send_to(boost::asio::buffer(send_buffer_.data(), resp_len),
+                                        remote_endpoint_, 0, send_ec);
+                    }
                 }
                 start_receive();
             });
     }
 
-    void handle_request(std::size_t length) {
+    void start_batch_receive() {
+        socket_.async_wait(udp::socket::wait_read,
+            [this](boost::system::error_code ec) {
+                if (!ec) {
+                    process_batches();
+                }
+                start_batch_receive();
+            });
+    }
+
+    void process_batches() {
+        const int fd = socket_.native_handle();
+        for (;;) {
+            int got = batch_->receive(fd);
+            if (got <= 0) {
+                return;
+            }
+            for (int i = 0; i < got; ++i) {
+                size_t resp_len = handle_request(batch_->query(i), batch_->queryLength(i),
+                                                 batch_->responseBuffer(i), batch_->responseCapacity());
+                if (resp_len > 0) {
+                    batch_->queueResponse(i, resp_len);
+                }
+            }
+            batch_->flush(fd);
+            if (static_cast<size_t>(got) < batch_->batchSize()) {
+                return;
+            }
+        }
+    }
+
+    // Returns the length of the response written into response, 0 to drop the query
+    size_t handle_request(const uint8_t* query, std::size_t length,
+                          uint8_t* response, std::size_t response_capacity) {
     ldns_pkt* query_pkt;
-    ldns_status status = ldns_wire2pkt(&query_pkt, recv_buffer_.data(), length);
-    if (status != LDNS_STATUS_OK) return;
+    ldns_status status = ldns_wire2pkt(&query_pkt, query, length);
+    if (status != LDNS_STATUS_OK) return 0;
+
+    // The same qname hash the other front-ends give the hashed policies
+    dnswire::QueryView view;
+    const uint32_t qname_hash = dnswire::parseQuery(query, length, view) ? dnswire::hashQname(view) : 0;
+
+    // Never answer with more than the client can take: its EDNS UDP payload size, 512 without EDNS
+    size_t udp_payload_size = ldns_pkt_edns(query_pkt) ? ldns_pkt_edns_udp_size(query_pkt) : 512;
+    response_capacity = std::min(response_capacity, std::max<size_t>(udp_payload_size, 512));
 
     ldns_pkt* resp_pkt = ldns_pkt_new();
     ldns_pkt_set_id(resp_pkt, ldns_pkt_id(query_pkt));
@@ -76,17 +136,12 @@ private:
         ldns_rr_type qtype = ldns_rr_get_type(q);
 
         if (ldns_dname_compare(qname, zone_dname_) == 0 && qtype == LDNS_RR_TYPE_A) {
-            // Get domain name as string for load balancer
-            char* domain_str = ldns_rdf2str(qname);
-            std::string domain = domain_str ? std::string(domain_str) : "";
-            free(domain_str);
-            
             // Get next server from load balancer using round-robin
-            std::string backend_ip = load_balancer_->getServerForQuery(domain);
+            const std::string& backend_ip = load_balancer_->getServerForQuery(qname_hash);
             
             if (backend_ip.empty()) {
                 // No backend available, return SERVFAIL
-                std::cerr << "❌ No backend server available for query" << std::endl;
+                LOG_WARNING("No backend server available for query");
                 ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_SERVFAIL);
             } else {
                 // Create A record with backend server IP
@@ -100,9 +155,9 @@ private:
                 if (ldns_str2rdf_a(&ip_rdf, backend_ip.c_str()) == LDNS_STATUS_OK) {
                     ldns_rr_push_rdf(a_rr, ip_rdf);
                     ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_ANSWER, a_rr);
-                    std::cout << "✅ Responding with backend IP: " << backend_ip << std::endl;
+                    LOG_DEBUG("Responding with backend IP: %s", backend_ip.c_str());
                 } else {
-                    std::cerr << "❌ Failed to convert IP: " << backend_ip << std::endl;
+                    LOG_ERROR("Failed to convert IP: %s", backend_ip.c_str());
                     ldns_rr_free(a_rr);
                     ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_SERVFAIL);
                 }
@@ -115,22 +170,27 @@ private:
 
     // Convert packet to wire format - CORRECTED
     uint8_t* resp_wire = nullptr;
-    size_t resp_len;
+    size_t resp_len = 0;
     ldns_status wire_status = ldns_pkt2wire(&resp_wire, resp_pkt, &resp_len);
 
+    size_t written = 0;
     if (wire_status == LDNS_STATUS_OK && resp_wire) {
-        socket_.send_to(boost::asio::buffer(resp_wire, resp_len), remote_endpoint_);
+        if (resp_len <= response_capacity) {
+            memcpy(response, resp_wire, resp_len);
+            written = resp_len;
+        }
         free(resp_wire); // Free the allocated wire data
     }
 
     ldns_pkt_free(query_pkt);
     ldns_pkt_free(resp_pkt);
+    return written;
 }
 };
 
 // Global objects for signal handling
 HealthChecker* g_health_checker = nullptr;
-LoadBalancer* g_load_balancer = nullptr;
+DnsdistLoadBalancer* g_load_balancer = nullptr;
 
 void signalHandler(int signal) {
     std::cout << "\nReceived signal " << signal << ", shutting down gracefully..." << std::endl;
@@ -140,14 +200,24 @@ void signalHandler(int signal) {
     if (g_load_balancer) {
         g_load_balancer->printStats();
     }
+    Logger::instance().stop();
     exit(0);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     // Set up signal handlers for graceful shutdown
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
     
+    // --batch-size=N enables the recvmmsg/sendmmsg path
+    size_t batch_size = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--batch-size=", 0) == 0) {
+            batch_size = static_cast<size_t>(std::max(1, std::stoi(arg.substr(13))));
+        }
+    }
+    
     try {
         std::cout << " Starting DNS Load Balancer..." << std::endl;
         
@@ -166,6 +236,7 @@ int main() {
         };
         
         std::vector<ServerPool> pools;
+        GlobalSettings settings;
         bool config_loaded = false;
         
         for (const auto& config_path : possible_config_paths) {
@@ -173,17 +244,24 @@ int main() {
             pools = ConfigLoader::loadBackends(config_path);
             if (!pools.empty()) {
                 std::cout << " Successfully loaded config from: " << config_path << std::endl;
+                settings = ConfigLoader::loadGlobalSettings(config_path);
                 config_loaded = true;
                 break;
             }
         }
         
+        LogLevel log_level = LogLevel::Info;
+        Logger::parseLevel(settings.log_level, log_level);
+        Logger::instance().setLevel(log_level);
+        Logger::instance().setRateLimit(settings.log_rate_limit);
+        Logger::instance().start();
+        
         if (!config_loaded) {
             std::cout << "  No config file found, creating default test pool..." << std::endl;
             // Create a default test pool if no config is found
             ServerPool default_pool;
             default_pool.name = "test-pool";
-            default_pool.servers = {"192.168.1.100", "192.168.1.101", "192.168.99.99"}; // Include a down server
+            default_pool.servers = {{"192.168.1.100"}, {"192.168.1.101"}, {"192.168.99.99"}}; // Include a down server
             default_pool.health_endpoint = "http://192.168.1.100/health";
             default_pool.geo_region = "us-east";
             default_pool.check_interval_sec = 10;
@@ -191,17 +269,17 @@ int main() {
         }
         
         // Initialize and start health checker
-        HealthChecker health_checker(pools);
+        HealthChecker health_checker(pools, settings);
         g_health_checker = &health_checker;
         health_checker.start();
         
-        // Initialize load balancer with round-robin algorithm
-        LoadBalancer load_balancer(pools, &health_checker, LoadBalancingAlgorithm::ROUND_ROBIN);
+        // Initialize load balancer, round-robin by default
+        DnsdistLoadBalancer load_balancer(pools, &health_checker);
         g_load_balancer = &load_balancer;
         
         // Start DNS server with load balancer
         boost::asio::io_context io_context;
-        DnsServer server(io_context, &load_balancer);
+        DnsServer server(io_context, &load_balancer, batch_size);
         std::cout << " DNS server started on port " << DNS_PORT << std::endl;
         std::cout << " Health checker monitoring " << pools.size() << " server pools" << std::endl;
         
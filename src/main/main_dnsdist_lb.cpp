@@ -6,24 +6,48 @@
  */
 
 #include <boost/asio.hpp>
-#include <ldns/ldns.h>
 #include <iostream>
+#include <cstring>
 #include <thread>
 #include <vector>
 #include <memory>
 #include <signal.h>
 #include <unistd.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
 #include <atomic>
-#include <map>
+#include <mutex>
+#include <condition_variable>
 
-// Load balancing includes from dnsdist
-#include "../../load_balancing/dnsdist-lbpolicies.hh"
-#include "../../load_balancing/dnsdist-backend.hh"
-#include "../../load_balancing/dnsdist.hh"
+// Load balancer with the dnsdist policies
+#include "../load_balancer/dnsdist_load_balancer.h"
 
 // Configuration includes
 #include "../config/config_loader.h"
 #include "../config/health_checker.h"
+#include "../config/warm_state.h"
+
+// Logging and metrics
+#include "../logging/logger.h"
+#include "../metrics/metrics_server.h"
+
+// Server includes
+#include "../server/packet_buffer_pool.h"
+#include "../server/udp_batch.h"
+#include "../server/dns_wire.h"
+#include "../server/packet_cache.h"
+#include "../server/udp_forwarder.h"
+#include "../server/tcp_backend_pool.h"
+#include "../server/tcp_listener.h"
+#include "../server/traffic_rings.h"
+#include "../server/async_holder.h"
+#ifdef HAVE_XSK
+#include "../server/xsk_listener.h"
+#endif
+#ifdef HAVE_LUAJIT
+#include "../load_balancer/lua_policy.h"
+#endif
 
 using namespace std;
 using boost::asio::ip::udp;
@@ -32,376 +56,646 @@ const int DNS_PORT = 5353; // Use 53 if running as root
 const char* ZONE_NAME = "example.com."; // Our zone
 
 /**
- * Wrapper class to integrate dnsdist backend servers with our health checker
+ * Runtime options taken from the command line
  */
-class DnsdistLoadBalancer {
+struct ServerOptions {
+    std::string policy_name = "roundrobin";
+    int num_threads = 4;
+    bool reuse_port = false;   // one SO_REUSEPORT socket + io_context per thread
+    bool pin_cpus = false;     // pin each per-core worker to its own CPU
+    size_t batch_size = 1;     // > 1 enables the recvmmsg/sendmmsg fast path
+    uint32_t answer_ttl = DnsdistLoadBalancer::DEFAULT_ANSWER_TTL;
+    size_t packet_cache_size = 0;   // 0 disables the packet cache
+    bool forward = false;           // proxy queries to the backends instead of answering them
+    size_t backend_sockets = UdpForwarder::DEFAULT_SOCKETS_PER_BACKEND;
+    bool tcp = true;                // DNS over TCP listener next to the UDP one
+    size_t traffic_ring_size = TrafficRings::DEFAULT_RING_SIZE;   // 0 disables the traffic rings
+    uint16_t metrics_port = MetricsServer::DEFAULT_PORT;          // 0 disables the /metrics endpoint
+    uint32_t hold_no_backend_ms = 0;   // 0 answers SERVFAIL right away when no backend is healthy
+    std::string xsk_interface;      // empty disables the AF_XDP receive path
+    uint32_t xsk_queues = 1;        // NIC queues with an AF_XDP socket, from queue 0 on
+#ifdef XSK_BPF_OBJECT
+    std::string xsk_program = XSK_BPF_OBJECT;
+#else
+    std::string xsk_program;
+#endif
+};
+
+/**
+ * DNS Server with integrated dnsdist load balancing
+ */
+class DnsServer {
 public:
-    DnsdistLoadBalancer(const std::vector<ServerPool>& pools, HealthChecker* health_checker)
-        : health_checker_(health_checker), current_policy_name_("roundrobin") {
-        
-        if (!health_checker_) {
-            throw std::runtime_error("HealthChecker cannot be null");
-        }
-        
-        // Initialize server pools and create DownstreamState objects
-        initializeBackends(pools);
-        
-        // Set default policy to round-robin
-        setPolicy("roundrobin");
-        
-        std::cout << "✅ DnsdistLoadBalancer initialized with " 
-                  << backends_.size() << " backend servers" << std::endl;
-    }
-    
     /**
-     * Get the next server IP for a DNS query using the configured load balancing policy
+     * With reuse_port set, the socket is bound with SO_REUSEPORT so that several
+     * DnsServer instances (one per worker thread) can share DNS_PORT and let the
+     * kernel spread incoming queries across them.
+     *
+     * A batch_size above 1 switches to the batched path: the socket is drained
+     * with recvmmsg() whenever it becomes readable and all responses of a batch
+     * go out with a single sendmmsg().
+     *
+     * With a packet cache, repeated questions are answered from it without
+     * running the policy, until the set of healthy backends changes. Answers
+     * are cached per routing pool.
+     *
+     * With a forwarder every query is relayed to the selected backend, and the
+     * forwarder sends the response back on this server's socket.
+     *
+     * answer_query() is also what the TCP listener uses to answer locally.
+     *
+     * With traffic rings every UDP query and every response built here is
+     * recorded for the traffic summary, forwarded responses are recorded by
+     * the forwarder.
+     *
+     * With an async rule, see setAsyncRule(), a query can be parked while a
+     * slow decision is made and is answered once it is resumed.
      */
-    std::string getServerForQuery(const std::string& domain) {
-        // Filter healthy servers only
-        ServerPolicy::NumberedServerVector available_servers;
-        
-        for (size_t i = 0; i < backends_.size(); ++i) {
-            auto& backend = backends_[i];
-            std::string backend_ip = getBackendIP(backend);
-            
-            // Check if server is healthy
-            if (health_checker_->isHealthy(backend_ip)) {
-                available_servers.push_back({static_cast<unsigned int>(i), backend});
-            }
-        }
+    DnsServer(boost::asio::io_context& io_context, DnsdistLoadBalancer* load_balancer,
+              bool reuse_port = false, size_t batch_size = 1, PacketCache* packet_cache = nullptr,
+              UdpForwarder* forwarder = nullptr, TrafficRings* traffic_rings = nullptr)
+        : io_context_(io_context),
+          socket_(io_context),
+          load_balancer_(load_balancer),
+          packet_cache_(packet_cache),
+          forwarder_(forwarder),
+          traffic_rings_(traffic_rings) {
         
-        if (available_servers.empty()) {
-            std::cerr << "❌ No healthy backends available" << std::endl;
-            return "";
+        udp::endpoint endpoint(udp::v4(), DNS_PORT);
+        socket_.open(endpoint.protocol());
+        if (reuse_port) {
+            using reuse_port_option = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+            socket_.set_option(reuse_port_option(true));
         }
+        socket_.bind(endpoint);
         
-        // Use the dnsdist load balancing policy to select a server
-        try {
-            // Create a minimal DNSQuestion context (nullptr for now, as we don't need full context)
-            DNSQuestion* dq = nullptr;
-            
-            auto selected_pos = applyPolicy(available_servers, dq);
-            
-            if (selected_pos.has_value() && *selected_pos < available_servers.size()) {
-                auto& selected_backend = available_servers[*selected_pos].second;
-                std::string selected_ip = getBackendIP(selected_backend);
-                
-                // Update statistics
-                incrementBackendQueries(selected_backend);
-                
-                std::cout << "🎯 Policy '" << current_policy_name_ 
-                          << "' selected: " << selected_ip 
-                          << " (backend " << *selected_pos << ")" << std::endl;
-                
-                return selected_ip;
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "❌ Error applying load balancing policy: " << e.what() << std::endl;
-        }
-        
-        // Fallback to first available server if policy fails
-        if (!available_servers.empty()) {
-            auto& fallback = available_servers[0].second;
-            std::string fallback_ip = getBackendIP(fallback);
-            std::cout << "⚠️  Fallback to first available: " << fallback_ip << std::endl;
-            return fallback_ip;
+        if (!load_balancer_) {
+            throw std::runtime_error("LoadBalancer is null");
         }
         
-        return "";
-    }
-    
-    /**
-     * Change the load balancing policy
-     * Supported: roundrobin, leastOutstanding, wrandom, whashed, chashed, firstAvailable
-     */
-    void setPolicy(const std::string& policy_name) {
-        if (policy_name == "roundrobin") {
-            current_policy_ = roundrobin;
-            current_policy_name_ = "roundrobin";
-        } else if (policy_name == "leastOutstanding") {
-            current_policy_ = leastOutstanding;
-            current_policy_name_ = "leastOutstanding";
-        } else if (policy_name == "wrandom") {
-            current_policy_ = wrandom;
-            current_policy_name_ = "wrandom";
-        } else if (policy_name == "whashed") {
-            current_policy_ = whashed;
-            current_policy_name_ = "whashed";
-        } else if (policy_name == "chashed") {
-            current_policy_ = chashed;
-            current_policy_name_ = "chashed";
-        } else if (policy_name == "firstAvailable") {
-            current_policy_ = firstAvailable;
-            current_policy_name_ = "firstAvailable";
+        if (batch_size > 1) {
+            batch_ = std::make_unique<UdpBatch>(batch_size, PacketBufferPool::BUFFER_SIZE);
+            socket_.non_blocking(true);
+            start_batch_receive();
         } else {
-            std::cerr << "⚠️  Unknown policy '" << policy_name << "', using roundrobin" << std::endl;
-            current_policy_ = roundrobin;
-            current_policy_name_ = "roundrobin";
+            start_receive();
         }
-        
-        std::cout << "📋 Load balancing policy set to: " << current_policy_name_ << std::endl;
     }
-    
+
     /**
-     * Print statistics about backend server usage
+     * Answer a parsed query from the packet cache or build the answer, returns its length.
+     * pool comes from DnsdistLoadBalancer::routeQuery(). backend is set to the backend
+     * in the answer, or one of TrafficRings::CACHE_BACKEND and TrafficRings::NO_BACKEND.
      */
-    void printStats() const {
-        std::cout << "\n📊 Load Balancer Statistics:" << std::endl;
-        std::cout << "   Policy: " << current_policy_name_ << std::endl;
-        std::cout << "   Total Backends: " << backends_.size() << std::endl;
-        
-        size_t healthy_count = 0;
-        for (const auto& backend : backends_) {
-            std::string ip = getBackendIP(backend);
-            if (health_checker_->isHealthy(ip)) {
-                healthy_count++;
-            }
+    size_t answer_query(const dnswire::QueryView& q, uint32_t qname_hash, int pool,
+                        uint8_t* response, std::size_t response_capacity, int& backend) {
+        if (!packet_cache_) {
+            return build_response(q, qname_hash, pool, response, response_capacity, backend);
         }
-        std::cout << "   Healthy Backends: " << healthy_count << std::endl;
-        
-        // Print per-backend stats
-        for (size_t i = 0; i < backends_.size(); ++i) {
-            std::string ip = getBackendIP(backends_[i]);
-            bool is_healthy = health_checker_->isHealthy(ip);
-            uint64_t queries = getBackendQueryCount(backends_[i]);
-            
-            std::cout << "   Backend " << i << ": " << ip 
-                      << (is_healthy ? " ✓" : " ✗")
-                      << " (" << queries << " queries)" << std::endl;
+
+        // Each pool answers with its own backends, keep their answers apart
+        const uint32_t cache_hash = pool == DnsdistLoadBalancer::ALL_POOLS
+                                        ? qname_hash
+                                        : dnswire::hashQname(q, static_cast<uint32_t>(pool) + 1);
+        const bool do_bit = dnswire::hasDOBit(q);
+        const uint64_t generation = load_balancer_->viewGeneration();
+        size_t resp_len = packet_cache_->get(q, cache_hash, do_bit, generation, response, response_capacity);
+        if (resp_len > 0) {
+            backend = TrafficRings::CACHE_BACKEND;
+            return resp_len;
         }
+        resp_len = build_response(q, qname_hash, pool, response, response_capacity, backend);
+        if (resp_len > 0) {
+            packet_cache_->insert(q, cache_hash, do_bit, generation, response, resp_len);
+        }
+        return resp_len;
     }
 
-private:
-    HealthChecker* health_checker_;
-    std::vector<std::shared_ptr<DownstreamState>> backends_;
-    std::function<std::optional<ServerPolicy::SelectedServerPosition>(
-        const ServerPolicy::NumberedServerVector&, const DNSQuestion*)> current_policy_;
-    std::string current_policy_name_;
+    /**
+     * UDP queries received so far
+     */
+    uint64_t queries() const { return queries_.load(0); }
+
+    /**
+     * The UDP socket, where forwarded responses of queries received over AF_XDP go out
+     */
+    int socketFd() { return socket_.native_handle(); }
+
+    /**
+     * Let rule park UDP queries in holder, after routing. Set before the io_context runs.
+     */
+    void setAsyncRule(AsyncHolder* holder, const AsyncRule* rule) {
+        async_holder_ = holder;
+        async_rule_ = rule;
+    }
     
-    // Map to store backend IPs (since DownstreamState might not expose it directly)
-    std::map<DownstreamState*, std::string> backend_ip_map_;
-    std::map<DownstreamState*, std::atomic<uint64_t>> backend_query_count_;
+private:
+    boost::asio::io_context& io_context_;
+    udp::socket socket_;
+    udp::endpoint remote_endpoint_;
+    // Large enough for any EDNS query, responses are capped per client in handle_request()
+    PacketBuffer recv_buffer_ = PacketBufferPool::acquire();
+    PacketBuffer send_buffer_ = PacketBufferPool::acquire();
+    std::unique_ptr<UdpBatch> batch_;
+    DNSName zone_{ZONE_NAME};
+    DnsdistLoadBalancer* load_balancer_;
+    PacketCache* packet_cache_;
+    UdpForwarder* forwarder_;
+    TrafficRings* traffic_rings_;
+    AsyncHolder* async_holder_{nullptr};
+    const AsyncRule* async_rule_{nullptr};
+    PerThreadCounters queries_{1};
     
+    void start_receive() {
+        socket_.async_receive_from(
+            boost::asio::buffer(recv_buffer_.data(), recv_buffer_.size()), remote_endpoint_,
+            [this](boost::system::error_code ec, std::size_t bytes_recvd) {
+                if (!ec && bytes_recvd > 0) {
+                    size_t resp_len = handle_request(recv_buffer_.data(), bytes_recvd,
+                                                     send_buffer_.data(), send_buffer_.size(),
+                                                     remote_endpoint_.data(), remote_endpoint_.size());
+                    if (resp_len > 0) {
+                        boost::system::error_code send_ec;
+                        socket_.send_to(boost::asio::buffer(send_buffer_.data(), resp_len),
+                                        remote_endpoint_, 0, send_ec);
+                    }
+                }
+                start_receive();
+            });
+    }
+
     /**
-     * Initialize backend servers from configuration
+     * Wait for readability, then drain the socket one batch at a time
      */
-    void initializeBackends(const std::vector<ServerPool>& pools) {
-        for (const auto& pool : pools) {
-            for (const auto& server_ip : pool.servers) {
-                // Create a DownstreamState for each backend
-                // Note: This is a simplified version. In production dnsdist,
-                // DownstreamState is much more complex with connection pools, etc.
-                auto backend = std::make_shared<DownstreamState>();
-                
-                // Store the IP address for this backend
-                backend_ip_map_[backend.get()] = server_ip;
-                backend_query_count_[backend.get()] = 0;
-                
-                backends_.push_back(backend);
-                
-                std::cout << "   Added backend: " << server_ip 
-                          << " (pool: " << pool.name << ")" << std::endl;
+    void start_batch_receive() {
+        socket_.async_wait(udp::socket::wait_read,
+            [this](boost::system::error_code ec) {
+                if (!ec) {
+                    process_batches();
+                }
+                start_batch_receive();
+            });
+    }
+
+    void process_batches() {
+        const int fd = socket_.native_handle();
+        for (;;) {
+            int got = batch_->receive(fd);
+            if (got <= 0) {
+                return;
+            }
+
+            for (int i = 0; i < got; ++i) {
+                size_t resp_len = handle_request(batch_->query(i), batch_->queryLength(i),
+                                                 batch_->responseBuffer(i), batch_->responseCapacity(),
+                                                 batch_->remote(i), batch_->remoteLength(i));
+                if (resp_len > 0) {
+                    batch_->queueResponse(i, resp_len);
+                }
+            }
+            batch_->flush(fd);
+
+            // A partial batch means the socket buffer is empty
+            if (static_cast<size_t>(got) < batch_->batchSize()) {
+                return;
             }
         }
     }
-    
+
+public:
     /**
-     * Apply the current load balancing policy
+     * Build the response for one query into response, returns its length (0 to drop).
+     * The query is parsed in place and the answer written directly into response,
+     * so parsing and building the packet never touch the heap.
+     * Forwarded queries return 0, their response is sent by the forwarder, and
+     * so do suspended ones, their response is sent once they are resumed.
+     * The response is limited to the UDP payload size the client advertised.
+     * Also the entry point of queries received by an XskListener.
      */
-    std::optional<ServerPolicy::SelectedServerPosition> applyPolicy(
-        const ServerPolicy::NumberedServerVector& servers,
-        DNSQuestion* dq) const {
-        
-        if (current_policy_) {
-            return current_policy_(servers, dq);
+    size_t handle_request(const uint8_t* query, std::size_t length,
+                          uint8_t* response, std::size_t response_capacity,
+                          const sockaddr* client, socklen_t client_length) {
+        // Before parsing, a denied or flooding client costs a table lookup and gets no answer
+        if (!load_balancer_->isAllowed(client, client_length) ||
+            !load_balancer_->admitClient(client, client_length)) {
+            return 0;
         }
-        
-        // Fallback: return first server
-        if (!servers.empty()) {
+        dnswire::QueryView q;
+        if (!dnswire::parseQuery(query, length, q)) {
             return 0;
         }
-        
-        return std::nullopt;
+        queries_.increment(0);
+        const uint32_t qname_hash = dnswire::hashQname(q);
+        response_capacity = std::min<std::size_t>(response_capacity, dnswire::getUDPPayloadSize(q));
+        if (traffic_rings_) {
+            traffic_rings_->insertQuery(q, qname_hash, client, client_length);
+        }
+
+        const int pool = load_balancer_->routeQuery(q, client, client_length);
+        if (async_rule_ && suspend_query(q, query, length, qname_hash, pool, client, client_length)) {
+            return 0;
+        }
+        return respond(q, qname_hash, pool, response, response_capacity, client, client_length);
     }
-    
+
+private:
     /**
-     * Get IP address for a backend
+     * Forward or answer a routed query, the second half of handle_request()
      */
-    std::string getBackendIP(const std::shared_ptr<DownstreamState>& backend) const {
-        auto it = backend_ip_map_.find(backend.get());
-        if (it != backend_ip_map_.end()) {
-            return it->second;
+    size_t respond(const dnswire::QueryView& q, uint32_t qname_hash, int pool,
+                   uint8_t* response, std::size_t response_capacity,
+                   const sockaddr* client, socklen_t client_length) {
+        size_t resp_len = 0;
+        int backend = TrafficRings::NO_BACKEND;
+        if (forwarder_) {
+            if (forwarder_->forward(q, qname_hash, pool, socket_.native_handle(), client, client_length)) {
+                return 0;
+            }
+            resp_len = dnswire::writeErrorResponse(q, response, response_capacity, RCode::ServFail);
+        } else {
+            resp_len = answer_query(q, qname_hash, pool, response, response_capacity, backend);
         }
-        return "";
+
+        if (traffic_rings_ && resp_len > 0) {
+            traffic_rings_->insertResponse(response, resp_len, client, client_length, backend, 0);
+        }
+        return resp_len;
     }
-    
+
     /**
-     * Increment query count for a backend
+     * Park a copy of the query if the async rule wants it to wait, true if it did
      */
-    void incrementBackendQueries(const std::shared_ptr<DownstreamState>& backend) {
-        auto it = backend_query_count_.find(backend.get());
-        if (it != backend_query_count_.end()) {
-            it->second++;
+    bool suspend_query(const dnswire::QueryView& q, const uint8_t* query, std::size_t length, uint32_t qname_hash,
+                       int pool, const sockaddr* client, socklen_t client_length) {
+        const std::chrono::milliseconds timeout = async_rule_->timeout(q, pool);
+        if (timeout.count() <= 0 || client_length > sizeof(sockaddr_storage)) {
+            return false;
         }
+
+        auto held = std::make_unique<AsyncHolder::SuspendedQuery>();
+        held->packet = PacketBufferPool::acquire(length);
+        std::memcpy(held->packet.data(), query, length);
+        held->qname_hash = qname_hash;
+        held->pool = pool;
+        std::memcpy(&held->client, client, client_length);
+        held->client_length = client_length;
+        auto resumer = [this](std::unique_ptr<AsyncHolder::SuspendedQuery> resumed, bool expired) {
+            resume_query(std::move(resumed), expired);
+        };
+        const uint64_t id = async_holder_->suspend(held, timeout, io_context_, resumer);
+        if (id == 0) {
+            return false;
+        }
+        async_rule_->start(id, q, pool);
+        return true;
     }
-    
+
     /**
-     * Get query count for a backend
+     * Answer a query handed back by the async holder, on this server's io_context.
+     * One that expired goes on with the pool it was routed to before.
      */
-    uint64_t getBackendQueryCount(const std::shared_ptr<DownstreamState>& backend) const {
-        auto it = backend_query_count_.find(backend.get());
-        if (it != backend_query_count_.end()) {
-            return it->second.load();
+    void resume_query(std::unique_ptr<AsyncHolder::SuspendedQuery> held, bool expired) {
+        dnswire::QueryView q;
+        if (!dnswire::parseQuery(held->packet.data(), held->packet.size(), q)) {
+            return;
+        }
+        if (expired) {
+            LOG_DEBUG("Suspended query timed out, going on with pool %d", held->pool);
+        }
+        // Not send_buffer_, a receive handler may be using it on another thread of a shared io_context
+        PacketBuffer response = PacketBufferPool::acquire();
+        const std::size_t capacity = std::min<std::size_t>(response.capacity(), dnswire::getUDPPayloadSize(q));
+        const auto* client = reinterpret_cast<const sockaddr*>(&held->client);
+        const size_t resp_len = respond(q, held->qname_hash, held->pool, response.data(), capacity,
+                                        client, held->client_length);
+        if (resp_len > 0) {
+            sendto(socket_.native_handle(), response.data(), resp_len, MSG_DONTWAIT, client, held->client_length);
+        }
+    }
+
+    size_t build_response(const dnswire::QueryView& q, uint32_t qname_hash, int pool,
+                          uint8_t* response, std::size_t response_capacity, int& backend) {
+        backend = TrafficRings::NO_BACKEND;
+        if (q.qtype != QType::A || !dnswire::qnameEquals(q, zone_)) {
+            // Not in zone → NXDOMAIN
+            return dnswire::writeErrorResponse(q, response, response_capacity, RCode::NXDomain);
+        }
+
+        // Get next server from load balancer using dnsdist policies
+        const dnswire::AnswerTemplate* answer = load_balancer_->getAnswerForQuery(qname_hash, &backend, pool);
+        if (!answer) {
+            // No backend available, return SERVFAIL
+            LOG_WARNING("No backend server available for query");
+            return dnswire::writeErrorResponse(q, response, response_capacity, RCode::ServFail);
         }
-        return 0;
+
+        return dnswire::writeTemplatedResponse(q, response, response_capacity, *answer);
     }
 };
 
 /**
- * DNS Server with integrated dnsdist load balancing
+ * One SO_REUSEPORT listener driven by its own io_context and thread
  */
-class DnsServer {
+struct DnsWorker {
+    boost::asio::io_context io_context{1};
+    std::unique_ptr<DnsServer> server;
+    std::unique_ptr<TcpListener> tcp_listener;
+    std::thread thread;
+};
+
+/**
+ * Pin a thread to a single CPU, returns false if the kernel refused
+ */
+static bool pinThreadToCPU(std::thread& thread, int cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(cpuset), &cpuset) == 0;
+}
+
+/**
+ * TCP listener on the same port, answering like server or forwarding over backend_pool
+ */
+static std::unique_ptr<TcpListener> makeTcpListener(boost::asio::io_context& io_context, DnsServer& server,
+                                                    DnsdistLoadBalancer* load_balancer,
+                                                    TcpBackendPool* backend_pool, bool reuse_port) {
+    auto handler = [&server](const dnswire::QueryView& q, uint32_t qname_hash, int pool,
+                             uint8_t* response, size_t capacity) {
+        int backend = TrafficRings::NO_BACKEND;
+        return server.answer_query(q, qname_hash, pool, response, capacity, backend);
+    };
+    return std::make_unique<TcpListener>(io_context, DNS_PORT, handler, load_balancer, backend_pool, reuse_port);
+}
+
+/**
+ * Async rule that parks UDP queries while no backend is healthy, until a
+ * health snapshot brings one back or the timeout. Queries that come in before
+ * the first health checks are done, or while every backend is down for a
+ * moment, wait for them instead of getting SERVFAIL.
+ */
+class HealthWaitRule {
 public:
-    DnsServer(boost::asio::io_context& io_context, DnsdistLoadBalancer* load_balancer)
-        : socket_(io_context, udp::endpoint(udp::v4(), DNS_PORT)),
-          load_balancer_(load_balancer) {
-        
-        zone_dname_ = ldns_dname_new_frm_str(ZONE_NAME);
-        if (!zone_dname_) {
-            throw std::runtime_error("Failed to create zone dname");
-        }
-        if (!load_balancer_) {
-            throw std::runtime_error("LoadBalancer is null");
-        }
-        
-        start_receive();
-    }
-    
-    ~DnsServer() {
-        if (zone_dname_) {
-            ldns_rdf_deep_free(zone_dname_);
-        }
+    HealthWaitRule(AsyncHolder& holder, HealthChecker& health_checker, DnsdistLoadBalancer& load_balancer,
+                   std::chrono::milliseconds timeout)
+        : holder_(holder), health_checker_(health_checker), load_balancer_(load_balancer) {
+        rule_.timeout = [this, timeout](const dnswire::QueryView&, int) {
+            return load_balancer_.hasHealthyBackend() ? std::chrono::milliseconds(0) : timeout;
+        };
+        // Nothing to keep per query, the listener hands back everything the holder has. A snapshot
+        // that came in between timeout() and suspend() found nothing to resume, so check again.
+        rule_.start = [this](uint64_t id, const dnswire::QueryView&, int pool) {
+            if (load_balancer_.hasHealthyBackend()) {
+                holder_.resume(id, pool);
+            }
+        };
+        // After the load balancer's listener, its view already follows the snapshot when this one runs
+        listener_id_ = health_checker_.addSnapshotListener([this](const HealthSnapshot&) {
+            if (load_balancer_.hasHealthyBackend()) {
+                holder_.resumeAll();
+            }
+        });
     }
 
-private:
-    udp::socket socket_;
-    udp::endpoint remote_endpoint_;
-    std::array<uint8_t, 512> recv_buffer_;
-    ldns_rdf* zone_dname_;
-    DnsdistLoadBalancer* load_balancer_;
-    
-    void start_receive() {
-        socket_.async_receive_from(
-            boost::asio::buffer(recv_buffer_), remote_endpoint_,
-            [this](boost::system::error_code ec, std::size_t bytes_recvd) {
-                if (!ec && bytes_recvd > 0) {
-                    handle_request(bytes_recvd);
-                }
-                start_receive();
-            });
-    }
+    ~HealthWaitRule() { health_checker_.removeSnapshotListener(listener_id_); }
 
-    void handle_request(std::size_t length) {
-        ldns_pkt* query_pkt;
-        ldns_status status = ldns_wire2pkt(&query_pkt, recv_buffer_.data(), length);
-        if (status != LDNS_STATUS_OK) return;
-
-        ldns_pkt* resp_pkt = ldns_pkt_new();
-        ldns_pkt_set_id(resp_pkt, ldns_pkt_id(query_pkt));
-        ldns_pkt_set_qr(resp_pkt, true);  // response
-        ldns_pkt_set_aa(resp_pkt, true);  // authoritative
-        ldns_pkt_set_ra(resp_pkt, false);
-
-        ldns_rr_list* qlist = ldns_pkt_question(query_pkt);
-        ldns_pkt_push_rr_list(resp_pkt, LDNS_SECTION_QUESTION, ldns_rr_list_clone(qlist));
-
-        // Process each question
-        for (size_t i = 0; i < ldns_rr_list_rr_count(qlist); ++i) {
-            ldns_rr* q = ldns_rr_list_rr(qlist, i);
-            ldns_rdf* qname = ldns_rr_owner(q);
-            ldns_rr_type qtype = ldns_rr_get_type(q);
-
-            if (ldns_dname_compare(qname, zone_dname_) == 0 && qtype == LDNS_RR_TYPE_A) {
-                // Get domain name as string for load balancer
-                char* domain_str = ldns_rdf2str(qname);
-                std::string domain = domain_str ? std::string(domain_str) : "";
-                free(domain_str);
-                
-                // Get next server from load balancer using dnsdist policies
-                std::string backend_ip = load_balancer_->getServerForQuery(domain);
-                
-                if (backend_ip.empty()) {
-                    // No backend available, return SERVFAIL
-                    std::cerr << "❌ No backend server available for query" << std::endl;
-                    ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_SERVFAIL);
-                } else {
-                    // Create A record with backend server IP
-                    ldns_rr* a_rr = ldns_rr_new();
-                    ldns_rr_set_owner(a_rr, ldns_rdf_clone(qname));
-                    ldns_rr_set_type(a_rr, LDNS_RR_TYPE_A);
-                    ldns_rr_set_class(a_rr, LDNS_RR_CLASS_IN);
-                    ldns_rr_set_ttl(a_rr, 300); // TTL 5min
-
-                    ldns_rdf* ip_rdf;
-                    if (ldns_str2rdf_a(&ip_rdf, backend_ip.c_str()) == LDNS_STATUS_OK) {
-                        ldns_rr_push_rdf(a_rr, ip_rdf);
-                        ldns_pkt_push_rr(resp_pkt, LDNS_SECTION_ANSWER, a_rr);
-                        std::cout << "✅ Responding with backend IP: " << backend_ip << std::endl;
-                    } else {
-                        std::cerr << "❌ Failed to convert IP: " << backend_ip << std::endl;
-                        ldns_rr_free(a_rr);
-                        ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_SERVFAIL);
-                    }
-                }
-            } else {
-                // Not in zone → NXDOMAIN
-                ldns_pkt_set_rcode(resp_pkt, LDNS_RCODE_NXDOMAIN);
-            }
-        }
+    HealthWaitRule(const HealthWaitRule&) = delete;
+    HealthWaitRule& operator=(const HealthWaitRule&) = delete;
 
-        // Convert packet to wire format
-        uint8_t* resp_wire = nullptr;
-        size_t resp_len;
-        ldns_status wire_status = ldns_pkt2wire(&resp_wire, resp_pkt, &resp_len);
+    const AsyncRule& rule() const { return rule_; }
 
-        if (wire_status == LDNS_STATUS_OK && resp_wire) {
-            socket_.send_to(boost::asio::buffer(resp_wire, resp_len), remote_endpoint_);
-            free(resp_wire);
-        }
+private:
+    AsyncHolder& holder_;
+    HealthChecker& health_checker_;
+    DnsdistLoadBalancer& load_balancer_;
+    AsyncRule rule_;
+    size_t listener_id_{0};
+};
 
-        ldns_pkt_free(query_pkt);
-        ldns_pkt_free(resp_pkt);
+/**
+ * Parse command line: [policy] [--threads=N] [--reuseport] [--pin-cpus] [--batch-size=N] [--ttl=N]
+ *                     [--packet-cache=N] [--forward] [--backend-sockets=N] [--no-tcp] [--rings=N]
+ *                     [--metrics-port=N] [--xsk=IFACE] [--xsk-queues=N] [--xsk-prog=PATH]
+ *                     [--hold-no-backend=MS]
+ */
+static ServerOptions parseOptions(int argc, char* argv[]) {
+    ServerOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--threads=", 0) == 0) {
+            options.num_threads = std::max(1, std::stoi(arg.substr(10)));
+        } else if (arg == "--reuseport") {
+            options.reuse_port = true;
+        } else if (arg == "--pin-cpus") {
+            options.pin_cpus = true;
+        } else if (arg.rfind("--ttl=", 0) == 0) {
+            options.answer_ttl = static_cast<uint32_t>(std::stoul(arg.substr(6)));
+        } else if (arg.rfind("--batch-size=", 0) == 0) {
+            options.batch_size = static_cast<size_t>(std::max(1, std::stoi(arg.substr(13))));
+        } else if (arg.rfind("--packet-cache=", 0) == 0) {
+            options.packet_cache_size = static_cast<size_t>(std::stoul(arg.substr(15)));
+        } else if (arg == "--forward") {
+            options.forward = true;
+        } else if (arg.rfind("--backend-sockets=", 0) == 0) {
+            options.backend_sockets = static_cast<size_t>(std::max(1, std::stoi(arg.substr(18))));
+        } else if (arg == "--no-tcp") {
+            options.tcp = false;
+        } else if (arg.rfind("--rings=", 0) == 0) {
+            options.traffic_ring_size = static_cast<size_t>(std::stoul(arg.substr(8)));
+        } else if (arg.rfind("--metrics-port=", 0) == 0) {
+            options.metrics_port = static_cast<uint16_t>(std::stoul(arg.substr(15)));
+        } else if (arg.rfind("--xsk=", 0) == 0) {
+            options.xsk_interface = arg.substr(6);
+        } else if (arg.rfind("--xsk-queues=", 0) == 0) {
+            options.xsk_queues = static_cast<uint32_t>(std::max(1, std::stoi(arg.substr(13))));
+        } else if (arg.rfind("--xsk-prog=", 0) == 0) {
+            options.xsk_program = arg.substr(11);
+        } else if (arg.rfind("--hold-no-backend=", 0) == 0) {
+            options.hold_no_backend_ms = static_cast<uint32_t>(std::stoul(arg.substr(18)));
+        } else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "⚠️  Ignoring unknown option: " << arg << std::endl;
+        } else {
+            options.policy_name = arg;
+        }
     }
-};
+    return options;
+}
 
 // Global objects for signal handling
 HealthChecker* g_health_checker = nullptr;
 DnsdistLoadBalancer* g_load_balancer = nullptr;
+UdpForwarder* g_forwarder = nullptr;
+TrafficRings* g_traffic_rings = nullptr;
+#ifdef HAVE_XSK
+XskProgram* g_xsk_program = nullptr;
+#endif
+/**
+ * Save the health, backend ids and Maglev tables for the next start to pick up
+ */
+static void saveWarmState(const std::string& state_file, const HealthChecker& health_checker,
+                          const DnsdistLoadBalancer& load_balancer) {
+    WarmState state;
+    health_checker.exportState(state);
+    load_balancer.exportState(state);
+    // Failures are logged, the next round tries again
+    state.save(state_file);
+}
+
+/**
+ * Rewrites the state file every interval on a thread of its own, so that a
+ * crash loses little more than that. stop() waits for a save in progress.
+ */
+class StateSaver {
+public:
+    StateSaver(std::string state_file, int interval_sec, const HealthChecker& health_checker,
+               const DnsdistLoadBalancer& load_balancer)
+        : state_file_(std::move(state_file)), interval_(interval_sec), health_checker_(health_checker),
+          load_balancer_(load_balancer) {}
+
+    ~StateSaver() { stop(); }
+
+    void start() { thread_ = std::thread(&StateSaver::saveLoop, this); }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wakeup_.notify_all();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
 
-void signalHandler(int signal) {
+private:
+    void saveLoop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!wakeup_.wait_for(lock, interval_, [this]() { return stopping_; })) {
+            lock.unlock();
+            saveWarmState(state_file_, health_checker_, load_balancer_);
+            lock.lock();
+        }
+    }
+
+    std::string state_file_;
+    std::chrono::seconds interval_;
+    const HealthChecker& health_checker_;
+    const DnsdistLoadBalancer& load_balancer_;
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stopping_{false};
+    std::thread thread_;
+};
+
+/**
+ * Stop on SIGINT or SIGTERM. Runs on the main thread once sigwait() returned,
+ * not in a signal handler, so it may take locks and do I/O like any other code.
+ * A save by state_saver is finished first, then the final state is saved.
+ */
+static void shutdown(int signal, StateSaver* state_saver, const std::string& state_file) {
     std::cout << "\nReceived signal " << signal << ", shutting down gracefully..." << std::endl;
+#ifdef HAVE_XSK
+    // exit() runs no destructors, without this the interface would keep redirecting to dead sockets
+    if (g_xsk_program) {
+        g_xsk_program->detach();
+    }
+#endif
+    if (state_saver) {
+        state_saver->stop();
+    }
     if (g_health_checker) {
         g_health_checker->stop();
     }
+    // After stop(), the health saved is the last one checked
+    if (g_health_checker && g_load_balancer && !state_file.empty()) {
+        saveWarmState(state_file, *g_health_checker, *g_load_balancer);
+    }
     if (g_load_balancer) {
         g_load_balancer->printStats();
     }
+    if (g_forwarder) {
+        g_forwarder->printStats();
+    }
+    if (g_traffic_rings) {
+        g_traffic_rings->printSummary();
+    }
+    Logger::instance().stop();
+    if (uint64_t dropped = Logger::instance().dropped()) {
+        std::cout << "   Log messages dropped: " << dropped << std::endl;
+    }
     exit(0);
 }
 
+/**
+ * Reload the configuration on every SIGHUP. The file is parsed and diffed on
+ * this thread, queries keep going to the current backends until the load
+ * balancer publishes its new view, and the ones in flight finish on the old one.
+ */
+static void reloadLoop(std::vector<std::string> config_paths, HealthChecker* health_checker,
+                       DnsdistLoadBalancer* load_balancer) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+
+    for (;;) {
+        int received = 0;
+        if (sigwait(&signals, &received) != 0) {
+            continue;
+        }
+        std::cout << "\n🔄 Received SIGHUP, reloading configuration..." << std::endl;
+
+        std::vector<ServerPool> pools;
+        std::string loaded_path;
+        for (const auto& config_path : config_paths) {
+            pools = ConfigLoader::loadBackends(config_path);
+            if (!pools.empty()) {
+                loaded_path = config_path;
+                break;
+            }
+        }
+        if (pools.empty()) {
+            std::cerr << "❌ No usable configuration, keeping the current one" << std::endl;
+            continue;
+        }
+
+        GlobalSettings settings = ConfigLoader::loadGlobalSettings(loaded_path);
+        LogLevel log_level = LogLevel::Info;
+        if (Logger::parseLevel(settings.log_level, log_level)) {
+            Logger::instance().setLevel(log_level);
+        } else {
+            std::cerr << "⚠️  Unknown log_level '" << settings.log_level << "', keeping the current one" << std::endl;
+        }
+        Logger::instance().setRateLimit(settings.log_rate_limit);
+
+        // Health first, so that new backends have an index when the load balancer takes them
+        health_checker->reload(pools);
+        if (!load_balancer->reload(pools)) {
+            std::cerr << "⚠️  Not all backends fit, capacity is " << load_balancer->backendCapacity() << std::endl;
+        }
+        // After the pools, routing targets are resolved against them
+        load_balancer->setRouting(ConfigLoader::loadRouting(loaded_path));
+        load_balancer->setAccessControl(ConfigLoader::loadAccessControl(loaded_path));
+        load_balancer->setRateLimit(ConfigLoader::loadRateLimit(loaded_path));
+        std::cout << "✅ Configuration reloaded from " << loaded_path << std::endl;
+    }
+}
+
 int main(int argc, char* argv[]) {
-    // Set up signal handlers for graceful shutdown
-    signal(SIGINT, signalHandler);
-    signal(SIGTERM, signalHandler);
+    // SIGHUP is taken by sigwait() on the reload thread, SIGINT and SIGTERM by the main
+    // thread once everything runs. Block them before any other thread starts, so that
+    // every thread inherits the mask and none of them is interrupted by a handler.
+    sigset_t blocked_signals;
+    sigemptyset(&blocked_signals);
+    sigaddset(&blocked_signals, SIGHUP);
+    sigaddset(&blocked_signals, SIGINT);
+    sigaddset(&blocked_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked_signals, nullptr);
     
     try {
         std::cout << "🚀 Starting DNS Load Balancer with PowerDNS/dnsdist algorithms..." << std::endl;
         
         // Parse command line arguments
-        std::string policy_name = "roundrobin"; // default
-        if (argc > 1) {
-            policy_name = argv[1];
-        }
+        ServerOptions options = parseOptions(argc, argv);
+        const std::string& policy_name = options.policy_name;
         
         // Show current working directory for debugging
         char cwd[1024];
@@ -418,6 +712,7 @@ int main(int argc, char* argv[]) {
         };
         
         std::vector<ServerPool> pools;
+        GlobalSettings settings;
         bool config_loaded = false;
         
         for (const auto& config_path : possible_config_paths) {
@@ -425,16 +720,42 @@ int main(int argc, char* argv[]) {
             pools = ConfigLoader::loadBackends(config_path);
             if (!pools.empty()) {
                 std::cout << "✅ Successfully loaded config from: " << config_path << std::endl;
+                settings = ConfigLoader::loadGlobalSettings(config_path);
                 config_loaded = true;
+                // Reloads read the same file again
+                possible_config_paths = {config_path};
                 break;
             }
         }
         
+        // Asynchronous logging from here on, the query path never writes to stdout itself
+        LogLevel log_level = LogLevel::Info;
+        if (!Logger::parseLevel(settings.log_level, log_level)) {
+            std::cerr << "⚠️  Unknown log_level '" << settings.log_level << "', using info" << std::endl;
+        }
+        Logger::instance().setLevel(log_level);
+        Logger::instance().setRateLimit(settings.log_rate_limit);
+        Logger::instance().start();
+
+        // What the previous run knew, so that queries are answered before the first checks complete
+        WarmState warm_state;
+        bool warm_start = false;
+        if (!settings.state_file.empty() && warm_state.load(settings.state_file)) {
+            const int64_t age_sec = warm_state.ageMs() / 1000;
+            if (settings.state_max_age_sec > 0 && age_sec > settings.state_max_age_sec) {
+                std::cout << "⚠️  Warm state in " << settings.state_file << " is " << age_sec
+                          << "s old, starting cold" << std::endl;
+            } else {
+                warm_start = true;
+                std::cout << "♻️  Warm state from " << settings.state_file << ", saved " << age_sec << "s ago" << std::endl;
+            }
+        }
+        
         if (!config_loaded) {
             std::cout << "⚠️  No config file found, creating default test pool..." << std::endl;
             ServerPool default_pool;
             default_pool.name = "test-pool";
-            default_pool.servers = {"192.168.1.100", "192.168.1.101", "192.168.1.102"};
+            default_pool.servers = {{"192.168.1.100"}, {"192.168.1.101"}, {"192.168.1.102"}};
             default_pool.health_endpoint = "http://192.168.1.100/health";
             default_pool.geo_region = "us-east";
             default_pool.check_interval_sec = 10;
@@ -443,54 +764,303 @@ int main(int argc, char* argv[]) {
         
         // Initialize and start health checker
         std::cout << "\n🏥 Initializing health checker..." << std::endl;
-        HealthChecker health_checker(pools);
+        HealthChecker health_checker(pools, settings);
         g_health_checker = &health_checker;
+        // Before start(), fresh results replace the restored ones as they come in
+        if (warm_start) {
+            health_checker.restoreState(warm_state);
+        }
         health_checker.start();
         
+        // Lua policies before the load balancer, pools of the config may name them
+        std::vector<LuaPolicyConfig> lua_policies;
+        if (config_loaded) {
+            lua_policies = ConfigLoader::loadLuaPolicies(possible_config_paths.front());
+        }
+#ifdef HAVE_LUAJIT
+        for (const auto& lua_policy : lua_policies) {
+            try {
+                auto policy = std::make_shared<const LuaFfiPolicy>(lua_policy.name, lua_policy.code);
+                if (!DnsdistLoadBalancer::registerPolicy(lua_policy.name, LuaFfiPolicy::makeFunction(policy))) {
+                    std::cerr << "⚠️  Lua policy " << lua_policy.name << " shadows a built-in policy, ignored" << std::endl;
+                    continue;
+                }
+                std::cout << "✅ Lua policy " << lua_policy.name << " compiled" << std::endl;
+            } catch (const std::exception& e) {
+                std::cerr << "❌ " << e.what() << std::endl;
+            }
+        }
+#else
+        if (!lua_policies.empty()) {
+            std::cerr << "⚠️  Built without LuaJIT, ignoring " << lua_policies.size() << " Lua policies" << std::endl;
+        }
+#endif
+        
         // Initialize load balancer with dnsdist algorithms
         std::cout << "\n⚖️  Initializing dnsdist load balancer..." << std::endl;
-        DnsdistLoadBalancer load_balancer(pools, &health_checker);
+        DnsdistLoadBalancer load_balancer(pools, &health_checker, options.answer_ttl);
         g_load_balancer = &load_balancer;
         
         // Set the load balancing policy
         load_balancer.setPolicy(policy_name);
+        if (config_loaded) {
+            load_balancer.setRouting(ConfigLoader::loadRouting(possible_config_paths.front()));
+            load_balancer.setAccessControl(ConfigLoader::loadAccessControl(possible_config_paths.front()));
+            load_balancer.setRateLimit(ConfigLoader::loadRateLimit(possible_config_paths.front()));
+        }
+        // With the policies set, a restored Maglev table replaces the one just built
+        if (warm_start) {
+            load_balancer.restoreState(warm_state);
+            warm_state = WarmState();
+        }
+
+        // Traffic analytics, per-thread rings aggregated by one maintenance thread
+        std::unique_ptr<TrafficRings> traffic_rings;
+        if (options.traffic_ring_size > 0) {
+            traffic_rings = std::make_unique<TrafficRings>(&load_balancer, options.traffic_ring_size);
+            traffic_rings->start();
+            g_traffic_rings = traffic_rings.get();
+            std::cout << "📈 Traffic rings enabled with " << options.traffic_ring_size << " records per thread" << std::endl;
+        }
+
+        // Proxy mode, one forwarder and one TCP connection pool shared by all listeners
+        std::unique_ptr<UdpForwarder> forwarder;
+        std::unique_ptr<TcpBackendPool> backend_pool;
+        if (options.forward) {
+            backend_pool = std::make_unique<TcpBackendPool>(&load_balancer);
+            backend_pool->start();
+            forwarder = std::make_unique<UdpForwarder>(&load_balancer, options.backend_sockets);
+            forwarder->setTcpBackendPool(backend_pool.get());
+            forwarder->setTrafficRings(traffic_rings.get());
+            forwarder->start();
+            g_forwarder = forwarder.get();
+        }
+
+        // Optional packet cache, shared by all listeners
+        std::unique_ptr<PacketCache> packet_cache;
+        if (options.packet_cache_size > 0 && forwarder) {
+            std::cout << "⚠️  The packet cache only covers locally built answers, ignored with --forward" << std::endl;
+        } else if (options.packet_cache_size > 0) {
+            packet_cache = std::make_unique<PacketCache>(options.packet_cache_size);
+            std::cout << "🗄️  Packet cache enabled with " << packet_cache->capacity() << " entries" << std::endl;
+            if (policy_name != "whashed" && policy_name != "chashed" && policy_name != "chashedBounded" &&
+                policy_name != "maglev") {
+                std::cout << "⚠️  Policy '" << policy_name << "' is not sticky, cached answers will pin "
+                          << "each qname to one backend for its TTL" << std::endl;
+            }
+        }
         
         // Start DNS server with load balancer
         std::cout << "\n🌐 Starting DNS server..." << std::endl;
+        const int num_threads = options.num_threads;
+
+        // Enough packet buffers for every thread to fill its cache without going to the heap
+        PacketBufferPool::reserve(static_cast<size_t>(num_threads + 2) * PacketBufferPool::LOCAL_CACHE_SIZE);
+        
+        // Shared mode: one socket, all threads run the same io_context
         boost::asio::io_context io_context;
-        DnsServer server(io_context, &load_balancer);
-        std::cout << "✅ DNS server started on port " << DNS_PORT << std::endl;
+        std::unique_ptr<DnsServer> shared_server;
+        std::unique_ptr<TcpListener> shared_tcp_listener;
+        
+        // Per-core mode: one SO_REUSEPORT socket and io_context per thread
+        std::vector<std::unique_ptr<DnsWorker>> workers;
+        
+        if (options.reuse_port) {
+            for (int i = 0; i < num_threads; ++i) {
+                auto worker = std::make_unique<DnsWorker>();
+                worker->server = std::make_unique<DnsServer>(worker->io_context, &load_balancer, true,
+                                                             options.batch_size, packet_cache.get(),
+                                                             forwarder.get(), traffic_rings.get());
+                if (options.tcp) {
+                    worker->tcp_listener = makeTcpListener(worker->io_context, *worker->server, &load_balancer,
+                                                           backend_pool.get(), true);
+                }
+                workers.push_back(std::move(worker));
+            }
+        } else {
+            shared_server = std::make_unique<DnsServer>(io_context, &load_balancer, false,
+                                                        options.batch_size, packet_cache.get(),
+                                                        forwarder.get(), traffic_rings.get());
+            if (options.tcp) {
+                shared_tcp_listener = makeTcpListener(io_context, *shared_server, &load_balancer,
+                                                      backend_pool.get(), false);
+            }
+        }
+        std::cout << "✅ DNS server started on port " << DNS_PORT
+                  << (options.tcp ? " (UDP and TCP)" : " (UDP)") << std::endl;
+
+        // UDP queries that find no healthy backend wait for the health checker instead of failing
+        std::unique_ptr<AsyncHolder> async_holder;
+        std::unique_ptr<HealthWaitRule> health_wait_rule;
+        if (options.hold_no_backend_ms > 0) {
+            async_holder = std::make_unique<AsyncHolder>();
+            async_holder->start();
+            health_wait_rule = std::make_unique<HealthWaitRule>(*async_holder, health_checker, load_balancer,
+                                                                std::chrono::milliseconds(options.hold_no_backend_ms));
+            if (shared_server) {
+                shared_server->setAsyncRule(async_holder.get(), &health_wait_rule->rule());
+            }
+            for (auto& worker : workers) {
+                worker->server->setAsyncRule(async_holder.get(), &health_wait_rule->rule());
+            }
+            std::cout << "⏳ Queries wait up to " << options.hold_no_backend_ms
+                      << " ms for a healthy backend" << std::endl;
+        }
+
+        // Kernel-bypass receive path, queue q is answered like a query to worker q's socket
+#ifdef HAVE_XSK
+        std::unique_ptr<XskProgram> xsk_program;
+        std::vector<std::unique_ptr<XskListener>> xsk_listeners;
+        if (!options.xsk_interface.empty()) {
+            xsk_program = std::make_unique<XskProgram>(options.xsk_interface, options.xsk_program, DNS_PORT);
+            g_xsk_program = xsk_program.get();
+            for (uint32_t queue = 0; queue < options.xsk_queues; ++queue) {
+                DnsServer& server = shared_server ? *shared_server : *workers[queue % workers.size()]->server;
+                auto handler = [&server](const uint8_t* query, size_t length, uint8_t* response, size_t capacity,
+                                         const sockaddr* client, socklen_t client_length) {
+                    return server.handle_request(query, length, response, capacity, client, client_length);
+                };
+                xsk_listeners.push_back(std::make_unique<XskListener>(*xsk_program, queue, handler,
+                                                                       server.socketFd()));
+            }
+            std::cout << "✅ AF_XDP on " << options.xsk_interface << ", " << options.xsk_queues
+                      << " queue(s)" << std::endl;
+        }
+#else
+        if (!options.xsk_interface.empty()) {
+            std::cerr << "⚠️  Built without AF_XDP support, ignoring --xsk=" << options.xsk_interface << std::endl;
+        }
+#endif
+
+        // Prometheus endpoint on a DNS io_context, a scrape only reads counters
+        std::unique_ptr<MetricsServer> metrics_server;
+        if (options.metrics_port > 0) {
+            auto render = [&](std::string& out) {
+                uint64_t udp_queries = 0;
+                uint64_t tcp_queries = 0;
+                if (shared_server) {
+                    udp_queries = shared_server->queries();
+                }
+                if (shared_tcp_listener) {
+                    tcp_queries = shared_tcp_listener->queries();
+                }
+                for (const auto& worker : workers) {
+                    udp_queries += worker->server->queries();
+                    if (worker->tcp_listener) {
+                        tcp_queries += worker->tcp_listener->queries();
+                    }
+                }
+                out += "# TYPE dnslb_queries_total counter\n";
+                out += "dnslb_queries_total{protocol=\"udp\"} " + std::to_string(udp_queries) + "\n";
+                out += "dnslb_queries_total{protocol=\"tcp\"} " + std::to_string(tcp_queries) + "\n";
+                if (packet_cache) {
+                    out += "# TYPE dnslb_packet_cache_hits_total counter\n";
+                    out += "dnslb_packet_cache_hits_total " + std::to_string(packet_cache->hits()) + "\n";
+                    out += "# TYPE dnslb_packet_cache_misses_total counter\n";
+                    out += "dnslb_packet_cache_misses_total " + std::to_string(packet_cache->misses()) + "\n";
+                }
+                load_balancer.writeMetrics(out);
+                if (forwarder) {
+                    forwarder->writeMetrics(out);
+                }
+                if (async_holder) {
+                    async_holder->writeMetrics(out);
+                }
+#ifdef HAVE_XSK
+                if (!xsk_listeners.empty()) {
+                    out += "# TYPE dnslb_xsk_packets_total counter\n";
+                    for (const auto& listener : xsk_listeners) {
+                        listener->writeMetrics(out);
+                    }
+                }
+#endif
+                out += "# TYPE dnslb_log_messages_dropped_total counter\n";
+                out += "dnslb_log_messages_dropped_total " + std::to_string(Logger::instance().dropped()) + "\n";
+            };
+            boost::asio::io_context& metrics_context = workers.empty() ? io_context : workers.front()->io_context;
+            metrics_server = std::make_unique<MetricsServer>(metrics_context, options.metrics_port, render);
+            std::cout << "✅ Metrics on http://0.0.0.0:" << options.metrics_port << "/metrics" << std::endl;
+        }
         std::cout << "✅ Health checker monitoring " << pools.size() << " server pools" << std::endl;
         
-        // Give health checker time to start
-        std::this_thread::sleep_for(std::chrono::seconds(2));
+        // No waiting for the first checks: restored backends serve right away, the others join as they pass
         health_checker.printHealthSummary();
+
+        // Everything that follows the load balancer's backends is set up, reloads can start
+        std::thread(reloadLoop, possible_config_paths, &health_checker, &load_balancer).detach();
+        std::unique_ptr<StateSaver> state_saver;
+        if (!settings.state_file.empty() && settings.state_save_interval_sec > 0) {
+            state_saver = std::make_unique<StateSaver>(settings.state_file, settings.state_save_interval_sec,
+                                                       health_checker, load_balancer);
+            state_saver->start();
+            std::cout << "💾 Saving state to " << settings.state_file << " every "
+                      << settings.state_save_interval_sec << "s" << std::endl;
+        }
+#ifdef HAVE_XSK
+        for (auto& listener : xsk_listeners) {
+            listener->start();
+        }
+#endif
         
         // Start DNS server threads
         std::vector<std::thread> threads;
-        const int num_threads = 4;
-        for (int i = 0; i < num_threads; ++i) {
-            threads.emplace_back([&io_context]() { 
-                io_context.run(); 
-            });
+        if (options.reuse_port) {
+            const unsigned int num_cpus = std::max(1u, std::thread::hardware_concurrency());
+            for (int i = 0; i < num_threads; ++i) {
+                auto& worker = *workers[i];
+                worker.thread = std::thread([&worker]() {
+                    worker.io_context.run();
+                });
+                if (options.pin_cpus) {
+                    int cpu = static_cast<int>(i % num_cpus);
+                    if (!pinThreadToCPU(worker.thread, cpu)) {
+                        std::cerr << "⚠️  Failed to pin worker " << i << " to CPU " << cpu << std::endl;
+                    }
+                }
+            }
+        } else {
+            for (int i = 0; i < num_threads; ++i) {
+                threads.emplace_back([&io_context]() { 
+                    io_context.run(); 
+                });
+            }
         }
         
         std::cout << "\n🎯 DNS Load Balancer is running!" << std::endl;
         std::cout << "   Policy: " << policy_name << std::endl;
-        std::cout << "   Threads: " << num_threads << std::endl;
-        std::cout << "   Press Ctrl+C to stop." << std::endl;
+        std::cout << "   Threads: " << num_threads
+                  << (options.reuse_port ? " (per-core SO_REUSEPORT listeners)" : " (shared socket)") << std::endl;
+        if (options.batch_size > 1) {
+            std::cout << "   UDP batch size: " << options.batch_size << " (recvmmsg/sendmmsg)" << std::endl;
+        }
+        if (!options.xsk_interface.empty()) {
+            std::cout << "   AF_XDP: " << options.xsk_interface << " (" << options.xsk_queues << " queues)" << std::endl;
+        }
+        if (options.forward) {
+            std::cout << "   Mode: forwarding proxy (" << options.backend_sockets << " sockets per backend)" << std::endl;
+        }
+        std::cout << "   Press Ctrl+C to stop, send SIGHUP to reload the configuration." << std::endl;
         std::cout << "\nAvailable policies:" << std::endl;
         std::cout << "   - roundrobin: Distribute queries evenly across backends" << std::endl;
         std::cout << "   - leastOutstanding: Send to backend with fewest pending queries" << std::endl;
         std::cout << "   - wrandom: Weighted random selection" << std::endl;
         std::cout << "   - whashed: Weighted consistent hashing" << std::endl;
         std::cout << "   - chashed: Consistent hashing" << std::endl;
+        std::cout << "   - chashedBounded: Consistent hashing with bounded backend load" << std::endl;
+        std::cout << "   - maglev: Maglev lookup table hashing" << std::endl;
         std::cout << "   - firstAvailable: Always use first available backend" << std::endl;
+        std::cout << "   - p2c: Fewer pending queries of two random backends" << std::endl;
+        std::cout << "   - ewmaLatency: Lower latency x pending queries of two random backends" << std::endl;
         
-        // Wait for all threads
-        for (auto& t : threads) {
-            t.join();
+        // The workers run until shutdown() exits, a signal sent during startup waits here
+        sigset_t shutdown_signals;
+        sigemptyset(&shutdown_signals);
+        sigaddset(&shutdown_signals, SIGINT);
+        sigaddset(&shutdown_signals, SIGTERM);
+        int received = 0;
+        while (sigwait(&shutdown_signals, &received) != 0) {
         }
+        shutdown(received, state_saver.get(), settings.state_file);
         
     } catch (std::exception& e) {
         std::cerr << "❌ Exception: " << e.what() << std::endl;
@@ -0,0 +1,41 @@
+#include <algorithm>
+#include <cstdio>
+#include "latency_histogram.h"
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+    Snapshot snapshot;
+    for (size_t i = 0; i <= BUCKET_COUNT; ++i) {
+        snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+    snapshot.sum = sum_.load(std::memory_order_relaxed);
+    snapshot.count = count_.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void LatencyHistogram::writePrometheus(std::string& out, const char* name, const std::string& labels,
+                                       double unit_seconds) const {
+    const Snapshot snapshot = this->snapshot();
+    const std::string separator = labels.empty() ? "" : ",";
+    char line[256];
+
+    // Prometheus buckets are cumulative
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        cumulative += snapshot.buckets[i];
+        snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels.c_str(), separator.c_str(),
+                 static_cast<double>(1ULL << i) * unit_seconds, static_cast<unsigned long long>(cumulative));
+        out += line;
+    }
+    cumulative += snapshot.buckets[BUCKET_COUNT];
+    // Concurrent records may have bumped a bucket after count was read
+    const uint64_t count = std::max(cumulative, snapshot.count);
+    snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels.c_str(), separator.c_str(),
+             static_cast<unsigned long long>(count));
+    out += line;
+
+    const std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    snprintf(line, sizeof(line), "%s_sum%s %g\n", name, braces.c_str(), static_cast<double>(snapshot.sum) * unit_seconds);
+    out += line;
+    snprintf(line, sizeof(line), "%s_count%s %llu\n", name, braces.c_str(), static_cast<unsigned long long>(count));
+    out += line;
+}
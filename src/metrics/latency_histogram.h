@@ -0,0 +1,62 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Log-bucketed histogram of durations, recorded with relaxed atomics.
+ *
+ * Bucket i counts the values up to 2^i units, the last bucket everything
+ * above. Like doLatencyStats() in dnsdist.cc a record is a bucket increment
+ * plus the running sum and count, here with a bucket per power of two instead
+ * of fixed millisecond ranges, so one layout covers both nanosecond policy
+ * timings and backend round trips. Any thread may record, readers get a
+ * snapshot that is consistent per counter but not across counters, which is
+ * all a scrape needs.
+ */
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKET_COUNT = 32;     // up to 2^31 units, then +Inf
+
+    struct Snapshot {
+        std::array<uint64_t, BUCKET_COUNT + 1> buckets{};
+        uint64_t count{0};
+        uint64_t sum{0};
+    };
+
+    void record(uint64_t value) {
+        buckets_[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+    /**
+     * Append the histogram in Prometheus text format. labels is either empty or
+     * a list like `backend="192.0.2.1:53"`, unit_seconds converts the recorded
+     * unit to seconds (1e-6 for microseconds). The # TYPE line is left to the caller
+     * so that several label sets can share it.
+     */
+    void writePrometheus(std::string& out, const char* name, const std::string& labels, double unit_seconds) const;
+
+    static size_t bucketOf(uint64_t value) {
+        if (value <= 1) {
+            return 0;
+        }
+        // ceil(log2(value))
+        const size_t bucket = 64 - static_cast<size_t>(__builtin_clzll(value - 1));
+        return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT + 1> buckets_{};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> count_{0};
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -0,0 +1,99 @@
+#include <istream>
+#include <memory>
+#include <stdexcept>
+#include "metrics_server.h"
+
+using boost::asio::ip::tcp;
+
+class MetricsServer::Session : public std::enable_shared_from_this<Session> {
+public:
+    Session(tcp::socket socket, MetricsServer& server)
+        : socket_(std::move(socket)), server_(server), timer_(socket_.get_executor()),
+          request_(MAX_REQUEST_SIZE) {}
+
+    void start() {
+        auto self = shared_from_this();
+        timer_.expires_after(REQUEST_TIMEOUT);
+        timer_.async_wait([self](boost::system::error_code ec) {
+            if (!ec) {
+                boost::system::error_code ignored;
+                self->socket_.close(ignored);
+            }
+        });
+        boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+            [self](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    self->timer_.cancel();
+                    return;
+                }
+                self->respond();
+            });
+    }
+
+private:
+    tcp::socket socket_;
+    MetricsServer& server_;
+    boost::asio::steady_timer timer_;
+    boost::asio::streambuf request_;
+    std::string response_;
+
+    void respond() {
+        std::istream stream(&request_);
+        std::string method, target;
+        stream >> method >> target;
+
+        std::string body;
+        const char* status = "200 OK";
+        const char* content_type = "text/plain; version=0.0.4; charset=utf-8";
+        if (method != "GET") {
+            status = "405 Method Not Allowed";
+            content_type = "text/plain";
+            body = "Only GET is supported\n";
+        } else if (target != "/metrics" && target.rfind("/metrics?", 0) != 0) {
+            status = "404 Not Found";
+            content_type = "text/plain";
+            body = "Not found, try /metrics\n";
+        } else {
+            server_.renderer_(body);
+        }
+
+        response_ = std::string("HTTP/1.1 ") + status + "\r\nContent-Type: " + content_type +
+                    "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+        response_ += body;
+
+        auto self = shared_from_this();
+        boost::asio::async_write(socket_, boost::asio::buffer(response_),
+            [self](boost::system::error_code, std::size_t) {
+                self->timer_.cancel();
+                boost::system::error_code ignored;
+                self->socket_.shutdown(tcp::socket::shutdown_both, ignored);
+                self->socket_.close(ignored);
+            });
+    }
+};
+
+MetricsServer::MetricsServer(boost::asio::io_context& io_context, uint16_t port, Renderer renderer)
+    : acceptor_(io_context), renderer_(std::move(renderer)) {
+
+    if (!renderer_) {
+        throw std::runtime_error("MetricsServer needs a renderer");
+    }
+
+    tcp::endpoint endpoint(tcp::v4(), port);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(tcp::acceptor::reuse_address(true));
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    startAccept();
+}
+
+void MetricsServer::startAccept() {
+    // The shared io_context runs on several threads, keep each session's handlers on one strand
+    acceptor_.async_accept(boost::asio::make_strand(acceptor_.get_executor()),
+        [this](boost::system::error_code ec, tcp::socket socket) {
+            if (!ec) {
+                std::make_shared<Session>(std::move(socket), *this)->start();
+            }
+            startAccept();
+        });
+}
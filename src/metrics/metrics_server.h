@@ -0,0 +1,40 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * Minimal HTTP endpoint serving GET /metrics in the Prometheus text format.
+ *
+ * Runs on an io_context the DNS listeners already use, one request per
+ * connection. The body is rendered on every scrape by the callback, which only
+ * reads counters, so a scrape never holds up the query path.
+ */
+class MetricsServer {
+public:
+    static constexpr uint16_t DEFAULT_PORT = 9153;
+    static constexpr size_t MAX_REQUEST_SIZE = 8192;
+    static constexpr std::chrono::seconds REQUEST_TIMEOUT{5};
+
+    /**
+     * Append the metrics to out
+     */
+    using Renderer = std::function<void(std::string& out)>;
+
+    MetricsServer(boost::asio::io_context& io_context, uint16_t port, Renderer renderer);
+
+private:
+    class Session;
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    Renderer renderer_;
+
+    void startAccept();
+};
+
+#endif // METRICS_SERVER_H
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "async_holder.h"
+#include "../logging/logger.h"
+
+// Longest the expiry thread sleeps without a query to expire, it checks running_ in between
+static constexpr int IDLE_WAIT_MS = 1000;
+
+AsyncHolder::AsyncHolder(size_t max_queries) : max_queries_(max_queries) {
+    if (max_queries_ == 0) {
+        throw std::runtime_error("Async holder needs room for at least one query");
+    }
+    if (pipe2(notify_fds_, O_NONBLOCK | O_CLOEXEC) < 0) {
+        throw std::runtime_error(std::string("pipe2 failed: ") + strerror(errno));
+    }
+}
+
+AsyncHolder::~AsyncHolder() {
+    stop();
+    for (int fd : notify_fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void AsyncHolder::start() {
+    running_ = true;
+    expiry_thread_ = std::thread(&AsyncHolder::expiryLoop, this);
+}
+
+void AsyncHolder::stop() {
+    running_ = false;
+    notify();
+    if (expiry_thread_.joinable()) {
+        expiry_thread_.join();
+    }
+
+    // suspend() refuses queries from here on, hand back the ones still parked
+    std::vector<Entry> remaining;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pickupExpired(content_, Clock::time_point::max(), remaining);
+    }
+    for (auto& entry : remaining) {
+        post(entry, true);
+    }
+}
+
+uint64_t AsyncHolder::suspend(std::unique_ptr<SuspendedQuery>& query, std::chrono::milliseconds timeout,
+                              boost::asio::io_context& io_context, Resumer resumer) {
+    const Clock::time_point ttd = Clock::now() + timeout;
+    uint64_t id = 0;
+    bool earliest = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_.load(std::memory_order_relaxed) || content_.size() >= max_queries_) {
+            counters_.increment(Refused);
+            return 0;
+        }
+        id = next_id_++;
+        const auto& by_ttd = content_.get<TtdTag>();
+        earliest = by_ttd.empty() || ttd < by_ttd.begin()->ttd;
+        content_.emplace(Entry{id, ttd, std::move(query), std::move(resumer), &io_context});
+    }
+    counters_.increment(Suspended);
+    // The expiry thread sleeps until the earliest TTD it knew of
+    if (earliest) {
+        notify();
+    }
+    return id;
+}
+
+bool AsyncHolder::resume(uint64_t id, int pool) {
+    Entry resumed{};
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& by_id = content_.get<IdTag>();
+        auto it = by_id.find(id);
+        if (it == by_id.end()) {
+            return false;
+        }
+        resumed = Entry{it->id, it->ttd, std::move(it->query), std::move(it->resumer), it->io_context};
+        by_id.erase(it);
+    }
+    resumed.query->pool = pool;
+    post(resumed, false);
+    counters_.increment(Resumed);
+    return true;
+}
+
+size_t AsyncHolder::resumeAll() {
+    std::vector<Entry> resumed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pickupExpired(content_, Clock::time_point::max(), resumed);
+    }
+    for (auto& entry : resumed) {
+        post(entry, false);
+        counters_.increment(Resumed);
+    }
+    return resumed.size();
+}
+
+size_t AsyncHolder::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return content_.size();
+}
+
+void AsyncHolder::pickupExpired(Content& content, Clock::time_point now, std::vector<Entry>& expired) {
+    auto& by_ttd = content.get<TtdTag>();
+    // Entries are const in the container, their mutable members can still be moved out
+    for (auto it = by_ttd.begin(); it != by_ttd.end() && it->ttd < now;) {
+        expired.push_back(Entry{it->id, it->ttd, std::move(it->query), std::move(it->resumer), it->io_context});
+        it = by_ttd.erase(it);
+    }
+}
+
+void AsyncHolder::post(Entry& entry, bool expired) {
+    boost::asio::post(*entry.io_context,
+                      [query = std::move(entry.query), resumer = std::move(entry.resumer), expired]() mutable {
+                          resumer(std::move(query), expired);
+                      });
+}
+
+void AsyncHolder::expiryLoop() {
+    std::vector<Entry> expired;
+    while (running_.load(std::memory_order_acquire)) {
+        int wait_ms = IDLE_WAIT_MS;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            const Clock::time_point now = Clock::now();
+            pickupExpired(content_, now, expired);
+            const auto& by_ttd = content_.get<TtdTag>();
+            if (!by_ttd.empty()) {
+                const auto until_next = std::chrono::ceil<std::chrono::milliseconds>(by_ttd.begin()->ttd - now);
+                wait_ms = static_cast<int>(std::clamp<int64_t>(until_next.count(), 0, IDLE_WAIT_MS));
+            }
+        }
+
+        // Posted without the lock, resume() and suspend() go on meanwhile
+        for (auto& entry : expired) {
+            post(entry, true);
+            counters_.increment(Expired);
+        }
+        if (!expired.empty()) {
+            LOG_DEBUG("%zu suspended queries expired", expired.size());
+        }
+        expired.clear();
+
+        pollfd pfd{notify_fds_[0], POLLIN, 0};
+        if (poll(&pfd, 1, wait_ms) > 0) {
+            std::array<char, 64> drain;
+            while (read(notify_fds_[0], drain.data(), drain.size()) > 0) {
+            }
+        }
+    }
+}
+
+void AsyncHolder::notify() const {
+    // A full pipe already has a wake-up pending
+    const char byte = 0;
+    const ssize_t written = write(notify_fds_[1], &byte, sizeof(byte));
+    (void)written;
+}
+
+void AsyncHolder::writeMetrics(std::string& out) const {
+    static constexpr std::array<const char*, CounterCount> names = {"suspended", "resumed", "expired", "refused"};
+    const std::vector<uint64_t> values = counters_.loadAll();
+    out += "# TYPE dnslb_async_queries_total counter\n";
+    for (size_t i = 0; i < CounterCount; ++i) {
+        out += "dnslb_async_queries_total{event=\"";
+        out += names[i];
+        out += "\"} " + std::to_string(values[i]) + "\n";
+    }
+    out += "# TYPE dnslb_async_suspended_queries gauge\n";
+    out += "dnslb_async_suspended_queries " + std::to_string(size()) + "\n";
+}
@@ -0,0 +1,161 @@
+#ifndef ASYNC_HOLDER_H
+#define ASYNC_HOLDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+
+#include <boost/asio.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include "dns_wire.h"
+#include "packet_buffer_pool.h"
+#include "../load_balancer/per_thread_counters.h"
+
+/**
+ * Queries parked while a slow decision about them is made elsewhere, an
+ * external geo lookup or a health probe in flight, say. Modeled on
+ * dnsdist::AsynchronousHolder (dnsdist-async.hh): the parked queries live in
+ * a multi_index container, by id and by time to die (TTD), and one thread
+ * hands back the expired ones with pickupExpired(). That thread sleeps until
+ * the next TTD, and is woken through a pipe, like dnsdist's channel Notifier
+ * and Waiter, when a new query dies before the one it was waiting for.
+ *
+ * Worker threads never wait on the holder: suspend() parks the query and
+ * returns, and the query comes back on the worker's io_context through
+ * boost::asio::post(), resumed or expired. The resumer runs there like any
+ * other handler of that worker.
+ */
+class AsyncHolder {
+public:
+    static constexpr size_t DEFAULT_MAX_QUERIES = 65536;
+
+    /**
+     * A parked query, with what its worker needs to answer it later
+     */
+    struct SuspendedQuery {
+        PacketBuffer packet;                 // the query as received, packet.size() bytes
+        uint32_t qname_hash{0};
+        int pool{0};                         // from routeQuery(), resume() may change it
+        sockaddr_storage client{};
+        socklen_t client_length{0};
+    };
+
+    /**
+     * Runs on the io_context given to suspend(), expired set if the query
+     * timed out before it was resumed
+     */
+    using Resumer = std::function<void(std::unique_ptr<SuspendedQuery> query, bool expired)>;
+
+    explicit AsyncHolder(size_t max_queries = DEFAULT_MAX_QUERIES);
+    ~AsyncHolder();
+
+    AsyncHolder(const AsyncHolder&) = delete;
+    AsyncHolder& operator=(const AsyncHolder&) = delete;
+
+    /**
+     * Start the expiry thread. stop() expires every query still parked.
+     */
+    void start();
+    void stop();
+
+    /**
+     * Park query for at most timeout. Returns the id to resume() it with, or
+     * 0 and leaves query to the caller when max_queries are parked already.
+     */
+    uint64_t suspend(std::unique_ptr<SuspendedQuery>& query, std::chrono::milliseconds timeout,
+                     boost::asio::io_context& io_context, Resumer resumer);
+
+    /**
+     * Hand a parked query back to its worker, with pool as its routing
+     * decision. Safe from any thread. False if id is not parked, it expired
+     * already for instance.
+     */
+    bool resume(uint64_t id, int pool);
+
+    /**
+     * Hand every parked query back to its worker, each with the pool it has.
+     * Safe from any thread. Returns how many were parked.
+     */
+    size_t resumeAll();
+
+    /**
+     * Queries parked right now
+     */
+    size_t size() const;
+
+    /**
+     * Append the suspension counters in the Prometheus text format
+     */
+    void writeMetrics(std::string& out) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum Counter : size_t { Suspended, Resumed, Expired, Refused, CounterCount };
+
+    struct IdTag {};
+    struct TtdTag {};
+
+    struct Entry {
+        uint64_t id;
+        Clock::time_point ttd;
+        // Not used by any of the indexes, so mutable
+        mutable std::unique_ptr<SuspendedQuery> query;
+        mutable Resumer resumer;
+        boost::asio::io_context* io_context;
+    };
+
+    using Content = boost::multi_index_container<
+        Entry,
+        boost::multi_index::indexed_by<
+            boost::multi_index::hashed_unique<boost::multi_index::tag<IdTag>,
+                                              boost::multi_index::member<Entry, uint64_t, &Entry::id>>,
+            boost::multi_index::ordered_non_unique<boost::multi_index::tag<TtdTag>,
+                                                   boost::multi_index::member<Entry, Clock::time_point,
+                                                                              &Entry::ttd>>>>;
+
+    size_t max_queries_;
+    mutable std::mutex mutex_;
+    Content content_;                        // under mutex_
+    uint64_t next_id_{1};                    // under mutex_, 0 means not parked
+    int notify_fds_[2] = {-1, -1};           // pipe, the expiry thread waits on the read end
+    std::atomic<bool> running_{false};
+    std::thread expiry_thread_;
+    PerThreadCounters counters_{CounterCount};
+
+    /**
+     * Move the entries whose TTD is before now out of content into expired
+     */
+    static void pickupExpired(Content& content, Clock::time_point now, std::vector<Entry>& expired);
+
+    static void post(Entry& entry, bool expired);
+
+    void expiryLoop();
+    void notify() const;
+};
+
+/**
+ * Which queries wait for a decision, and how it is made. timeout runs on the
+ * worker thread for every query and returns how long the query may wait, 0
+ * to go on without waiting. start runs once the query is parked as id: it
+ * kicks off the decision, which ends with AsyncHolder::resume() or
+ * resumeAll() from any thread, and must not wait for it. A query that is not resumed in time goes
+ * on with the pool routeQuery() picked.
+ */
+struct AsyncRule {
+    std::function<std::chrono::milliseconds(const dnswire::QueryView& query, int pool)> timeout;
+    std::function<void(uint64_t id, const dnswire::QueryView& query, int pool)> start;
+};
+
+#endif // ASYNC_HOLDER_H
@@ -0,0 +1,252 @@
+#include <cstring>
+#include <netinet/in.h>
+#include "dns_wire.h"
+
+namespace dnswire {
+
+static inline void writeUint16(uint8_t* out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value >> 8);
+    out[1] = static_cast<uint8_t>(value & 0xFF);
+}
+
+static inline void writeUint32(uint8_t* out, uint32_t value) {
+    writeUint16(out, static_cast<uint16_t>(value >> 16));
+    writeUint16(out + 2, static_cast<uint16_t>(value & 0xFFFF));
+}
+
+bool parseQuery(const uint8_t* packet, size_t length, QueryView& query) {
+    if (length < HEADER_SIZE) {
+        return false;
+    }
+    dnsheader_aligned header(packet);
+    if (header->qr || header->opcode != Opcode::Query) {
+        return false;
+    }
+    return parseQuestion(packet, length, query);
+}
+
+bool parseQuestion(const uint8_t* packet, size_t length, QueryView& query) {
+    if (length < HEADER_SIZE + 1 + DNS_TYPE_SIZE + DNS_CLASS_SIZE) {
+        return false;
+    }
+
+    dnsheader_aligned header(packet);
+    if (ntohs(header->qdcount) != 1) {
+        return false;
+    }
+
+    // Walk the labels, the question name is never compressed in a query
+    size_t pos = HEADER_SIZE;
+    for (;;) {
+        if (pos >= length) {
+            return false;
+        }
+        uint8_t label_length = packet[pos];
+        if (label_length == 0) {
+            ++pos;
+            break;
+        }
+        if (label_length > 63) {
+            return false;
+        }
+        pos += 1 + label_length;
+        if (pos - HEADER_SIZE > DNSName::s_maxDNSNameLength) {
+            return false;
+        }
+    }
+
+    if (pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE > length) {
+        return false;
+    }
+
+    query.packet = packet;
+    query.length = length;
+    query.qname = packet + HEADER_SIZE;
+    query.qname_length = pos - HEADER_SIZE;
+    query.id = header->id;
+    query.qtype = static_cast<uint16_t>((packet[pos] << 8) | packet[pos + 1]);
+    query.qclass = static_cast<uint16_t>((packet[pos + 2] << 8) | packet[pos + 3]);
+    query.question_end = pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE;
+    return true;
+}
+
+uint32_t hashQname(const QueryView& query, uint32_t init) {
+    return burtleCI(query.qname, static_cast<uint32_t>(query.qname_length), init);
+}
+
+/**
+ * Offset of the EDNS OPT record in the query, 0 if there is none. Only looks at
+ * the first additional record, which is where clients put the OPT record.
+ */
+static size_t findOPT(const QueryView& query) {
+    dnsheader_aligned header(query.packet);
+    if (header->arcount == 0 || header->ancount != 0 || header->nscount != 0) {
+        return 0;
+    }
+
+    // Root owner name, then type, class (UDP payload size), extended rcode, version and flags
+    const size_t pos = query.question_end;
+    if (pos + 1 + DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE > query.length || query.packet[pos] != 0) {
+        return 0;
+    }
+    const uint16_t type = static_cast<uint16_t>((query.packet[pos + 1] << 8) | query.packet[pos + 2]);
+    if (type != QType::OPT) {
+        return 0;
+    }
+    return pos;
+}
+
+bool hasDOBit(const QueryView& query) {
+    const size_t pos = findOPT(query);
+    return pos != 0 && (query.packet[pos + 7] & 0x80) != 0;
+}
+
+uint16_t getUDPPayloadSize(const QueryView& query) {
+    constexpr uint16_t MIN_UDP_PAYLOAD_SIZE = 512;
+    const size_t pos = findOPT(query);
+    if (pos == 0) {
+        return MIN_UDP_PAYLOAD_SIZE;
+    }
+    const uint16_t payload_size = static_cast<uint16_t>((query.packet[pos + 3] << 8) | query.packet[pos + 4]);
+    return payload_size < MIN_UDP_PAYLOAD_SIZE ? MIN_UDP_PAYLOAD_SIZE : payload_size;
+}
+
+bool getClientSubnet(const QueryView& query, ComboAddress& source, uint8_t& source_prefix) {
+    constexpr uint16_t ECS_OPTION_CODE = 8;
+    constexpr uint16_t FAMILY_IPV4 = 1;
+    constexpr uint16_t FAMILY_IPV6 = 2;
+
+    const size_t pos = findOPT(query);
+    if (pos == 0 || pos + 11 > query.length) {
+        return false;
+    }
+    // RDATA follows the fixed part of the OPT record, a list of code, length, data options
+    const size_t rdlength = static_cast<size_t>((query.packet[pos + 9] << 8) | query.packet[pos + 10]);
+    size_t option = pos + 11;
+    const size_t end = option + rdlength;
+    if (end > query.length) {
+        return false;
+    }
+
+    while (option + 4 <= end) {
+        const uint16_t code = static_cast<uint16_t>((query.packet[option] << 8) | query.packet[option + 1]);
+        const size_t length = static_cast<size_t>((query.packet[option + 2] << 8) | query.packet[option + 3]);
+        const uint8_t* data = query.packet + option + 4;
+        option += 4 + length;
+        if (option > end) {
+            return false;
+        }
+        if (code != ECS_OPTION_CODE) {
+            continue;
+        }
+
+        // Family, source prefix length, scope prefix length, then just enough address bytes
+        if (length < 4) {
+            return false;
+        }
+        const uint16_t family = static_cast<uint16_t>((data[0] << 8) | data[1]);
+        const uint8_t prefix = data[2];
+        const size_t address_length = length - 4;
+        if ((family != FAMILY_IPV4 || prefix > 32) && (family != FAMILY_IPV6 || prefix > 128)) {
+            return false;
+        }
+        // A source prefix of 0 is the client opting out, RFC 7871 section 7.1.2
+        if (prefix == 0 || address_length != (static_cast<size_t>(prefix) + 7) / 8) {
+            return false;
+        }
+
+        std::array<uint8_t, 16> address{};
+        memcpy(address.data(), data + 4, address_length);
+        if (prefix % 8 != 0) {
+            address[address_length - 1] &= static_cast<uint8_t>(0xFF << (8 - prefix % 8));
+        }
+
+        source = ComboAddress();
+        if (family == FAMILY_IPV4) {
+            source.sin4.sin_family = AF_INET;
+            memcpy(&source.sin4.sin_addr.s_addr, address.data(), 4);
+        } else {
+            source.sin6.sin6_family = AF_INET6;
+            memcpy(&source.sin6.sin6_addr.s6_addr, address.data(), 16);
+        }
+        source_prefix = prefix;
+        return true;
+    }
+    return false;
+}
+
+size_t truncateResponse(uint8_t* response, size_t length) {
+    QueryView question;
+    if (!parseQuestion(response, length, question)) {
+        return 0;
+    }
+    dnsheader header;
+    memcpy(&header, response, sizeof(header));
+    header.tc = 1;
+    header.ancount = 0;
+    header.nscount = 0;
+    header.arcount = 0;
+    memcpy(response, &header, sizeof(header));
+    return question.question_end;
+}
+
+size_t writeResponseHeader(const QueryView& query, uint8_t* response, size_t capacity,
+                           uint8_t rcode, uint16_t ancount) {
+    if (query.question_end > capacity) {
+        return 0;
+    }
+
+    // Header and question are echoed verbatim, then the flags and counts are fixed up
+    memcpy(response, query.packet, query.question_end);
+
+    dnsheader header;
+    memcpy(&header, response, sizeof(header));
+    header.qr = 1;
+    header.aa = 1;
+    header.tc = 0;
+    header.ra = 0;
+    header.ad = 0;
+    header.rcode = rcode;
+    header.qdcount = htons(1);
+    header.ancount = htons(ancount);
+    header.nscount = 0;
+    header.arcount = 0;
+    memcpy(response, &header, sizeof(header));
+
+    return query.question_end;
+}
+
+AnswerTemplate AnswerTemplate::forA(uint32_t address, uint32_t ttl) {
+    AnswerTemplate answer;
+    uint8_t* rr = answer.rr.data();
+    writeUint16(rr, QNAME_POINTER);
+    writeUint16(rr + 2, QType::A);
+    writeUint16(rr + 4, QClass::IN);
+    writeUint32(rr + 6, ttl);
+    writeUint16(rr + 10, sizeof(address));
+    memcpy(rr + 12, &address, sizeof(address));
+    answer.size = A_RECORD_SIZE;
+    return answer;
+}
+
+size_t writeTemplatedResponse(const QueryView& query, uint8_t* response, size_t capacity,
+                              const AnswerTemplate& answer) {
+    size_t pos = writeResponseHeader(query, response, capacity, RCode::NoError, 1);
+    if (pos == 0 || pos + answer.size > capacity) {
+        return 0;
+    }
+
+    memcpy(response + pos, answer.rr.data(), answer.size);
+    return pos + answer.size;
+}
+
+size_t writeAResponse(const QueryView& query, uint8_t* response, size_t capacity,
+                      uint32_t address, uint32_t ttl) {
+    return writeTemplatedResponse(query, response, capacity, AnswerTemplate::forA(address, ttl));
+}
+
+size_t writeErrorResponse(const QueryView& query, uint8_t* response, size_t capacity, uint8_t rcode) {
+    return writeResponseHeader(query, response, capacity, rcode, 0);
+}
+
+} // namespace dnswire
@@ -0,0 +1,137 @@
+#ifndef DNS_WIRE_H
+#define DNS_WIRE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "../../load_balancing/dns.hh"
+#include "../../load_balancing/dnsname.hh"
+#include "../../load_balancing/iputils.hh"
+
+/**
+ * Allocation-free DNS wire format helpers for the query hot path.
+ *
+ * Queries are parsed in place from the receive buffer, and responses are written
+ * straight into a caller-provided buffer by echoing the question and appending
+ * answers that point back at it with a compression pointer.
+ */
+namespace dnswire {
+
+constexpr size_t HEADER_SIZE = sizeof(dnsheader);
+
+// Compression pointer to the question name, which always starts right after the header
+constexpr uint16_t QNAME_POINTER = 0xC000 | HEADER_SIZE;
+
+/**
+ * View over a single-question query, pointing into the original packet
+ */
+struct QueryView {
+    const uint8_t* packet{nullptr};
+    size_t length{0};
+    const uint8_t* qname{nullptr};   // uncompressed wire format, including the root label
+    size_t qname_length{0};
+    uint16_t id{0};                  // network byte order, echoed as-is
+    uint16_t qtype{0};
+    uint16_t qclass{0};
+    size_t question_end{0};          // offset of the first byte after the question
+
+    std::string_view qnameView() const {
+        return std::string_view(reinterpret_cast<const char*>(qname), qname_length);
+    }
+};
+
+/**
+ * Pre-rendered answer RR for the question name: compression pointer, type, class,
+ * TTL, rdlength and rdata. Built once per backend so that answering a query is a
+ * header fix-up plus two memcpy()s.
+ */
+struct AnswerTemplate {
+    static constexpr size_t A_RECORD_SIZE = 2 + DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE + DNS_RDLENGTH_SIZE + 4;
+
+    std::array<uint8_t, A_RECORD_SIZE> rr{};
+    size_t size{0};
+
+    /**
+     * address is in network byte order
+     */
+    static AnswerTemplate forA(uint32_t address, uint32_t ttl);
+};
+
+/**
+ * Parse the header and the question of a standard query.
+ * Returns false for responses, non-QUERY opcodes, qdcount != 1 and malformed names.
+ */
+bool parseQuery(const uint8_t* packet, size_t length, QueryView& query);
+
+/**
+ * Parse the header and the single question of any message, query or response
+ */
+bool parseQuestion(const uint8_t* packet, size_t length, QueryView& query);
+
+/**
+ * Case-insensitive hash of the qname, identical to DNSName::hash(init) for the same name
+ */
+uint32_t hashQname(const QueryView& query, uint32_t init = 0);
+
+/**
+ * Is the DNSSEC OK bit set in the EDNS OPT record of the query? Only looks at
+ * the first additional record, which is where clients put the OPT record.
+ */
+bool hasDOBit(const QueryView& query);
+
+/**
+ * Largest UDP response the client accepts: the payload size of its EDNS OPT
+ * record (never less than 512), or 512 without EDNS.
+ */
+uint16_t getUDPPayloadSize(const QueryView& query);
+
+/**
+ * Source address of the EDNS Client Subnet option (RFC 7871) of the query, with
+ * the bits past source_prefix cleared. Returns false if the query has no valid
+ * ECS option, or one with a source prefix of 0.
+ */
+bool getClientSubnet(const QueryView& query, ComboAddress& source, uint8_t& source_prefix);
+
+/**
+ * Cut a response down to header and question with the TC bit set, so that the
+ * client retries over TCP. Works in place, returns the new length or 0 if the
+ * response cannot be parsed.
+ */
+size_t truncateResponse(uint8_t* response, size_t length);
+
+/**
+ * Does the qname equal zone (case-insensitively)?
+ */
+inline bool qnameEquals(const QueryView& query, const DNSName& zone) {
+    return zone.wirelength() == query.qname_length && zone.matchesUncompressedName(query.qnameView());
+}
+
+/**
+ * Write the response header and the echoed question. Returns the number of bytes
+ * written (the offset where answers go), or 0 if capacity is too small.
+ */
+size_t writeResponseHeader(const QueryView& query, uint8_t* response, size_t capacity,
+                           uint8_t rcode, uint16_t ancount);
+
+/**
+ * Full response with a single A record for the qname. address is in network byte order.
+ */
+size_t writeAResponse(const QueryView& query, uint8_t* response, size_t capacity,
+                      uint32_t address, uint32_t ttl);
+
+/**
+ * Full response with the pre-rendered answer appended after the echoed question
+ */
+size_t writeTemplatedResponse(const QueryView& query, uint8_t* response, size_t capacity,
+                              const AnswerTemplate& answer);
+
+/**
+ * Full response without answers (NXDOMAIN, SERVFAIL, ...)
+ */
+size_t writeErrorResponse(const QueryView& query, uint8_t* response, size_t capacity, uint8_t rcode);
+
+} // namespace dnswire
+
+#endif // DNS_WIRE_H
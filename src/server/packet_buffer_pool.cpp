@@ -0,0 +1,158 @@
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "packet_buffer_pool.h"
+
+namespace {
+
+std::atomic<uint64_t> g_heap_allocations{0};
+
+uint8_t* allocateBuffer(size_t capacity) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return new uint8_t[capacity];
+}
+
+/**
+ * Free buffers shared by all threads
+ */
+struct Depot {
+    std::mutex mutex;
+    std::vector<uint8_t*> buffers;
+
+    ~Depot() {
+        for (uint8_t* buffer : buffers) {
+            delete[] buffer;
+        }
+    }
+
+    // Move up to count buffers into out
+    void take(std::vector<uint8_t*>& out, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (count-- > 0 && !buffers.empty()) {
+            out.push_back(buffers.back());
+            buffers.pop_back();
+        }
+    }
+
+    // Take back the last count buffers of in, freeing what does not fit
+    void give(std::vector<uint8_t*>& in, size_t count) {
+        std::lock_guard<std::mutex> lock(mutex);
+        while (count-- > 0 && !in.empty()) {
+            if (buffers.size() < PacketBufferPool::MAX_DEPOT_BUFFERS) {
+                buffers.push_back(in.back());
+            } else {
+                delete[] in.back();
+            }
+            in.pop_back();
+        }
+    }
+};
+
+Depot& depot() {
+    static Depot instance;
+    return instance;
+}
+
+/**
+ * Free buffers of one thread, handed to the depot when the thread exits
+ */
+struct LocalCache {
+    std::vector<uint8_t*> buffers;
+
+    LocalCache() {
+        buffers.reserve(PacketBufferPool::LOCAL_CACHE_SIZE);
+    }
+
+    ~LocalCache() {
+        depot().give(buffers, buffers.size());
+    }
+};
+
+LocalCache& localCache() {
+    thread_local LocalCache cache;
+    return cache;
+}
+
+} // namespace
+
+PacketBuffer::PacketBuffer(PacketBuffer&& other) noexcept
+    : data_(other.data_), size_(other.size_), capacity_(other.capacity_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.capacity_ = 0;
+}
+
+PacketBuffer& PacketBuffer::operator=(PacketBuffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+    }
+    return *this;
+}
+
+void PacketBuffer::reset() {
+    if (data_) {
+        PacketBufferPool::release(data_, capacity_);
+        data_ = nullptr;
+        size_ = 0;
+        capacity_ = 0;
+    }
+}
+
+PacketBuffer PacketBufferPool::acquire(size_t size) {
+    if (size > BUFFER_SIZE) {
+        return PacketBuffer(allocateBuffer(size), size, size);
+    }
+
+    auto& cache = localCache().buffers;
+    if (cache.empty()) {
+        depot().take(cache, LOCAL_CACHE_SIZE / 2);
+    }
+    if (cache.empty()) {
+        return PacketBuffer(allocateBuffer(BUFFER_SIZE), size, BUFFER_SIZE);
+    }
+    uint8_t* data = cache.back();
+    cache.pop_back();
+    return PacketBuffer(data, size, BUFFER_SIZE);
+}
+
+void PacketBufferPool::release(uint8_t* data, size_t capacity) {
+    if (capacity != BUFFER_SIZE) {
+        delete[] data;
+        return;
+    }
+
+    auto& cache = localCache().buffers;
+    if (cache.size() >= LOCAL_CACHE_SIZE) {
+        depot().give(cache, LOCAL_CACHE_SIZE / 2);
+    }
+    cache.push_back(data);
+}
+
+void PacketBufferPool::reserve(size_t count) {
+    if (count > MAX_DEPOT_BUFFERS) {
+        count = MAX_DEPOT_BUFFERS;
+    }
+    std::vector<uint8_t*> buffers;
+    buffers.reserve(count);
+    {
+        std::lock_guard<std::mutex> lock(depot().mutex);
+        if (depot().buffers.size() >= count) {
+            return;
+        }
+        count -= depot().buffers.size();
+    }
+    for (size_t i = 0; i < count; ++i) {
+        buffers.push_back(allocateBuffer(BUFFER_SIZE));
+    }
+    depot().give(buffers, buffers.size());
+}
+
+uint64_t PacketBufferPool::heapAllocations() {
+    return g_heap_allocations.load(std::memory_order_relaxed);
+}
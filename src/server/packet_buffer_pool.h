@@ -0,0 +1,90 @@
+#ifndef PACKET_BUFFER_POOL_H
+#define PACKET_BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * One pooled packet buffer, the counterpart of the PacketBuffer dnsdist uses
+ * for every query. Move-only: a query is handed from the receiving stage to the
+ * forwarding stage, and a response back to the writer, without copying.
+ * Destroying it (or reset()) gives the buffer back to the pool.
+ */
+class PacketBuffer {
+public:
+    PacketBuffer() = default;
+    ~PacketBuffer() { reset(); }
+
+    PacketBuffer(PacketBuffer&& other) noexcept;
+    PacketBuffer& operator=(PacketBuffer&& other) noexcept;
+    PacketBuffer(const PacketBuffer&) = delete;
+    PacketBuffer& operator=(const PacketBuffer&) = delete;
+
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+
+    /**
+     * Bytes in use, set by resize(), at most capacity()
+     */
+    size_t size() const { return size_; }
+    void resize(size_t size) { size_ = size < capacity_ ? size : capacity_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    void reset();
+
+private:
+    friend class PacketBufferPool;
+
+    PacketBuffer(uint8_t* data, size_t size, size_t capacity) : data_(data), size_(size), capacity_(capacity) {}
+
+    uint8_t* data_{nullptr};
+    size_t size_{0};
+    size_t capacity_{0};
+};
+
+/**
+ * Fixed-size packet buffers recycled through per-thread caches.
+ *
+ * BUFFER_SIZE mirrors s_initialUDPPacketBufferSize in dnsdist.cc (without the
+ * DNSCrypt padding, which this server does not do): any EDNS query a client
+ * can send us fits, and so does any response we relay over UDP.
+ *
+ * Each thread keeps up to LOCAL_CACHE_SIZE free buffers and swaps half of them
+ * at a time with a shared depot, so acquiring and releasing a buffer usually
+ * touches no lock and no heap. Buffers released by another thread than the one
+ * that acquired them (a query handed to the TCP pool thread, say) flow back
+ * through the depot instead of piling up. The depot holds at most
+ * MAX_DEPOT_BUFFERS, anything beyond is freed, which keeps the memory held by
+ * the pool bounded after a burst. Requests larger than BUFFER_SIZE, i.e. TCP
+ * messages, get a buffer of their own from the heap.
+ */
+class PacketBufferPool {
+public:
+    static constexpr size_t BUFFER_SIZE = 4096;
+    static constexpr size_t LOCAL_CACHE_SIZE = 64;
+    static constexpr size_t MAX_DEPOT_BUFFERS = 8192;
+
+    /**
+     * Buffer of at least size bytes, with size() set to size
+     */
+    static PacketBuffer acquire(size_t size = BUFFER_SIZE);
+
+    /**
+     * Fill the depot with up to count buffers, so that the first burst does
+     * not go to the heap
+     */
+    static void reserve(size_t count);
+
+    /**
+     * Buffers taken from the heap so far, flat once the pool is warm
+     */
+    static uint64_t heapAllocations();
+
+private:
+    friend class PacketBuffer;
+
+    static void release(uint8_t* data, size_t capacity);
+};
+
+#endif // PACKET_BUFFER_POOL_H
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <netinet/in.h>
+#include "packet_cache.h"
+
+static inline uint16_t readUint16(const uint8_t* in) {
+    return static_cast<uint16_t>((in[0] << 8) | in[1]);
+}
+
+static inline uint32_t readUint32(const uint8_t* in) {
+    return (static_cast<uint32_t>(readUint16(in)) << 16) | readUint16(in + 2);
+}
+
+static inline void writeUint32(uint8_t* out, uint32_t value) {
+    out[0] = static_cast<uint8_t>(value >> 24);
+    out[1] = static_cast<uint8_t>(value >> 16);
+    out[2] = static_cast<uint8_t>(value >> 8);
+    out[3] = static_cast<uint8_t>(value);
+}
+
+static inline uint8_t asciiLower(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<uint8_t>(c + ('a' - 'A')) : c;
+}
+
+/**
+ * Offsets of the TTL of every record after the question, OPT excluded.
+ * Returns false if the response is malformed or has too many records.
+ */
+template <size_t N>
+static bool findTTLOffsets(const uint8_t* response, size_t length, size_t question_end,
+                           std::array<uint16_t, N>& offsets, uint8_t& count) {
+    dnsheader_aligned header(response);
+    const size_t records = static_cast<size_t>(ntohs(header->ancount)) + ntohs(header->nscount) + ntohs(header->arcount);
+    if (records > N) {
+        return false;
+    }
+
+    count = 0;
+    size_t pos = question_end;
+    for (size_t i = 0; i < records; ++i) {
+        // Owner name: labels, optionally ending with a compression pointer
+        for (;;) {
+            if (pos >= length) {
+                return false;
+            }
+            const uint8_t label = response[pos];
+            if (label == 0) {
+                ++pos;
+                break;
+            }
+            if ((label & 0xC0) == 0xC0) {
+                pos += 2;
+                break;
+            }
+            pos += 1 + label;
+        }
+        if (pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE + DNS_RDLENGTH_SIZE > length) {
+            return false;
+        }
+        if (readUint16(response + pos) != QType::OPT) {
+            offsets[count++] = static_cast<uint16_t>(pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE);
+        }
+        pos += DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE;
+        pos += DNS_RDLENGTH_SIZE + readUint16(response + pos);
+    }
+    return pos <= length;
+}
+
+PacketCache::PacketCache(size_t max_entries, size_t shard_count, uint32_t max_ttl, uint32_t negative_ttl)
+    : shard_count_(shard_count), slots_per_shard_(1), max_ttl_(max_ttl), negative_ttl_(negative_ttl) {
+
+    if (shard_count_ == 0 || max_entries == 0) {
+        throw std::runtime_error("Packet cache needs at least one shard and one entry");
+    }
+
+    const size_t per_shard = (max_entries + shard_count_ - 1) / shard_count_;
+    while (slots_per_shard_ < std::max(per_shard, MAX_PROBES)) {
+        slots_per_shard_ <<= 1;
+    }
+
+    shards_ = std::make_unique<Shard[]>(shard_count_);
+    for (size_t i = 0; i < shard_count_; ++i) {
+        shards_[i].keys = std::make_unique<uint64_t[]>(slots_per_shard_);
+        shards_[i].entries = std::make_unique<Entry[]>(slots_per_shard_);
+    }
+}
+
+uint64_t PacketCache::makeKey(const dnswire::QueryView& query, uint32_t qname_hash, bool do_bit) {
+    return (static_cast<uint64_t>(qname_hash) << 32) | (static_cast<uint64_t>(query.qtype) << 16) |
+           (static_cast<uint64_t>(query.qclass & 0x7FFF) << 1) | (do_bit ? 1 : 0);
+}
+
+uint32_t PacketCache::now() {
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+size_t PacketCache::firstSlot(uint64_t key) const {
+    // The shard already used the high half, mix everything for the slot
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & (slots_per_shard_ - 1);
+}
+
+size_t PacketCache::get(const dnswire::QueryView& query, uint32_t qname_hash, bool do_bit, uint64_t generation,
+                        uint8_t* response, size_t capacity) {
+    const uint64_t key = makeKey(query, qname_hash, do_bit);
+    Shard& shard = shardFor(key);
+    const size_t first = firstSlot(key);
+    const uint32_t current = now();
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (size_t probe = 0; probe < MAX_PROBES; ++probe) {
+        const size_t slot = (first + probe) & (slots_per_shard_ - 1);
+        if (shard.keys[slot] != key) {
+            continue;
+        }
+
+        const Entry& entry = shard.entries[slot];
+        if (entry.generation != generation || entry.expiry <= current || entry.length > capacity ||
+            entry.length < query.question_end) {
+            continue;
+        }
+        // Same hash, make sure it is the same name
+        const uint8_t* cached_qname = entry.response.data() + dnswire::HEADER_SIZE;
+        bool same_name = true;
+        for (size_t i = 0; i < query.qname_length; ++i) {
+            if (asciiLower(cached_qname[i]) != asciiLower(query.qname[i])) {
+                same_name = false;
+                break;
+            }
+        }
+        if (!same_name) {
+            continue;
+        }
+
+        memcpy(response, entry.response.data(), entry.length);
+        // ID, RD and CD come from the new query, so does the case of the question
+        memcpy(response, &query.id, sizeof(query.id));
+        response[2] = static_cast<uint8_t>((response[2] & ~0x01) | (query.packet[2] & 0x01));
+        response[3] = static_cast<uint8_t>((response[3] & ~0x10) | (query.packet[3] & 0x10));
+        memcpy(response + dnswire::HEADER_SIZE, query.qname, query.qname_length);
+
+        const uint32_t age = current - entry.inserted;
+        for (size_t i = 0; i < entry.ttl_count; ++i) {
+            uint8_t* ttl = response + entry.ttl_offsets[i];
+            const uint32_t original = readUint32(ttl);
+            writeUint32(ttl, original > age ? original - age : 0);
+        }
+
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        return entry.length;
+    }
+
+    shard.misses.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+void PacketCache::insert(const dnswire::QueryView& query, uint32_t qname_hash, bool do_bit, uint64_t generation,
+                         const uint8_t* response, size_t length) {
+    const uint64_t key = makeKey(query, qname_hash, do_bit);
+    if (key == 0 || length > MAX_RESPONSE_SIZE || length < query.question_end) {
+        return;
+    }
+    dnsheader_aligned header(response);
+    if (header->rcode != RCode::NoError && header->rcode != RCode::NXDomain) {
+        return;
+    }
+
+    // Parsed outside of the lock
+    std::array<uint16_t, MAX_TTL_OFFSETS> ttl_offsets{};
+    uint8_t ttl_count = 0;
+    if (!findTTLOffsets(response, length, query.question_end, ttl_offsets, ttl_count)) {
+        return;
+    }
+    uint32_t ttl = ttl_count == 0 ? negative_ttl_ : max_ttl_;
+    for (size_t i = 0; i < ttl_count; ++i) {
+        ttl = std::min(ttl, readUint32(response + ttl_offsets[i]));
+    }
+    if (ttl == 0) {
+        return;
+    }
+
+    Shard& shard = shardFor(key);
+    const size_t first = firstSlot(key);
+    const uint32_t current = now();
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    // Same key first, then a free, expired or outdated slot, then the one closest to expiry
+    size_t victim = first;
+    int victim_rank = -1;
+    for (size_t probe = 0; probe < MAX_PROBES; ++probe) {
+        const size_t slot = (first + probe) & (slots_per_shard_ - 1);
+        const Entry& entry = shard.entries[slot];
+        int rank;
+        if (shard.keys[slot] == key) {
+            rank = 3;
+        } else if (shard.keys[slot] == 0 || entry.expiry <= current || entry.generation != generation) {
+            rank = 2;
+        } else {
+            rank = 1;
+        }
+
+        if (rank > victim_rank ||
+            (rank == 1 && victim_rank == 1 && entry.expiry < shard.entries[victim].expiry)) {
+            victim = slot;
+            victim_rank = rank;
+            if (rank == 3) {
+                break;
+            }
+        }
+    }
+
+    Entry& entry = shard.entries[victim];
+    shard.keys[victim] = key;
+    entry.generation = generation;
+    entry.inserted = current;
+    entry.expiry = current + ttl;
+    entry.length = static_cast<uint16_t>(length);
+    entry.ttl_count = ttl_count;
+    entry.ttl_offsets = ttl_offsets;
+    memcpy(entry.response.data(), response, length);
+}
+
+uint64_t PacketCache::hits() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < shard_count_; ++i) {
+        total += shards_[i].hits.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t PacketCache::misses() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < shard_count_; ++i) {
+        total += shards_[i].misses.load(std::memory_order_relaxed);
+    }
+    return total;
+}
@@ -0,0 +1,101 @@
+#ifndef PACKET_CACHE_H
+#define PACKET_CACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "dns_wire.h"
+
+/**
+ * Sharded cache of complete responses, modeled on the dnsdist packet cache.
+ *
+ * Entries are keyed on (qname hash, qtype, qclass, DO bit) and tagged with the
+ * health generation they were computed for, so a change in the set of healthy
+ * backends invalidates every cached decision at once. Each shard is a fixed
+ * size open-addressing table behind its own lock: lookups probe a short window
+ * of slots, and inserts overwrite the first free or expired slot of that window,
+ * or the one closest to expiry. Nothing is ever allocated after warm-up.
+ *
+ * Responses are kept for their lowest record TTL (capped at max_ttl), answers
+ * without records for negative_ttl, and SERVFAIL or other errors not at all.
+ * On a hit the response is copied out with the query ID and question case of
+ * the new query, and its TTLs lowered by the time spent in the cache.
+ */
+class PacketCache {
+public:
+    static constexpr size_t DEFAULT_SHARD_COUNT = 32;
+    // Longest response cached. Every slot stores this many bytes inline, so it is
+    // not the 4096 of the packet buffers: the answers built here (header, question
+    // with a qname of at most 255 bytes, one A record, no OPT) always fit in 512.
+    // Anything longer is not stored and simply misses.
+    static constexpr size_t MAX_RESPONSE_SIZE = 512;
+    static constexpr uint32_t DEFAULT_MAX_TTL = 86400;
+    static constexpr uint32_t DEFAULT_NEGATIVE_TTL = 60;
+
+    explicit PacketCache(size_t max_entries, size_t shard_count = DEFAULT_SHARD_COUNT,
+                         uint32_t max_ttl = DEFAULT_MAX_TTL, uint32_t negative_ttl = DEFAULT_NEGATIVE_TTL);
+
+    PacketCache(const PacketCache&) = delete;
+    PacketCache& operator=(const PacketCache&) = delete;
+
+    /**
+     * Write the cached response for query into response and return its length,
+     * or 0 on a miss (no entry, expired, other generation or too small a buffer)
+     */
+    size_t get(const dnswire::QueryView& query, uint32_t qname_hash, bool do_bit, uint64_t generation,
+               uint8_t* response, size_t capacity);
+
+    /**
+     * Cache a response built for query, if it is cacheable
+     */
+    void insert(const dnswire::QueryView& query, uint32_t qname_hash, bool do_bit, uint64_t generation,
+                const uint8_t* response, size_t length);
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+    size_t capacity() const { return shard_count_ * slots_per_shard_; }
+
+private:
+    // Probe window of a lookup or insert, keeps the worst case a few cache lines
+    static constexpr size_t MAX_PROBES = 8;
+    // TTL offsets remembered per entry, our responses carry one answer at most
+    static constexpr size_t MAX_TTL_OFFSETS = 8;
+
+    struct Entry {
+        uint64_t generation{0};
+        uint32_t inserted{0};        // seconds, see now()
+        uint32_t expiry{0};
+        uint16_t length{0};
+        uint8_t ttl_count{0};
+        std::array<uint16_t, MAX_TTL_OFFSETS> ttl_offsets{};
+        std::array<uint8_t, MAX_RESPONSE_SIZE> response{};
+    };
+
+    // Keys are kept apart from the entries so that probing only touches them
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unique_ptr<uint64_t[]> keys;   // 0 marks a free slot
+        std::unique_ptr<Entry[]> entries;
+        // Updated under the lock, atomic only so that hits()/misses() can read them
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    size_t shard_count_;
+    size_t slots_per_shard_;             // power of two
+    uint32_t max_ttl_;
+    uint32_t negative_ttl_;
+    std::unique_ptr<Shard[]> shards_;
+
+    static uint64_t makeKey(const dnswire::QueryView& query, uint32_t qname_hash, bool do_bit);
+    static uint32_t now();
+    Shard& shardFor(uint64_t key) { return shards_[(key >> 32) % shard_count_]; }
+    size_t firstSlot(uint64_t key) const;
+};
+
+#endif // PACKET_CACHE_H
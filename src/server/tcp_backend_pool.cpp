@@ -0,0 +1,204 @@
+#include <array>
+#include <cstring>
+#include "tcp_backend_pool.h"
+
+/**
+ * One query and its response over one backend connection
+ */
+struct TcpBackendPool::Exchange {
+    explicit Exchange(boost::asio::io_context& io_context) : timer(io_context) {}
+
+    size_t backend_index{0};
+    std::array<uint8_t, 2> query_length{};
+    PacketBuffer query;
+    ResponseCallback callback;
+    std::unique_ptr<tcp::socket> socket;
+    boost::asio::steady_timer timer;
+    std::array<uint8_t, 2> response_length{};
+    PacketBuffer response;
+    std::chrono::steady_clock::time_point started;
+    bool reused{false};                   // the connection came from the idle list
+    bool retried{false};
+    bool timed_out{false};
+    bool done{false};
+};
+
+TcpBackendPool::TcpBackendPool(DnsdistLoadBalancer* load_balancer, size_t max_idle_per_backend,
+                               std::chrono::milliseconds timeout)
+    : load_balancer_(load_balancer), max_idle_per_backend_(max_idle_per_backend), timeout_(timeout),
+      work_(boost::asio::make_work_guard(io_context_)) {
+
+    if (!load_balancer_) {
+        throw std::runtime_error("LoadBalancer cannot be null");
+    }
+
+    const size_t backend_count = load_balancer_->backendCount();
+    for (size_t i = 0; i < backend_count; ++i) {
+        addBackend(i);
+    }
+    // Queued ahead of any exchange with the new backend, which can only start once reload() returns
+    listener_id_ = load_balancer_->addBackendListener([this](size_t backend_index) {
+        boost::asio::post(io_context_, [this, backend_index]() { addBackend(backend_index); });
+    });
+}
+
+TcpBackendPool::~TcpBackendPool() {
+    load_balancer_->removeBackendListener(listener_id_);
+    stop();
+}
+
+void TcpBackendPool::addBackend(size_t backend_index) {
+    if (endpoints_.size() <= backend_index) {
+        endpoints_.resize(backend_index + 1);
+        idle_.resize(backend_index + 1);
+    }
+    const ComboAddress& address = load_balancer_->backendAddress(backend_index);
+    tcp::endpoint endpoint;
+    memcpy(endpoint.data(), &address, address.getSocklen());
+    endpoint.resize(address.getSocklen());
+    endpoints_[backend_index] = endpoint;
+}
+
+void TcpBackendPool::start() {
+    thread_ = std::thread([this]() { io_context_.run(); });
+}
+
+void TcpBackendPool::stop() {
+    work_.reset();
+    io_context_.stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void TcpBackendPool::forward(size_t backend_index, PacketBuffer query, ResponseCallback callback) {
+    if (backend_index >= load_balancer_->backendCount() || query.size() < sizeof(dnsheader) || query.size() > UINT16_MAX) {
+        callback(false, std::move(query));
+        return;
+    }
+
+    auto exchange = std::make_shared<Exchange>(io_context_);
+    exchange->backend_index = backend_index;
+    exchange->callback = std::move(callback);
+    exchange->query_length[0] = static_cast<uint8_t>(query.size() >> 8);
+    exchange->query_length[1] = static_cast<uint8_t>(query.size() & 0xFF);
+    exchange->query = std::move(query);
+
+    boost::asio::post(io_context_, [this, exchange]() {
+        ++load_balancer_->backendState(exchange->backend_index).outstanding;
+        exchange->started = std::chrono::steady_clock::now();
+        exchange->timer.expires_after(timeout_);
+        exchange->timer.async_wait([this, exchange](boost::system::error_code ec) {
+            if (!ec && !exchange->done) {
+                // Fails whatever operation is pending on the socket
+                exchange->timed_out = true;
+                boost::system::error_code ignored;
+                exchange->socket->close(ignored);
+            }
+        });
+        startExchange(exchange);
+    });
+}
+
+void TcpBackendPool::startExchange(const std::shared_ptr<Exchange>& exchange) {
+    auto& idle = idle_[exchange->backend_index];
+    // A retry always takes a new connection, the idle ones are likely stale too
+    if (!idle.empty() && !exchange->retried) {
+        exchange->socket = std::move(idle.back());
+        idle.pop_back();
+        exchange->reused = true;
+        sendQuery(exchange);
+        return;
+    }
+
+    exchange->socket = std::make_unique<tcp::socket>(io_context_);
+    exchange->reused = false;
+    exchange->socket->async_connect(endpoints_[exchange->backend_index],
+        [this, exchange](boost::system::error_code ec) {
+            if (ec) {
+                finishExchange(exchange, false);
+                return;
+            }
+            boost::system::error_code ignored;
+            exchange->socket->set_option(tcp::no_delay(true), ignored);
+            sendQuery(exchange);
+        });
+}
+
+void TcpBackendPool::sendQuery(const std::shared_ptr<Exchange>& exchange) {
+    // Length prefix and message go out in one write, the message is not copied
+    const std::array<boost::asio::const_buffer, 2> buffers{
+        boost::asio::buffer(exchange->query_length),
+        boost::asio::buffer(exchange->query.data(), exchange->query.size())};
+    boost::asio::async_write(*exchange->socket, buffers,
+        [this, exchange](boost::system::error_code ec, std::size_t) {
+            if (ec) {
+                retryOrFail(exchange);
+                return;
+            }
+            readResponse(exchange);
+        });
+}
+
+void TcpBackendPool::readResponse(const std::shared_ptr<Exchange>& exchange) {
+    boost::asio::async_read(*exchange->socket, boost::asio::buffer(exchange->response_length),
+        [this, exchange](boost::system::error_code ec, std::size_t) {
+            if (ec) {
+                retryOrFail(exchange);
+                return;
+            }
+            const size_t length = (static_cast<size_t>(exchange->response_length[0]) << 8) | exchange->response_length[1];
+            if (length < sizeof(dnsheader)) {
+                finishExchange(exchange, false);
+                return;
+            }
+            exchange->response = PacketBufferPool::acquire(length);
+            boost::asio::async_read(*exchange->socket,
+                boost::asio::buffer(exchange->response.data(), exchange->response.size()),
+                [this, exchange](boost::system::error_code read_ec, std::size_t) {
+                    // One query per connection at a time, the ID has to match
+                    const bool same_id = !read_ec && memcmp(exchange->response.data(), exchange->query.data(), 2) == 0;
+                    finishExchange(exchange, same_id);
+                });
+        });
+}
+
+void TcpBackendPool::retryOrFail(const std::shared_ptr<Exchange>& exchange) {
+    // Nothing was read yet on a parked connection: the backend closed it while idle
+    if (exchange->reused && !exchange->retried && !exchange->timed_out) {
+        boost::system::error_code ignored;
+        exchange->socket->close(ignored);
+        exchange->retried = true;
+        startExchange(exchange);
+        return;
+    }
+    finishExchange(exchange, false);
+}
+
+void TcpBackendPool::finishExchange(const std::shared_ptr<Exchange>& exchange, bool success) {
+    if (exchange->done) {
+        return;
+    }
+    exchange->done = true;
+    exchange->timer.cancel();
+
+    DownstreamState& state = load_balancer_->backendState(exchange->backend_index);
+    --state.outstanding;
+
+    auto& idle = idle_[exchange->backend_index];
+    if (success) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - exchange->started);
+        state.updateTCPLatency(static_cast<double>(elapsed.count()));
+        load_balancer_->recordBackendLatency(exchange->backend_index, static_cast<uint64_t>(elapsed.count()));
+        if (idle.size() < max_idle_per_backend_) {
+            idle.push_back(std::move(exchange->socket));
+        }
+    }
+    if (exchange->socket) {
+        boost::system::error_code ignored;
+        exchange->socket->close(ignored);
+    }
+
+    exchange->callback(success, success ? std::move(exchange->response) : std::move(exchange->query));
+}
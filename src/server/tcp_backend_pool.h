@@ -0,0 +1,83 @@
+#ifndef TCP_BACKEND_POOL_H
+#define TCP_BACKEND_POOL_H
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "packet_buffer_pool.h"
+#include "../load_balancer/dnsdist_load_balancer.h"
+
+/**
+ * DNS over TCP to the backends, with connection reuse.
+ *
+ * Every exchange runs on the pool's own io_context thread: it takes an idle
+ * connection to the backend if there is one, or connects a new one, writes the
+ * length-prefixed query and reads the response back. The connection is then
+ * parked for the next query instead of being closed, so steady traffic pays
+ * for the handshake once per connection, not once per query. A parked
+ * connection the backend has closed in the meantime is detected on reuse and
+ * the query retried once on a fresh one.
+ *
+ * Exchanges are counted in DownstreamState::outstanding while in flight and
+ * feed DownstreamState::latencyUsecTCP, which the policies use for TCP-only
+ * backends.
+ */
+class TcpBackendPool {
+public:
+    static constexpr size_t DEFAULT_MAX_IDLE_PER_BACKEND = 8;
+    static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{2000};
+
+    /**
+     * Called on the pool thread. On success response holds the complete
+     * message, without the length prefix. On failure it holds the query
+     * back, so the caller can still answer it with an error.
+     */
+    using ResponseCallback = std::function<void(bool success, PacketBuffer response)>;
+
+    explicit TcpBackendPool(DnsdistLoadBalancer* load_balancer,
+                            size_t max_idle_per_backend = DEFAULT_MAX_IDLE_PER_BACKEND,
+                            std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+    ~TcpBackendPool();
+
+    TcpBackendPool(const TcpBackendPool&) = delete;
+    TcpBackendPool& operator=(const TcpBackendPool&) = delete;
+
+    void start();
+    void stop();
+
+    /**
+     * Send query (a complete message, without length prefix) to backend_index
+     * and call callback with its response. Thread-safe.
+     */
+    void forward(size_t backend_index, PacketBuffer query, ResponseCallback callback);
+
+private:
+    using tcp = boost::asio::ip::tcp;
+    struct Exchange;
+
+    DnsdistLoadBalancer* load_balancer_;
+    size_t max_idle_per_backend_;
+    std::chrono::milliseconds timeout_;
+    boost::asio::io_context io_context_{1};
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
+    std::thread thread_;
+    size_t listener_id_{0};
+    // Per backend, like the parked connections only touched on the pool thread once started
+    std::vector<tcp::endpoint> endpoints_;
+    std::vector<std::vector<std::unique_ptr<tcp::socket>>> idle_;
+
+    void addBackend(size_t backend_index);
+    void startExchange(const std::shared_ptr<Exchange>& exchange);
+    void sendQuery(const std::shared_ptr<Exchange>& exchange);
+    void readResponse(const std::shared_ptr<Exchange>& exchange);
+    void finishExchange(const std::shared_ptr<Exchange>& exchange, bool success);
+    void retryOrFail(const std::shared_ptr<Exchange>& exchange);
+};
+
+#endif // TCP_BACKEND_POOL_H
@@ -0,0 +1,221 @@
+#include <array>
+#include <deque>
+#include <memory>
+#include "tcp_listener.h"
+
+using boost::asio::ip::tcp;
+
+class TcpListener::Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(tcp::socket socket, TcpListener& listener)
+        : socket_(std::move(socket)), listener_(listener), idle_timer_(socket_.get_executor()) {
+        // Once per connection, every query on it is routed by this address
+        boost::system::error_code ec;
+        remote_ = socket_.remote_endpoint(ec);
+    }
+
+    void start() {
+        // Denied clients are closed on before reading anything, like UDP drops them
+        if (listener_.load_balancer_ && !listener_.load_balancer_->isAllowed(remote_.data(), remote_.size())) {
+            close();
+            return;
+        }
+        armIdleTimer();
+        maybeRead();
+    }
+
+private:
+    struct OutgoingMessage {
+        std::array<uint8_t, 2> length;
+        PacketBuffer message;
+    };
+
+    tcp::socket socket_;
+    TcpListener& listener_;
+    tcp::endpoint remote_;
+    boost::asio::steady_timer idle_timer_;
+    std::array<uint8_t, 2> length_{};
+    PacketBuffer query_;
+    std::deque<OutgoingMessage> write_queue_;
+    size_t in_flight_{0};                            // forwarded, not answered yet
+    bool reading_{false};
+    bool closed_{false};
+
+    void maybeRead() {
+        if (closed_ || reading_ || in_flight_ + write_queue_.size() >= MAX_IN_FLIGHT) {
+            return;
+        }
+        reading_ = true;
+        auto self = shared_from_this();
+        boost::asio::async_read(socket_, boost::asio::buffer(length_),
+            [self](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    self->close();
+                    return;
+                }
+                const size_t length = (static_cast<size_t>(self->length_[0]) << 8) | self->length_[1];
+                self->query_ = PacketBufferPool::acquire(length);
+                boost::asio::async_read(self->socket_,
+                    boost::asio::buffer(self->query_.data(), self->query_.size()),
+                    [self](boost::system::error_code read_ec, std::size_t) {
+                        self->reading_ = false;
+                        if (read_ec) {
+                            self->close();
+                            return;
+                        }
+                        self->handleQuery();
+                        // Pipelining: go for the next query right away
+                        self->maybeRead();
+                    });
+            });
+    }
+
+    void handleQuery() {
+        dnswire::QueryView query;
+        if (!dnswire::parseQuery(query_.data(), query_.size(), query)) {
+            close();
+            return;
+        }
+        armIdleTimer();
+        listener_.queries_.increment(0);
+        // The connection already proves the address, refuse instead of leaving the client hanging
+        if (listener_.load_balancer_ && !listener_.load_balancer_->admitClient(remote_.data(), remote_.size())) {
+            queueError(query_, RCode::Refused);
+            return;
+        }
+        const uint32_t qname_hash = dnswire::hashQname(query);
+        const int pool = listener_.load_balancer_
+                             ? listener_.load_balancer_->routeQuery(query, remote_.data(), remote_.size())
+                             : DnsdistLoadBalancer::ALL_POOLS;
+
+        if (listener_.backend_pool_) {
+            const int backend_index = listener_.load_balancer_->selectBackendIndex(qname_hash, pool);
+            if (backend_index >= 0) {
+                ++in_flight_;
+                auto self = shared_from_this();
+                listener_.backend_pool_->forward(static_cast<size_t>(backend_index), std::move(query_),
+                    [self](bool success, PacketBuffer message) {
+                        // Back from the pool thread onto this connection's strand
+                        boost::asio::post(self->socket_.get_executor(),
+                            [self, success, message = std::move(message)]() mutable {
+                                --self->in_flight_;
+                                if (success) {
+                                    self->queueWrite(std::move(message));
+                                } else {
+                                    self->queueError(message, RCode::ServFail);
+                                }
+                                self->maybeRead();
+                            });
+                    });
+                return;
+            }
+            queueError(query_, RCode::ServFail);
+            return;
+        }
+
+        PacketBuffer response = PacketBufferPool::acquire();
+        response.resize(listener_.handler_(query, qname_hash, pool, response.data(), response.capacity()));
+        queueWrite(std::move(response));
+    }
+
+    void queueError(const PacketBuffer& packet, uint8_t rcode) {
+        dnswire::QueryView query;
+        if (!dnswire::parseQuery(packet.data(), packet.size(), query)) {
+            return;
+        }
+        PacketBuffer response = PacketBufferPool::acquire();
+        response.resize(dnswire::writeErrorResponse(query, response.data(), response.capacity(), rcode));
+        queueWrite(std::move(response));
+    }
+
+    void queueWrite(PacketBuffer message) {
+        if (closed_ || message.empty() || message.size() > UINT16_MAX) {
+            return;
+        }
+        const size_t length = message.size();
+        write_queue_.push_back({{static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length & 0xFF)},
+                                std::move(message)});
+        if (write_queue_.size() == 1) {
+            writeNext();
+        }
+    }
+
+    void writeNext() {
+        auto self = shared_from_this();
+        OutgoingMessage& next = write_queue_.front();
+        const std::array<boost::asio::const_buffer, 2> buffers{
+            boost::asio::buffer(next.length), boost::asio::buffer(next.message.data(), next.message.size())};
+        boost::asio::async_write(socket_, buffers,
+            [self](boost::system::error_code ec, std::size_t) {
+                if (ec) {
+                    self->close();
+                    return;
+                }
+                self->write_queue_.pop_front();
+                if (!self->write_queue_.empty()) {
+                    self->writeNext();
+                }
+                self->maybeRead();
+            });
+    }
+
+    void armIdleTimer() {
+        idle_timer_.expires_after(IDLE_TIMEOUT);
+        auto self = shared_from_this();
+        idle_timer_.async_wait([self](boost::system::error_code ec) {
+            if (ec || self->closed_) {
+                return;
+            }
+            if (self->in_flight_ == 0 && self->write_queue_.empty()) {
+                self->close();
+            } else {
+                self->armIdleTimer();
+            }
+        });
+    }
+
+    void close() {
+        if (closed_) {
+            return;
+        }
+        closed_ = true;
+        idle_timer_.cancel();
+        boost::system::error_code ignored;
+        socket_.shutdown(tcp::socket::shutdown_both, ignored);
+        socket_.close(ignored);
+    }
+};
+
+TcpListener::TcpListener(boost::asio::io_context& io_context, uint16_t port, LocalHandler handler,
+                         DnsdistLoadBalancer* load_balancer, TcpBackendPool* backend_pool, bool reuse_port)
+    : io_context_(io_context), acceptor_(io_context), handler_(std::move(handler)),
+      load_balancer_(load_balancer), backend_pool_(backend_pool) {
+
+    if (backend_pool_ && !load_balancer_) {
+        throw std::runtime_error("Forwarding over TCP needs a load balancer");
+    }
+
+    tcp::endpoint endpoint(tcp::v4(), port);
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(tcp::acceptor::reuse_address(true));
+    if (reuse_port) {
+        using reuse_port_option = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+        acceptor_.set_option(reuse_port_option(true));
+    }
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    startAccept();
+}
+
+void TcpListener::startAccept() {
+    // Each connection gets its own strand, handlers of one connection never run concurrently
+    acceptor_.async_accept(boost::asio::make_strand(io_context_),
+        [this](boost::system::error_code ec, tcp::socket socket) {
+            if (!ec) {
+                boost::system::error_code ignored;
+                socket.set_option(tcp::no_delay(true), ignored);
+                std::make_shared<Connection>(std::move(socket), *this)->start();
+            }
+            startAccept();
+        });
+}
@@ -0,0 +1,64 @@
+#ifndef TCP_LISTENER_H
+#define TCP_LISTENER_H
+
+#include <boost/asio.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "dns_wire.h"
+#include "tcp_backend_pool.h"
+#include "../load_balancer/per_thread_counters.h"
+
+/**
+ * DNS over TCP listener (RFC 7766).
+ *
+ * Each connection runs on its own strand and keeps reading length-prefixed
+ * queries while earlier ones are still being answered, so pipelined queries
+ * are processed concurrently and answered as soon as they are ready, possibly
+ * out of order. Writes are queued and sent one at a time. A connection stops
+ * reading while MAX_IN_FLIGHT queries are pending and is closed after
+ * IDLE_TIMEOUT without a query.
+ *
+ * Queries are routed by the load balancer, when there is one, and answered by
+ * the local handler, or forwarded to the backend the load balancer selects
+ * over the pooled connections of a TcpBackendPool.
+ */
+class TcpListener {
+public:
+    static constexpr size_t MAX_IN_FLIGHT = 64;
+    static constexpr std::chrono::seconds IDLE_TIMEOUT{10};
+
+    /**
+     * Build the response to a parsed query, returns its length or 0 to drop it.
+     * pool is the routing decision of DnsdistLoadBalancer::routeQuery().
+     */
+    using LocalHandler = std::function<size_t(const dnswire::QueryView& query, uint32_t qname_hash, int pool,
+                                              uint8_t* response, size_t capacity)>;
+
+    /**
+     * With a backend pool every query is forwarded, otherwise answered by handler
+     */
+    TcpListener(boost::asio::io_context& io_context, uint16_t port, LocalHandler handler,
+                DnsdistLoadBalancer* load_balancer = nullptr, TcpBackendPool* backend_pool = nullptr,
+                bool reuse_port = false);
+
+    /**
+     * Queries received so far
+     */
+    uint64_t queries() const { return queries_.load(0); }
+
+private:
+    class Connection;
+
+    boost::asio::io_context& io_context_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    LocalHandler handler_;
+    DnsdistLoadBalancer* load_balancer_;
+    TcpBackendPool* backend_pool_;
+    PerThreadCounters queries_{1};
+
+    void startAccept();
+};
+
+#endif // TCP_LISTENER_H
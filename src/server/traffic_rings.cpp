@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "traffic_rings.h"
+#include "../logging/logger.h"
+
+static std::atomic<uint64_t> s_next_instance_id{1};
+
+thread_local std::vector<TrafficRings::LocalEntry> TrafficRings::t_rings;
+
+TrafficRings::TrafficRings(DnsdistLoadBalancer* load_balancer, size_t ring_size, size_t top_n,
+                           std::chrono::seconds window)
+    : instance_id_(s_next_instance_id.fetch_add(1)), ring_size_(ring_size), top_n_(top_n),
+      window_length_(window), load_balancer_(load_balancer) {
+
+    if (!load_balancer_) {
+        throw std::runtime_error("LoadBalancer cannot be null");
+    }
+    if (ring_size_ == 0 || (ring_size_ & (ring_size_ - 1)) != 0) {
+        throw std::runtime_error("Traffic ring size must be a power of two");
+    }
+
+    addBackendNames();
+    window_.start = std::chrono::system_clock::now();
+}
+
+void TrafficRings::addBackendNames() {
+    for (size_t i = backend_names_.size(); i < load_balancer_->backendCount(); ++i) {
+        backend_names_.push_back(load_balancer_->backendAddress(i).toStringWithPort());
+    }
+    window_.backends.resize(backend_names_.size(), 0);
+}
+
+TrafficRings::~TrafficRings() {
+    stop();
+}
+
+void TrafficRings::start() {
+    running_ = true;
+    maintenance_thread_ = std::thread(&TrafficRings::maintenanceLoop, this);
+}
+
+void TrafficRings::stop() {
+    running_ = false;
+    if (maintenance_thread_.joinable()) {
+        maintenance_thread_.join();
+    }
+}
+
+TrafficRings::ThreadRings& TrafficRings::registerThread() {
+    auto rings = std::make_unique<ThreadRings>(ring_size_);
+    ThreadRings* raw = rings.get();
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings_.push_back(std::move(rings));
+    }
+    t_rings.push_back({instance_id_, raw});
+    return *raw;
+}
+
+void TrafficRings::copyRequestor(Requestor& out, const sockaddr* requestor, socklen_t requestor_length) {
+    out.family = 0;
+    if (requestor->sa_family == AF_INET && requestor_length >= sizeof(sockaddr_in)) {
+        out.family = AF_INET;
+        memcpy(out.address.data(), &reinterpret_cast<const sockaddr_in*>(requestor)->sin_addr, 4);
+    } else if (requestor->sa_family == AF_INET6 && requestor_length >= sizeof(sockaddr_in6)) {
+        out.family = AF_INET6;
+        memcpy(out.address.data(), &reinterpret_cast<const sockaddr_in6*>(requestor)->sin6_addr, 16);
+    }
+}
+
+void TrafficRings::insertQuery(const dnswire::QueryView& query, uint32_t qname_hash,
+                               const sockaddr* requestor, socklen_t requestor_length) {
+    auto& ring = localRings().queries;
+    Query* record = ring.reserve();
+    if (!record) {
+        return;
+    }
+    copyRequestor(record->requestor, requestor, requestor_length);
+    record->qname_hash = qname_hash;
+    record->qtype = query.qtype;
+    record->size = static_cast<uint16_t>(query.length);
+    record->qname_length = static_cast<uint8_t>(std::min(query.qname_length, MAX_QNAME_BYTES));
+    memcpy(record->qname.data(), query.qname, record->qname_length);
+    ring.publish();
+}
+
+void TrafficRings::insertResponse(const uint8_t* response, size_t length, const sockaddr* requestor,
+                                  socklen_t requestor_length, int backend, uint32_t usec) {
+    if (length < dnswire::HEADER_SIZE) {
+        return;
+    }
+    auto& ring = localRings().responses;
+    Response* record = ring.reserve();
+    if (!record) {
+        return;
+    }
+    copyRequestor(record->requestor, requestor, requestor_length);
+    record->backend = backend;
+    record->usec = usec;
+    record->size = static_cast<uint16_t>(length);
+    record->rcode = response[3] & 0x0F;
+    ring.publish();
+}
+
+/**
+ * Dotted text of a (possibly truncated) wire format name
+ */
+static std::string qnameToString(const uint8_t* qname, size_t length) {
+    std::string name;
+    size_t pos = 0;
+    while (pos < length) {
+        const uint8_t label_length = qname[pos++];
+        if (label_length == 0) {
+            return name.empty() ? "." : name;
+        }
+        const size_t available = std::min<size_t>(label_length, length - pos);
+        name.append(reinterpret_cast<const char*>(qname + pos), available);
+        pos += available;
+        if (available < label_length) {
+            break;
+        }
+        name.push_back('.');
+    }
+    // The root label was cut off
+    return name + "...";
+}
+
+std::string TrafficRings::requestorToString(const std::string& key) {
+    char text[INET6_ADDRSTRLEN] = "unknown";
+    const int family = static_cast<uint8_t>(key[0]);
+    if (family == AF_INET || family == AF_INET6) {
+        inet_ntop(family, key.data() + 1, text, sizeof(text));
+    }
+    return text;
+}
+
+void TrafficRings::drain() {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    for (auto& rings : rings_) {
+        auto& queries = rings->queries;
+        const uint64_t query_head = queries.head.load(std::memory_order_acquire);
+        for (uint64_t i = queries.tail.load(std::memory_order_relaxed); i < query_head; ++i) {
+            const Query& record = queries.records[i & queries.mask];
+            ++window_.queries;
+            auto& qname = window_.qnames[record.qname_hash];
+            if (qname.second++ == 0) {
+                qname.first = qnameToString(record.qname.data(), record.qname_length);
+            }
+            const size_t address_length = record.requestor.family == AF_INET6 ? 16 : 4;
+            std::string key(1, static_cast<char>(record.requestor.family));
+            key.append(reinterpret_cast<const char*>(record.requestor.address.data()), address_length);
+            ++window_.requestors[key];
+        }
+        queries.tail.store(query_head, std::memory_order_release);
+
+        auto& responses = rings->responses;
+        const uint64_t response_head = responses.head.load(std::memory_order_acquire);
+        for (uint64_t i = responses.tail.load(std::memory_order_relaxed); i < response_head; ++i) {
+            const Response& record = responses.records[i & responses.mask];
+            ++window_.responses;
+            ++window_.rcodes[record.rcode];
+            // Backends get added by reloads, the slot is filled in by the time a query reaches it
+            if (record.backend >= 0 && static_cast<size_t>(record.backend) >= window_.backends.size()) {
+                addBackendNames();
+            }
+            if (record.backend >= 0 && static_cast<size_t>(record.backend) < window_.backends.size()) {
+                ++window_.backends[record.backend];
+            } else if (record.backend == CACHE_BACKEND) {
+                ++window_.cache_responses;
+            }
+            if (record.usec > 0) {
+                ++window_.latency_samples;
+                window_.latency_total_usec += record.usec;
+            }
+        }
+        responses.tail.store(response_head, std::memory_order_release);
+    }
+}
+
+std::vector<TrafficRings::TopEntry> TrafficRings::topOf(std::vector<TopEntry> entries) const {
+    const size_t count = std::min(top_n_, entries.size());
+    std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+                      [](const TopEntry& a, const TopEntry& b) { return a.count > b.count; });
+    entries.resize(count);
+    return entries;
+}
+
+void TrafficRings::publishWindow(std::chrono::system_clock::time_point now) {
+    auto summary = std::make_shared<Summary>();
+    summary->start = window_.start;
+    summary->end = now;
+    summary->queries = window_.queries;
+    summary->responses = window_.responses;
+    summary->cache_responses = window_.cache_responses;
+    summary->rcodes = window_.rcodes;
+    if (window_.latency_samples > 0) {
+        summary->average_latency_usec = static_cast<double>(window_.latency_total_usec) / window_.latency_samples;
+    }
+
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        for (const auto& rings : rings_) {
+            dropped += rings->queries.dropped.load(std::memory_order_relaxed);
+            dropped += rings->responses.dropped.load(std::memory_order_relaxed);
+        }
+    }
+    summary->dropped = dropped - dropped_seen_;
+    dropped_seen_ = dropped;
+
+    std::vector<TopEntry> entries;
+    entries.reserve(window_.qnames.size());
+    for (auto& qname : window_.qnames) {
+        entries.push_back({std::move(qname.second.first), qname.second.second});
+    }
+    summary->top_qnames = topOf(std::move(entries));
+
+    entries.clear();
+    for (const auto& requestor : window_.requestors) {
+        entries.push_back({requestor.first, requestor.second});
+    }
+    entries = topOf(std::move(entries));
+    // Only the winners get turned into text
+    for (auto& entry : entries) {
+        entry.name = requestorToString(entry.name);
+    }
+    summary->top_requestors = std::move(entries);
+
+    entries.clear();
+    for (size_t i = 0; i < window_.backends.size(); ++i) {
+        if (window_.backends[i] > 0) {
+            entries.push_back({backend_names_[i], window_.backends[i]});
+        }
+    }
+    summary->top_backends = topOf(std::move(entries));
+
+    if (summary->queries > 0) {
+        LOG_INFO("Traffic: %llu queries, %llu responses, top qname %s (%llu), top requestor %s (%llu)",
+                 static_cast<unsigned long long>(summary->queries),
+                 static_cast<unsigned long long>(summary->responses),
+                 summary->top_qnames.empty() ? "-" : summary->top_qnames.front().name.c_str(),
+                 static_cast<unsigned long long>(summary->top_qnames.empty() ? 0 : summary->top_qnames.front().count),
+                 summary->top_requestors.empty() ? "-" : summary->top_requestors.front().name.c_str(),
+                 static_cast<unsigned long long>(summary->top_requestors.empty() ? 0 : summary->top_requestors.front().count));
+    }
+
+    std::atomic_store(&summary_, std::shared_ptr<const Summary>(std::move(summary)));
+
+    window_.start = now;
+    window_.queries = 0;
+    window_.responses = 0;
+    window_.cache_responses = 0;
+    window_.latency_samples = 0;
+    window_.latency_total_usec = 0;
+    window_.rcodes.fill(0);
+    window_.qnames.clear();
+    window_.requestors.clear();
+    std::fill(window_.backends.begin(), window_.backends.end(), 0);
+}
+
+void TrafficRings::maintenanceLoop() {
+    while (running_) {
+        drain();
+        const auto now = std::chrono::system_clock::now();
+        if (now - window_.start >= window_length_) {
+            publishWindow(now);
+        }
+        std::this_thread::sleep_for(DRAIN_INTERVAL);
+    }
+}
+
+std::shared_ptr<const TrafficRings::Summary> TrafficRings::summary() const {
+    return std::atomic_load(&summary_);
+}
+
+void TrafficRings::printSummary() const {
+    auto summary = this->summary();
+    if (!summary) {
+        std::cout << "   No complete traffic window yet" << std::endl;
+        return;
+    }
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(summary->end - summary->start).count();
+    std::cout << "\n📈 Traffic over the last " << seconds << "s:" << std::endl;
+    std::cout << "   Queries: " << summary->queries << ", responses: " << summary->responses
+              << " (" << summary->cache_responses << " from cache), dropped records: " << summary->dropped << std::endl;
+    if (summary->average_latency_usec > 0.0) {
+        std::cout << "   Average backend latency: " << summary->average_latency_usec << "us" << std::endl;
+    }
+    std::cout << "   NoError: " << summary->rcodes[RCode::NoError] << ", NXDomain: " << summary->rcodes[RCode::NXDomain]
+              << ", ServFail: " << summary->rcodes[RCode::ServFail] << std::endl;
+
+    auto printTop = [](const char* title, const std::vector<TopEntry>& entries) {
+        std::cout << "   " << title << ":" << std::endl;
+        for (const auto& entry : entries) {
+            std::cout << "      " << entry.name << ": " << entry.count << std::endl;
+        }
+    };
+    printTop("Top qnames", summary->top_qnames);
+    printTop("Top requestors", summary->top_requestors);
+    printTop("Top backends", summary->top_backends);
+}
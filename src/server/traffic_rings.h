@@ -0,0 +1,210 @@
+#ifndef TRAFFIC_RINGS_H
+#define TRAFFIC_RINGS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/socket.h>
+
+#include "dns_wire.h"
+#include "../load_balancer/dnsdist_load_balancer.h"
+
+/**
+ * Query and response rings for live traffic analytics, after Rings in
+ * dnsdist-rings.hh and the top-N aggregation of dnsdist's maintThread.
+ *
+ * Instead of sharded rings behind try-locks, every thread that inserts owns a
+ * pair of single-producer/single-consumer rings: an insert copies a small
+ * fixed-size record into the next slot and publishes it with a release store,
+ * no lock and no allocation. A maintenance thread drains all rings every
+ * DRAIN_INTERVAL and aggregates queries per qname, requestor and backend; at
+ * the end of each window it publishes a Summary with the top entries and
+ * starts over. A ring that is full when the maintenance thread falls behind
+ * drops the record and counts it, inserting never waits.
+ */
+class TrafficRings {
+public:
+    static constexpr size_t DEFAULT_RING_SIZE = 16384;    // records per thread and ring, power of two
+    static constexpr size_t DEFAULT_TOP_N = 10;
+    static constexpr std::chrono::seconds DEFAULT_WINDOW{10};
+    static constexpr std::chrono::milliseconds DRAIN_INTERVAL{100};
+    // Longer names are kept truncated, they are still counted by their full hash
+    static constexpr size_t MAX_QNAME_BYTES = 64;
+    // Backend of a response answered from the packet cache
+    static constexpr int CACHE_BACKEND = -1;
+    // Backend of a response built without one: NXDOMAIN, SERVFAIL
+    static constexpr int NO_BACKEND = -2;
+
+    struct TopEntry {
+        std::string name;
+        uint64_t count;
+    };
+
+    /**
+     * Traffic of one window
+     */
+    struct Summary {
+        std::chrono::system_clock::time_point start;
+        std::chrono::system_clock::time_point end;
+        uint64_t queries{0};
+        uint64_t responses{0};
+        uint64_t cache_responses{0};
+        uint64_t dropped{0};               // records lost to full rings
+        double average_latency_usec{0.0};  // forwarded responses only
+        std::array<uint64_t, 16> rcodes{};
+        std::vector<TopEntry> top_qnames;
+        std::vector<TopEntry> top_requestors;
+        std::vector<TopEntry> top_backends;
+    };
+
+    TrafficRings(DnsdistLoadBalancer* load_balancer, size_t ring_size = DEFAULT_RING_SIZE,
+                 size_t top_n = DEFAULT_TOP_N, std::chrono::seconds window = DEFAULT_WINDOW);
+    ~TrafficRings();
+
+    TrafficRings(const TrafficRings&) = delete;
+    TrafficRings& operator=(const TrafficRings&) = delete;
+
+    /**
+     * Start the maintenance thread
+     */
+    void start();
+    void stop();
+
+    void insertQuery(const dnswire::QueryView& query, uint32_t qname_hash,
+                     const sockaddr* requestor, socklen_t requestor_length);
+
+    /**
+     * backend is a backend index, CACHE_BACKEND or NO_BACKEND. usec is the backend
+     * round-trip time, 0 for locally built responses.
+     */
+    void insertResponse(const uint8_t* response, size_t length, const sockaddr* requestor,
+                        socklen_t requestor_length, int backend, uint32_t usec);
+
+    /**
+     * Last complete window, nullptr before the first one ends
+     */
+    std::shared_ptr<const Summary> summary() const;
+
+    void printSummary() const;
+
+private:
+    struct Requestor {
+        uint8_t family{0};
+        std::array<uint8_t, 16> address{};
+    };
+
+    struct Query {
+        Requestor requestor;
+        uint32_t qname_hash;
+        uint16_t qtype;
+        uint16_t size;
+        uint8_t qname_length;              // stored bytes, at most MAX_QNAME_BYTES
+        std::array<uint8_t, MAX_QNAME_BYTES> qname;
+    };
+
+    struct Response {
+        Requestor requestor;
+        int32_t backend;
+        uint32_t usec;
+        uint16_t size;
+        uint8_t rcode;
+    };
+
+    /**
+     * Single producer, single consumer: head is only written by the inserting
+     * thread, tail only by the maintenance thread.
+     */
+    template <typename Record>
+    struct Ring {
+        explicit Ring(size_t size) : records(new Record[size]), mask(size - 1) {}
+
+        std::unique_ptr<Record[]> records;
+        const size_t mask;
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+
+        Record* reserve() {
+            const uint64_t current = head.load(std::memory_order_relaxed);
+            if (current - tail.load(std::memory_order_acquire) > mask) {
+                dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            return &records[current & mask];
+        }
+        void publish() {
+            head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+    };
+
+    struct ThreadRings {
+        explicit ThreadRings(size_t size) : queries(size), responses(size) {}
+        Ring<Query> queries;
+        Ring<Response> responses;
+    };
+
+    /**
+     * Counts of the current window, only touched by the maintenance thread
+     */
+    struct Window {
+        std::chrono::system_clock::time_point start;
+        uint64_t queries{0};
+        uint64_t responses{0};
+        uint64_t cache_responses{0};
+        uint64_t latency_samples{0};
+        uint64_t latency_total_usec{0};
+        std::array<uint64_t, 16> rcodes{};
+        std::unordered_map<uint32_t, std::pair<std::string, uint64_t>> qnames;
+        std::unordered_map<std::string, uint64_t> requestors;
+        std::vector<uint64_t> backends;
+    };
+
+    ThreadRings& localRings() {
+        for (const auto& entry : t_rings) {
+            if (entry.owner == instance_id_) {
+                return *entry.rings;
+            }
+        }
+        return registerThread();
+    }
+
+    ThreadRings& registerThread();
+    static void copyRequestor(Requestor& out, const sockaddr* requestor, socklen_t requestor_length);
+    static std::string requestorToString(const std::string& key);
+    void addBackendNames();
+    void drain();
+    void publishWindow(std::chrono::system_clock::time_point now);
+    void maintenanceLoop();
+    std::vector<TopEntry> topOf(std::vector<TopEntry> entries) const;
+
+    struct LocalEntry {
+        uint64_t owner;
+        ThreadRings* rings;
+    };
+    static thread_local std::vector<LocalEntry> t_rings;
+
+    const uint64_t instance_id_;
+    const size_t ring_size_;
+    const size_t top_n_;
+    const std::chrono::seconds window_length_;
+    DnsdistLoadBalancer* load_balancer_;
+    std::vector<std::string> backend_names_;
+    mutable std::mutex rings_mutex_;
+    std::vector<std::unique_ptr<ThreadRings>> rings_;
+    uint64_t dropped_seen_{0};
+    Window window_;
+    std::shared_ptr<const Summary> summary_;
+    std::atomic<bool> running_{false};
+    std::thread maintenance_thread_;
+};
+
+#endif // TRAFFIC_RINGS_H
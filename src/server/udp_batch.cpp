@@ -0,0 +1,75 @@
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include "udp_batch.h"
+
+UdpBatch::UdpBatch(size_t batch_size, size_t buffer_size)
+    : batch_size_(batch_size), buffer_size_(buffer_size),
+      slots_(batch_size), recv_msgs_(batch_size), send_msgs_(batch_size) {
+
+    if (batch_size_ == 0 || batch_size_ > UINT16_MAX) {
+        throw std::runtime_error("UDP batch size must be between 1 and 65535");
+    }
+
+    for (auto& slot : slots_) {
+        slot.query = PacketBufferPool::acquire(buffer_size_);
+        slot.response = PacketBufferPool::acquire(buffer_size_);
+    }
+}
+
+int UdpBatch::receive(int fd) {
+    // Reset the headers, recvmmsg() overwrites msg_namelen and msg_len
+    for (size_t i = 0; i < batch_size_; ++i) {
+        auto& slot = slots_[i];
+        slot.recv_iov.iov_base = slot.query.data();
+        slot.recv_iov.iov_len = slot.query.size();
+
+        msghdr& hdr = recv_msgs_[i].msg_hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        hdr.msg_name = &slot.remote;
+        hdr.msg_namelen = sizeof(slot.remote);
+        hdr.msg_iov = &slot.recv_iov;
+        hdr.msg_iovlen = 1;
+        recv_msgs_[i].msg_len = 0;
+    }
+    queued_ = 0;
+
+    int got = recvmmsg(fd, recv_msgs_.data(), static_cast<unsigned int>(batch_size_), MSG_DONTWAIT, nullptr);
+    if (got < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    return got;
+}
+
+void UdpBatch::queueResponse(size_t idx, size_t length) {
+    if (queued_ >= batch_size_ || length > buffer_size_) {
+        return;
+    }
+
+    auto& slot = slots_[idx];
+    slot.send_iov.iov_base = slot.response.data();
+    slot.send_iov.iov_len = length;
+
+    mmsghdr& out = send_msgs_[queued_++];
+    std::memset(&out.msg_hdr, 0, sizeof(out.msg_hdr));
+    out.msg_hdr.msg_name = &slot.remote;
+    out.msg_hdr.msg_namelen = recv_msgs_[idx].msg_hdr.msg_namelen;
+    out.msg_hdr.msg_iov = &slot.send_iov;
+    out.msg_hdr.msg_iovlen = 1;
+    out.msg_len = 0;
+}
+
+int UdpBatch::flush(int fd) {
+    size_t sent = 0;
+    while (sent < queued_) {
+        int res = sendmmsg(fd, send_msgs_.data() + sent, static_cast<unsigned int>(queued_ - sent), MSG_DONTWAIT);
+        if (res <= 0) {
+            // Socket buffer full or a hard error: drop what is left, clients will retry
+            break;
+        }
+        sent += static_cast<size_t>(res);
+    }
+    queued_ = 0;
+    return static_cast<int>(sent);
+}
@@ -0,0 +1,70 @@
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "packet_buffer_pool.h"
+
+/**
+ * Batched UDP receive/send built on recvmmsg()/sendmmsg(), modeled on
+ * MultipleMessagesUDPClientThread and queueResponse in dnsdist.cc.
+ *
+ * One receive() call drains up to batch_size datagrams from a non-blocking
+ * socket; responses are queued per slot and written back with one flush().
+ * Buffers are taken from the PacketBufferPool once up front and reused for
+ * every batch.
+ */
+class UdpBatch {
+public:
+    static constexpr size_t DEFAULT_BATCH_SIZE = 32;
+
+    UdpBatch(size_t batch_size, size_t buffer_size);
+
+    /**
+     * Receive as many datagrams as are ready (up to batchSize()) without blocking.
+     * Returns the number of messages, 0 if nothing was ready, -1 on error.
+     */
+    int receive(int fd);
+
+    const uint8_t* query(size_t idx) const { return slots_[idx].query.data(); }
+    size_t queryLength(size_t idx) const { return recv_msgs_[idx].msg_len; }
+    const sockaddr* remote(size_t idx) const { return reinterpret_cast<const sockaddr*>(&slots_[idx].remote); }
+    socklen_t remoteLength(size_t idx) const { return recv_msgs_[idx].msg_hdr.msg_namelen; }
+
+    uint8_t* responseBuffer(size_t idx) { return slots_[idx].response.data(); }
+    size_t responseCapacity() const { return buffer_size_; }
+
+    /**
+     * Queue the response written into responseBuffer(idx) for the sender of message idx
+     */
+    void queueResponse(size_t idx, size_t length);
+
+    /**
+     * Send every queued response with sendmmsg(), returns the number sent
+     */
+    int flush(int fd);
+
+    size_t batchSize() const { return batch_size_; }
+
+private:
+    struct Slot {
+        PacketBuffer query;
+        PacketBuffer response;
+        sockaddr_storage remote;
+        iovec recv_iov;
+        iovec send_iov;
+    };
+
+    size_t batch_size_;
+    size_t buffer_size_;
+    size_t queued_{0};
+    std::vector<Slot> slots_;
+    std::vector<mmsghdr> recv_msgs_;
+    std::vector<mmsghdr> send_msgs_;
+};
+
+#endif // UDP_BATCH_H
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "udp_forwarder.h"
+#include "../logging/logger.h"
+
+static int64_t steadyNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+UdpForwarder::UdpForwarder(DnsdistLoadBalancer* load_balancer, size_t sockets_per_backend,
+                           size_t max_outstanding, std::chrono::milliseconds timeout)
+    : load_balancer_(load_balancer), max_outstanding_(max_outstanding), timeout_(timeout),
+      sockets_per_backend_(sockets_per_backend) {
+
+    if (!load_balancer_) {
+        throw std::runtime_error("LoadBalancer cannot be null");
+    }
+    if (sockets_per_backend == 0) {
+        throw std::runtime_error("Forwarder needs at least one socket per backend");
+    }
+    if (max_outstanding_ == 0 || max_outstanding_ > 65536 || (max_outstanding_ & (max_outstanding_ - 1)) != 0) {
+        throw std::runtime_error("Outstanding queries per backend must be a power of two up to 65536");
+    }
+
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        throw std::runtime_error(std::string("epoll_create1 failed: ") + strerror(errno));
+    }
+
+    // Sized for every slot the load balancer may fill, backends added by a reload get theirs opened then
+    backends_ = std::make_unique<Backend[]>(load_balancer_->backendCapacity());
+    const size_t backend_count = load_balancer_->backendCount();
+    for (size_t i = 0; i < backend_count; ++i) {
+        openBackend(i);
+    }
+    listener_id_ = load_balancer_->addBackendListener([this](size_t backend_index) {
+        try {
+            openBackend(backend_index);
+        } catch (const std::exception& e) {
+            LOG_ERROR("Cannot forward to new backend %zu: %s", backend_index, e.what());
+        }
+    });
+
+    LOG_INFO("Forwarding to %zu backends with %zu sockets and %zu in-flight queries each", backend_count,
+             sockets_per_backend, max_outstanding_);
+}
+
+void UdpForwarder::openBackend(size_t backend_index) {
+    Backend& backend = backends_[backend_index];
+    backend.state = &load_balancer_->backendState(backend_index);
+    backend.id_states = std::make_unique<IDState[]>(max_outstanding_);
+
+    const ComboAddress& address = load_balancer_->backendAddress(backend_index);
+    std::vector<int> sockets;
+    for (size_t s = 0; s < sockets_per_backend_; ++s) {
+        int fd = socket(address.sin4.sin_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        // Connected, so the kernel only hands us datagrams from this backend
+        if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&address), address.getSocklen()) < 0) {
+            const std::string error = strerror(errno);
+            if (fd >= 0) {
+                close(fd);
+            }
+            for (int opened : sockets) {
+                close(opened);
+            }
+            throw std::runtime_error("Failed to open a socket to backend " + address.toStringWithPort() + ": " + error);
+        }
+        sockets.push_back(fd);
+    }
+    // Complete before it is counted or registered, the timeout scan and the responder read it then
+    backend.sockets = std::move(sockets);
+    backend_count_.store(std::max(backend_count_.load(std::memory_order_relaxed), backend_index + 1),
+                         std::memory_order_release);
+
+    for (int fd : backend.sockets) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = backend_index;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::runtime_error(std::string("epoll_ctl failed: ") + strerror(errno));
+        }
+    }
+}
+
+UdpForwarder::~UdpForwarder() {
+    load_balancer_->removeBackendListener(listener_id_);
+    stop();
+    const size_t backend_count = backend_count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < backend_count; ++i) {
+        for (int fd : backends_[i].sockets) {
+            close(fd);
+        }
+    }
+    if (epoll_fd_ >= 0) {
+        close(epoll_fd_);
+    }
+}
+
+void UdpForwarder::start() {
+    running_ = true;
+    responder_thread_ = std::thread(&UdpForwarder::responderLoop, this);
+}
+
+void UdpForwarder::stop() {
+    running_ = false;
+    if (responder_thread_.joinable()) {
+        responder_thread_.join();
+    }
+}
+
+bool UdpForwarder::forward(const dnswire::QueryView& query, uint32_t qname_hash, int pool, int client_fd,
+                           const sockaddr* client, socklen_t client_length) {
+    if (client_length > sizeof(sockaddr_storage)) {
+        return false;
+    }
+    const int backend_index = load_balancer_->selectBackendIndex(qname_hash, pool);
+    if (backend_index < 0) {
+        return false;
+    }
+    Backend& backend = backends_[backend_index];
+    // A backend added by a reload whose sockets could not be opened
+    if (backend.sockets.empty()) {
+        counters_.increment(SendErrors);
+        return false;
+    }
+    if (tcp_pool_ && backend.state->isTCPOnly()) {
+        forwardOverTcp(static_cast<size_t>(backend_index), query, client_fd, client, client_length);
+        return true;
+    }
+
+    const uint16_t backend_id = htons(saveState(backend, query, qname_hash, client_fd, client, client_length));
+
+    // New ID in front of the untouched rest of the packet, no copy needed
+    std::array<iovec, 2> iov{};
+    iov[0].iov_base = const_cast<uint16_t*>(&backend_id);
+    iov[0].iov_len = sizeof(backend_id);
+    iov[1].iov_base = const_cast<uint8_t*>(query.packet + sizeof(backend_id));
+    iov[1].iov_len = query.length - sizeof(backend_id);
+    msghdr msg{};
+    msg.msg_iov = iov.data();
+    msg.msg_iovlen = iov.size();
+
+    if (sendmsg(pickSocketForSending(backend), &msg, MSG_DONTWAIT) < 0) {
+        // Give the state back right away instead of waiting for the timeout
+        IDState& ids = backend.id_states[ntohs(backend_id)];
+        while (!ids.tryAcquire()) {
+        }
+        if (ids.in_use.load(std::memory_order_relaxed) && ids.orig_id == query.id) {
+            ids.in_use.store(false, std::memory_order_release);
+            --backend.state->outstanding;
+        }
+        ids.release();
+        counters_.increment(SendErrors);
+        return false;
+    }
+
+    counters_.increment(Forwarded);
+    return true;
+}
+
+uint16_t UdpForwarder::saveState(Backend& backend, const dnswire::QueryView& query, uint32_t qname_hash,
+                                 int client_fd, const sockaddr* client, socklen_t client_length) {
+    for (;;) {
+        const uint16_t selected_id = static_cast<uint16_t>(
+            backend.id_offset.fetch_add(1, std::memory_order_relaxed) & (max_outstanding_ - 1));
+        IDState& ids = backend.id_states[selected_id];
+        if (!ids.tryAcquire()) {
+            // Being read by the responder or another sender, take the next one
+            continue;
+        }
+
+        if (ids.in_use.load(std::memory_order_relaxed)) {
+            // The table wrapped around before this query timed out, it is lost
+            counters_.increment(Reused);
+        } else {
+            ++backend.state->outstanding;
+        }
+        ids.orig_id = query.id;
+        ids.qtype = query.qtype;
+        ids.qclass = query.qclass;
+        ids.qname_hash = qname_hash;
+        ids.udp_payload_size = dnswire::getUDPPayloadSize(query);
+        ids.client_fd = client_fd;
+        ids.client_length = client_length;
+        memcpy(&ids.client, client, client_length);
+        ids.sent.store(steadyNowNs(), std::memory_order_relaxed);
+        ids.in_use.store(true, std::memory_order_release);
+        ids.release();
+        return selected_id;
+    }
+}
+
+void UdpForwarder::forwardOverTcp(size_t backend_index, const dnswire::QueryView& query, int client_fd,
+                                  const sockaddr* client, socklen_t client_length) {
+    // The receive buffer is reused for the next datagram, the query needs a buffer of its own
+    PacketBuffer packet = PacketBufferPool::acquire(query.length);
+    memcpy(packet.data(), query.packet, query.length);
+    const uint16_t udp_payload_size = dnswire::getUDPPayloadSize(query);
+    sockaddr_storage client_address{};
+    memcpy(&client_address, client, client_length);
+
+    // The pool keeps the original ID, the response goes back to the client as-is
+    tcp_pool_->forward(backend_index, std::move(packet),
+        [this, backend_index, client_fd, client_address, client_length, udp_payload_size,
+         sent = steadyNowNs()](bool success, PacketBuffer response) {
+            if (!success) {
+                counters_.increment(Timeouts);
+                return;
+            }
+            if (response.size() > udp_payload_size) {
+                response.resize(dnswire::truncateResponse(response.data(), response.size()));
+                counters_.increment(Truncated);
+            }
+            sendto(client_fd, response.data(), response.size(), MSG_DONTWAIT,
+                   reinterpret_cast<const sockaddr*>(&client_address), client_length);
+            counters_.increment(Responses);
+            if (traffic_rings_) {
+                const auto usec = static_cast<uint32_t>((steadyNowNs() - sent) / 1000);
+                traffic_rings_->insertResponse(response.data(), response.size(),
+                                               reinterpret_cast<const sockaddr*>(&client_address), client_length,
+                                               static_cast<int>(backend_index), usec);
+            }
+        });
+    counters_.increment(Forwarded);
+}
+
+int UdpForwarder::pickSocketForSending(Backend& backend) {
+    const size_t count = backend.sockets.size();
+    if (count == 1) {
+        return backend.sockets[0];
+    }
+    return backend.sockets[backend.sockets_offset.fetch_add(1, std::memory_order_relaxed) % count];
+}
+
+void UdpForwarder::responderLoop() {
+    constexpr int MAX_EVENTS = 64;
+    constexpr int TIMEOUT_SCAN_MS = 100;
+    std::array<epoll_event, MAX_EVENTS> events{};
+    // Largest possible UDP payload, truncated later if the client cannot take it
+    PacketBuffer buffer = PacketBufferPool::acquire(UINT16_MAX);
+    auto next_scan = std::chrono::steady_clock::now();
+
+    while (running_) {
+        int ready = epoll_wait(epoll_fd_, events.data(), MAX_EVENTS, TIMEOUT_SCAN_MS);
+        for (int i = 0; i < ready; ++i) {
+            // Level-triggered, the next epoll_wait() comes back for whatever is left
+            Backend& backend = backends_[events[i].data.u64];
+            for (int fd : backend.sockets) {
+                for (;;) {
+                    ssize_t got = recv(fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+                    if (got <= 0) {
+                        break;
+                    }
+                    handleResponse(backend, buffer.data(), static_cast<size_t>(got));
+                }
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_scan) {
+            handleUDPTimeouts();
+            next_scan = now + std::chrono::milliseconds(TIMEOUT_SCAN_MS);
+        }
+    }
+}
+
+void UdpForwarder::handleResponse(Backend& backend, uint8_t* response, size_t length) {
+    dnswire::QueryView question;
+    if (!dnswire::parseQuestion(response, length, question)) {
+        counters_.increment(Dropped);
+        return;
+    }
+    const uint16_t backend_id = ntohs(question.id);
+    if (backend_id >= max_outstanding_) {
+        counters_.increment(Dropped);
+        return;
+    }
+
+    IDState& ids = backend.id_states[backend_id];
+    if (!ids.tryAcquire()) {
+        // A sender is reusing this state, so our query is gone anyway
+        counters_.increment(Dropped);
+        return;
+    }
+    // Late responses to a reused ID carry another question
+    if (!ids.in_use.load(std::memory_order_relaxed) || ids.qtype != question.qtype || ids.qclass != question.qclass ||
+        ids.qname_hash != dnswire::hashQname(question)) {
+        ids.release();
+        counters_.increment(Dropped);
+        return;
+    }
+    const uint16_t orig_id = ids.orig_id;
+    const int client_fd = ids.client_fd;
+    sockaddr_storage client = ids.client;
+    const socklen_t client_length = ids.client_length;
+    const uint16_t udp_payload_size = ids.udp_payload_size;
+    const int64_t sent = ids.sent.load(std::memory_order_relaxed);
+    ids.in_use.store(false, std::memory_order_release);
+    ids.release();
+    --backend.state->outstanding;
+    const size_t backend_index = static_cast<size_t>(&backend - backends_.get());
+    const auto usec = static_cast<uint32_t>((steadyNowNs() - sent) / 1000);
+    load_balancer_->recordBackendLatency(backend_index, usec);
+
+    if (length > udp_payload_size) {
+        length = dnswire::truncateResponse(response, length);
+        counters_.increment(Truncated);
+    }
+    memcpy(response, &orig_id, sizeof(orig_id));
+    sendto(client_fd, response, length, MSG_DONTWAIT, reinterpret_cast<const sockaddr*>(&client), client_length);
+    counters_.increment(Responses);
+    if (traffic_rings_) {
+        traffic_rings_->insertResponse(response, length, reinterpret_cast<const sockaddr*>(&client), client_length,
+                                       static_cast<int>(backend_index), usec);
+    }
+}
+
+void UdpForwarder::handleUDPTimeouts() {
+    const int64_t deadline = steadyNowNs() - std::chrono::duration_cast<std::chrono::nanoseconds>(timeout_).count();
+    const size_t backend_count = backend_count_.load(std::memory_order_acquire);
+    for (size_t b = 0; b < backend_count; ++b) {
+        Backend& backend = backends_[b];
+        if (backend.sockets.empty() || backend.state->outstanding.load() == 0) {
+            continue;
+        }
+        for (size_t i = 0; i < max_outstanding_; ++i) {
+            IDState& ids = backend.id_states[i];
+            if (!ids.in_use.load(std::memory_order_acquire) || ids.sent.load(std::memory_order_relaxed) > deadline) {
+                continue;
+            }
+            if (!ids.tryAcquire()) {
+                continue;
+            }
+            // Check again, now that we have locked this state
+            if (ids.in_use.load(std::memory_order_relaxed) && ids.sent.load(std::memory_order_relaxed) <= deadline) {
+                ids.in_use.store(false, std::memory_order_release);
+                --backend.state->outstanding;
+                counters_.increment(Timeouts);
+            }
+            ids.release();
+        }
+    }
+}
+
+void UdpForwarder::printStats() const {
+    std::cout << "   Forwarded: " << counters_.load(Forwarded)
+              << ", responses: " << counters_.load(Responses)
+              << ", timeouts: " << counters_.load(Timeouts)
+              << ", send errors: " << counters_.load(SendErrors)
+              << ", truncated: " << counters_.load(Truncated)
+              << ", reused IDs: " << counters_.load(Reused)
+              << ", dropped responses: " << counters_.load(Dropped) << std::endl;
+}
+
+void UdpForwarder::writeMetrics(std::string& out) const {
+    static constexpr std::array<const char*, CounterCount> names = {
+        "forwarded", "send_errors", "responses", "timeouts", "reused_ids", "dropped_responses", "truncated"};
+    const std::vector<uint64_t> values = counters_.loadAll();
+    out += "# TYPE dnslb_forwarder_events_total counter\n";
+    for (size_t i = 0; i < CounterCount; ++i) {
+        out += "dnslb_forwarder_events_total{event=\"";
+        out += names[i];
+        out += "\"} " + std::to_string(values[i]) + "\n";
+    }
+}
@@ -0,0 +1,156 @@
+#ifndef UDP_FORWARDER_H
+#define UDP_FORWARDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+
+#include "dns_wire.h"
+#include "tcp_backend_pool.h"
+#include "traffic_rings.h"
+#include "../load_balancer/dnsdist_load_balancer.h"
+#include "../load_balancer/per_thread_counters.h"
+
+/**
+ * Forwarding proxy for UDP queries, modeled on the dnsdist UDP path
+ * (DownstreamState::saveState/getState, pickSocketForSending, responderThread
+ * and handleUDPTimeouts).
+ *
+ * Every backend has a small pool of connected non-blocking sockets and a fixed
+ * table of in-flight query states. A forwarded query takes the next state of
+ * the table, whose index becomes the query ID on the wire, and is sent without
+ * copying the packet. A single responder thread waits on all backend sockets,
+ * matches each response to its state by ID and question, and relays it to the
+ * client with the original ID. States older than the timeout are reclaimed by
+ * handleUDPTimeouts(), which the responder runs between reads.
+ *
+ * Worker threads never block on a backend: sending is MSG_DONTWAIT and a full
+ * socket buffer simply fails the forward, so the caller can answer SERVFAIL.
+ * In-flight queries are counted in DownstreamState::outstanding, which is what
+ * the load-aware policies look at.
+ *
+ * Responses larger than the client's EDNS UDP payload size (512 bytes without
+ * EDNS) are truncated to the question with TC set, so the client retries over
+ * TCP.
+ *
+ * Backends configured as TCP-only get their queries over the pooled
+ * connections of a TcpBackendPool instead, when one is set.
+ *
+ * Backends added to the load balancer by a reload get their sockets when they
+ * are added, removed ones keep them so that late responses are still relayed.
+ */
+class UdpForwarder {
+public:
+    static constexpr size_t DEFAULT_SOCKETS_PER_BACKEND = 4;
+    // Power of two, at most 65536 so that a state index fits in the query ID
+    static constexpr size_t DEFAULT_MAX_OUTSTANDING = 1024;
+    static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{2000};
+
+    UdpForwarder(DnsdistLoadBalancer* load_balancer, size_t sockets_per_backend = DEFAULT_SOCKETS_PER_BACKEND,
+                 size_t max_outstanding = DEFAULT_MAX_OUTSTANDING,
+                 std::chrono::milliseconds timeout = DEFAULT_TIMEOUT);
+    ~UdpForwarder();
+
+    UdpForwarder(const UdpForwarder&) = delete;
+    UdpForwarder& operator=(const UdpForwarder&) = delete;
+
+    /**
+     * Start the responder thread
+     */
+    void start();
+    void stop();
+
+    /**
+     * Send query to a backend the load balancer picks from pool, see
+     * DnsdistLoadBalancer::routeQuery(). The response will be sent to client
+     * from client_fd. Returns false if no backend is available or the query
+     * could not be sent, nothing is sent in that case.
+     */
+    bool forward(const dnswire::QueryView& query, uint32_t qname_hash, int pool, int client_fd,
+                 const sockaddr* client, socklen_t client_length);
+
+    /**
+     * Route queries for TCP-only backends through pool. Set before start().
+     */
+    void setTcpBackendPool(TcpBackendPool* pool) { tcp_pool_ = pool; }
+
+    /**
+     * Record relayed responses with their backend and latency. Set before start().
+     */
+    void setTrafficRings(TrafficRings* rings) { traffic_rings_ = rings; }
+
+    /**
+     * Reclaim the states of queries that did not get a response in time
+     */
+    void handleUDPTimeouts();
+
+    void printStats() const;
+
+    /**
+     * Append the forwarding counters in the Prometheus text format
+     */
+    void writeMetrics(std::string& out) const;
+
+private:
+    enum Counter : size_t { Forwarded, SendErrors, Responses, Timeouts, Reused, Dropped, Truncated, CounterCount };
+
+    /**
+     * One in-flight query. lock serializes the sender filling it in, the
+     * responder consuming it and the timeout scan; in_use and sent are atomic
+     * so the timeout scan can skip states without taking the lock.
+     */
+    struct IDState {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        std::atomic<bool> in_use{false};
+        std::atomic<int64_t> sent{0};        // steady clock, nanoseconds
+        uint16_t orig_id{0};                 // network byte order
+        uint16_t qtype{0};
+        uint16_t qclass{0};
+        uint32_t qname_hash{0};
+        uint16_t udp_payload_size{0};        // largest response the client accepts
+        int client_fd{-1};
+        socklen_t client_length{0};
+        sockaddr_storage client{};
+
+        bool tryAcquire() { return !lock.test_and_set(std::memory_order_acquire); }
+        void release() { lock.clear(std::memory_order_release); }
+    };
+
+    struct Backend {
+        DownstreamState* state{nullptr};
+        std::vector<int> sockets;
+        std::unique_ptr<IDState[]> id_states;
+        std::atomic<uint32_t> id_offset{0};
+        std::atomic<uint32_t> sockets_offset{0};
+    };
+
+    DnsdistLoadBalancer* load_balancer_;
+    size_t max_outstanding_;
+    std::chrono::milliseconds timeout_;
+    size_t sockets_per_backend_;
+    std::unique_ptr<Backend[]> backends_;
+    std::atomic<size_t> backend_count_{0};   // one past the highest opened backend
+    size_t listener_id_{0};
+    int epoll_fd_{-1};
+    std::atomic<bool> running_{false};
+    std::thread responder_thread_;
+    PerThreadCounters counters_{CounterCount};
+    TcpBackendPool* tcp_pool_{nullptr};
+    TrafficRings* traffic_rings_{nullptr};
+
+    void openBackend(size_t backend_index);
+    uint16_t saveState(Backend& backend, const dnswire::QueryView& query, uint32_t qname_hash, int client_fd,
+                       const sockaddr* client, socklen_t client_length);
+    int pickSocketForSending(Backend& backend);
+    void forwardOverTcp(size_t backend_index, const dnswire::QueryView& query, int client_fd,
+                        const sockaddr* client, socklen_t client_length);
+    void responderLoop();
+    void handleResponse(Backend& backend, uint8_t* response, size_t length);
+};
+
+#endif // UDP_FORWARDER_H
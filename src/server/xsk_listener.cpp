@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <xdp/xsk.h>
+#include "xsk_listener.h"
+#include "../logging/logger.h"
+
+// How long an idle worker waits in poll() before it looks at running_ again
+static constexpr int IDLE_POLL_MS = 100;
+static constexpr uint8_t RESPONSE_HOP_LIMIT = 64;
+static constexpr uint32_t FRAME_HEADROOM = 2;
+
+struct XskListener::Rings {
+    xsk_ring_prod fill{};
+    xsk_ring_cons comp{};
+    xsk_ring_cons rx{};
+    xsk_ring_prod tx{};
+};
+
+// One's complement sum of big-endian 16-bit words, an odd last byte is padded with zero
+static uint32_t addWords(uint32_t sum, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i + 1 < length; i += 2) {
+        sum += static_cast<uint32_t>(data[i]) << 8 | data[i + 1];
+    }
+    if (length & 1) {
+        sum += static_cast<uint32_t>(data[length - 1]) << 8;
+    }
+    return sum;
+}
+
+// Folded and complemented, in network byte order
+static uint16_t finishChecksum(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return htons(static_cast<uint16_t>(~sum));
+}
+
+XskProgram::XskProgram(const std::string& interface, const std::string& object_path, uint16_t port)
+    : interface_(interface) {
+    ifindex_ = if_nametoindex(interface.c_str());
+    if (ifindex_ == 0) {
+        throw std::runtime_error("No network interface named " + interface);
+    }
+
+    object_ = bpf_object__open_file(object_path.c_str(), nullptr);
+    if (!object_) {
+        throw std::runtime_error("Cannot open XDP program " + object_path + ": " + strerror(errno));
+    }
+    if (bpf_object__load(object_) != 0) {
+        const int error = errno;
+        bpf_object__close(object_);
+        throw std::runtime_error("Cannot load XDP program " + object_path + ": " + strerror(error));
+    }
+
+    bpf_program* program = bpf_object__find_program_by_name(object_, "dns_xsk");
+    xsk_map_fd_ = bpf_object__find_map_fd_by_name(object_, "xsks_map");
+    const int port_map_fd = bpf_object__find_map_fd_by_name(object_, "dns_port_map");
+    uint32_t key = 0;
+    uint32_t value = port;
+    if (!program || xsk_map_fd_ < 0 || port_map_fd < 0 ||
+        bpf_map_update_elem(port_map_fd, &key, &value, BPF_ANY) != 0) {
+        bpf_object__close(object_);
+        throw std::runtime_error("XDP program " + object_path + " is not the DNS redirect program");
+    }
+
+    // Native mode when the driver has it, generic mode works everywhere but copies every packet
+    const int program_fd = bpf_program__fd(program);
+    attach_flags_ = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_DRV_MODE;
+    if (bpf_xdp_attach(static_cast<int>(ifindex_), program_fd, attach_flags_, nullptr) != 0) {
+        attach_flags_ = XDP_FLAGS_UPDATE_IF_NOEXIST | XDP_FLAGS_SKB_MODE;
+        if (bpf_xdp_attach(static_cast<int>(ifindex_), program_fd, attach_flags_, nullptr) != 0) {
+            const int error = errno;
+            bpf_object__close(object_);
+            throw std::runtime_error("Cannot attach XDP program to " + interface + ": " + strerror(error));
+        }
+        LOG_WARNING("XDP program attached to %s in generic mode, the driver has no native XDP",
+                    interface.c_str());
+    }
+    attached_.store(true);
+    LOG_INFO("XDP program attached to %s, UDP port %u goes to the AF_XDP sockets", interface.c_str(),
+             static_cast<unsigned>(port));
+}
+
+XskProgram::~XskProgram() {
+    detach();
+    bpf_object__close(object_);
+}
+
+void XskProgram::detach() {
+    if (attached_.exchange(false)) {
+        bpf_xdp_detach(static_cast<int>(ifindex_), attach_flags_ & ~XDP_FLAGS_UPDATE_IF_NOEXIST, nullptr);
+    }
+}
+
+XskListener::XskListener(const XskProgram& program, uint32_t queue_id, Handler handler, int fallback_fd)
+    : queue_id_(queue_id), handler_(std::move(handler)), fallback_fd_(fallback_fd), rings_(std::make_unique<Rings>()) {
+
+    const size_t umem_size = FRAME_COUNT * FRAME_SIZE;
+    umem_area_ = mmap(nullptr, umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (umem_area_ == MAP_FAILED) {
+        umem_area_ = nullptr;
+        throw std::runtime_error(std::string("Cannot map the UMEM: ") + strerror(errno));
+    }
+
+    // Room in the fill and completion rings for every frame, so returning a frame never has to wait
+    xsk_umem_config umem_config{};
+    umem_config.fill_size = FRAME_COUNT;
+    umem_config.comp_size = FRAME_COUNT;
+    umem_config.frame_size = FRAME_SIZE;
+    // Like NET_IP_ALIGN: 2 bytes put the IP header behind the 14-byte Ethernet header on a 4-byte boundary
+    umem_config.frame_headroom = FRAME_HEADROOM;
+    int ret = xsk_umem__create(&umem_, umem_area_, umem_size, &rings_->fill, &rings_->comp, &umem_config);
+    if (ret != 0) {
+        release();
+        throw std::runtime_error(std::string("Cannot create the UMEM: ") + strerror(-ret));
+    }
+
+    // XskProgram owns the XDP program, libxdp must not load its default one
+    xsk_socket_config socket_config{};
+    socket_config.rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS;
+    socket_config.tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS;
+    socket_config.libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD;
+    socket_config.bind_flags = XDP_USE_NEED_WAKEUP;
+    ret = xsk_socket__create(&socket_, program.interface().c_str(), queue_id_, umem_, &rings_->rx, &rings_->tx,
+                             &socket_config);
+    if (ret == 0) {
+        ret = xsk_socket__update_xskmap(socket_, program.xskMapFd());
+    }
+    if (ret != 0) {
+        release();
+        throw std::runtime_error("Cannot bind an AF_XDP socket to " + program.interface() + " queue " +
+                                 std::to_string(queue_id_) + ": " + strerror(-ret));
+    }
+
+    std::vector<uint64_t> frames(FRAME_COUNT);
+    for (size_t i = 0; i < FRAME_COUNT; ++i) {
+        frames[i] = i * FRAME_SIZE;
+    }
+    recycleFrames(frames.data(), frames.size());
+}
+
+XskListener::~XskListener() {
+    stop();
+    release();
+}
+
+void XskListener::release() {
+    if (socket_) {
+        xsk_socket__delete(socket_);
+        socket_ = nullptr;
+    }
+    if (umem_) {
+        xsk_umem__delete(umem_);
+        umem_ = nullptr;
+    }
+    if (umem_area_) {
+        munmap(umem_area_, FRAME_COUNT * FRAME_SIZE);
+        umem_area_ = nullptr;
+    }
+}
+
+void XskListener::start() {
+    running_ = true;
+    worker_thread_ = std::thread(&XskListener::workerLoop, this);
+}
+
+void XskListener::stop() {
+    running_ = false;
+    if (worker_thread_.joinable()) {
+        worker_thread_.join();
+    }
+}
+
+void XskListener::recycleFrames(const uint64_t* addresses, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    uint32_t index = 0;
+    // The fill ring holds every frame, a short reserve only means the kernel has not caught up yet
+    while (xsk_ring_prod__reserve(&rings_->fill, static_cast<uint32_t>(count), &index) != count) {
+    }
+    for (size_t i = 0; i < count; ++i) {
+        *xsk_ring_prod__fill_addr(&rings_->fill, index + static_cast<uint32_t>(i)) =
+            addresses[i] - addresses[i] % FRAME_SIZE;
+    }
+    xsk_ring_prod__submit(&rings_->fill, static_cast<uint32_t>(count));
+}
+
+bool XskListener::processPacket(uint8_t* frame, size_t length, size_t capacity, uint8_t* scratch,
+                                Answer& answer) {
+    // The XDP program only redirects what is checked here, anything else is a broken packet
+    if (length < ETH_HLEN + sizeof(udphdr)) {
+        counters_.increment(Invalid);
+        return false;
+    }
+    ethhdr* eth = reinterpret_cast<ethhdr*>(frame);
+    iphdr* ip = nullptr;
+    ipv6hdr* ip6 = nullptr;
+    size_t headers = ETH_HLEN;
+    if (eth->h_proto == htons(ETH_P_IP) && length >= ETH_HLEN + sizeof(iphdr) + sizeof(udphdr)) {
+        ip = reinterpret_cast<iphdr*>(frame + ETH_HLEN);
+        headers += sizeof(iphdr);
+    } else if (eth->h_proto == htons(ETH_P_IPV6) && length >= ETH_HLEN + sizeof(ipv6hdr) + sizeof(udphdr)) {
+        ip6 = reinterpret_cast<ipv6hdr*>(frame + ETH_HLEN);
+        headers += sizeof(ipv6hdr);
+    } else {
+        counters_.increment(Invalid);
+        return false;
+    }
+    udphdr* udp = reinterpret_cast<udphdr*>(frame + headers);
+    headers += sizeof(udphdr);
+
+    // The UDP length, not the frame's: short frames are padded
+    const size_t udp_length = ntohs(udp->len);
+    if (udp_length < sizeof(udphdr) || headers - sizeof(udphdr) + udp_length > length) {
+        counters_.increment(Invalid);
+        return false;
+    }
+    const size_t query_length = udp_length - sizeof(udphdr);
+
+    std::memset(&answer.client, 0, sizeof(answer.client));
+    if (ip) {
+        auto* client = reinterpret_cast<sockaddr_in*>(&answer.client);
+        client->sin_family = AF_INET;
+        client->sin_port = udp->source;
+        client->sin_addr.s_addr = ip->saddr;
+        answer.client_length = sizeof(sockaddr_in);
+    } else {
+        auto* client = reinterpret_cast<sockaddr_in6*>(&answer.client);
+        client->sin6_family = AF_INET6;
+        client->sin6_port = udp->source;
+        std::memcpy(&client->sin6_addr, &ip6->saddr, sizeof(client->sin6_addr));
+        answer.client_length = sizeof(sockaddr_in6);
+    }
+
+    // The response starts with the query's header and question, built aside and copied over it
+    const size_t room = std::min(capacity, FRAME_SIZE) - headers;
+    const size_t response_length = handler_(frame + headers, query_length, scratch, room,
+                                            reinterpret_cast<const sockaddr*>(&answer.client),
+                                            answer.client_length);
+    if (response_length == 0 || response_length > room) {
+        counters_.increment(NoResponse);
+        return false;
+    }
+    std::memcpy(frame + headers, scratch, response_length);
+
+    uint8_t mac[ETH_ALEN];
+    std::memcpy(mac, eth->h_dest, ETH_ALEN);
+    std::memcpy(eth->h_dest, eth->h_source, ETH_ALEN);
+    std::memcpy(eth->h_source, mac, ETH_ALEN);
+
+    std::swap(udp->source, udp->dest);
+    udp->len = htons(static_cast<uint16_t>(sizeof(udphdr) + response_length));
+    udp->check = 0;
+
+    if (ip) {
+        std::swap(ip->saddr, ip->daddr);
+        ip->tot_len = htons(static_cast<uint16_t>(sizeof(iphdr) + sizeof(udphdr) + response_length));
+        ip->ttl = RESPONSE_HOP_LIMIT;
+        ip->frag_off = htons(0x4000);        // DF
+        ip->check = 0;
+        ip->check = finishChecksum(addWords(0, reinterpret_cast<const uint8_t*>(ip), sizeof(iphdr)));
+        // An IPv4 UDP checksum of zero means none, resolvers accept it
+    } else {
+        std::swap(ip6->saddr, ip6->daddr);
+        ip6->payload_len = udp->len;
+        ip6->hop_limit = RESPONSE_HOP_LIMIT;
+        // Mandatory over IPv6: pseudo header of addresses, length and next header, then the datagram
+        uint32_t sum = addWords(0, reinterpret_cast<const uint8_t*>(&ip6->saddr), 2 * sizeof(ip6->saddr));
+        sum += sizeof(udphdr) + response_length;
+        sum += IPPROTO_UDP;
+        sum = addWords(sum, reinterpret_cast<const uint8_t*>(udp), sizeof(udphdr) + response_length);
+        udp->check = finishChecksum(sum);
+        if (udp->check == 0) {
+            udp->check = 0xffff;
+        }
+    }
+
+    answer.length = static_cast<uint32_t>(headers + response_length);
+    answer.payload_offset = static_cast<uint16_t>(headers);
+    answer.payload_length = static_cast<uint16_t>(response_length);
+    return true;
+}
+
+void XskListener::workerLoop() {
+    Rings& rings = *rings_;
+    const int fd = xsk_socket__fd(socket_);
+    std::vector<uint8_t> scratch(FRAME_SIZE);
+    std::array<Answer, BATCH_SIZE> answers;
+    std::array<uint64_t, BATCH_SIZE> recycle;
+    size_t tx_in_flight = 0;
+
+    while (running_.load(std::memory_order_relaxed)) {
+        // Frames the NIC has sent go back to the fill ring
+        uint32_t comp_index = 0;
+        const uint32_t completed = xsk_ring_cons__peek(&rings.comp, BATCH_SIZE, &comp_index);
+        if (completed > 0) {
+            for (uint32_t i = 0; i < completed; ++i) {
+                recycle[i] = *xsk_ring_cons__comp_addr(&rings.comp, comp_index + i);
+            }
+            xsk_ring_cons__release(&rings.comp, completed);
+            recycleFrames(recycle.data(), completed);
+            tx_in_flight -= std::min<size_t>(tx_in_flight, completed);
+        }
+
+        uint32_t rx_index = 0;
+        const uint32_t received = xsk_ring_cons__peek(&rings.rx, BATCH_SIZE, &rx_index);
+        if (received == 0) {
+            if (tx_in_flight > 0) {
+                // Completions only show up after the kernel gets to the TX ring
+                if (xsk_ring_prod__needs_wakeup(&rings.tx)) {
+                    sendto(fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+                }
+                continue;
+            }
+            pollfd pfd{fd, POLLIN, 0};
+            poll(&pfd, 1, IDLE_POLL_MS);
+            continue;
+        }
+
+        size_t answer_count = 0;
+        size_t recycle_count = 0;
+        for (uint32_t i = 0; i < received; ++i) {
+            const xdp_desc* desc = xsk_ring_cons__rx_desc(&rings.rx, rx_index + i);
+            uint8_t* frame = static_cast<uint8_t*>(xsk_umem__get_data(umem_area_, desc->addr));
+            counters_.increment(Received);
+            Answer& answer = answers[answer_count];
+            answer.address = desc->addr;
+            if (processPacket(frame, desc->len, FRAME_SIZE - desc->addr % FRAME_SIZE, scratch.data(), answer)) {
+                answer_count++;
+            } else {
+                recycle[recycle_count++] = desc->addr;
+            }
+        }
+        xsk_ring_cons__release(&rings.rx, received);
+
+        // Exactly as many TX slots as answers, a reserved slot cannot be given back
+        uint32_t tx_index = 0;
+        const uint32_t reserved = answer_count > 0
+            ? xsk_ring_prod__reserve(&rings.tx, static_cast<uint32_t>(answer_count), &tx_index)
+            : 0;
+        for (size_t i = 0; i < answer_count; ++i) {
+            const Answer& answer = answers[i];
+            if (i < reserved) {
+                xdp_desc* desc = xsk_ring_prod__tx_desc(&rings.tx, tx_index + static_cast<uint32_t>(i));
+                desc->addr = answer.address;
+                desc->len = answer.length;
+                continue;
+            }
+            // TX ring full, the regular socket sends this one
+            const uint8_t* frame = static_cast<const uint8_t*>(xsk_umem__get_data(umem_area_, answer.address));
+            sendto(fallback_fd_, frame + answer.payload_offset, answer.payload_length, MSG_DONTWAIT,
+                   reinterpret_cast<const sockaddr*>(&answer.client), answer.client_length);
+            counters_.increment(Fallback);
+            recycle[recycle_count++] = answer.address;
+        }
+        if (reserved > 0) {
+            xsk_ring_prod__submit(&rings.tx, reserved);
+            tx_in_flight += reserved;
+            counters_.increment(Answered, reserved);
+            if (xsk_ring_prod__needs_wakeup(&rings.tx)) {
+                sendto(fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+            }
+        }
+        recycleFrames(recycle.data(), recycle_count);
+    }
+}
+
+void XskListener::writeMetrics(std::string& out) const {
+    static constexpr std::array<const char*, CounterCount> names = {
+        "received", "answered", "no_response", "fallback", "invalid"};
+    const std::vector<uint64_t> values = counters_.loadAll();
+    const std::string queue = std::to_string(queue_id_);
+    for (size_t i = 0; i < CounterCount; ++i) {
+        out += "dnslb_xsk_packets_total{queue=\"" + queue + "\",event=\"";
+        out += names[i];
+        out += "\"} " + std::to_string(values[i]) + "\n";
+    }
+}
@@ -0,0 +1,149 @@
+#ifndef XSK_LISTENER_H
+#define XSK_LISTENER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../load_balancer/per_thread_counters.h"
+
+struct bpf_object;
+struct xsk_socket;
+struct xsk_umem;
+
+/**
+ * The XDP program of src/xdp/dns_xsk.bpf.c attached to one interface. It
+ * redirects UDP queries to port to the AF_XDP socket of their RX queue and
+ * passes everything else to the kernel. Detached again on destruction.
+ */
+class XskProgram {
+public:
+    /**
+     * Throws std::runtime_error if the object cannot be loaded or attached
+     */
+    XskProgram(const std::string& interface, const std::string& object_path, uint16_t port);
+    ~XskProgram();
+
+    XskProgram(const XskProgram&) = delete;
+    XskProgram& operator=(const XskProgram&) = delete;
+
+    /**
+     * Take the program off the interface, queries go to the kernel again.
+     * Also called by the destructor, and safe to call more than once.
+     */
+    void detach();
+
+    const std::string& interface() const { return interface_; }
+    int xskMapFd() const { return xsk_map_fd_; }
+
+private:
+    std::string interface_;
+    unsigned int ifindex_{0};
+    bpf_object* object_{nullptr};
+    int xsk_map_fd_{-1};
+    uint32_t attach_flags_{0};
+    std::atomic<bool> attached_{false};
+};
+
+/**
+ * AF_XDP receive path for one NIC queue, modeled on XskProcessQuery() in
+ * dnsdist.cc.
+ *
+ * The socket owns a UMEM of FRAME_COUNT frames, all of them handed to the
+ * fill ring up front. The worker thread takes a batch of received frames,
+ * parses Ethernet, IP and UDP, and runs the query through handler like a
+ * query from the regular UDP socket. An answer is written into the frame the
+ * query came in, behind swapped addresses and ports, and goes out on the TX
+ * ring: the packet never passes through the kernel network stack. Frames come
+ * back to the fill ring once sent, or right away when there is nothing to send.
+ *
+ * Whatever the fast path cannot do goes through fallback_fd, the regular
+ * socket on the same port: the handler gets it as the client socket, so
+ * forwarded queries are answered from there by the UdpForwarder, and answers
+ * that find the TX ring full are sent from there too.
+ */
+class XskListener {
+public:
+    static constexpr size_t FRAME_COUNT = 4096;
+    static constexpr size_t FRAME_SIZE = 2048;
+    static constexpr size_t BATCH_SIZE = 64;
+
+    /**
+     * Returns the response length written to response, 0 for no response.
+     * Same contract as DnsServer::handle_request().
+     */
+    using Handler = std::function<size_t(const uint8_t* query, size_t length, uint8_t* response,
+                                         size_t capacity, const sockaddr* client, socklen_t client_length)>;
+
+    /**
+     * Bind an AF_XDP socket to queue queue_id of program's interface and
+     * register it in the program's map. Throws std::runtime_error on failure.
+     */
+    XskListener(const XskProgram& program, uint32_t queue_id, Handler handler, int fallback_fd);
+    ~XskListener();
+
+    XskListener(const XskListener&) = delete;
+    XskListener& operator=(const XskListener&) = delete;
+
+    /**
+     * Start the worker thread of this queue
+     */
+    void start();
+    void stop();
+
+    uint32_t queueId() const { return queue_id_; }
+
+    /**
+     * Append the counters of this queue in the Prometheus text format, the
+     * caller writes the # TYPE line once for all queues
+     */
+    void writeMetrics(std::string& out) const;
+
+private:
+    enum Counter : size_t { Received, Answered, NoResponse, Fallback, Invalid, CounterCount };
+
+    struct Rings;
+
+    // A frame answered by processPacket(), with what the regular socket needs to send it instead
+    struct Answer {
+        uint64_t address;                    // in the UMEM
+        uint32_t length;                     // of the whole frame
+        uint16_t payload_offset;             // of the DNS response
+        uint16_t payload_length;
+        sockaddr_storage client;
+        socklen_t client_length;
+    };
+
+    uint32_t queue_id_;
+    Handler handler_;
+    int fallback_fd_;
+    void* umem_area_{nullptr};
+    xsk_umem* umem_{nullptr};
+    xsk_socket* socket_{nullptr};
+    std::unique_ptr<Rings> rings_;
+    std::atomic<bool> running_{false};
+    std::thread worker_thread_;
+    PerThreadCounters counters_{CounterCount};
+
+    void workerLoop();
+
+    /**
+     * Answer the packet in frame in place, false if there is nothing to send.
+     * capacity is the room in the frame, scratch has FRAME_SIZE bytes.
+     */
+    bool processPacket(uint8_t* frame, size_t length, size_t capacity, uint8_t* scratch, Answer& answer);
+
+    void recycleFrames(const uint64_t* addresses, size_t count);
+
+    // Socket, UMEM and mapping, from the destructor or a failed constructor
+    void release();
+};
+
+#endif // XSK_LISTENER_H
@@ -0,0 +1,729 @@
+/**
+ * High-rate UDP load generator for aiori-dnsdist.
+ *
+ * Every thread owns a connected UDP socket, so queries come from as many
+ * source ports as there are threads and SO_REUSEPORT listeners see their share
+ * of the load. Queries are sent with sendmmsg() and answers drained with
+ * recvmmsg(), in batches of --batch.
+ *
+ * Two modes:
+ *   closed  each thread keeps --inflight queries outstanding and sends a new one
+ *           whenever an answer (or a timeout) frees a slot: maximum throughput
+ *   open    queries leave at a fixed --rate regardless of answers. Latency is
+ *           measured from the time a query was due, not when it actually left,
+ *           so a stalled server shows up in the percentiles instead of just
+ *           slowing the generator down (coordinated omission).
+ *
+ * Query names are drawn uniformly or with a Zipf distribution from --names
+ * names below --zone (the first one is the zone apex), or replayed from a file
+ * with one name per line. The report has latency percentiles, response codes
+ * and how the answers were spread over the backends, by A record address.
+ */
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t MAX_BATCH = 256;
+constexpr size_t MAX_PACKET = 512;
+constexpr size_t RESPONSE_BUFFER = 4096;
+constexpr uint16_t QTYPE_A = 1;
+constexpr uint16_t QCLASS_IN = 1;
+constexpr int64_t WAIT_NS = 1000000;     // longest sleep while idle, keeps timeouts on time
+
+/**
+ * Command line options
+ */
+struct Options {
+    std::string server = "127.0.0.1";
+    uint16_t port = 5353;
+    int threads = 4;
+    bool open_loop = false;
+    uint64_t rate = 100000;          // queries per second over all threads, open loop only
+    size_t inflight = 64;            // outstanding queries per thread, closed loop only
+    size_t batch = 32;
+    double duration = 10.0;          // seconds
+    double timeout = 1.0;            // seconds before a query counts as lost
+    std::string zone = "example.com";
+    std::string distribution = "uniform";
+    size_t names = 1;
+    double zipf_exponent = 1.0;
+    std::string names_file;
+};
+
+/**
+ * Log-linear histogram of nanoseconds: 32 linear sub-buckets per power of two,
+ * so any percentile is within about 3%. Each thread fills its own, merged at the end.
+ */
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 6;
+    static constexpr size_t SUB_BUCKETS = 1u << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    Histogram() : counts_(BUCKETS, 0) {}
+
+    void record(uint64_t value) {
+        ++counts_[indexOf(value)];
+        ++count_;
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const Histogram& other) {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max() const { return max_; }
+
+    /**
+     * Upper bound of the bucket holding the given quantile, 0 when empty
+     */
+    uint64_t percentile(double quantile) const {
+        if (count_ == 0) {
+            return 0;
+        }
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(quantile * count_)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(upperBound(i), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t count_{0};
+    uint64_t max_{0};
+
+    static size_t indexOf(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        const int exponent = 63 - __builtin_clzll(value) - SUB_BITS + 1;
+        const size_t sub = static_cast<size_t>(value >> exponent) - SUB_BUCKETS / 2;
+        return static_cast<size_t>(exponent) * (SUB_BUCKETS / 2) + SUB_BUCKETS / 2 + sub;
+    }
+
+    static uint64_t upperBound(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        const size_t half = SUB_BUCKETS / 2;
+        const size_t exponent = (index - half) / half;
+        const uint64_t sub = (index - half) % half + half;
+        return ((sub + 1) << exponent) - 1;
+    }
+};
+
+/**
+ * Picks the index of the next query name
+ */
+class NamePicker {
+public:
+    NamePicker(const Options& options, size_t count, uint32_t seed) : rng_(seed), uniform_(0, count - 1) {
+        if (options.distribution == "zipf" && count > 1) {
+            // P(rank k) proportional to 1 / k^s
+            cdf_.resize(count);
+            double total = 0.0;
+            for (size_t k = 0; k < count; ++k) {
+                total += 1.0 / std::pow(static_cast<double>(k + 1), options.zipf_exponent);
+                cdf_[k] = total;
+            }
+            for (double& value : cdf_) {
+                value /= total;
+            }
+        }
+    }
+
+    size_t next() {
+        if (cdf_.empty()) {
+            return uniform_(rng_);
+        }
+        const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng_);
+        return static_cast<size_t>(std::lower_bound(cdf_.begin(), cdf_.end(), u) - cdf_.begin());
+    }
+
+private:
+    std::mt19937_64 rng_;
+    std::uniform_int_distribution<size_t> uniform_;
+    std::vector<double> cdf_;
+};
+
+/**
+ * Encode a dotted name into wire format, returns false if it is not a valid name
+ */
+bool encodeName(const std::string& name, std::string& out) {
+    out.clear();
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t end = name.find('.', start);
+        if (end == std::string::npos) {
+            end = name.size();
+        }
+        const size_t length = end - start;
+        if (length == 0 || length > 63) {
+            return false;
+        }
+        out.push_back(static_cast<char>(length));
+        out.append(name, start, length);
+        start = end + 1;
+    }
+    out.push_back('\0');
+    return out.size() <= 255;
+}
+
+std::vector<std::string> buildNames(const Options& options) {
+    std::vector<std::string> dotted;
+    if (!options.names_file.empty()) {
+        std::ifstream file(options.names_file);
+        if (!file) {
+            throw std::runtime_error("Cannot open " + options.names_file);
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() && line[0] != '#') {
+                dotted.push_back(line);
+            }
+        }
+    } else {
+        dotted.push_back(options.zone);
+        for (size_t i = 1; i < options.names; ++i) {
+            dotted.push_back("q" + std::to_string(i) + "." + options.zone);
+        }
+    }
+
+    std::vector<std::string> wire;
+    for (auto& name : dotted) {
+        if (!name.empty() && name.back() == '.') {
+            name.pop_back();
+        }
+        std::string encoded;
+        if (encodeName(name, encoded)) {
+            wire.push_back(std::move(encoded));
+        } else {
+            std::cerr << "⚠️  Skipping invalid name: " << name << std::endl;
+        }
+    }
+    if (wire.empty()) {
+        throw std::runtime_error("No query names");
+    }
+    return wire;
+}
+
+size_t writeQuery(uint8_t* packet, uint16_t id, const std::string& qname) {
+    const uint8_t header[12] = {static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id & 0xFF),
+                                0x01, 0x00,     // RD
+                                0x00, 0x01,     // one question
+                                0, 0, 0, 0, 0, 0};
+    memcpy(packet, header, sizeof(header));
+    memcpy(packet + sizeof(header), qname.data(), qname.size());
+    size_t offset = sizeof(header) + qname.size();
+    packet[offset++] = 0;
+    packet[offset++] = QTYPE_A;
+    packet[offset++] = 0;
+    packet[offset++] = QCLASS_IN;
+    return offset;
+}
+
+/**
+ * Skip a possibly compressed name, returns the offset after it or 0 if malformed
+ */
+size_t skipName(const uint8_t* packet, size_t length, size_t offset) {
+    while (offset < length) {
+        const uint8_t label = packet[offset];
+        if (label == 0) {
+            return offset + 1;
+        }
+        if ((label & 0xC0) == 0xC0) {
+            return offset + 2 <= length ? offset + 2 : 0;
+        }
+        offset += 1 + label;
+    }
+    return 0;
+}
+
+/**
+ * First A record of the answer section in network byte order, 0 if there is none
+ */
+uint32_t firstAddress(const uint8_t* packet, size_t length) {
+    const uint16_t questions = static_cast<uint16_t>((packet[4] << 8) | packet[5]);
+    const uint16_t answers = static_cast<uint16_t>((packet[6] << 8) | packet[7]);
+    size_t offset = 12;
+    for (uint16_t i = 0; i < questions; ++i) {
+        offset = skipName(packet, length, offset);
+        if (offset == 0 || offset + 4 > length) {
+            return 0;
+        }
+        offset += 4;
+    }
+    for (uint16_t i = 0; i < answers; ++i) {
+        offset = skipName(packet, length, offset);
+        if (offset == 0 || offset + 10 > length) {
+            return 0;
+        }
+        const uint16_t type = static_cast<uint16_t>((packet[offset] << 8) | packet[offset + 1]);
+        const uint16_t rdlength = static_cast<uint16_t>((packet[offset + 8] << 8) | packet[offset + 9]);
+        offset += 10;
+        if (offset + rdlength > length) {
+            return 0;
+        }
+        if (type == QTYPE_A && rdlength == 4) {
+            uint32_t address;
+            memcpy(&address, packet + offset, sizeof(address));
+            return address;
+        }
+        offset += rdlength;
+    }
+    return 0;
+}
+
+int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Results of one thread
+ */
+struct ThreadResult {
+    Histogram latency;
+    uint64_t sent{0};
+    uint64_t received{0};
+    uint64_t timeouts{0};
+    uint64_t send_errors{0};
+    uint64_t mismatched{0};
+    std::array<uint64_t, 16> rcodes{};
+    std::map<uint32_t, uint64_t> answers;      // by A record address, network byte order
+};
+
+class Worker {
+public:
+    Worker(const Options& options, const std::vector<std::string>& names, int index, int64_t start, int64_t end)
+        : options_(options), names_(names), picker_(options, names.size(), 1000 + static_cast<uint32_t>(index)),
+          start_(start), end_(end), timeout_ns_(static_cast<int64_t>(options.timeout * 1e9)),
+          slots_(65536), batch_(std::min(options.batch, MAX_BATCH)), rng_(static_cast<uint32_t>(index)),
+          packets_(batch_), responses_(batch_) {
+
+        fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd_ < 0) {
+            throw std::runtime_error("socket() failed: " + std::string(strerror(errno)));
+        }
+        int buffer_size = 8 * 1024 * 1024;
+        setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+        setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+        sockaddr_in server{};
+        server.sin_family = AF_INET;
+        server.sin_port = htons(options.port);
+        if (inet_pton(AF_INET, options.server.c_str(), &server.sin_addr) != 1) {
+            throw std::runtime_error("Invalid server address: " + options.server);
+        }
+        if (connect(fd_, reinterpret_cast<const sockaddr*>(&server), sizeof(server)) < 0) {
+            throw std::runtime_error("connect() failed: " + std::string(strerror(errno)));
+        }
+
+        if (options_.open_loop) {
+            interval_ns_ = static_cast<double>(options.threads) * 1e9 / static_cast<double>(std::max<uint64_t>(1, options.rate));
+        }
+        // IDs are reused oldest first, so a late answer rarely meets a new query with its ID
+        std::vector<uint16_t> ids(65536);
+        for (uint32_t id = 0; id < 65536; ++id) {
+            ids[id] = static_cast<uint16_t>(id);
+        }
+        std::shuffle(ids.begin(), ids.end(), rng_);
+        free_ids_.assign(ids.begin(), ids.end());
+    }
+
+    ~Worker() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    void run() {
+        while (true) {
+            const int64_t now = nowNs();
+            if (now >= end_) {
+                break;
+            }
+            const size_t sent = sendDue(now);
+            const size_t received = receive();
+            expire(now);
+            if (sent == 0 && received == 0) {
+                waitForWork(now);
+            }
+        }
+        // Let the answers of the last queries come in
+        const int64_t drain_end = nowNs() + timeout_ns_;
+        while (in_flight_ > 0 && nowNs() < drain_end) {
+            if (receive() == 0) {
+                waitForWork(nowNs());
+            }
+        }
+        result_.timeouts += in_flight_;
+    }
+
+    const ThreadResult& result() const { return result_; }
+
+private:
+    struct Slot {
+        int64_t due{0};         // when the query was meant to leave, latency starts here
+        bool in_use{false};
+    };
+
+    struct Pending {
+        uint16_t id;
+        int64_t due;
+    };
+
+    const Options& options_;
+    const std::vector<std::string>& names_;
+    NamePicker picker_;
+    const int64_t start_;
+    const int64_t end_;
+    const int64_t timeout_ns_;
+    double interval_ns_{0.0};
+    uint64_t scheduled_{0};      // open loop: queries due so far
+    std::vector<Slot> slots_;
+    std::deque<uint16_t> free_ids_;
+    std::deque<Pending> timeout_queue_;   // in send order, for expiry
+    size_t in_flight_{0};
+    const size_t batch_;
+    std::mt19937 rng_;
+    std::vector<std::array<uint8_t, MAX_PACKET>> packets_;
+    std::vector<std::array<uint8_t, RESPONSE_BUFFER>> responses_;
+    int fd_{-1};
+    ThreadResult result_;
+
+    /**
+     * Send what is due, returns the number of queries sent
+     */
+    size_t sendDue(int64_t now) {
+        size_t count = 0;
+        if (options_.open_loop) {
+            const uint64_t due = static_cast<uint64_t>(static_cast<double>(now - start_) / interval_ns_);
+            count = static_cast<size_t>(std::min<uint64_t>(due - std::min(due, scheduled_), batch_));
+        } else if (in_flight_ < options_.inflight) {
+            count = std::min(options_.inflight - in_flight_, batch_);
+        }
+        count = std::min(count, free_ids_.size());
+        if (count == 0) {
+            return 0;
+        }
+
+        std::array<iovec, MAX_BATCH> iovecs;
+        std::array<mmsghdr, MAX_BATCH> messages{};
+        std::array<uint16_t, MAX_BATCH> ids;
+        for (size_t i = 0; i < count; ++i) {
+            ids[i] = free_ids_.front();
+            free_ids_.pop_front();
+            iovecs[i].iov_base = packets_[i].data();
+            iovecs[i].iov_len = writeQuery(packets_[i].data(), ids[i], names_[picker_.next()]);
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int sent = sendmmsg(fd_, messages.data(), static_cast<unsigned int>(count), MSG_DONTWAIT);
+        const size_t accepted = sent > 0 ? static_cast<size_t>(sent) : 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (i >= accepted) {
+                free_ids_.push_front(ids[i]);
+                continue;
+            }
+            Slot& slot = slots_[ids[i]];
+            slot.in_use = true;
+            slot.due = options_.open_loop
+                ? start_ + static_cast<int64_t>(static_cast<double>(scheduled_ + i) * interval_ns_) : now;
+            timeout_queue_.push_back({ids[i], slot.due});
+        }
+        in_flight_ += accepted;
+        result_.sent += accepted;
+        if (options_.open_loop) {
+            // Queries the socket did not take are lost, the schedule moves on
+            result_.send_errors += count - accepted;
+            scheduled_ += count;
+        } else if (accepted < count) {
+            result_.send_errors += count - accepted;
+        }
+        return accepted;
+    }
+
+    /**
+     * Sleep until an answer arrives or the next query is due, at most WAIT_NS.
+     * Spinning instead would take the CPU from the server when both share a machine.
+     */
+    void waitForWork(int64_t now) {
+        int64_t wake = std::min(end_, now + WAIT_NS);
+        if (options_.open_loop) {
+            wake = std::min(wake, start_ + static_cast<int64_t>(static_cast<double>(scheduled_ + 1) * interval_ns_));
+        }
+        if (wake <= now) {
+            return;
+        }
+        const timespec timeout{0, static_cast<long>(wake - now)};
+        pollfd pfd{fd_, POLLIN, 0};
+        ppoll(&pfd, 1, &timeout, nullptr);
+    }
+
+    /**
+     * Drain the answers waiting on the socket, returns how many there were
+     */
+    size_t receive() {
+        std::array<iovec, MAX_BATCH> iovecs;
+        std::array<mmsghdr, MAX_BATCH> messages{};
+        for (size_t i = 0; i < batch_; ++i) {
+            iovecs[i].iov_base = responses_[i].data();
+            iovecs[i].iov_len = responses_[i].size();
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int got = recvmmsg(fd_, messages.data(), static_cast<unsigned int>(batch_), MSG_DONTWAIT, nullptr);
+        if (got <= 0) {
+            return 0;
+        }
+        const int64_t received_at = nowNs();
+        for (int i = 0; i < got; ++i) {
+            const uint8_t* packet = responses_[i].data();
+            const size_t length = messages[i].msg_len;
+            if (length < 12) {
+                ++result_.mismatched;
+                continue;
+            }
+            const uint16_t id = static_cast<uint16_t>((packet[0] << 8) | packet[1]);
+            Slot& slot = slots_[id];
+            if (!slot.in_use) {
+                // Late answer to a query that already timed out
+                ++result_.mismatched;
+                continue;
+            }
+            slot.in_use = false;
+            free_ids_.push_back(id);
+            --in_flight_;
+            ++result_.received;
+            result_.latency.record(static_cast<uint64_t>(std::max<int64_t>(0, received_at - slot.due)));
+            ++result_.rcodes[packet[3] & 0x0F];
+            if (const uint32_t address = firstAddress(packet, length)) {
+                ++result_.answers[address];
+            }
+        }
+        return static_cast<size_t>(got);
+    }
+
+    void expire(int64_t now) {
+        while (!timeout_queue_.empty() && now - timeout_queue_.front().due >= timeout_ns_) {
+            const Pending pending = timeout_queue_.front();
+            timeout_queue_.pop_front();
+            Slot& slot = slots_[pending.id];
+            // Entries of answered queries are skipped, their ID may already carry a newer query
+            if (slot.in_use && slot.due == pending.due) {
+                slot.in_use = false;
+                free_ids_.push_back(pending.id);
+                --in_flight_;
+                ++result_.timeouts;
+            }
+        }
+    }
+};
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "  --server=IP          server address (127.0.0.1)\n"
+              << "  --port=N             server port (5353)\n"
+              << "  --threads=N          sending threads, one socket each (4)\n"
+              << "  --mode=closed|open   max throughput or fixed rate (closed)\n"
+              << "  --rate=QPS           total query rate in open mode (100000)\n"
+              << "  --inflight=N         outstanding queries per thread in closed mode (64)\n"
+              << "  --batch=N            queries per sendmmsg/recvmmsg call (32)\n"
+              << "  --duration=S         test length in seconds (10)\n"
+              << "  --timeout=S          seconds before a query is lost (1)\n"
+              << "  --zone=NAME          zone of the generated names (example.com)\n"
+              << "  --qnames=uniform|zipf|FILE  name distribution, or a file with one name per line (uniform)\n"
+              << "  --names=N            generated names, the first is the zone apex (1)\n"
+              << "  --zipf=S             Zipf exponent (1.0)\n";
+}
+
+Options parseOptions(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        auto value = [&arg]() { return arg.substr(arg.find('=') + 1); };
+        if (arg.rfind("--server=", 0) == 0) {
+            options.server = value();
+        } else if (arg.rfind("--port=", 0) == 0) {
+            options.port = static_cast<uint16_t>(std::stoul(value()));
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            options.threads = std::max(1, std::stoi(value()));
+        } else if (arg.rfind("--mode=", 0) == 0) {
+            options.open_loop = value() == "open";
+        } else if (arg.rfind("--rate=", 0) == 0) {
+            options.rate = std::max<uint64_t>(1, std::stoull(value()));
+        } else if (arg.rfind("--inflight=", 0) == 0) {
+            options.inflight = std::max<size_t>(1, std::stoul(value()));
+        } else if (arg.rfind("--batch=", 0) == 0) {
+            options.batch = std::clamp<size_t>(std::stoul(value()), 1, MAX_BATCH);
+        } else if (arg.rfind("--duration=", 0) == 0) {
+            options.duration = std::stod(value());
+        } else if (arg.rfind("--timeout=", 0) == 0) {
+            options.timeout = std::stod(value());
+        } else if (arg.rfind("--zone=", 0) == 0) {
+            options.zone = value();
+        } else if (arg.rfind("--qnames=", 0) == 0) {
+            const std::string qnames = value();
+            if (qnames == "uniform" || qnames == "zipf") {
+                options.distribution = qnames;
+            } else {
+                options.names_file = qnames;
+            }
+        } else if (arg.rfind("--names=", 0) == 0) {
+            options.names = std::max<size_t>(1, std::stoul(value()));
+        } else if (arg.rfind("--zipf=", 0) == 0) {
+            options.zipf_exponent = std::stod(value());
+        } else if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            exit(0);
+        } else {
+            std::cerr << "⚠️  Ignoring unknown option: " << arg << std::endl;
+        }
+    }
+    // Every query of a thread needs its own ID
+    options.inflight = std::min<size_t>(options.inflight, 65536);
+    return options;
+}
+
+void printReport(const Options& options, const ThreadResult& total, double elapsed) {
+    auto ms = [](uint64_t ns) { return static_cast<double>(ns) / 1e6; };
+    std::cout << "\n📊 Results over " << elapsed << "s:" << std::endl;
+    std::cout << "   Sent: " << total.sent << ", answered: " << total.received << ", lost: " << total.timeouts
+              << ", send errors: " << total.send_errors << ", late/unknown: " << total.mismatched << std::endl;
+    std::cout << "   Throughput: " << static_cast<uint64_t>(static_cast<double>(total.received) / elapsed)
+              << " answers/s";
+    if (options.open_loop) {
+        std::cout << " (target " << options.rate << " queries/s)";
+    }
+    std::cout << std::endl;
+
+    std::cout << "   Latency (ms): p50 " << ms(total.latency.percentile(0.50))
+              << ", p90 " << ms(total.latency.percentile(0.90))
+              << ", p99 " << ms(total.latency.percentile(0.99))
+              << ", p99.9 " << ms(total.latency.percentile(0.999))
+              << ", max " << ms(total.latency.max()) << std::endl;
+
+    static const char* rcode_names[16] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
+    std::cout << "   Response codes:";
+    for (size_t i = 0; i < total.rcodes.size(); ++i) {
+        if (total.rcodes[i] > 0) {
+            std::cout << " " << (rcode_names[i] ? rcode_names[i] : std::to_string(i).c_str()) << "=" << total.rcodes[i];
+        }
+    }
+    std::cout << std::endl;
+
+    if (total.answers.empty()) {
+        return;
+    }
+    uint64_t with_address = 0;
+    for (const auto& entry : total.answers) {
+        with_address += entry.second;
+    }
+    std::cout << "\n⚖️  Answers per backend:" << std::endl;
+    for (const auto& entry : total.answers) {
+        const double share = 100.0 * static_cast<double>(entry.second) / static_cast<double>(with_address);
+        const std::string bar(static_cast<size_t>(share / 2), '#');
+        char address[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &entry.first, address, sizeof(address));
+        printf("   %-15s : %10llu (%5.1f%%) %s\n", address,
+               static_cast<unsigned long long>(entry.second), share, bar.c_str());
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        const Options options = parseOptions(argc, argv);
+        const std::vector<std::string> names = buildNames(options);
+
+        std::cout << "🚀 dns-loadgen: " << options.threads << " threads against " << options.server << ":"
+                  << options.port << ", " << (options.open_loop ? "open loop at " + std::to_string(options.rate) +
+                                                                       " queries/s"
+                                                                 : "closed loop with " +
+                                                                       std::to_string(options.inflight) +
+                                                                       " queries in flight per thread")
+                  << std::endl;
+        std::cout << "   " << names.size() << " names, "
+                  << (options.names_file.empty() ? options.distribution : "from " + options.names_file)
+                  << ", " << options.duration << "s" << std::endl;
+
+        const int64_t start = nowNs() + 10000000;     // give every thread time to set up
+        const int64_t end = start + static_cast<int64_t>(options.duration * 1e9);
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (int i = 0; i < options.threads; ++i) {
+            workers.push_back(std::make_unique<Worker>(options, names, i, start, end));
+        }
+
+        std::vector<std::thread> threads;
+        for (auto& worker : workers) {
+            threads.emplace_back([&worker, start]() {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(std::max<int64_t>(0, start - nowNs())));
+                worker->run();
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        ThreadResult total;
+        for (const auto& worker : workers) {
+            const ThreadResult& result = worker->result();
+            total.latency.merge(result.latency);
+            total.sent += result.sent;
+            total.received += result.received;
+            total.timeouts += result.timeouts;
+            total.send_errors += result.send_errors;
+            total.mismatched += result.mismatched;
+            for (size_t i = 0; i < total.rcodes.size(); ++i) {
+                total.rcodes[i] += result.rcodes[i];
+            }
+            for (const auto& entry : result.answers) {
+                total.answers[entry.first] += entry.second;
+            }
+        }
+        printReport(options, total, options.duration);
+        return total.received > 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "❌ " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,72 @@
+/**
+ * XDP program for XskListener: UDP packets to the DNS port of a queue with
+ * an AF_XDP socket bound go to that socket, everything else goes on to the
+ * kernel stack. Only what the fast path can answer is redirected: IPv4
+ * without options or fragments and IPv6 without extension headers.
+ *
+ * Built with clang -target bpf, loaded by XskProgram which fills in the port.
+ */
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+struct {
+    __uint(type, BPF_MAP_TYPE_XSKMAP);
+    __uint(max_entries, 64);
+    __type(key, __u32);
+    __type(value, __u32);
+} xsks_map SEC(".maps");
+
+// Entry 0: the DNS port, host byte order
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u32);
+} dns_port_map SEC(".maps");
+
+SEC("xdp")
+int dns_xsk(struct xdp_md* ctx) {
+    void* data = (void*)(long)ctx->data;
+    void* data_end = (void*)(long)ctx->data_end;
+    struct udphdr* udp;
+
+    struct ethhdr* eth = data;
+    if ((void*)(eth + 1) > data_end) {
+        return XDP_PASS;
+    }
+    if (eth->h_proto == bpf_htons(ETH_P_IP)) {
+        struct iphdr* ip = (void*)(eth + 1);
+        if ((void*)(ip + 1) > data_end || ip->ihl != 5 || ip->protocol != IPPROTO_UDP ||
+            (ip->frag_off & bpf_htons(0x3fff)) != 0) {
+            return XDP_PASS;
+        }
+        udp = (void*)(ip + 1);
+    } else if (eth->h_proto == bpf_htons(ETH_P_IPV6)) {
+        struct ipv6hdr* ip6 = (void*)(eth + 1);
+        if ((void*)(ip6 + 1) > data_end || ip6->nexthdr != IPPROTO_UDP) {
+            return XDP_PASS;
+        }
+        udp = (void*)(ip6 + 1);
+    } else {
+        return XDP_PASS;
+    }
+    if ((void*)(udp + 1) > data_end) {
+        return XDP_PASS;
+    }
+
+    __u32 key = 0;
+    __u32* port = bpf_map_lookup_elem(&dns_port_map, &key);
+    if (!port || udp->dest != bpf_htons((__u16)*port)) {
+        return XDP_PASS;
+    }
+    // XDP_PASS as well when no socket is bound to this queue
+    return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+char LICENSE[] SEC("license") = "GPL";